@@ -0,0 +1,471 @@
+/*
+ * rims_bench: Google Benchmark suite for the Rwanda Infrastructure Management System.
+ *
+ *     rims_bench [--cities=1000,10000,100000] [--degree=D] [--hubs] [--geographic] [--disconnected]
+ *                [--work=DIR] [benchmark flags]
+ *
+ * A synthetic network is generated for every city count under DIR (rims_bench_data by default)
+ * at each start, so every run measures the same data. The benchmarks cover loading the data
+ * files, city lookups, the console's display paths, saving changes and the graph queries,
+ * including the all-pairs route cost table and the spatial queries. With --geographic, roads join
+ * nearby cities, which is the kind of network on which A* route queries pay off. The investment
+ * optimizer needs groups of cities that cannot reach each other, which --disconnected leaves.
+ * Google Benchmark's own flags apply as usual; --benchmark_out=FILE --benchmark_out_format=json
+ * keeps a run for comparison with a later one with its tools/compare.py.
+ */
+#include <benchmark/benchmark.h>
+#include <iostream>   // For messages
+#include <memory>     // For the open manager
+#include <optional>   // For timing loads without their teardown
+#include <random>     // For reproducible query mixes
+#include <filesystem> // For the work directory
+#include <fcntl.h>    // For discarding console output
+#include <unistd.h>   // For redirecting stdout
+#include "rims_dataset.h"
+#include "rims_console.h"
+#include "rims_optimizer.h"
+
+using namespace std;
+
+const size_t QUERY_MIX = 1024;          // Distinct inputs cycled through by the query benchmarks
+const int DISPLAY_LIMIT = 10000;        // Largest network whose full matrices are displayed
+const int FLOYD_WARSHALL_LIMIT = 2000;  // Largest network given the cubic all-pairs method
+
+// One generated network. Its data files live in their own directory and, as the program uses
+// paths relative to the working directory, a benchmark enters the directory before touching it.
+// At most one scale keeps a manager open, so only one network is held in memory at a time.
+class BenchScale {
+private:
+    static BenchScale* active;          // The scale whose directory is the working directory
+    unique_ptr<InfrastructureManager> manager;
+    unique_ptr<ConsoleMenu> menu;
+
+public:
+    DatasetSpec spec;
+    string directory;
+
+    BenchScale(const DatasetSpec& spec, const string& directory) : spec(spec), directory(directory) {}
+
+    // Makes this scale's directory the working directory, closing the previous scale's manager
+    void enter() {
+        if (active == this) return;
+        if (active != nullptr) active->close();
+        filesystem::current_path(directory);
+        active = this;
+    }
+
+    // Enters the scale and returns its manager, opening it if it is closed
+    InfrastructureManager& open() {
+        enter();
+        if (!manager) {
+            manager = make_unique<InfrastructureManager>();
+            manager->set_max_cities(spec.cities);
+            menu = make_unique<ConsoleMenu>(*manager);
+        }
+        return *manager;
+    }
+
+    // Returns the console attached to the open manager
+    ConsoleMenu& console() {
+        open();
+        return *menu;
+    }
+
+    // Closes the manager, folding its changes into the data files
+    void close() {
+        menu.reset();
+        manager.reset();
+    }
+};
+
+BenchScale* BenchScale::active = nullptr;
+
+// Sends stdout to /dev/null while in scope, so display benchmarks time formatting and writing
+// rather than a terminal
+class DiscardStdout {
+    int saved;
+
+public:
+    DiscardStdout() {
+        cout.flush();
+        fflush(stdout);
+        saved = dup(STDOUT_FILENO);
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, STDOUT_FILENO);
+        close(null_fd);
+    }
+
+    ~DiscardStdout() {
+        cout.flush();
+        fflush(stdout);
+        dup2(saved, STDOUT_FILENO);
+        close(saved);
+    }
+};
+
+// Returns QUERY_MIX random pairs of distinct cities
+static vector<pair<int, int>> random_city_pairs(int cities, uint64_t seed) {
+    mt19937_64 random(seed);
+    vector<pair<int, int>> pairs;
+    while (pairs.size() < QUERY_MIX) {
+        int a = static_cast<int>(random() % cities), b = static_cast<int>(random() % cities);
+        if (a != b) pairs.emplace_back(a, b);
+    }
+    return pairs;
+}
+
+// Times opening the network, from the text files when from_text is set and from the snapshots
+// otherwise; closing it again is not timed
+static void bench_load(benchmark::State& state, BenchScale& scale, bool from_text) {
+    scale.enter();
+    scale.close();
+    PersistenceOptions options;
+    options.import_text = from_text;
+    optional<InfrastructureManager> manager;
+    for (auto _ : state) {
+        manager.emplace(options);
+        benchmark::DoNotOptimize(manager->city_count());
+        state.PauseTiming();
+        manager.reset();
+        state.ResumeTiming();
+    }
+    state.counters["cities"] = static_cast<double>(scale.spec.cities);
+}
+
+// Times looking up a city by name, either names that exist or names that do not
+static void bench_find_city(benchmark::State& state, BenchScale& scale, bool hits) {
+    InfrastructureManager& manager = scale.open();
+    mt19937_64 random(7);
+    vector<string> names;
+    for (size_t k = 0; k < QUERY_MIX; k++) {
+        int index = static_cast<int>(random() % scale.spec.cities);
+        names.push_back(synthetic_city_name(hits ? index : scale.spec.cities + index));
+    }
+    size_t k = 0;
+    for (auto _ : state) benchmark::DoNotOptimize(manager.find_city(names[k++ % QUERY_MIX]));
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Times listing the first 20 cities starting with a two-syllable prefix
+static void bench_search_prefix(benchmark::State& state, BenchScale& scale) {
+    InfrastructureManager& manager = scale.open();
+    mt19937_64 random(11);
+    vector<string> prefixes;
+    for (size_t k = 0; k < QUERY_MIX; k++) {
+        prefixes.push_back(synthetic_city_name(static_cast<int>(random() % scale.spec.cities)).substr(0, 4));
+    }
+    vector<uint32_t> found;
+    size_t k = 0;
+    for (auto _ : state) {
+        manager.cities_starting_with(prefixes[k++ % QUERY_MIX], 20, found);
+        benchmark::DoNotOptimize(found.data());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Times finding the cities within two edits of a misspelt name
+static void bench_search_similar(benchmark::State& state, BenchScale& scale) {
+    InfrastructureManager& manager = scale.open();
+    mt19937_64 random(13);
+    vector<string> names;
+    for (size_t k = 0; k < QUERY_MIX; k++) {
+        string name = synthetic_city_name(static_cast<int>(random() % scale.spec.cities));
+        name[1 + random() % (name.size() - 1)] = 'x';
+        names.push_back(name);
+    }
+    vector<CitySearchIndex::Match> found;
+    size_t k = 0;
+    for (auto _ : state) {
+        manager.cities_similar_to(names[k++ % QUERY_MIX], 2, 10, found);
+        benchmark::DoNotOptimize(found.data());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Times route queries between random cities on the published view
+static void bench_route(benchmark::State& state, BenchScale& scale, RouteWeight weight) {
+    shared_ptr<const NetworkView> view = scale.open().view();
+    vector<pair<int, int>> pairs = random_city_pairs(scale.spec.cities, 17);
+    RouteSearch search;
+    vector<int> path;
+    double cost = 0;
+    size_t k = 0;
+    for (auto _ : state) {
+        const auto& [source, target] = pairs[k++ % QUERY_MIX];
+        benchmark::DoNotOptimize(view->find_route(source, target, weight, search, path, cost));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Times finding the ten cities nearest to a city, or every city within 5 km of it
+static void bench_nearby(benchmark::State& state, BenchScale& scale, bool nearest) {
+    shared_ptr<const NetworkView> view = scale.open().view();
+    vector<pair<int, int>> pairs = random_city_pairs(scale.spec.cities, 23);
+    vector<CityDistance> found;
+    view->nearest_cities(0, 1, found);  // Builds the k-d tree outside the timed loop
+    size_t k = 0;
+    for (auto _ : state) {
+        int city = pairs[k++ % QUERY_MIX].first;
+        if (nearest) view->nearest_cities(city, 10, found);
+        else view->cities_within(city, 5.0, found);
+        benchmark::DoNotOptimize(found.data());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Times proposing the 100 shortest missing roads of up to 10 km, on a fresh version each time
+// so the k-d tree is built as part of it
+static void bench_propose_roads(benchmark::State& state, BenchScale& scale) {
+    InfrastructureManager& manager = scale.open();
+    vector<RoadProposal> proposals;
+    for (auto _ : state) {
+        state.PauseTiming();
+        manager.set_location(0, manager.city_location(0).latitude, manager.city_location(0).longitude);
+        shared_ptr<const NetworkView> view = manager.view();
+        state.ResumeTiming();
+        view->propose_roads(10.0, 100, proposals);
+        benchmark::DoNotOptimize(proposals.data());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Times choosing which of the 24 shortest roads that would join two groups of cities to build for
+// a third of their total cost, on the given number of threads
+static void bench_optimize_investment(benchmark::State& state, BenchScale& scale, int threads) {
+    shared_ptr<const NetworkView> view = scale.open().view();
+    vector<RoadCandidate> candidates;
+    propose_investments(*view, 50.0, 24, 1.0, candidates);
+    if (candidates.empty()) {
+        state.SkipWithError("No proposed road joins two groups of cities; generate with --disconnected");
+        return;
+    }
+    InvestmentOptions options;
+    for (const auto& candidate : candidates) options.budget_cap += candidate.cost / 3.0;
+    options.threads = threads;
+    options.time_limit = chrono::seconds(5);
+    InvestmentPlan plan;
+    for (auto _ : state) {
+        optimize_investment(*view, candidates, options, plan);
+        benchmark::DoNotOptimize(plan.value);
+    }
+    state.counters["branches"] = static_cast<double>(plan.nodes);
+    state.counters["optimal"] = plan.optimal ? 1.0 : 0.0;
+}
+
+// Times planning the minimum-budget network
+static void bench_plan_network(benchmark::State& state, BenchScale& scale) {
+    shared_ptr<const NetworkView> view = scale.open().view();
+    NetworkPlan plan;
+    for (auto _ : state) {
+        view->plan_minimum_network(plan);
+        benchmark::DoNotOptimize(plan);
+    }
+}
+
+// Times the bridge and articulation point scan
+static void bench_bridge_scan(benchmark::State& state, BenchScale& scale) {
+    shared_ptr<const NetworkView> view = scale.open().view();
+    ConnectivityScan scan;
+    for (auto _ : state) {
+        view->scan_bridges_and_articulations(scan);
+        benchmark::DoNotOptimize(scan);
+    }
+}
+
+// Times labelling the connected groups of cities
+static void bench_label_components(benchmark::State& state, BenchScale& scale) {
+    shared_ptr<const NetworkView> view = scale.open().view();
+    vector<int> group;
+    for (auto _ : state) benchmark::DoNotOptimize(view->label_components(group));
+}
+
+// Times computing the all-pairs route cost table with one method
+static void bench_route_table(benchmark::State& state, BenchScale& scale, RouteTableMethod method) {
+    shared_ptr<const NetworkView> view = scale.open().view();
+    RouteCostTable table;
+    for (auto _ : state) {
+        view->compute_route_costs(table, method);
+        benchmark::DoNotOptimize(table.costs.data());
+    }
+    state.counters["threads"] = table.threads;
+}
+
+// Times the console's city list
+static void bench_display_cities(benchmark::State& state, BenchScale& scale) {
+    ConsoleMenu& console = scale.console();
+    DiscardStdout discard;
+    for (auto _ : state) console.display_cities();
+}
+
+// Times the console's city list and road matrix
+static void bench_display_roads(benchmark::State& state, BenchScale& scale) {
+    ConsoleMenu& console = scale.console();
+    DiscardStdout discard;
+    for (auto _ : state) console.display_roads();
+}
+
+// Times saving a changed budget: the change is logged, then folded into the data files
+static void bench_save_roads(benchmark::State& state, BenchScale& scale) {
+    InfrastructureManager& manager = scale.open();
+    const Road road = manager.roads()[0];
+    bool toggle = false;
+    for (auto _ : state) {
+        manager.set_budget(road.city1, road.city2, (toggle = !toggle) ? 1.5 : 2.5);
+        manager.checkpoint();
+    }
+}
+
+// Times a route query on the version that follows a change, including rebuilding its search graph
+static void bench_route_after_change(benchmark::State& state, BenchScale& scale) {
+    InfrastructureManager& manager = scale.open();
+    const Road road = manager.roads()[0];
+    vector<pair<int, int>> pairs = random_city_pairs(scale.spec.cities, 19);
+    RouteSearch search;
+    vector<int> path;
+    double cost = 0;
+    bool toggle = false;
+    size_t k = 0;
+    for (auto _ : state) {
+        state.PauseTiming();
+        manager.set_budget(road.city1, road.city2, (toggle = !toggle) ? 1.5 : 2.5);
+        shared_ptr<const NetworkView> view = manager.view();
+        state.ResumeTiming();
+        const auto& [source, target] = pairs[k++ % QUERY_MIX];
+        benchmark::DoNotOptimize(view->find_route(source, target, RouteWeight::Budget, search, path, cost));
+    }
+}
+
+// Times adding roads one call at a time, each logged before the call returns
+static void bench_add_road(benchmark::State& state, BenchScale& scale) {
+    InfrastructureManager& manager = scale.open();
+    mt19937_64 random(23);
+    for (auto _ : state) {
+        state.PauseTiming();
+        int a, b;
+        do {
+            a = static_cast<int>(random() % scale.spec.cities);
+            b = static_cast<int>(random() % scale.spec.cities);
+        } while (a == b || manager.road_exists(a, b));
+        state.ResumeTiming();
+        manager.add_road(a, b);
+    }
+}
+
+// Times committing a group of 256 budget changes the way the server commits its clients' changes
+static void bench_group_commit(benchmark::State& state, BenchScale& scale) {
+    InfrastructureManager& manager = scale.open();
+    vector<InfrastructureManager::BatchCommand> commands;
+    size_t roads = manager.roads().size();
+    for (size_t k = 0; k < 256; k++) {
+        const Road& road = manager.roads()[k * 7919 % roads];
+        commands.push_back({InfrastructureManager::BatchCommand::Kind::Budget, static_cast<int>(k + 1),
+                            string(manager.city_name(road.city1)), string(manager.city_name(road.city2)), 0.0, {}});
+    }
+    vector<ChangeStatus> statuses;
+    bool toggle = false;
+    for (auto _ : state) {
+        toggle = !toggle;
+        for (auto& command : commands) command.budget = toggle ? 3.5 : 4.5;
+        manager.apply_commands(commands, statuses);
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(commands.size()));
+}
+
+// Registers every benchmark for one scale, in the order they run
+static void register_scale(BenchScale& scale) {
+    string suffix = "/cities:" + to_string(scale.spec.cities);
+    auto add = [&](const string& name, auto&& function) {
+        return benchmark::RegisterBenchmark((name + suffix).c_str(), function)->Unit(benchmark::kMicrosecond);
+    };
+    BenchScale* s = &scale;
+    add("load_text", [s](benchmark::State& st) { bench_load(st, *s, true); });
+    add("load_snapshot", [s](benchmark::State& st) { bench_load(st, *s, false); });
+    add("find_city_hit", [s](benchmark::State& st) { bench_find_city(st, *s, true); })->Unit(benchmark::kNanosecond);
+    add("find_city_miss", [s](benchmark::State& st) { bench_find_city(st, *s, false); })->Unit(benchmark::kNanosecond);
+    add("search_prefix", [s](benchmark::State& st) { bench_search_prefix(st, *s); });
+    add("search_similar", [s](benchmark::State& st) { bench_search_similar(st, *s); });
+    add("route_budget", [s](benchmark::State& st) { bench_route(st, *s, RouteWeight::Budget); });
+    add("route_hops", [s](benchmark::State& st) { bench_route(st, *s, RouteWeight::Hops); });
+    add("nearest_cities", [s](benchmark::State& st) { bench_nearby(st, *s, true); });
+    add("cities_within", [s](benchmark::State& st) { bench_nearby(st, *s, false); });
+    add("propose_roads", [s](benchmark::State& st) { bench_propose_roads(st, *s); });
+    add("plan_network", [s](benchmark::State& st) { bench_plan_network(st, *s); });
+    add("optimize_investment", [s](benchmark::State& st) { bench_optimize_investment(st, *s, 1); })->Unit(benchmark::kMillisecond);
+    add("optimize_investment_parallel", [s](benchmark::State& st) { bench_optimize_investment(st, *s, 0); })
+        ->Unit(benchmark::kMillisecond);
+    add("bridge_scan", [s](benchmark::State& st) { bench_bridge_scan(st, *s); });
+    add("label_components", [s](benchmark::State& st) { bench_label_components(st, *s); });
+    if (scale.spec.cities <= FLOYD_WARSHALL_LIMIT) {
+        add("route_table_floyd_warshall", [s](benchmark::State& st) { bench_route_table(st, *s, RouteTableMethod::FloydWarshall); });
+    }
+    if (scale.spec.cities <= DISPLAY_LIMIT) {
+        add("route_table_dijkstra", [s](benchmark::State& st) { bench_route_table(st, *s, RouteTableMethod::Dijkstra); });
+    }
+    add("display_cities", [s](benchmark::State& st) { bench_display_cities(st, *s); });
+    if (scale.spec.cities <= DISPLAY_LIMIT) {
+        add("display_roads", [s](benchmark::State& st) { bench_display_roads(st, *s); });
+    }
+    add("save_roads", [s](benchmark::State& st) { bench_save_roads(st, *s); });
+    add("route_after_change", [s](benchmark::State& st) { bench_route_after_change(st, *s); });
+    add("add_road", [s](benchmark::State& st) { bench_add_road(st, *s); });
+    add("group_commit", [s](benchmark::State& st) { bench_group_commit(st, *s); });
+}
+
+int main(int argc, char* argv[]) {
+    benchmark::Initialize(&argc, argv);
+
+    vector<int> city_counts = {1000, 10000, 100000};
+    DatasetSpec base;
+    string work = "rims_bench_data";
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        bool ok = true;
+        if (arg == "--hubs") base.hubs = true;
+        else if (arg == "--geographic") base.geographic = true;
+        else if (arg == "--disconnected") base.connected = false;
+        else if (arg.rfind("--work=", 0) == 0) ok = arg.size() > 7, work = arg.substr(7);
+        else if (arg.rfind("--degree=", 0) == 0) ok = from_chars(arg.data() + 9, arg.data() + arg.size(), base.degree).ec == errc();
+        else if (arg.rfind("--cities=", 0) == 0) {
+            city_counts.clear();
+            string_view list = string_view(arg).substr(9);
+            while (ok && !list.empty()) {
+                size_t comma = min(list.find(','), list.size());
+                int count = 0;
+                auto [ptr, ec] = from_chars(list.data(), list.data() + comma, count);
+                ok = ec == errc() && ptr == list.data() + comma && count >= 2;
+                city_counts.push_back(count);
+                list.remove_prefix(min(comma + 1, list.size()));
+            }
+        } else ok = false;
+        if (!ok || city_counts.empty()) {
+            cout << "Error: Invalid option " << arg << ".\n"
+                 << "Usage: rims_bench [--cities=N,N,...] [--degree=D] [--hubs] [--geographic] [--disconnected]"
+                    " [--work=DIR] [benchmark flags]\n";
+            return 1;
+        }
+    }
+
+    error_code ec;
+    filesystem::path root = filesystem::absolute(work, ec);
+    vector<unique_ptr<BenchScale>> scales;
+    for (int count : city_counts) {
+        DatasetSpec spec = base;
+        spec.cities = count;
+        filesystem::path directory = root / ("cities_" + to_string(count));
+        filesystem::create_directories(directory, ec);
+        if (ec) {
+            cout << "Error: Cannot create " << directory.string() << ": " << ec.message() << ".\n";
+            return 1;
+        }
+        filesystem::current_path(directory);
+        cout << "Generating " << count << " cities in " << directory.string() << "\n";
+        if (!generate_dataset(spec)) return 1;
+        scales.push_back(make_unique<BenchScale>(spec, directory.string()));
+        register_scale(*scales.back());
+    }
+
+    benchmark::RunSpecifiedBenchmarks();
+    for (auto& scale : scales) scale->close();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,136 @@
+#include "rims_dataset.h"
+
+#include <iostream>   // For error messages
+#include <random>     // For reproducible random networks
+#include <unordered_set> // For keeping roads distinct
+#include <filesystem> // For clearing the data directory
+#include <climits>    // For INT_MAX
+#include <cmath>      // For rounding budgets to tenths
+
+using namespace std;
+
+string synthetic_city_name(int index) {
+    static const char* const syllables[16] = {"ka", "ki", "ko", "ku", "ga", "gi", "go", "ru",
+                                              "ra", "ri", "mu", "ma", "bu", "se", "to", "na"};
+    string name;
+    for (int digits = 0; digits < 3 || index > 0; digits++) {
+        name.insert(0, syllables[index % 16]);
+        index /= 16;
+    }
+    name[0] = static_cast<char>(name[0] - 'a' + 'A');
+    return name;
+}
+
+bool generate_dataset(const DatasetSpec& spec) {
+    if (spec.cities < 2) {
+        cout << "Error: A data set needs at least 2 cities.\n";
+        return false;
+    }
+    error_code ec;
+    filesystem::remove_all("data", ec);
+    if (ec) {
+        cout << "Error: Cannot clear the data directory: " << ec.message() << ".\n";
+        return false;
+    }
+
+    // Roads: a random spanning tree keeps the network connected, unless it need not be, then extra
+    // roads are added up to the requested degree. With hubs, one end of each road is the end of a random existing road,
+    // which picks cities in proportion to their degree.
+    mt19937_64 random(spec.seed);
+    size_t n = static_cast<size_t>(spec.cities);
+    size_t max_roads = n * (n - 1) / 2;
+    size_t road_target = min(max_roads, static_cast<size_t>(spec.degree * static_cast<double>(n) / 2));
+    if (spec.connected) road_target = max(road_target, n - 1);
+    vector<pair<int, int>> roads;
+    roads.reserve(road_target);
+    unordered_set<uint64_t> taken;
+    taken.reserve(road_target);
+    auto any_city = [&](size_t below) { return static_cast<int>(random() % below); };
+    auto add = [&](int i, int j) {
+        if (i == j) return;
+        uint64_t key = (static_cast<uint64_t>(min(i, j)) << 32) | static_cast<uint32_t>(max(i, j));
+        if (taken.insert(key).second) roads.emplace_back(i, j);
+    };
+    auto hub_city = [&](size_t below) {
+        if (roads.empty()) return any_city(below);
+        const auto& road = roads[random() % roads.size()];
+        return random() % 2 == 0 ? road.first : road.second;
+    };
+    // Locations come from a generator of their own, so they leave the roads of a seed unchanged
+    mt19937_64 placement(spec.seed ^ 0x9e3779b97f4a7c15ULL);
+    uniform_real_distribution<double> latitude(-2.84, -1.05), longitude(28.86, 30.90);
+    vector<LocationChange> locations(n);
+    for (size_t c = 0; c < n; c++) {
+        locations[c] = {static_cast<int>(c), {latitude(placement), longitude(placement)}};
+    }
+
+    if (spec.geographic) {
+        // Each city in west-to-east order joins the nearest of the few before it, which keeps the
+        // network connected, then the rest of the roads join cities to one of their nearest
+        vector<int> order(n);
+        for (size_t c = 0; c < n; c++) order[c] = static_cast<int>(c);
+        sort(order.begin(), order.end(), [&](int a, int b) {
+            return locations[a].location.longitude < locations[b].location.longitude;
+        });
+        for (size_t k = 1; spec.connected && k < n; k++) {
+            int city = order[k], closest = order[k - 1];
+            for (size_t back = 2; back <= min<size_t>(k, 8); back++) {
+                int other = order[k - back];
+                if (great_circle_km(locations[city].location, locations[other].location) <
+                    great_circle_km(locations[city].location, locations[closest].location)) closest = other;
+            }
+            add(city, closest);
+        }
+        CityLocationIndex index;
+        for (const auto& [city, location] : locations) index.add(city, location);
+        index.build();
+        size_t choices = max<size_t>(2, static_cast<size_t>(spec.degree) + 1);
+        vector<CityDistance> near;
+        for (size_t attempts = 0; roads.size() < road_target && attempts < 20 * road_target; attempts++) {
+            int city = spec.hubs ? hub_city(n) : any_city(n);
+            index.nearest(locations[city].location, choices, city, near);
+            if (!near.empty()) add(city, near[random() % near.size()].city);
+        }
+    } else {
+        for (size_t c = 1; spec.connected && c < n; c++) add(static_cast<int>(c), spec.hubs ? hub_city(c) : any_city(c));
+        for (size_t attempts = 0; roads.size() < road_target && attempts < 20 * road_target; attempts++) {
+            add(any_city(n), spec.hubs ? hub_city(n) : any_city(n));
+        }
+    }
+
+    vector<BudgetChange> budgets;
+    uniform_int_distribution<int> tenths(5, 5000);  // 0.5 to 500.0 billion RWF, in tenths as roads.txt keeps them
+    uniform_real_distribution<double> per_km(0.1, 1.0); // Billion RWF per km of a geographic road
+    bernoulli_distribution funded(spec.funded);
+    for (const auto& [i, j] : roads) {
+        if (!funded(random)) continue;
+        if (spec.geographic) {
+            double km = great_circle_km(locations[i].location, locations[j].location);
+            budgets.push_back({i, j, clamp(round(km * per_km(random) * 10.0) / 10.0, 0.1, 1000.0)});
+        } else {
+            budgets.push_back({i, j, tenths(random) / 10.0});
+        }
+    }
+
+    vector<string> names;
+    names.reserve(n);
+    for (size_t c = 0; c < n; c++) names.push_back(synthetic_city_name(static_cast<int>(c)));
+    vector<string_view> name_views(names.begin(), names.end());
+
+    PersistenceOptions options;
+    options.compact_after_records = SIZE_MAX;  // One compaction at the end instead of several along the way
+    options.compact_interval_ms = INT_MAX;
+    InfrastructureManager manager(options);
+    manager.set_max_cities(spec.cities);
+    size_t failed = 0;
+    ChangeStatus status = manager.add_cities(name_views, &failed);
+    if (status == ChangeStatus::Ok) status = manager.add_roads(roads, &failed);
+    if (status == ChangeStatus::Ok) status = manager.set_budgets(budgets, &failed);
+    if (status == ChangeStatus::Ok) status = manager.set_locations(locations, &failed);
+    if (status != ChangeStatus::Ok) {
+        cout << "Error: Generated change " << (failed + 1) << " was rejected: " << describe(status) << "\n";
+        return false;
+    }
+    manager.checkpoint();
+    return true;
+}
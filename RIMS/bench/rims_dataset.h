@@ -0,0 +1,29 @@
+/*
+ * Synthetic road networks for the benchmarks and the rims_gen tool. A data set is built through
+ * the InfrastructureManager API, so the files it leaves behind (data/cities.txt, data/roads.txt
+ * and the snapshots) are exactly what the program itself would write. Every city is placed at a
+ * random point within Rwanda's borders' bounding box.
+ */
+#pragma once
+
+#include "rims_core.h"
+
+// Shape and size of a synthetic road network
+struct DatasetSpec {
+    int cities = 1000;
+    double degree = 4.0;                // Average number of roads per city
+    bool hubs = false;                  // Skewed degrees: new roads favour cities that already have many
+    bool geographic = false;            // Roads join nearby cities, budgets in proportion to their length
+    bool connected = true;              // Every city can reach every other; otherwise roads are only added up to the degree
+    double funded = 0.8;                // Share of roads given a budget
+    uint64_t seed = 1;
+};
+
+// Returns the name of synthetic city index: two-letter syllables spelling index in base 16, so
+// every name is distinct and valid
+std::string synthetic_city_name(int index);
+
+// Builds the network described by spec in the data/ directory under the current directory,
+// replacing anything already there, and folds it into the data files. Returns false after
+// saying why if the network cannot be built.
+bool generate_dataset(const DatasetSpec& spec);
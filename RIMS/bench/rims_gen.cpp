@@ -0,0 +1,71 @@
+/*
+ * rims_gen: writes a synthetic road network as RwandaInfraSystem data files.
+ *
+ *     rims_gen --out DIR [--cities N] [--degree D] [--hubs] [--geographic] [--disconnected] [--funded P]
+ *              [--seed S] [--force]
+ *
+ * The network is written to DIR/data (cities.txt, roads.txt and the snapshots), ready to be
+ * opened by running RwandaInfraSystem in DIR. With --disconnected the network is not given a
+ * spanning tree first, so a low degree leaves groups of cities that cannot reach each other.
+ */
+#include <iostream>   // For messages
+#include <string>     // For option values
+#include <filesystem> // For the output directory
+#include <charconv>   // For parsing option values
+#include "rims_dataset.h"
+
+using namespace std;
+
+// Parses a whole option value as a number; returns false if it is not one
+template <typename T>
+static bool parse_value(const string& text, T& value) {
+    const char* end = text.data() + text.size();
+    auto [ptr, ec] = from_chars(text.data(), end, value);
+    return ec == errc() && ptr == end;
+}
+
+int main(int argc, char* argv[]) {
+    DatasetSpec spec;
+    string out;
+    bool force = false;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        bool ok = true;
+        if (arg == "--hubs") spec.hubs = true;
+        else if (arg == "--geographic") spec.geographic = true;
+        else if (arg == "--disconnected") spec.connected = false;
+        else if (arg == "--force") force = true;
+        else if (arg == "--out" && has_value) out = argv[++i];
+        else if (arg == "--cities" && has_value) ok = parse_value(argv[++i], spec.cities) && spec.cities >= 2;
+        else if (arg == "--degree" && has_value) ok = parse_value(argv[++i], spec.degree) && spec.degree >= 0;
+        else if (arg == "--funded" && has_value) ok = parse_value(argv[++i], spec.funded) && spec.funded >= 0 && spec.funded <= 1;
+        else if (arg == "--seed" && has_value) ok = parse_value(argv[++i], spec.seed);
+        else ok = false;
+        if (!ok) {
+            cout << "Error: Invalid option " << arg << ".\n"
+                 << "Usage: rims_gen --out DIR [--cities N] [--degree D] [--hubs] [--geographic] [--disconnected]"
+                    " [--funded P] [--seed S] [--force]\n";
+            return 1;
+        }
+    }
+    if (out.empty()) {
+        cout << "Error: No output directory given (--out DIR).\n";
+        return 1;
+    }
+
+    error_code ec;
+    filesystem::create_directories(out, ec);
+    if (!ec) filesystem::current_path(out, ec);
+    if (ec) {
+        cout << "Error: Cannot use " << out << ": " << ec.message() << ".\n";
+        return 1;
+    }
+    if (filesystem::exists("data") && !force) {
+        cout << "Error: " << out << "/data already exists; use --force to replace it.\n";
+        return 1;
+    }
+    if (!generate_dataset(spec)) return 1;
+    cout << "Wrote " << spec.cities << " cities to " << out << "/data\n";
+    return 0;
+}
@@ -1,11 +1,12 @@
 #include <iostream>   // For input and output
-#include <vector>     // For vectors and matrices
 #include <string>     // For string operations
-#include <fstream>    // For saving data to files
-#include <iomanip>    // For formatting output
-#include <algorithm>  // For ordering and sorting
+#include <fstream>    // For reading batch files and writing statistics
 #include <limits>     // For numeric_limits
-#include <direct.h>   // For directory creation
+#include <charconv>   // For parsing option values
+#include <optional>   // For timing the chosen menu entry
+#include "rims_core.h" // The city and road network and its persistence
+#include "rims_console.h" // The menu actions
+#include "rims_server.h" // Server mode
 
 using namespace std;
 
@@ -14,471 +15,210 @@ using namespace std;
  *
  * A console application to manage cities, roads, and budgets for Rwanda's infrastructure,
  * under the Ministry of Infrastructure (MININFRA). This application supports adding cities,
- * roads, and budgets; editing city names; searching cities by index; displaying data; and
- * persisting data to files in the "data" directory. Data is loaded from files on startup and
- * saved immediately after each operation for live synchronization.
+ * roads, and budgets; removing roads and cities; editing city names; searching cities by index;
+ * finding routes between cities; planning the minimum-budget road network; analysing
+ * connectivity; exporting the cheapest-route cost between every pair of cities; displaying data;
+ * grouping corrections into transactions that can be rolled back, undone and redone; and
+ * persisting data to files in the "data" directory.
+ *
+ * Data is loaded on startup from binary snapshots of the cities and the roads (data/cities.snap
+ * and data/roads.snap), or from the text files when there are none. Each operation is appended
+ * to a write-ahead log (data/rims.wal) that is flushed to disk in small groups, and a background
+ * worker periodically folds the log back into whichever snapshot and text files it changed.
+ * Roads refer to cities by index, so renaming a city never rewrites the roads. With --lazy-roads
+ * only the cities are read at startup, and each city's roads are paged in from the snapshot the
+ * first time a change or a query needs them, so the menu appears as quickly for a million roads
+ * as for ten. Every budget set is also kept in a history by fiscal year (July to June), one
+ * columnar file per year (data/budgets_fy<year>.snap), so earlier years can be compared.
+ * Cities may be given a latitude and longitude; a k-d tree over them answers nearest-city and
+ * radius queries and proposes roads between nearby cities, and routes are found with A*. An
+ * optimizer (rims_optimizer.h) chooses which proposed roads to build within a budget cap so the
+ * network ends up as connected as it can be. Every change that reaches the log is also appended,
+ * numbered, to a change feed (data/changes.feed) that downstream systems follow: they bootstrap
+ * from the data files, whose last change is recorded in data/changes.position, and then read the
+ * feed from there by sequence number (the server's 'changes' request).
+ *
+ * The network and its persistence live in the rims_core library (rims_core.h) and the menu
+ * actions in rims_console.h; this file holds the menu loop and the command-line modes.
+ *
+ * Run with --batch FILE (or --batch - for standard input) to apply a command file of cities,
+ * roads, budgets, renames and locations as a single validated transaction instead of using the
+ * menu, or with --import FILE to load a CSV or GeoJSON road inventory. With --serve [HOST]:PORT
+ * one shared instance answers queries and changes from many clients over TCP (see rims_server.h).
+ * --stats-json FILE writes the call counts and timings of the instrumented operations
+ * (rims_stats.h) to FILE, or to standard output for -, when the program exits.
  *
  * Author: [Ishimwe Arsene]
  * Date: [23.05.2025]
  */
 
-class InfrastructureManager {
-private:
-    vector<string> city_names;          // Stores city names
-    vector<vector<int>> roads;          // Adjacency matrix indicating roads between cities (1 if road exists, 0 otherwise)
-    vector<vector<double>> budgets;     // Adjacency matrix holding budgets for roads between cities
-    const int MAX_CITIES = 500;         // Maximum number of cities to prevent crashes
-
-    // Returns 0-based index of city by name, or -1 if not found
-    int get_city_index(const string& name) {
-        for (size_t i = 0; i < city_names.size(); i++) {
-            if (city_names[i] == name) return static_cast<int>(i);
-        }
-        return -1;
-    }
-
-    // Checks if a city exists
-    bool city_exists(const string& name) {
-        return get_city_index(name) != -1;
-    }
-
-    // Validates city name
-    bool is_valid_city_name(const string& name) {
-        if (name.empty() || name.length() < 2) {
-            return false;
-        }
-        bool has_letter = false;
-        for (char c : name) {
-            if (isalpha(c)) has_letter = true;
-            if (!isalnum(c) && c != ' ' && c != '-') {
-                return false;
-            }
-        }
-        return has_letter;
-    }
-
-    // Validates budget amount
-    bool is_valid_budget(double budget) {
-        return budget > 0 && budget <= 1000.0; // Max 1000 billion RWF
-    }
-
-    // Validates city count
-    bool is_valid_city_count(int count) {
-        return count > 0 && count <= MAX_CITIES - static_cast<int>(city_names.size());
-    }
-
-    // Validates city index
-    bool is_valid_index(int index) {
-        return index >= 1 && index <= static_cast<int>(city_names.size());
-    }
-
-    // Creates data directory if it doesn't exist
-    void ensure_data_directory() {
-        #ifdef _WIN32
-            _mkdir("data");
-        #else
-            mkdir("data", 0777);
-        #endif
-    }
-
-    // Saves cities to data/cities.txt
-    void save_cities_to_file() {
-        ensure_data_directory();
-        ofstream cities_file("data/cities.txt");
-        if (cities_file.is_open()) {
-            cities_file << "Index\tCity Name\n";
-            for (size_t i = 0; i < city_names.size(); i++) {
-                cities_file << (i + 1) << "\t" << city_names[i] << "\n";
-            }
-            cities_file.close();
-        } else {
-            cout << "Error: Cannot save to cities.txt. Check permissions.\n";
-        }
-    }
-
-    // Saves roads to data/roads.txt
-    void save_roads_to_file() {
-        ensure_data_directory();
-
-        // Structure to hold road data
-        struct RoadEntry {
-            int nbr;
-            string city1, city2;
-            double budget;
-        };
-        vector<RoadEntry> existing_roads;
-
-        // Read existing roads from file
-        ifstream in_file("data/roads.txt");
-        if (in_file.is_open()) {
-            string line;
-            getline(in_file, line); // Skip header
-            while (getline(in_file, line)) {
-                size_t first_tab = line.find('\t');
-                size_t second_tab = line.find('\t', first_tab + 1);
-                if (first_tab == string::npos || second_tab == string::npos) continue;
-
-                int nbr;
-                try {
-                    nbr = stoi(line.substr(0, first_tab));
-                } catch (...) {
-                    continue;
-                }
-
-                string road = line.substr(first_tab + 1, second_tab - first_tab - 1);
-                double budget;
-                try {
-                    budget = stod(line.substr(second_tab + 1));
-                } catch (...) {
-                    continue;
-                }
-
-                size_t dash_pos = road.find(" - ");
-                if (dash_pos == string::npos) continue;
-                string city1 = road.substr(0, dash_pos);
-                string city2 = road.substr(dash_pos + 3);
-
-                existing_roads.push_back({nbr, city1, city2, budget});
-            }
-            in_file.close();
-        }
-
-        // Update or add roads based on current state
-        vector<RoadEntry> updated_roads;
-        bool found;
-        for (size_t i = 0; i < roads.size(); i++) {
-            for (size_t j = i + 1; j < roads[i].size(); j++) {
-                if (roads[i][j] == 1) {
-                    string city1 = city_names[i];
-                    string city2 = city_names[j];
-                    double budget = budgets[i][j];
-                    found = false;
-
-                    // Check if road exists in file
-                    for (auto& entry : existing_roads) {
-                        if ((entry.city1 == city1 && entry.city2 == city2) ||
-                            (entry.city1 == city2 && entry.city2 == city1)) {
-                            updated_roads.push_back({entry.nbr, city1, city2, budget});
-                            found = true;
-                            break;
-                        }
-                    }
+const int EXIT_CHOICE = 23;             // Menu entry that ends the program
 
-                    // New road: assign next Nbr
-                    if (!found) {
-                        int next_nbr = existing_roads.empty() ? 1 : existing_roads.back().nbr + 1;
-                        updated_roads.push_back({next_nbr, city1, city2, budget});
-                    }
-                }
-            }
-        }
-        // Sort roads by Nbr
-        sort(updated_roads.begin(), updated_roads.end(),
-             [](const RoadEntry& a, const RoadEntry& b) {
-                 return a.nbr < b.nbr;
-             });
-
-        // Write sorted roads to file
-        ofstream out_file("data/roads.txt");
-        if (out_file.is_open()) {
-            out_file << "Nbr\tRoad\t\t\tBudget\n";
-            for (const auto& entry : updated_roads) {
-                out_file << entry.nbr << "\t" << entry.city1 << " - " << entry.city2
-                         << "\t" << fixed << setprecision(1) << entry.budget << endl;
-            }
-            out_file.close();
-        } else {
-            cout << "Error: Cannot save to roads.txt.\n";
-        }
-    }
-
-    // Loads cities from data/cities.txt
-    void load_cities_from_file() {
-        ifstream cities_file("data/cities.txt");
-        if (!cities_file.is_open()) return;
-
-        string line;
-        getline(cities_file, line); // Skip header
-        while (getline(cities_file, line)) {
-            size_t tab_pos = line.find('\t');
-            if (tab_pos == string::npos) continue;
-            string city_name = line.substr(tab_pos + 1);
-            if (is_valid_city_name(city_name) && !city_exists(city_name)) {
-                city_names.push_back(city_name);
-                size_t n = city_names.size();
-                for (auto& row : roads) row.resize(n, 0);
-                for (auto& row : budgets) row.resize(n, 0.0);
-                roads.push_back(vector<int>(n, 0));
-                budgets.push_back(vector<double>(n, 0.0));
-            }
-        }
-        cities_file.close();
-    }
-
-    // Loads roads and budgets from data/roads.txt
-    void load_roads_from_file() {
-        ifstream roads_file("data/roads.txt");
-        if (!roads_file.is_open()) return;
-
-        string line;
-        getline(roads_file, line); // Skip header
-        while (getline(roads_file, line)) {
-            size_t first_tab = line.find('\t');
-            size_t second_tab = line.find('\t', first_tab + 1);
-            if (first_tab == string::npos || second_tab == string::npos) continue;
+// Displaying the menu
+void display_menu() {
+    cout << "\nMenu:\n"
+         << "1. Add new city(ies)\n"
+         << "2. Add roads between cities\n"
+         << "3. Add the budget for roads\n"
+         << "4. Edit city\n"
+         << "5. Search for a city by index or name\n"
+         << "6. Display cities\n"
+         << "7. Display roads\n"
+         << "8. Display recorded data on console\n"
+         << "9. Find a route between two cities\n"
+         << "10. Plan the minimum-budget road network\n"
+         << "11. Analyse network connectivity\n"
+         << "12. Import roads from a CSV or GeoJSON file\n"
+         << "13. Compare the neighbours of two cities\n"
+         << "14. Display the budget report\n"
+         << "15. Browse cities, roads and budgets\n"
+         << "16. Display statistics\n"
+         << "17. Export the all-pairs route cost table\n"
+         << "18. Transactions, undo and redo\n"
+         << "19. Remove a road\n"
+         << "20. Remove a city\n"
+         << "21. Budget history by fiscal year\n"
+         << "22. City locations and nearby cities\n"
+         << "23. Exit\n"
+         << "Enter your choice: ";
+}
 
-            string road = line.substr(first_tab + 1, second_tab - first_tab - 1);
-            double budget;
-            try {
-                budget = stod(line.substr(second_tab + 1));
-            } catch (...) {
-                continue;
-            }
+// Parses a non-negative integer command-line value
+bool parse_option_value(const char* text, long long& value) {
+    string_view digits(text);
+    auto result = from_chars(digits.data(), digits.data() + digits.size(), value);
+    return result.ec == errc() && result.ptr == digits.data() + digits.size() && value >= 0;
+}
 
-            size_t dash_pos = road.find(" - ");
-            if (dash_pos == string::npos) continue;
-            string city1 = road.substr(0, dash_pos);
-            string city2 = road.substr(dash_pos + 3);
+// Settings taken from the command line
+struct ProgramOptions {
+    PersistenceOptions persistence;
+    string batch_path;                  // Batch command file to apply instead of showing the menu; "-" for stdin
+    string import_path;                 // CSV or GeoJSON road inventory to import instead of showing the menu
+    bool serve = false;                 // Run the network server instead of showing the menu
+    string stats_path;                  // Where to write the statistics as JSON on exit; "-" for stdout
+    ServerOptions server;
+    int max_cities = DEFAULT_MAX_CITIES;
+};
 
-            int i = get_city_index(city1);
-            int j = get_city_index(city2);
-            if (i != -1 && j != -1 && is_valid_budget(budget)) {
-                roads[i][j] = roads[j][i] = 1;
-                budgets[i][j] = budgets[j][i] = budget;
-            }
+// Parses command-line options; returns false on a bad option
+bool parse_options(int argc, char* argv[], ProgramOptions& options) {
+    PersistenceOptions& persistence = options.persistence;
+    for (int i = 1; i < argc; i++) {
+        string_view option(argv[i]);
+        if (option == "--import-text") {
+            persistence.import_text = true;
+            continue;
         }
-        roads_file.close();
-    }
-
-public:
-    // Constructor initializes and loads data
-    InfrastructureManager() {
-        roads = vector<vector<int>>(0);
-        budgets = vector<vector<double>>(0);
-        load_cities_from_file();
-        load_roads_from_file();
-    }
-
-    // Adding new cities
-    void add_cities() {
-        int k;
-        while (true) {
-            cout << "Enter the number of cities to add: ";
-            if (cin >> k && is_valid_city_count(k)) {
-                break;
-            }
-            cout << "Error: Enter a number between 1 and " << (MAX_CITIES - city_names.size()) << ".\n";
-            cin.clear();
-            cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        if (option == "--lazy-roads") {
+            persistence.lazy_roads = true;
+            continue;
         }
-        cin.ignore();
-
-        for (int i = 0; i < k; i++) {
-            string name;
-            while (true) {
-                cout << "Enter name for city " << (city_names.size() + 1) << ": ";
-                getline(cin, name);
-                if (name.empty()) {
-                    cout << "Error: City name cannot be empty.\n";
-                } else if (city_exists(name)) {
-                    cout << "Error: City '" << name << "' already exists.\n";
-                } else if (!is_valid_city_name(name)) {
-                    cout << "Error: City name must be 2+ characters, contain at least one letter, "
-                         << "and only include alphanumeric, space, or hyphen.\n";
-                } else {
-                    break;
-                }
+        if (option == "--batch") {
+            if (i + 1 >= argc) {
+                cout << "Error: Option '--batch' needs a file name, or - for standard input.\n";
+                return false;
             }
-            city_names.push_back(name);
-            size_t n = city_names.size();
-            for (auto& row : roads) row.resize(n, 0);
-            for (auto& row : budgets) row.resize(n, 0.0);
-            roads.push_back(vector<int>(n, 0));
-            budgets.push_back(vector<double>(n, 0.0));
+            options.batch_path = argv[++i];
+            continue;
         }
-        cout << k << " cities added successfully.\n";
-        save_cities_to_file();
-    }
-
-    // Add road between cities
-    void add_road() {
-        string city1, city2;
-        while (true) {
-            cout << "Enter the name of the first city: ";
-            getline(cin, city1);
-            if (city_exists(city1)) {
-                break;
+        if (option == "--import") {
+            if (i + 1 >= argc) {
+                cout << "Error: Option '--import' needs a CSV or GeoJSON file name.\n";
+                return false;
             }
-            cout << "Error: City '" << city1 << "' does not exist.\n";
+            options.import_path = argv[++i];
+            continue;
         }
-        while (true) {
-            cout << "Enter the name of the second city: ";
-            getline(cin, city2);
-            if (city2 == city1) {
-                cout << "Error: Cannot add a road from a city to itself.\n";
-            } else if (!city_exists(city2)) {
-                cout << "Error: City '" << city2 << "' does not exist.\n";
-            } else if (roads[get_city_index(city1)][get_city_index(city2)] == 1) {
-                cout << "Error: Road already exists between " << city1 << " and " << city2 << ".\n";
-            } else {
-                break;
+        if (option == "--stats-json") {
+            if (i + 1 >= argc) {
+                cout << "Error: Option '--stats-json' needs a file name, or - for standard output.\n";
+                return false;
             }
+            options.stats_path = argv[++i];
+            continue;
         }
-        int i = get_city_index(city1);
-        int j = get_city_index(city2);
-        roads[i][j] = roads[j][i] = 1;
-        cout << "Road added between " << city1 << " and " << city2 << ".\n";
-        save_roads_to_file();
-    }
-
-    // Add budget for a road
-    void add_budget() {
-        string city1, city2;
-        while (true) {
-            cout << "Enter the name of the first city: ";
-            getline(cin, city1);
-            if (city_exists(city1)) break;
-            cout << "Error: City '" << city1 << "' does not exist.\n";
-        }
-        while (true) {
-            cout << "Enter the name of the second city: ";
-            getline(cin, city2);
-            if (!city_exists(city2)) {
-                cout << "Error: City '" << city2 << "' does not exist.\n";
-            } else if (roads[get_city_index(city1)][get_city_index(city2)] == 0) {
-                cout << "Error: No road exists between " << city1 << " and " << city2 << ".\n";
-            } else {
-                break;
+        if (option == "--serve") {
+            // [HOST]:PORT, or just PORT
+            string_view address = i + 1 < argc ? string_view(argv[i + 1]) : string_view();
+            size_t colon = address.rfind(':');
+            string_view port = colon == string_view::npos ? address : address.substr(colon + 1);
+            long long value;
+            if (port.empty() || !parse_option_value(string(port).c_str(), value) || value == 0 || value > 65535) {
+                cout << "Error: Option '--serve' needs an address such as :8080 or 127.0.0.1:8080.\n";
+                return false;
             }
+            options.serve = true;
+            options.server.port = static_cast<int>(value);
+            if (colon != string_view::npos) options.server.host = string(address.substr(0, colon));
+            // Brackets around an IPv6 address are for the command line only
+            string& host = options.server.host;
+            if (host.size() >= 2 && host.front() == '[' && host.back() == ']') host = host.substr(1, host.size() - 2);
+            i++;
+            continue;
         }
-        int i = get_city_index(city1);
-        int j = get_city_index(city2);
-        double budget;
-        while (true) {
-            cout << "Enter the budget for the road: ";
-            if (cin >> budget && is_valid_budget(budget)) break;
-            cout << "Error: Budget must be between 0 and 1000 billion RWF.\n";
-            cin.clear();
-            cin.ignore(numeric_limits<streamsize>::max(), '\n');
-        }
-        cin.ignore();
-        budgets[i][j] = budgets[j][i] = budget;
-        cout << "Budget added for the road between " << city1 << " and " << city2 << ".\n";
-        save_roads_to_file();
-    }
-
-    // Edit city name function
-    void edit_city() {
-        int index;
-        while (true) {
-            cout << "Enter the index of the city to be edited: ";
-            if (cin >> index && is_valid_index(index)) break;
-            cout << "Error: Invalid index. Enter a number between 1 and " << city_names.size() << ".\n";
-            cin.clear();
-            cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        if (option != "--group-commit-ops" && option != "--group-commit-ms" && option != "--compact-after" &&
+            option != "--compact-ms" && option != "--max-cities" && option != "--serve-threads") {
+            cout << "Error: Unknown option '" << option << "'.\n"
+                 << "Usage: RwandaInfraSystem [--batch FILE|-] [--import FILE] [--import-text] [--lazy-roads] [--group-commit-ops N]"
+                 << " [--group-commit-ms T] [--compact-after N] [--compact-ms T] [--max-cities N]"
+                 << " [--serve [HOST]:PORT] [--serve-threads N] [--stats-json FILE|-]\n";
+            return false;
         }
-        cin.ignore();
-        index--;
-        string new_name;
-        while (true) {
-            cout << "Enter the new name of the city: ";
-            getline(cin, new_name);
-            if (new_name.empty()) {
-                cout << "Error: City name cannot be empty.\n";
-            } else if (city_exists(new_name)) {
-                cout << "Error: City '" << new_name << "' already exists.\n";
-            } else if (!is_valid_city_name(new_name)) {
-                cout << "Error: City name must be 2+ characters, contain at least one letter, "
-                     << "and only include alphanumeric, space, or hyphen.\n";
-            } else {
-                break;
-            }
+        long long value;
+        if (i + 1 >= argc || !parse_option_value(argv[i + 1], value)) {
+            cout << "Error: Option '" << option << "' needs a non-negative number.\n";
+            return false;
         }
-        city_names[index] = new_name;
-        cout << "City edited successfully.\n";
-        save_cities_to_file();
-        save_roads_to_file();
-    }
-
-    // Search city by index function
-    void search_city() {
-        int index;
-        while (true) {
-            cout << "Enter the index of the city: ";
-            if (cin >> index && is_valid_index(index)) break;
-            cout << "Error: Invalid index. Enter a number between 1 and " << city_names.size() << ".\n";
-            cin.clear();
-            cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        if (option == "--group-commit-ops") {
+            persistence.group_commit_ops = static_cast<size_t>(value);
+        } else if (option == "--group-commit-ms") {
+            persistence.group_commit_ms = static_cast<int>(min<long long>(value, numeric_limits<int>::max()));
+        } else if (option == "--compact-after") {
+            persistence.compact_after_records = static_cast<size_t>(value);
+        } else if (option == "--max-cities") {
+            options.max_cities = static_cast<int>(min<long long>(value, numeric_limits<int>::max()));
+        } else if (option == "--serve-threads") {
+            options.server.worker_threads = static_cast<int>(min<long long>(value, 1024));
+        } else {
+            persistence.compact_interval_ms = static_cast<int>(min<long long>(value, numeric_limits<int>::max()));
         }
-        cin.ignore();
-        index--;
-        cout << "City at index " << (index + 1) << ": " << city_names[index] << "\n";
+        i++;
     }
+    return true;
+}
 
-    // Display cities function
-    void display_cities() {
-        if (city_names.empty()) {
-            cout << "No cities recorded.\n";
-            return;
-        }
-        cout << "Cities:\n";
-        for (size_t i = 0; i < city_names.size(); i++) {
-            cout << (i + 1) << ": " << city_names[i] << "\n";
+// Menu entries as instrumented operations, by choice - 1
+const Probe MENU_PROBES[EXIT_CHOICE - 1] = {
+    Probe("menu.add_cities"), Probe("menu.add_road"), Probe("menu.add_budget"), Probe("menu.edit_city"),
+    Probe("menu.search_city"), Probe("menu.display_cities"), Probe("menu.display_roads"),
+    Probe("menu.display_recorded_data"), Probe("menu.find_route"), Probe("menu.plan_network"),
+    Probe("menu.analyze_connectivity"), Probe("menu.import_roads"), Probe("menu.compare_neighbors"),
+    Probe("menu.budget_report"), Probe("menu.browse_data"), Probe("menu.statistics"),
+    Probe("menu.export_route_costs"), Probe("menu.changes"), Probe("menu.remove_road"), Probe("menu.remove_city"),
+    Probe("menu.budget_history"), Probe("menu.locations")};
+
+// Runs the mode chosen on the command line; returns the process exit status
+int run_program(const ProgramOptions& options) {
+    InfrastructureManager manager(options.persistence);
+    manager.set_max_cities(options.max_cities);
+    if (!options.batch_path.empty()) {
+        // Batch mode: apply the command stream and exit, folding it into the data files on the way out
+        if (options.batch_path == "-") return manager.run_batch(cin) ? 0 : 1;
+        ifstream batch_file(options.batch_path);
+        if (!batch_file.is_open()) {
+            cout << "Error: Cannot open batch file '" << options.batch_path << "'.\n";
+            return 1;
         }
+        return manager.run_batch(batch_file) ? 0 : 1;
     }
-
-    // Display roads function
-    void display_roads() {
-        if (roads.empty()) {
-            cout << "No roads recorded.\n";
-            return;
-        }
-        display_cities();
-        cout << "\nRoads Adjacency Matrix:\n";
-        for (const auto& row : roads) {
-            for (int val : row) cout << val << " ";
-            cout << "\n";
-        }
+    if (!options.import_path.empty()) {
+        return manager.import_road_file(options.import_path) ? 0 : 1;
     }
-
-    // Display recorded data function
-    void display_recorded_data() {
-        if (city_names.empty()) {
-            cout << "No data recorded.\n";
-            return;
-        }
-        display_cities();
-        cout << "\nRoads Adjacency Matrix:\n";
-        for (const auto& row : roads) {
-            for (int val : row) cout << val << " ";
-            cout << "\n";
-        }
-        cout << "\nBudgets Adjacency Matrix:\n";
-        for (const auto& row : budgets) {
-            for (double val : row) cout << fixed << setprecision(1) << val << " ";
-            cout << "\n";
-        }
+    if (options.serve) {
+        return run_server(manager, options.server);
     }
-};
-
-// Displaying the menu
-void display_menu() {
-    cout << "\nMenu:\n"
-         << "1. Add new city(ies)\n"
-         << "2. Add roads between cities\n"
-         << "3. Add the budget for roads\n"
-         << "4. Edit city\n"
-         << "5. Search for a city using its index\n"
-         << "6. Display cities\n"
-         << "7. Display roads\n"
-         << "8. Display recorded data on console\n"
-         << "9. Exit\n"
-         << "Enter your choice: ";
-}
-
-// Main function
-int main() {
-    InfrastructureManager manager;
+    ConsoleMenu console(manager);
     cout << "\nWelcome to Rwanda Infrastructure Management System\n"
          << "---------------------------------------------------\n"
          << "Ministry of Infrastructure\n\n";
@@ -487,52 +227,130 @@ int main() {
     do {
         display_menu();
         if (!(cin >> choice)) {
-            cout << "Error: Please enter a number between 1 and 9.\n";
+            cout << "Error: Please enter a number between 1 and " << EXIT_CHOICE << ".\n";
             cin.clear();
             cin.ignore(numeric_limits<streamsize>::max(), '\n');
             continue;
         }
         cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        optional<ProbeTimer> timer;
+        if (choice >= 1 && choice < EXIT_CHOICE) timer.emplace(MENU_PROBES[choice - 1]);
         switch (choice) {
             case 1:
                 // Add new cities
-                manager.add_cities();
+                console.add_cities();
                 break;
             case 2:
                 // Add roads between cities
-                manager.add_road();
+                console.add_road();
                 break;
             case 3:
                 // Add budget for roads
-                manager.add_budget();
+                console.add_budget();
                 break;
             case 4:
                 // Edit city name
-                manager.edit_city();
+                console.edit_city();
                 break;
             case 5:
                 // Search for city by index
-                manager.search_city();
+                console.search_city();
                 break;
             case 6:
                 // Display cities
-                manager.display_cities();
+                console.display_cities();
                 break;
             case 7:
                 // Display roads
-                manager.display_roads();
+                console.display_roads();
                 break;
             case 8:
                 // Display recorded data
-                manager.display_recorded_data();
+                console.display_recorded_data();
                 break;
             case 9:
+                // Find a route between cities
+                console.find_route_between_cities();
+                break;
+            case 10:
+                // Plan the minimum-budget network
+                console.plan_road_network();
+                break;
+            case 11:
+                // Analyse network connectivity
+                console.analyze_connectivity();
+                break;
+            case 12:
+                // Import a road inventory
+                console.import_road_inventory();
+                break;
+            case 13:
+                // Compare the neighbours of two cities
+                console.compare_city_neighbors();
+                break;
+            case 14:
+                // Summarize the recorded budgets
+                console.display_budget_report();
+                break;
+            case 15:
+                // Show part of the recorded data
+                console.browse_recorded_data();
+                break;
+            case 16:
+                // Show the operation statistics
+                console.display_statistics();
+                break;
+            case 17:
+                // Write the all-pairs route cost table
+                console.export_route_cost_table();
+                break;
+            case 18:
+                // Transactions, undo and redo
+                console.manage_changes();
+                break;
+            case 19:
+                // Remove a road
+                console.remove_road();
+                break;
+            case 20:
+                // Remove a city and its roads
+                console.remove_city();
+                break;
+            case 21:
+                // Record and compare budgets by fiscal year
+                console.budget_history();
+                break;
+            case 22:
+                // Locations, nearest-city queries and road proposals
+                console.manage_locations();
+                break;
+            case EXIT_CHOICE:
                 // Exit the program
+                if (manager.rollback_transaction()) cout << "The open transaction was rolled back.\n";
                 cout << "Exiting...\n";
                 break;
             default:
-                cout << "Error: Invalid choice. Enter a number between 1 and 9.\n";
+                cout << "Error: Invalid choice. Enter a number between 1 and " << EXIT_CHOICE << ".\n";
         }
-    } while (choice != 9);
+    } while (choice != EXIT_CHOICE);
     return 0;
 }
+
+// Main function
+int main(int argc, char* argv[]) {
+    ProgramOptions options;
+    if (!parse_options(argc, argv, options)) return 1;
+    int status = run_program(options);
+    // Written after the manager has shut down, so the final compaction is included
+    if (options.stats_path == "-") {
+        write_statistics_json(cout);
+    } else if (!options.stats_path.empty()) {
+        ofstream stats_file(options.stats_path);
+        write_statistics_json(stats_file);
+        if (!stats_file) {
+            cout << "Error: Cannot write statistics to '" << options.stats_path << "'.\n";
+            return 1;
+        }
+    }
+    return status;
+}
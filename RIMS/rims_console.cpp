@@ -0,0 +1,962 @@
+#include "rims_console.h"
+#include "rims_optimizer.h"
+
+#include <sstream>    // For formatting output in memory
+#include <iomanip>    // For formatting output
+#include <chrono>     // For timing the route cost table
+#include <cmath>      // For HUGE_VAL
+#include <limits>     // For numeric_limits
+
+using namespace std;
+
+void ConsoleMenu::report_unknown_city(string_view name) {
+    cout << "Error: City '" << name << "' does not exist.";
+    vector<CitySearchIndex::Match> similar;
+    if (!trim(name).empty()) manager.cities_similar_to(name, 2, 5, similar);
+    for (size_t k = 0; k < similar.size(); k++) {
+        cout << (k == 0 ? " Did you mean " : ", ") << manager.city_name(similar[k].id);
+    }
+    cout << (similar.empty() ? "\n" : "?\n");
+}
+
+int ConsoleMenu::prompt_existing_city(const string& prompt) {
+    string name;
+    while (true) {
+        cout << prompt;
+        getline(cin, name);
+        int index = manager.find_city(name);
+        if (index != -1) return index;
+        report_unknown_city(name);
+    }
+}
+
+void ConsoleMenu::prompt_existing_road(int& city1, int& city2) {
+    city1 = prompt_existing_city("Enter the name of the first city: ");
+    while (true) {
+        city2 = prompt_existing_city("Enter the name of the second city: ");
+        if (manager.road_exists(city1, city2)) return;
+        cout << "Error: " << describe(ChangeStatus::NoSuchRoad) << "\n";
+    }
+}
+
+int ConsoleMenu::prompt_number(const string& prompt, int low, int high) {
+    int value;
+    while (true) {
+        cout << prompt;
+        if (cin >> value && value >= low && value <= high) break;
+        cout << "Error: Enter a number between " << low << " and " << high << ".\n";
+        cin.clear();
+        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    }
+    cin.ignore();
+    return value;
+}
+
+double ConsoleMenu::prompt_decimal(const string& prompt, double low, double high) {
+    double value;
+    while (true) {
+        cout << prompt;
+        if (cin >> value && value >= low && value <= high) break;
+        cout << "Error: Enter a number between " << low << " and " << high << ".\n";
+        cin.clear();
+        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    }
+    cin.ignore();
+    return value;
+}
+
+bool ConsoleMenu::matches_filter(string_view name, string_view filter) {
+    auto same = [](char a, char b) { return tolower(static_cast<unsigned char>(a)) == tolower(static_cast<unsigned char>(b)); };
+    return search(name.begin(), name.end(), filter.begin(), filter.end(), same) != name.end();
+}
+
+bool ConsoleMenu::continue_paging() {
+    screen.flush();
+    cout << "-- Press Enter for more, or q to stop: ";
+    string answer;
+    if (!getline(cin, answer)) return false;
+    return trim(answer) != "q" && trim(answer) != "Q";
+}
+
+void ConsoleMenu::render_roads_rows(size_t first, size_t last, bool labelled) {
+    size_t n = manager.city_count();
+    string row(2 * n, ' ');
+    for (size_t i = first; i <= last; i++) {
+        for (size_t j = 0; j < n; j++) row[2 * j] = '0';
+        for (const auto& link : manager.roads_of(static_cast<int>(i))) row[2 * link.neighbor] = '1';
+        if (labelled) {
+            screen.append_int(static_cast<long long>(i + 1));
+            screen.append(": ");
+        }
+        screen.append(row);
+        screen.append('\n');
+        screen.flush_if_full();
+    }
+}
+
+void ConsoleMenu::render_budget_rows(size_t first, size_t last, bool labelled) {
+    const vector<double>& budgets = manager.budgets();
+    size_t n = manager.city_count();
+    vector<double> row(n);
+    for (size_t i = first; i <= last; i++) {
+        fill(row.begin(), row.end(), 0.0);
+        for (const auto& link : manager.roads_of(i)) row[link.neighbor] = budgets[link.road];
+        if (labelled) {
+            screen.append_int(static_cast<long long>(i + 1));
+            screen.append(": ");
+        }
+        for (double val : row) {
+            screen.append_budget(val);
+            screen.append(' ');
+        }
+        screen.append('\n');
+        screen.flush_if_full();
+    }
+}
+
+bool ConsoleMenu::is_valid_city_count(int count) {
+    return count > 0 && count <= manager.city_limit() - static_cast<int>(manager.city_count());
+}
+
+bool ConsoleMenu::is_valid_index(int index) {
+    return index >= 1 && index <= static_cast<int>(manager.city_count());
+}
+
+void ConsoleMenu::add_cities() {
+    if (static_cast<int>(manager.city_count()) >= manager.city_limit()) {
+        cout << "Error: The limit of " << manager.city_limit() << " cities is reached.\n";
+        return;
+    }
+    int k;
+    while (true) {
+        cout << "Enter the number of cities to add: ";
+        if (cin >> k && is_valid_city_count(k)) {
+            break;
+        }
+        cout << "Error: Enter a number between 1 and " << (manager.city_limit() - static_cast<int>(manager.city_count())) << ".\n";
+        cin.clear();
+        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    }
+    cin.ignore();
+
+    for (int i = 0; i < k; i++) {
+        string name;
+        while (true) {
+            cout << "Enter name for city " << (manager.city_count() + 1) << ": ";
+            getline(cin, name);
+            ChangeStatus status = manager.add_city(name);
+            if (status == ChangeStatus::Ok) break;
+            cout << "Error: " << describe(status) << "\n";
+            if (status == ChangeStatus::CityLimitReached) {
+                cout << i << " cities added.\n";
+                return;
+            }
+        }
+    }
+    cout << k << " cities added successfully.\n";
+}
+
+void ConsoleMenu::add_road() {
+    string city1, city2;
+    while (true) {
+        cout << "Enter the name of the first city: ";
+        getline(cin, city1);
+        if (manager.find_city(city1) != -1) {
+            break;
+        }
+        report_unknown_city(city1);
+    }
+    int i = manager.find_city(city1);
+    while (true) {
+        cout << "Enter the name of the second city: ";
+        getline(cin, city2);
+        int j = manager.find_city(city2);
+        if (j == -1) {
+            report_unknown_city(city2);
+            continue;
+        }
+        ChangeStatus status = manager.add_road(i, j);
+        if (status == ChangeStatus::Ok) break;
+        cout << "Error: " << describe(status) << "\n";
+    }
+    cout << "Road added between " << city1 << " and " << city2 << ".\n";
+}
+
+void ConsoleMenu::add_budget() {
+    string city1, city2;
+    while (true) {
+        cout << "Enter the name of the first city: ";
+        getline(cin, city1);
+        if (manager.find_city(city1) != -1) break;
+        report_unknown_city(city1);
+    }
+    while (true) {
+        cout << "Enter the name of the second city: ";
+        getline(cin, city2);
+        if (manager.find_city(city2) == -1) {
+            report_unknown_city(city2);
+        } else if (!manager.road_exists(manager.find_city(city1), manager.find_city(city2))) {
+            cout << "Error: " << describe(ChangeStatus::NoSuchRoad) << "\n";
+        } else {
+            break;
+        }
+    }
+    int i = manager.find_city(city1);
+    int j = manager.find_city(city2);
+    double budget;
+    while (true) {
+        cout << "Enter the budget for the road: ";
+        ChangeStatus status = cin >> budget ? manager.set_budget(i, j, budget) : ChangeStatus::InvalidBudget;
+        if (status == ChangeStatus::Ok) break;
+        cout << "Error: " << describe(status) << "\n";
+        cin.clear();
+        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    }
+    cin.ignore();
+    cout << "Budget added for the road between " << city1 << " and " << city2 << ".\n";
+}
+
+void ConsoleMenu::remove_road() {
+    if (manager.city_count() < 2) {
+        cout << "Error: At least two cities are needed.\n";
+        return;
+    }
+    int i, j;
+    prompt_existing_road(i, j);
+    ChangeStatus status = manager.remove_road(i, j);
+    if (status != ChangeStatus::Ok) {
+        cout << "Error: " << describe(status) << "\n";
+        return;
+    }
+    cout << "Road removed between " << manager.city_name(i) << " and " << manager.city_name(j) << ".\n";
+}
+
+void ConsoleMenu::remove_city() {
+    if (manager.city_count() == 0) {
+        cout << "No cities recorded.\n";
+        return;
+    }
+    int city = prompt_existing_city("Enter the name of the city to remove: ");
+    size_t roads = manager.roads_of(city).size();
+    cout << "Remove " << manager.city_name(city) << " and its " << roads
+         << " road(s)? Every city after it moves down one index. (y/n): ";
+    string answer;
+    getline(cin, answer);
+    if (trim(answer) != "y" && trim(answer) != "Y") {
+        cout << "Nothing removed.\n";
+        return;
+    }
+    string name(manager.city_name(city));  // The city's ID is reused by the next city
+    ChangeStatus status = manager.remove_city(city);
+    if (status != ChangeStatus::Ok) {
+        cout << "Error: " << describe(status) << "\n";
+        return;
+    }
+    cout << "City " << name << " removed with " << roads << " road(s).\n";
+}
+
+void ConsoleMenu::edit_city() {
+    int index;
+    while (true) {
+        cout << "Enter the index of the city to be edited: ";
+        if (cin >> index && is_valid_index(index)) break;
+        cout << "Error: Invalid index. Enter a number between 1 and " << manager.city_count() << ".\n";
+        cin.clear();
+        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    }
+    cin.ignore();
+    index--;
+    string new_name;
+    while (true) {
+        cout << "Enter the new name of the city: ";
+        getline(cin, new_name);
+        ChangeStatus status = manager.rename_city(index, new_name);
+        if (status == ChangeStatus::Ok) break;
+        cout << "Error: " << describe(status) << "\n";
+    }
+    cout << "City edited successfully.\n";
+}
+
+void ConsoleMenu::search_city() {
+    if (manager.city_count() == 0) {
+        cout << "No cities recorded.\n";
+        return;
+    }
+    string query;
+    int index = 0;
+    while (true) {
+        cout << "Enter the index or the name (or start of the name) of the city: ";
+        getline(cin, query);
+        string_view text = trim(query);
+        if (text.empty() || !all_of(text.begin(), text.end(), [](unsigned char ch) { return isdigit(ch); })) break;
+        auto result = from_chars(text.data(), text.data() + text.size(), index);
+        if (result.ec == errc() && is_valid_index(index)) break;
+        cout << "Error: Invalid index. Enter a number between 1 and " << manager.city_count() << ".\n";
+    }
+    if (index > 0) {
+        cout << "City at index " << index << ": " << manager.city_name(index - 1) << "\n";
+        return;
+    }
+
+    string_view name = trim(query);
+    if (name.empty()) {
+        cout << "Error: Enter an index or a name.\n";
+        return;
+    }
+    int exact = manager.find_city(name);
+    if (exact != -1) cout << "City at index " << (exact + 1) << ": " << manager.city_name(exact) << "\n";
+
+    const size_t shown = 20;
+    vector<uint32_t> prefixed;
+    manager.cities_starting_with(name, shown + 1, prefixed);
+    if (exact == -1 || prefixed.size() > 1) {
+        if (!prefixed.empty()) cout << "Cities whose names start with '" << name << "':\n";
+        for (size_t k = 0; k < min(shown, prefixed.size()); k++) {
+            cout << (prefixed[k] + 1) << ": " << manager.city_name(prefixed[k]) << "\n";
+        }
+        if (prefixed.size() > shown) cout << "... and more; type more of the name to narrow the list.\n";
+    }
+    if (!prefixed.empty()) return;
+
+    vector<CitySearchIndex::Match> similar;
+    manager.cities_similar_to(name, 2, 10, similar);
+    if (similar.empty()) {
+        cout << "Error: No city matches '" << name << "'.\n";
+        return;
+    }
+    cout << "No city starts with '" << name << "'. Closest names:\n";
+    for (const auto& match : similar) cout << (match.id + 1) << ": " << manager.city_name(match.id) << "\n";
+}
+
+void ConsoleMenu::find_route_between_cities() {
+    if (manager.city_count() < 2) {
+        cout << "Error: At least two cities are needed to find a route.\n";
+        return;
+    }
+    int source = prompt_existing_city("Enter the name of the starting city: ");
+    int target;
+    while (true) {
+        target = prompt_existing_city("Enter the name of the destination city: ");
+        if (target != source) break;
+        cout << "Error: The destination must differ from the starting city.\n";
+    }
+    int mode;
+    while (true) {
+        cout << "Route by (1) lowest total budget over funded roads or (2) fewest roads: ";
+        if (cin >> mode && (mode == 1 || mode == 2)) break;
+        cout << "Error: Enter 1 or 2.\n";
+        cin.clear();
+        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    }
+    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    RouteWeight weight = mode == 1 ? RouteWeight::Budget : RouteWeight::Hops;
+
+    shared_ptr<const NetworkView> network = manager.view();
+    vector<int> path;
+    double cost = 0.0;
+    if (!network->find_route(source, target, weight, route_search, path, cost)) {
+        cout << "No " << (weight == RouteWeight::Budget ? "funded " : "") << "route exists between "
+             << network->city_name(source) << " and " << network->city_name(target) << ".\n";
+        return;
+    }
+    cout << "Route: ";
+    for (size_t k = 0; k < path.size(); k++) {
+        cout << (k > 0 ? " -> " : "") << network->city_name(path[k]);
+    }
+    cout << "\n" << (path.size() - 1) << " road(s)";
+    if (weight == RouteWeight::Budget) {
+        cout << ", total budget " << fixed << setprecision(1) << cost << " billion RWF";
+    }
+    cout << ".\n";
+}
+
+void ConsoleMenu::plan_road_network() {
+    if (manager.city_count() == 0) {
+        cout << "No cities recorded.\n";
+        return;
+    }
+    shared_ptr<const NetworkView> network = manager.view();
+    NetworkPlan& plan = network_plan;
+    network->plan_minimum_network(plan);
+    int unfunded = static_cast<int>(network->road_count() - plan.candidates.size());
+    cout << "Minimum-budget network: " << plan.selected_count << " road(s), total budget "
+         << fixed << setprecision(1) << plan.total_budget << " billion RWF.\n";
+    if (plan.components.count() > 1) {
+        cout << "The funded roads leave the cities in " << plan.components.count()
+             << " separate groups; the plan connects each group on its own.\n";
+    }
+    if (unfunded > 0) {
+        cout << unfunded << " road(s) without a budget were not considered.\n";
+    }
+
+    int redundant = static_cast<int>(plan.candidates.size()) - plan.selected_count;
+    if (redundant == 0) {
+        cout << "No funded road is redundant.\n";
+        return;
+    }
+    cout << "Redundant funded roads (" << redundant << "):\n";
+    for (int r = 0; r < static_cast<int>(network->road_slots()); r++) {
+        const Road& road = network->road(r);
+        if (network->budget(r) > 0.0 && !plan.selected[r]) {
+            cout << road.nbr << "\t" << network->city_name(road.city1) << " - " << network->city_name(road.city2)
+                 << "\t" << network->budget(r) << "\n";
+        }
+    }
+}
+
+void ConsoleMenu::analyze_connectivity() {
+    if (manager.city_count() == 0) {
+        cout << "No cities recorded.\n";
+        return;
+    }
+    shared_ptr<const NetworkView> network = manager.view();
+    size_t n = network->city_count();
+    if (network->is_connected()) {
+        cout << "The road network connects all " << n << " cities.\n";
+    } else {
+        // List the groups of connected cities in order of their first city
+        vector<int> group_of;
+        vector<vector<int>> groups(network->label_components(group_of));
+        for (size_t c = 0; c < n; c++) groups[group_of[c]].push_back(static_cast<int>(c));
+        cout << "The road network is split into " << groups.size() << " groups:\n";
+        for (size_t g = 0; g < groups.size(); g++) {
+            cout << (g + 1) << ": ";
+            for (size_t k = 0; k < groups[g].size(); k++) {
+                cout << (k > 0 ? ", " : "") << network->city_name(groups[g][k]);
+            }
+            cout << "\n";
+        }
+    }
+
+    ConnectivityScan& scan = connectivity_scan;
+    network->scan_bridges_and_articulations(scan);
+    if (scan.bridges.empty()) {
+        cout << "No single road closure would split the network.\n";
+    } else {
+        cout << "Roads whose closure would split the network (" << scan.bridges.size() << "):\n";
+        for (int r : scan.bridges) {
+            const Road& road = network->road(r);
+            cout << road.nbr << "\t" << network->city_name(road.city1) << " - " << network->city_name(road.city2) << "\n";
+        }
+    }
+    vector<int> critical_cities;
+    for (size_t c = 0; c < n; c++) {
+        if (scan.articulation[c]) critical_cities.push_back(static_cast<int>(c));
+    }
+    if (critical_cities.empty()) {
+        cout << "No single city closure would split the network.\n";
+    } else {
+        cout << "Cities whose closure would split the network (" << critical_cities.size() << "):\n";
+        for (int c : critical_cities) cout << (c + 1) << ": " << network->city_name(c) << "\n";
+    }
+}
+
+void ConsoleMenu::import_road_inventory() {
+    string path;
+    cout << "Enter the path of the CSV or GeoJSON file to import: ";
+    getline(cin, path);
+    manager.import_road_file(string(trim(path)));
+}
+
+void ConsoleMenu::compare_city_neighbors() {
+    if (manager.city_count() < 2) {
+        cout << "Error: At least two cities are needed to compare neighbours.\n";
+        return;
+    }
+    int a = prompt_existing_city("Enter the name of the first city: ");
+    int b;
+    while (true) {
+        b = prompt_existing_city("Enter the name of the second city: ");
+        if (b != a) break;
+        cout << "Error: Enter two different cities.\n";
+    }
+    vector<int> common;
+    size_t two_hop_count;
+    manager.neighbor_overlap(a, b, common, two_hop_count);
+    if (common.empty()) {
+        cout << manager.city_name(a) << " and " << manager.city_name(b) << " share no neighbouring city.\n";
+    } else {
+        cout << manager.city_name(a) << " and " << manager.city_name(b) << " share " << common.size() << " neighbouring city(ies): ";
+        for (size_t k = 0; k < common.size(); k++) cout << (k > 0 ? ", " : "") << manager.city_name(common[k]);
+        cout << "\n";
+    }
+    cout << manager.city_name(a) << " reaches " << two_hop_count << " city(ies) within two roads.\n";
+}
+
+void ConsoleMenu::display_budget_report() {
+    const vector<Road>& roads = manager.roads();
+    const vector<double>& budgets = manager.budgets();
+    size_t road_count = manager.road_count();
+    if (road_count == 0) {
+        cout << "No roads recorded.\n";
+        return;
+    }
+    // Tombstones of removed roads hold a budget of 0, so they add nothing to the summary
+    BudgetSummary summary = summarize_budgets(budgets.data(), budgets.size());
+    cout << fixed << setprecision(1)
+         << "Roads: " << road_count << " (" << summary.funded << " funded, "
+         << road_count - summary.funded << " without a budget)\n"
+         << "Total budget: " << summary.total << " billion RWF\n";
+    if (summary.funded == 0) return;
+    cout << "Smallest funded budget: " << summary.min << "\n"
+         << "Largest funded budget: " << summary.max << "\n"
+         << "Mean funded budget: " << summary.total / static_cast<double>(summary.funded) << "\n";
+
+    const double limits[] = {0.0, 1.0, 5.0, 10.0, 50.0, 100.0, 500.0};
+    const size_t limit_count = size(limits);
+    size_t above[limit_count];
+    count_budgets_above(budgets.data(), budgets.size(), limits, limit_count, above);
+    cout << "\nFunded roads by budget (billion RWF):\n";
+    for (size_t k = 0; k < limit_count; k++) {
+        size_t in_range = above[k] - (k + 1 < limit_count ? above[k + 1] : 0);
+        ostringstream label;
+        label << fixed << setprecision(0) << limits[k];
+        if (k + 1 < limit_count) label << " - " << limits[k + 1];
+        else label << "+";
+        size_t bar = (in_range * 40 + summary.funded - 1) / summary.funded;
+        cout << left << setw(12) << label.str() << right << setw(8) << in_range << "  " << string(bar, '#') << "\n";
+    }
+
+    // Each road's budget counts towards both of its cities
+    vector<double> city_totals(manager.city_count(), 0.0);
+    for (size_t r = 0; r < roads.size(); r++) {
+        if (roads[r].removed()) continue;
+        city_totals[roads[r].city1] += budgets[r];
+        city_totals[roads[r].city2] += budgets[r];
+    }
+    vector<int> ranked(manager.city_count());
+    for (size_t i = 0; i < ranked.size(); i++) ranked[i] = static_cast<int>(i);
+    size_t shown = min<size_t>(10, ranked.size());
+    partial_sort(ranked.begin(), ranked.begin() + shown, ranked.end(),
+                 [&](int a, int b) { return city_totals[a] > city_totals[b] || (city_totals[a] == city_totals[b] && a < b); });
+    cout << "\nCities with the largest road budgets:\n";
+    for (size_t k = 0; k < shown && city_totals[ranked[k]] > 0.0; k++) {
+        cout << (ranked[k] + 1) << ": " << manager.city_name(ranked[k]) << "\t" << city_totals[ranked[k]] << "\n";
+    }
+}
+
+void ConsoleMenu::export_route_cost_table() {
+    shared_ptr<const NetworkView> view = manager.view();
+    if (view->city_count() == 0) {
+        cout << "No cities recorded.\n";
+        return;
+    }
+    if (view->city_count() > static_cast<size_t>(MAX_ROUTE_TABLE_CITIES)) {
+        cout << "Error: The route cost table is limited to " << MAX_ROUTE_TABLE_CITIES << " cities.\n";
+        return;
+    }
+    string path;
+    cout << "Enter the file to write the route cost table to: ";
+    getline(cin, path);
+    path = string(trim(path));
+    if (path.empty()) {
+        cout << "Error: No file name given.\n";
+        return;
+    }
+
+    RouteCostTable table;
+    auto started = chrono::steady_clock::now();
+    view->compute_route_costs(table);
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - started;
+    size_t n = table.city_count, connected = 0;
+    for (size_t i = 0; i < n; i++) {
+        for (size_t j = i + 1; j < n; j++) connected += table.cost(static_cast<int>(i), static_cast<int>(j)) != HUGE_VAL;
+    }
+    ios::fmtflags flags = cout.flags();
+    streamsize precision = cout.precision();
+    cout << "Route costs between " << n << " cities computed by "
+         << (table.method == RouteTableMethod::FloydWarshall ? "tiled Floyd-Warshall" : "Dijkstra from every city")
+         << " on " << table.threads << " thread(s) in " << fixed << setprecision(3) << elapsed.count() << " s.\n"
+         << connected << " of " << n * (n - 1) / 2 << " city pairs are joined by funded roads.\n";
+    cout.flags(flags);
+    cout.precision(precision);
+    if (!save_route_cost_table(table, path)) {
+        cout << "Error: Cannot write '" << path << "'.\n";
+        return;
+    }
+    cout << "Route cost table written to '" << path << "' (" << n << " x " << n << " doubles, rows and columns by city index).\n";
+}
+
+void ConsoleMenu::display_statistics() {
+    vector<ProbeSummary> summaries = collect_statistics();
+    if (summaries.empty()) {
+        cout << "No operations recorded.\n";
+        return;
+    }
+    ios::fmtflags flags = cout.flags();
+    streamsize precision = cout.precision();
+    auto ms = [](double ns) { return ns / 1e6; };
+    cout << "Times in milliseconds; menu entries include the time spent at their prompts.\n"
+         << left << setw(26) << "Operation" << right << setw(10) << "Calls" << setw(10) << "Timed"
+         << setw(12) << "Mean" << setw(12) << "p50" << setw(12) << "p99" << setw(12) << "Max"
+         << setw(12) << "Last" << setw(14) << "Last bytes" << setw(16) << "Total bytes" << "\n"
+         << fixed << setprecision(3);
+    for (const auto& s : summaries) {
+        cout << left << setw(26) << s.name << right << setw(10) << s.calls << setw(10) << s.timed_calls
+             << setw(12) << ms(s.mean_ns()) << setw(12) << ms(static_cast<double>(s.percentile_ns(0.5)))
+             << setw(12) << ms(static_cast<double>(s.percentile_ns(0.99))) << setw(12) << ms(static_cast<double>(s.max_ns))
+             << setw(12) << ms(static_cast<double>(s.last_ns)) << setw(14) << s.last_bytes << setw(16) << s.total_bytes << "\n";
+    }
+    cout.flags(flags);
+    cout.precision(precision);
+}
+
+void ConsoleMenu::display_cities() {
+    if (manager.city_count() == 0) {
+        cout << "No cities recorded.\n";
+        return;
+    }
+    screen.append("Cities:\n");
+    for (size_t i = 0; i < manager.city_count(); i++) {
+        screen.append_int(static_cast<long long>(i + 1));
+        screen.append(": ");
+        screen.append(manager.city_name(i));
+        screen.append('\n');
+        screen.flush_if_full();
+    }
+    screen.flush();
+}
+
+void ConsoleMenu::print_roads_matrix() {
+    if (manager.city_count() > 0) render_roads_rows(0, manager.city_count() - 1, false);
+    screen.flush();
+}
+
+void ConsoleMenu::print_budgets_matrix() {
+    if (manager.city_count() > 0) render_budget_rows(0, manager.city_count() - 1, false);
+    screen.flush();
+}
+
+void ConsoleMenu::manage_changes() {
+    if (manager.in_transaction()) {
+        cout << "A transaction is open with " << manager.transaction_size() << " change(s).\n";
+    }
+    cout << manager.undo_steps_available() << " step(s) can be undone and " << manager.redo_steps_available()
+         << " redone.\n"
+         << "1. Begin a transaction\n"
+         << "2. Commit the transaction\n"
+         << "3. Roll back the transaction\n"
+         << "4. Undo the latest step\n"
+         << "5. Redo the latest undone step\n"
+         << "6. Back to the menu\n";
+    int action = prompt_number("Enter your choice: ", 1, 6);
+    size_t changes = manager.transaction_size();
+    switch (action) {
+        case 1:
+            if (manager.begin_transaction()) cout << "Transaction started; its changes are saved when it is committed.\n";
+            else cout << "Error: A transaction is already open.\n";
+            break;
+        case 2:
+            if (manager.commit_transaction()) cout << "Transaction committed with " << changes << " change(s).\n";
+            else cout << "Error: No transaction is open.\n";
+            break;
+        case 3:
+            if (manager.rollback_transaction()) cout << "Transaction rolled back; " << changes << " change(s) taken back.\n";
+            else cout << "Error: No transaction is open.\n";
+            break;
+        case 4:
+        case 5:
+            if (manager.in_transaction()) {
+                cout << "Error: Commit or roll back the open transaction first.\n";
+                break;
+            }
+            changes = action == 4 ? manager.undo() : manager.redo();
+            if (changes == 0) cout << "Nothing to " << (action == 4 ? "undo" : "redo") << ".\n";
+            else cout << (action == 4 ? "Undid " : "Redid ") << changes << " change(s).\n";
+            break;
+        default:
+            break;
+    }
+}
+
+void ConsoleMenu::budget_history() {
+    if (manager.road_count() == 0) {
+        cout << "No roads recorded.\n";
+        return;
+    }
+    int current_year = current_fiscal_year();
+    vector<int> years = manager.budget_history_years();
+    cout << "The current fiscal year is FY" << current_year << " (July " << current_year - 1 << " to June " << current_year
+         << ").\n";
+    if (years.empty()) {
+        cout << "No budget history recorded yet.\n";
+    } else {
+        cout << "Fiscal years with budget history:";
+        for (int year : years) cout << " FY" << year;
+        cout << "\n";
+    }
+    cout << "1. Record a road's budget for a fiscal year\n"
+         << "2. Compare a city's road budgets between two fiscal years\n"
+         << "3. Show a road's budget in each fiscal year\n"
+         << "4. Back to the menu\n";
+    int action = prompt_number("Enter your choice: ", 1, 4);
+    if (action == 4) return;
+    cout << fixed << setprecision(1);
+    if (action == 1) {
+        int i, j;
+        prompt_existing_road(i, j);
+        int year = prompt_number("Enter the fiscal year (FY2025 is July 2024 to June 2025): ", MIN_FISCAL_YEAR,
+                                 MAX_FISCAL_YEAR);
+        double budget;
+        while (true) {
+            cout << "Enter the budget for the road: ";
+            ChangeStatus status =
+                cin >> budget ? manager.set_budget_for_year(i, j, year, budget) : ChangeStatus::InvalidBudget;
+            if (status == ChangeStatus::Ok) break;
+            cout << "Error: " << describe(status) << "\n";
+            cin.clear();
+            cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        }
+        cin.ignore();
+        cout << "FY" << year << " budget recorded for the road between " << manager.city_name(i) << " and "
+             << manager.city_name(j) << (year == current_year ? "; it is also the road's current budget.\n" : ".\n");
+    } else if (action == 2) {
+        int city = prompt_existing_city("Enter the name of the city: ");
+        int first = prompt_number("Enter the earlier fiscal year: ", MIN_FISCAL_YEAR, MAX_FISCAL_YEAR);
+        int second = prompt_number("Enter the later fiscal year: ", MIN_FISCAL_YEAR, MAX_FISCAL_YEAR);
+        size_t roads = manager.roads_of(city).size();
+        BudgetSummary before = manager.city_budgets_in_year(city, first);
+        BudgetSummary after = manager.city_budgets_in_year(city, second);
+        cout << "Roads at " << manager.city_name(city) << ": " << roads << "\n";
+        for (auto [year, summary] : {pair{first, before}, pair{second, after}}) {
+            cout << "FY" << year << ": " << summary.total << " billion RWF over " << summary.funded << " funded road(s)\n";
+        }
+        double change = after.total - before.total;
+        cout << "Change: " << showpos << change << noshowpos << " billion RWF";
+        if (before.total > 0.0) cout << " (" << showpos << 100.0 * change / before.total << noshowpos << "%)";
+        cout << "\n";
+    } else {
+        int i, j;
+        prompt_existing_road(i, j);
+        bool found = false;
+        for (int year : years) {
+            double budget;
+            if (!manager.budget_in_year(i, j, year, budget)) continue;
+            cout << "FY" << year << ": " << budget << "\n";
+            found = true;
+        }
+        if (!found) cout << "No budget history recorded for that road.\n";
+    }
+}
+
+void ConsoleMenu::manage_locations() {
+    if (manager.city_count() == 0) {
+        cout << "No cities recorded.\n";
+        return;
+    }
+    shared_ptr<const NetworkView> network = manager.view();
+    size_t located = 0;
+    for (size_t c = 0; c < network->city_count(); c++) located += network->city_location(static_cast<int>(c)).known();
+    cout << located << " of " << network->city_count() << " cities have a location.\n"
+         << "1. Set a city's location\n"
+         << "2. List the cities nearest to a city\n"
+         << "3. List the cities within a distance of a city\n"
+         << "4. Propose roads between nearby cities that have none\n"
+         << "5. Choose which proposed roads to build within a budget\n"
+         << "6. Back to the menu\n";
+    int action = prompt_number("Enter your choice: ", 1, 6);
+    if (action == 6) return;
+    if (action == 5) {
+        plan_road_investment(*network);
+        return;
+    }
+    cout << fixed << setprecision(1);
+    if (action == 1) {
+        int city = prompt_existing_city("Enter the name of the city: ");
+        double latitude = prompt_decimal("Enter the latitude in degrees (south is negative): ", -90.0, 90.0);
+        double longitude = prompt_decimal("Enter the longitude in degrees (west is negative): ", -180.0, 180.0);
+        ChangeStatus status = manager.set_location(city, latitude, longitude);
+        if (status != ChangeStatus::Ok) {
+            cout << "Error: " << describe(status) << "\n";
+            return;
+        }
+        cout << "Location set for " << manager.city_name(city) << ".\n";
+        return;
+    }
+    if (action == 4) {
+        double max_km = prompt_decimal("Enter the longest road to propose in km: ", 0.0, 20000.0);
+        int limit = prompt_number("Enter how many roads to propose: ", 1, 1000);
+        vector<RoadProposal> proposals;
+        network->propose_roads(max_km, static_cast<size_t>(limit), proposals);
+        if (proposals.empty()) {
+            cout << "No cities without a road between them lie within " << max_km << " km of each other.\n";
+            return;
+        }
+        cout << "Proposed roads, closest first (* joins cities that cannot reach each other today):\n";
+        for (const auto& proposal : proposals) {
+            cout << network->city_name(proposal.city1) << " - " << network->city_name(proposal.city2) << "\t"
+                 << proposal.km << " km" << (proposal.joins_groups ? " *" : "") << "\n";
+        }
+        return;
+    }
+    int city = prompt_existing_city("Enter the name of the city: ");
+    if (!network->city_location(city).known()) {
+        cout << "Error: " << network->city_name(city) << " has no location.\n";
+        return;
+    }
+    vector<CityDistance> found;
+    if (action == 2) {
+        int count = prompt_number("Enter how many cities to list: ", 1, 1000);
+        network->nearest_cities(city, static_cast<size_t>(count), found);
+    } else {
+        double radius_km = prompt_decimal("Enter the distance in km: ", 0.0, 20000.0);
+        network->cities_within(city, radius_km, found);
+    }
+    if (found.empty()) {
+        cout << "No other city with a location is near enough.\n";
+        return;
+    }
+    for (const auto& [other, km] : found) {
+        cout << (other + 1) << ": " << network->city_name(other) << "\t" << km << " km"
+             << (manager.road_exists(city, other) ? " (road)" : "") << "\n";
+    }
+}
+
+void ConsoleMenu::plan_road_investment(const NetworkView& network) {
+    if (network.is_connected()) {
+        cout << "Every city can already reach every other by road.\n";
+        return;
+    }
+    cout << fixed << setprecision(1);
+    double max_km = prompt_decimal("Enter the longest new road to consider in km: ", 0.0, 20000.0);
+    int limit = prompt_number("Enter how many candidate roads to consider: ", 1, static_cast<int>(MAX_INVESTMENT_CANDIDATES));
+    double per_km, typical = typical_cost_per_km(network);
+    if (typical > 0.0) {
+        cout << "Funded roads between located cities cost a median of " << setprecision(3) << typical
+             << setprecision(1) << " billion RWF per km.\n";
+        per_km = prompt_decimal("Enter the cost per km of a new road in billion RWF (0 for the median): ", 0.0, 1000.0);
+        if (per_km == 0.0) per_km = typical;
+    } else {
+        per_km = prompt_decimal("Enter the cost per km of a new road in billion RWF: ", 0.001, 1000.0);
+    }
+    vector<RoadCandidate> candidates;
+    propose_investments(network, max_km, static_cast<size_t>(limit), per_km, candidates);
+    if (candidates.empty()) {
+        cout << "No two cities that cannot reach each other lie within " << max_km << " km of each other.\n";
+        return;
+    }
+
+    InvestmentOptions options;
+    options.budget_cap = prompt_decimal("Enter the total budget available in billion RWF: ", 0.0, 1e9);
+    int goal = prompt_number("Connect the most (1) pairs of cities or (2) cities to one city: ", 1, 2);
+    if (goal == 2) {
+        options.goal = InvestmentGoal::CitiesReached;
+        options.hub = prompt_existing_city("Enter the name of the city to reach: ");
+    }
+    options.time_limit = chrono::seconds(prompt_number("Enter the longest time to search in seconds: ", 1, 3600));
+    InvestmentPlan plan;
+    optimize_investment(network, candidates, options, plan);
+
+    if (plan.chosen.empty()) {
+        cout << "No candidate road within the budget connects more cities.\n";
+    } else {
+        cout << "Build " << plan.chosen.size() << " road(s) for " << plan.cost << " billion RWF:\n";
+        for (int k : plan.chosen) {
+            const RoadCandidate& road = candidates[k];
+            double km = great_circle_km(network.city_location(road.city1), network.city_location(road.city2));
+            cout << network.city_name(road.city1) << " - " << network.city_name(road.city2) << "\t" << km << " km\t"
+                 << road.cost << " billion RWF\n";
+        }
+    }
+    if (goal == 1) cout << "Pairs of cities that can reach each other: ";
+    else cout << "Cities that can reach " << network.city_name(options.hub) << ": ";
+    cout << plan.value_before << " now, " << plan.value << " with these roads.\n"
+         << (plan.optimal ? "No plan within the budget does better.\n"
+                          : "The search ran out of time, so a better plan may exist.\n")
+         << "Explored " << plan.nodes << " branch(es) on " << plan.threads << " thread(s).\n";
+}
+
+void ConsoleMenu::browse_recorded_data() {
+    if (manager.city_count() == 0) {
+        cout << "No data recorded.\n";
+        return;
+    }
+    cout << "1. Matrix rows in a range\n"
+         << "2. Cities whose names contain some text\n"
+         << "3. Road list\n";
+    int view = prompt_number("Enter your choice: ", 1, 3);
+    int count = static_cast<int>(manager.city_count());
+
+    if (view == 1) {
+        int first = prompt_number("Enter the index of the first row: ", 1, count);
+        int last = prompt_number("Enter the index of the last row: ", first, count);
+        screen.append("Roads Adjacency Matrix, rows ");
+        screen.append_int(first);
+        screen.append(" to ");
+        screen.append_int(last);
+        screen.append(":\n");
+        render_roads_rows(first - 1, last - 1, true);
+        screen.append("\nBudgets Adjacency Matrix, rows ");
+        screen.append_int(first);
+        screen.append(" to ");
+        screen.append_int(last);
+        screen.append(":\n");
+        render_budget_rows(first - 1, last - 1, true);
+        screen.flush();
+        return;
+    }
+
+    string filter;
+    cout << (view == 2 ? "Enter the text to look for: " : "Show roads of cities containing (leave empty for all): ");
+    getline(cin, filter);
+    string_view wanted = trim(filter);
+    size_t shown = 0;
+
+    if (view == 2) {
+        for (int i = 0; i < count; i++) {
+            if (!matches_filter(manager.city_name(i), wanted)) continue;
+            if (shown > 0 && shown % PAGE_LINES == 0 && !continue_paging()) return;
+            screen.append_int(i + 1);
+            screen.append(": ");
+            screen.append(manager.city_name(i));
+            screen.append(" (");
+            screen.append_int(static_cast<long long>(manager.roads_of(i).size()));
+            screen.append(" road(s))\n");
+            shown++;
+        }
+        if (shown == 0) screen.append("No city matches.\n");
+        screen.flush();
+        return;
+    }
+
+    screen.append("Nbr\tRoad\t\t\tBudget\n");
+    for (size_t r = 0; r < manager.roads().size(); r++) {
+        const Road& road = manager.roads()[r];
+        if (road.removed()) continue;
+        if (!matches_filter(manager.city_name(road.city1), wanted) && !matches_filter(manager.city_name(road.city2), wanted)) continue;
+        if (shown > 0 && shown % PAGE_LINES == 0 && !continue_paging()) return;
+        screen.append_int(road.nbr);
+        screen.append('\t');
+        screen.append(manager.city_name(road.city1));
+        screen.append(" - ");
+        screen.append(manager.city_name(road.city2));
+        screen.append('\t');
+        screen.append_budget(manager.budgets()[r]);
+        screen.append('\n');
+        shown++;
+    }
+    if (shown == 0) screen.append("No road matches.\n");
+    screen.flush();
+}
+
+void ConsoleMenu::display_roads() {
+    if (manager.city_count() == 0) {
+        cout << "No roads recorded.\n";
+        return;
+    }
+    display_cities();
+    cout << "\nRoads Adjacency Matrix:\n";
+    print_roads_matrix();
+}
+
+void ConsoleMenu::display_recorded_data() {
+    if (manager.city_count() == 0) {
+        cout << "No data recorded.\n";
+        return;
+    }
+    display_cities();
+    cout << "\nRoads Adjacency Matrix:\n";
+    print_roads_matrix();
+    cout << "\nBudgets Adjacency Matrix:\n";
+    print_budgets_matrix();
+}
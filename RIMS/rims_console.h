@@ -0,0 +1,175 @@
+/*
+ * Interactive console of the Rwanda Infrastructure Management System: the menu actions that
+ * prompt for input, call the InfrastructureManager API and format the results.
+ */
+#pragma once
+
+#include <iostream>   // For input and output
+#include <charconv>   // For number formatting in bulk output
+#include <cstdio>     // For writing bulk output
+#include "rims_core.h" // The city and road network and its persistence
+
+// Reusable buffer for bulk console output. Numbers are formatted with to_chars rather than one
+// iostream call per value, and the text reaches the terminal in large single writes.
+class OutputBuffer {
+    static constexpr size_t FLUSH_SIZE = size_t(4) << 20; // Bytes gathered before a write
+    std::string text;
+
+public:
+    void append(std::string_view part) { text.append(part); }
+    void append(char c) { text.push_back(c); }
+
+    void append_int(long long value) {
+        char digits[24];
+        text.append(digits, std::to_chars(digits, digits + sizeof(digits), value).ptr);
+    }
+
+    // Appends value with one decimal, as fixed << setprecision(1) formats it
+    void append_budget(double value) {
+        char digits[320];               // Room for any double in fixed notation
+        text.append(digits, std::to_chars(digits, digits + sizeof(digits), value, std::chars_format::fixed, 1).ptr);
+    }
+
+    // Writes the buffer out once it is large enough, so matrix dumps run in bounded memory
+    void flush_if_full() {
+        if (text.size() >= FLUSH_SIZE) flush();
+    }
+
+    // Writes everything buffered after whatever cout already holds
+    void flush() {
+        std::cout.flush();
+        fwrite(text.data(), 1, text.size(), stdout);
+        fflush(stdout);
+        text.clear();
+    }
+};
+
+const size_t PAGE_LINES = 40;           // Lines shown per page by the paged views
+
+// Interactive console client: prompts for input, calls the InfrastructureManager API and
+// formats the results
+class ConsoleMenu {
+private:
+    InfrastructureManager& manager;
+    OutputBuffer screen;                // Reused by the matrix and list views
+    RouteSearch route_search;           // Buffers reused across route queries
+    NetworkPlan network_plan;           // Buffers reused across network plans
+    ConnectivityScan connectivity_scan; // Buffers reused across bridge scans
+
+    // Reports a city name that matched nothing, suggesting close spellings
+    void report_unknown_city(std::string_view name);
+
+    // Prompts until the user names an existing city and returns its index
+    int prompt_existing_city(const std::string& prompt);
+
+    // Prompts until the user names two cities with a road between them
+    void prompt_existing_road(int& city1, int& city2);
+
+    // Prompts until the user enters a whole number between low and high
+    int prompt_number(const std::string& prompt, int low, int high);
+
+    // Prompts until the user enters a number between low and high
+    double prompt_decimal(const std::string& prompt, double low, double high);
+
+    // Choose which proposed roads to build within a budget cap so the network is as connected as it can be
+    void plan_road_investment(const NetworkView& network);
+
+    // Whether name contains filter, ignoring case; an empty filter matches every name
+    static bool matches_filter(std::string_view name, std::string_view filter);
+
+    // Writes out the current page and asks whether to show the next one
+    bool continue_paging();
+
+    // Appends rows first to last (0-based, inclusive) of the road adjacency matrix to screen,
+    // each prefixed with its city index when labelled
+    void render_roads_rows(size_t first, size_t last, bool labelled);
+
+    // Appends rows first to last (0-based, inclusive) of the budget adjacency matrix to screen,
+    // each prefixed with its city index when labelled
+    void render_budget_rows(size_t first, size_t last, bool labelled);
+
+    // Validates city count
+    bool is_valid_city_count(int count);
+
+    // Validates city index
+    bool is_valid_index(int index);
+
+public:
+    explicit ConsoleMenu(InfrastructureManager& manager) : manager(manager) {}
+
+    // Adding new cities
+    void add_cities();
+
+    // Add road between cities
+    void add_road();
+
+    // Add budget for a road
+    void add_budget();
+
+    // Remove the road between two cities
+    void remove_road();
+
+    // Remove a city and its roads, after confirming
+    void remove_city();
+
+    // Edit city name function
+    void edit_city();
+
+    // Search city by index or name function
+    void search_city();
+
+    // Find the cheapest or shortest route between two cities
+    void find_route_between_cities();
+
+    // Plan the minimum-budget set of roads that connects the cities
+    void plan_road_network();
+
+    // Report disconnected cities, and the roads and cities whose closure would split the network
+    void analyze_connectivity();
+
+    // Prompt for a road inventory file and import it
+    void import_road_inventory();
+
+    // Show the neighbours two cities share and how far the first city reaches in two roads
+    void compare_city_neighbors();
+
+    // Summarize the recorded budgets: totals, the spread of funded budgets, a histogram by
+    // budget range and the cities whose roads carry the most budget
+    void display_budget_report();
+
+    // Compute the cheapest funded-route cost between every pair of cities and write it to a binary file
+    void export_route_cost_table();
+
+    // Show how often the instrumented operations and menu entries ran and how long they took
+    void display_statistics();
+
+    // Begin, commit or roll back a transaction, or undo or redo the latest changes
+    void manage_changes();
+
+    // Record a road's budget for a fiscal year, compare a city's budgets between two fiscal years,
+    // or show a road's budget in every fiscal year with history
+    void budget_history();
+
+    // Give a city a location, list the cities nearest to a city or within a distance of it,
+    // propose roads between nearby cities that have none, or choose which of those to build
+    void manage_locations();
+
+    // Display cities function
+    void display_cities();
+
+    // Prints the road adjacency matrix, expanding each city's adjacency list into a row
+    void print_roads_matrix();
+
+    // Prints the budget adjacency matrix, expanding each city's adjacency list into a row
+    void print_budgets_matrix();
+
+    // Show part of the recorded data instead of the full matrices: a window of matrix rows, the
+    // cities matching a filter, or the roads as a sparse list, a page at a time
+    void browse_recorded_data();
+
+    // Display roads function
+    void display_roads();
+
+    // Display recorded data function
+    void display_recorded_data();
+};
@@ -0,0 +1,3659 @@
+#include "rims_core.h"
+
+#include <iostream>   // For input and output
+#include <unordered_set> // For roads staged by a batch
+#include <fstream>    // For saving data to files
+#include <sstream>    // For formatting file contents in memory
+#include <iomanip>    // For formatting output
+#include <limits>     // For numeric_limits
+#include <cmath>      // For HUGE_VAL in budget aggregates
+#include <numbers>    // For pi in distances on the sphere
+#include <charconv>   // For exact number formatting in log records
+#include <filesystem> // For atomically replacing snapshot files
+#include <optional>   // For timing only the compactions that save something
+#include <numeric>    // For iota when putting lazily loaded roads back in order
+#include <utility>    // For exchange
+#include <barrier>    // For the stages of the tiled Floyd-Warshall
+#ifdef __AVX2__
+#include <immintrin.h> // For vectorized row intersections and min-plus tiles
+#endif
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>  // For memory-mapping the snapshot
+#include <direct.h>   // For directory creation
+#include <io.h>       // For _commit
+#else
+#include <sys/mman.h> // For memory-mapping the snapshot
+#include <sys/stat.h> // For directory creation
+#include <fcntl.h>    // For opening the snapshot to map it
+#include <unistd.h>   // For fsync
+#endif
+
+using namespace std;
+
+// Paths of the files that make up the persisted state
+const char* const CITIES_SNAPSHOT_PATH = "data/cities.snap";
+const char* const ROADS_SNAPSHOT_PATH = "data/roads.snap";
+const char* const LEGACY_SNAPSHOT_PATH = "data/rims.snap";  // Combined snapshot of older versions, replaced by the two above
+const char* const CITIES_PATH = "data/cities.txt";
+const char* const ROADS_PATH = "data/roads.txt";
+const char* const ROADS_FILE_HEADER = "Nbr\tCity 1\tCity 2\tBudget"; // Older files name the cities instead
+const char* const LOG_PATH = "data/rims.wal";
+const char* const RETIRED_LOG_PATH = "data/rims.wal.old";   // Log being folded into the data files
+const char* const COMPACTION_MARKER_PATH = "data/compaction.commit";
+const char* const FEED_PATH = "data/changes.feed";
+const char* const FEED_POSITION_PATH = "data/changes.position"; // Last change the other data files include
+
+const uint64_t FEED_TAIL_BYTES = 64 * 1024;     // Read from the end of the feed at first to find its last line
+const uint64_t FEED_SCAN_BYTES = 64 * 1024;     // Feed reads scan forward once the search has narrowed to this
+
+// Instrumented operations, reported by the console's statistics view and --stats-json
+const Probe LOAD_PROBE("load");                         // Snapshots or text files, then the log replay
+const Probe SAVE_PROBE("save");                         // Rewriting the changed data files during compaction
+const Probe LOG_FLUSH_PROBE("log_flush");
+const Probe CITY_LOOKUP_PROBE("city_lookup", 6);
+const Probe PREFIX_SEARCH_PROBE("search_prefix");
+const Probe SIMILAR_SEARCH_PROBE("search_similar");
+const Probe ROUTE_PROBE("route");
+const Probe PLAN_PROBE("plan_network");
+const Probe CONNECTIVITY_PROBE("connectivity_scan");
+const Probe COMPONENTS_PROBE("components");
+const Probe NEAREST_PROBE("nearest_cities");
+const Probe RADIUS_PROBE("cities_within");
+const Probe PROPOSE_PROBE("propose_roads");
+const Probe BATCH_PROBE("batch");
+const Probe COMMIT_PROBE("apply_commands");
+const Probe IMPORT_PROBE("import");
+const Probe ROUTE_TABLE_PROBE("route_table");
+const Probe ROUTE_TABLE_EXPORT_PROBE("route_table_export");
+const Probe ROAD_PAGE_IN_PROBE("roads_page_in");         // One city's roads, with --lazy-roads
+const Probe ROAD_FULL_LOAD_PROBE("roads_load_all");      // Every road left in roads.snap, with --lazy-roads
+const Probe FEED_READ_PROBE("change_feed_read");
+
+// Forces a file's written contents to stable storage; returns false if they may not be there
+bool sync_file(FILE* file) {
+    #ifdef _WIN32
+        return _commit(_fileno(file)) == 0;
+    #else
+        return fsync(fileno(file)) == 0;
+    #endif
+}
+
+// Writes contents to a file and syncs it; returns false if the file cannot be written
+bool write_file_synced(const string& path, const string& contents) {
+    FILE* file = fopen(path.c_str(), "wb");
+    if (file == nullptr) return false;
+    bool written = fwrite(contents.data(), 1, contents.size(), file) == contents.size();
+    written = fflush(file) == 0 && written;
+    written = sync_file(file) && written;
+    return fclose(file) == 0 && written;
+}
+
+/*
+ * Binary snapshot layout, all integers little-endian. The cities and the roads are kept in two
+ * files so each is rewritten only when it changed; roads refer to cities by 0-based index.
+ *
+ *   data/cities.snap                        data/roads.snap
+ *     SnapshotHeader (CITIES_MAGIC)           SnapshotHeader (ROADS_MAGIC)
+ *     uint32_t name_offsets[count + 1]        SnapshotRoad roads[count], in Nbr order
+ *     char     names[...]                     RoadIndexHeader
+ *     double   locations[2 * count]           uint32_t road_offsets[cities + 1]
+ *                                             uint32_t city_roads[2 * count]
+ *
+ * name_offsets holds the start of each name in the string table, plus its end. The table holds
+ * the names back to back, zero-padded to 8 bytes. locations holds each city's latitude and
+ * longitude, NaN for a city without one; version 1 cities files have none and are still read.
+ * Every section starts on an 8-byte boundary, so a mapped file is read in place with no parsing.
+ *
+ * The index after the roads lists, city by city, the positions in roads[] of the roads touching
+ * each city, in increasing order; road_offsets holds where each city's list starts, plus its end.
+ * It lets --lazy-roads load the roads of one city without reading the others. Version 1 roads
+ * files have no index and are still read.
+ */
+const char CITIES_MAGIC[8] = {'R', 'I', 'M', 'S', 'C', 'I', 'T', 'Y'};
+const char ROADS_MAGIC[8] = {'R', 'I', 'M', 'S', 'R', 'O', 'A', 'D'};
+const uint32_t CITIES_SNAPSHOT_VERSION = 2; // Version 2 added the locations
+const uint32_t ROADS_SNAPSHOT_VERSION = 2;  // Version 2 added the per-city index
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;                     // Cities or roads in the file
+    uint64_t payload_size;              // Bytes after the header
+    uint32_t next_road_nbr;             // Roads file only, 0 in the cities file
+    uint32_t payload_checksum;          // Covers everything after the header
+    uint32_t header_checksum;           // Covers the header up to this field
+    uint32_t reserved;
+};
+
+// Header of an exported route cost table
+struct RouteTableHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t city_count;
+    uint64_t network_version;
+    uint32_t payload_checksum;          // Covers the rows after the header
+    uint32_t reserved;
+};
+
+const char ROUTE_TABLE_MAGIC[8] = {'R', 'I', 'M', 'S', 'R', 'C', 'T', '1'};
+const uint32_t ROUTE_TABLE_VERSION = 1;
+
+// Budget history segments (see BudgetHistory::format_segment)
+const char BUDGET_HISTORY_MAGIC[8] = {'R', 'I', 'M', 'S', 'B', 'H', 'S', 'T'};
+const uint32_t BUDGET_HISTORY_VERSION = 1;
+
+struct SnapshotRoad {
+    uint32_t city1, city2;
+    uint32_t nbr;
+    uint32_t reserved;
+    double budget;
+};
+
+// Start of the per-city index of a version 2 roads file
+struct RoadIndexHeader {
+    uint32_t city_count;                // Cities indexed; cities added since have no roads in the file
+    uint32_t reserved;
+};
+
+// FNV-1a checksum of a byte range
+uint32_t checksum(const void* data, size_t size, uint32_t hash = 2166136261u) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Read-only memory mapping of a whole file
+class MappedFile {
+private:
+    const char* bytes = nullptr;
+    size_t length = 0;
+    #ifdef _WIN32
+        HANDLE file = INVALID_HANDLE_VALUE;
+        HANDLE mapping = nullptr;
+    #endif
+
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        #ifdef _WIN32
+            if (bytes != nullptr) UnmapViewOfFile(bytes);
+            if (mapping != nullptr) CloseHandle(mapping);
+            if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        #else
+            if (bytes != nullptr) munmap(const_cast<char*>(bytes), length);
+        #endif
+    }
+
+    // Maps the file; returns false if it is missing, empty or cannot be mapped
+    bool open(const string& path) {
+        #ifdef _WIN32
+            file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                               FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (file == INVALID_HANDLE_VALUE) return false;
+            LARGE_INTEGER file_size;
+            if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) return false;
+            mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping == nullptr) return false;
+            bytes = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+            if (bytes == nullptr) return false;
+            length = static_cast<size_t>(file_size.QuadPart);
+        #else
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd == -1) return false;
+            struct stat info;
+            if (fstat(fd, &info) != 0 || info.st_size == 0) {
+                ::close(fd);
+                return false;
+            }
+            void* mapped = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if (mapped == MAP_FAILED) return false;
+            bytes = static_cast<const char*>(mapped);
+            length = static_cast<size_t>(info.st_size);
+        #endif
+        return true;
+    }
+
+    const char* data() const { return bytes; }
+    size_t size() const { return length; }
+};
+
+// Rounds a section size up to the 8-byte alignment used in the snapshot
+size_t align_to_8(size_t size) {
+    return (size + 7) & ~static_cast<size_t>(7);
+}
+
+// Fills in the header at the front of a snapshot whose payload follows it
+void seal_snapshot(string& contents, const char* magic, uint32_t version, size_t count, uint32_t next_nbr) {
+    SnapshotHeader header = {};
+    memcpy(header.magic, magic, sizeof(header.magic));
+    header.version = version;
+    header.count = static_cast<uint32_t>(count);
+    header.payload_size = contents.size() - sizeof(SnapshotHeader);
+    header.next_road_nbr = next_nbr;
+    header.payload_checksum = checksum(contents.data() + sizeof(SnapshotHeader), header.payload_size);
+    header.header_checksum = checksum(&header, offsetof(SnapshotHeader, header_checksum));
+    memcpy(contents.data(), &header, sizeof(header));
+}
+
+// Maps a snapshot and checks its header, size and, if check_payload, checksum; returns false,
+// after saying why and what happens instead (fallback) unless the file is simply missing, if it
+// cannot be used. Versions from 1 to max_version are accepted.
+bool open_snapshot(MappedFile& snapshot, const char* path, const char* magic, uint32_t max_version,
+                   bool check_payload, SnapshotHeader& header, const char* fallback = "loading the text files instead") {
+    if (!snapshot.open(path)) return false;
+    if (snapshot.size() < sizeof(header)) {
+        cout << "Error: " << path << " is truncated; " << fallback << ".\n";
+        return false;
+    }
+    memcpy(&header, snapshot.data(), sizeof(header));
+    if (memcmp(header.magic, magic, sizeof(header.magic)) != 0 || header.version == 0 || header.version > max_version ||
+        header.header_checksum != checksum(&header, offsetof(SnapshotHeader, header_checksum))) {
+        cout << "Error: " << path << " is not a valid snapshot; " << fallback << ".\n";
+        return false;
+    }
+    if (snapshot.size() != sizeof(header) + header.payload_size) {
+        cout << "Error: " << path << " is truncated; " << fallback << ".\n";
+        return false;
+    }
+    if (check_payload && header.payload_checksum != checksum(snapshot.data() + sizeof(header), header.payload_size)) {
+        cout << "Error: " << path << " failed its checksum; " << fallback << ".\n";
+        return false;
+    }
+    return true;
+}
+
+// Returns the size of the per-city index of a roads file
+size_t road_index_size(size_t city_count, size_t road_count) {
+    return sizeof(RoadIndexHeader) + align_to_8((city_count + 1 + 2 * road_count) * sizeof(uint32_t));
+}
+
+// Checks that a road read from roads.snap joins two different cities below city_count
+bool is_usable_snapshot_road(const SnapshotRoad& road, size_t city_count) {
+    return road.city1 < city_count && road.city2 < city_count && road.city1 != road.city2;
+}
+
+struct LazyRoadSnapshot {
+    MappedFile file;
+    const SnapshotRoad* roads = nullptr;
+    uint32_t road_count = 0;
+    uint32_t indexed_cities = 0;
+    const uint32_t* offsets = nullptr;  // City c's roads are city_roads[offsets[c]] to city_roads[offsets[c + 1]]
+    const uint32_t* city_roads = nullptr;
+    vector<char> paged_in;              // Per indexed city: set once its roads are loaded
+    bool out_of_order = false;          // A road was loaded after one with a higher Nbr
+};
+
+int fiscal_year_of(chrono::system_clock::time_point when) {
+    // Rwanda keeps Central Africa Time, UTC+2, all year
+    chrono::year_month_day date{chrono::floor<chrono::days>(when + chrono::hours(2))};
+    int year = static_cast<int>(date.year());
+    return date.month() >= chrono::July ? year + 1 : year;
+}
+
+string BudgetHistory::segment_path(int fiscal_year) {
+    return "data/budgets_fy" + to_string(fiscal_year) + ".snap";
+}
+
+void BudgetHistory::find_saved_years() {
+    error_code ec;
+    for (const auto& entry : filesystem::directory_iterator("data", ec)) {
+        string name = entry.path().filename().string();
+        int year;
+        if (name.size() != string_view("budgets_fy0000.snap").size() || name.compare(0, 10, "budgets_fy") != 0 ||
+            name.compare(14, 5, ".snap") != 0) continue;
+        auto result = from_chars(name.data() + 10, name.data() + 14, year);
+        if (result.ec == errc() && result.ptr == name.data() + 14) saved_years.push_back(year);
+    }
+    sort(saved_years.begin(), saved_years.end());
+}
+
+BudgetHistory::Segment& BudgetHistory::segment(int fiscal_year) {
+    auto [it, added] = segments.try_emplace(fiscal_year);
+    Segment& entries = it->second;
+    if (!added || !binary_search(saved_years.begin(), saved_years.end(), fiscal_year)) return entries;
+
+    string path = segment_path(fiscal_year);
+    MappedFile file;
+    SnapshotHeader header;
+    if (!open_snapshot(file, path.c_str(), BUDGET_HISTORY_MAGIC, BUDGET_HISTORY_VERSION, true, header,
+                       "its budget history is left out")) return entries;
+    size_t count = header.count;
+    size_t nbrs_size = align_to_8(count * sizeof(uint32_t));
+    if (header.next_road_nbr != static_cast<uint32_t>(fiscal_year) ||
+        header.payload_size != nbrs_size + count * sizeof(double)) {
+        cout << "Error: " << path << " does not hold a budget history of FY" << fiscal_year
+             << "; its budget history is left out.\n";
+        return entries;
+    }
+    const char* columns = file.data() + sizeof(SnapshotHeader);
+    entries.nbrs.resize(count);
+    entries.amounts.resize(count);
+    memcpy(entries.nbrs.data(), columns, count * sizeof(uint32_t));
+    memcpy(entries.amounts.data(), columns + nbrs_size, count * sizeof(double));
+    return entries;
+}
+
+bool BudgetHistory::latest(int fiscal_year, int nbr, double& amount) {
+    const Segment& entries = segment(fiscal_year);
+    for (size_t k = entries.nbrs.size(); k-- > 0;) {
+        if (entries.nbrs[k] == static_cast<uint32_t>(nbr)) {
+            amount = entries.amounts[k];
+            return true;
+        }
+    }
+    return false;
+}
+
+void BudgetHistory::latest_of(int fiscal_year, const vector<int>& nbrs, vector<double>& amounts) {
+    amounts.assign(nbrs.size(), 0.0);
+    if (nbrs.empty()) return;
+    // Position of each wanted Nbr in nbrs, so the scan tests an entry with one array read
+    vector<int> wanted(static_cast<size_t>(*max_element(nbrs.begin(), nbrs.end())) + 1, -1);
+    for (size_t k = 0; k < nbrs.size(); k++) wanted[nbrs[k]] = static_cast<int>(k);
+    const Segment& entries = segment(fiscal_year);
+    const uint32_t* entry_nbrs = entries.nbrs.data();
+    const double* entry_amounts = entries.amounts.data();
+    for (size_t e = 0; e < entries.nbrs.size(); e++) {
+        uint32_t nbr = entry_nbrs[e];
+        if (nbr < wanted.size() && wanted[nbr] != -1) amounts[wanted[nbr]] = entry_amounts[e];
+    }
+}
+
+vector<int> BudgetHistory::years() const {
+    vector<int> found = saved_years;
+    for (const auto& [year, entries] : segments) {
+        if (!entries.nbrs.empty()) found.push_back(year);
+    }
+    sort(found.begin(), found.end());
+    found.erase(unique(found.begin(), found.end()), found.end());
+    return found;
+}
+
+vector<int> BudgetHistory::changed_years() const {
+    vector<int> found;
+    for (const auto& [year, entries] : segments) {
+        if (entries.changed) found.push_back(year);
+    }
+    return found;
+}
+
+string BudgetHistory::format_segment(int fiscal_year) {
+    Segment& entries = segments[fiscal_year];
+    size_t count = entries.nbrs.size();
+    size_t nbrs_size = align_to_8(count * sizeof(uint32_t));
+    string contents(sizeof(SnapshotHeader) + nbrs_size + count * sizeof(double), '\0');
+    char* columns = contents.data() + sizeof(SnapshotHeader);
+    memcpy(columns, entries.nbrs.data(), count * sizeof(uint32_t));
+    memcpy(columns + nbrs_size, entries.amounts.data(), count * sizeof(double));
+    seal_snapshot(contents, BUDGET_HISTORY_MAGIC, BUDGET_HISTORY_VERSION, count, static_cast<uint32_t>(fiscal_year));
+    entries.changed = false;
+    if (!binary_search(saved_years.begin(), saved_years.end(), fiscal_year)) {
+        saved_years.insert(upper_bound(saved_years.begin(), saved_years.end(), fiscal_year), fiscal_year);
+    }
+    return contents;
+}
+
+// Parses a whole field as a sequence number
+static bool parse_sequence(string_view field, uint64_t& sequence) {
+    auto [ptr, ec] = from_chars(field.data(), field.data() + field.size(), sequence);
+    return ec == errc() && ptr == field.data() + field.size();
+}
+
+// Splits a change feed line into its sequence number and record; returns false if it is not one
+static bool parse_feed_line(string_view line, uint64_t& sequence, string_view& record) {
+    size_t tab = line.find('\t');
+    if (tab == string_view::npos || !parse_sequence(line.substr(0, tab), sequence)) return false;
+    record = line.substr(tab + 1);
+    return true;
+}
+
+bool ChangeFeed::open(const string& feed_path) {
+    path = feed_path;
+    uint64_t first_found = 0, last_found = 0, complete = 0;
+    ifstream existing(path, ios::binary);
+    if (existing.is_open()) {
+        existing.seekg(0, ios::end);
+        uint64_t size = static_cast<uint64_t>(existing.tellg());
+        uint64_t sequence;
+        string_view record;
+        string line;
+        existing.seekg(0);
+        if (getline(existing, line) && !existing.eof() && parse_feed_line(line, sequence, record)) first_found = sequence;
+        // Read back from the end, further each time, until the chunk holds the last whole line
+        for (uint64_t tail = min(size, FEED_TAIL_BYTES); tail > 0; tail = min(size, tail * 2)) {
+            string chunk(tail, '\0');
+            existing.clear();
+            existing.seekg(static_cast<streamoff>(size - tail));
+            existing.read(chunk.data(), static_cast<streamsize>(tail));
+            size_t end = chunk.rfind('\n');
+            if (end != string::npos) {
+                complete = size - tail + end + 1;
+                size_t start = end == 0 ? string::npos : chunk.rfind('\n', end - 1);
+                if (start != string::npos || tail == size) {
+                    start = start == string::npos ? 0 : start + 1;
+                    if (parse_feed_line(string_view(chunk).substr(start, end - start), sequence, record)) last_found = sequence;
+                    break;
+                }
+            }
+            if (tail == size) break;
+        }
+        existing.close();
+        if (complete < size) {
+            error_code ec;
+            filesystem::resize_file(path, complete, ec);
+        }
+    }
+    first.store(last_found == 0 ? 0 : first_found, memory_order_release);
+    last.store(last_found, memory_order_release);
+    complete_size.store(complete, memory_order_release);
+    file = fopen(path.c_str(), "ab");
+    return file != nullptr;
+}
+
+void ChangeFeed::write_change(uint64_t sequence, string_view record) {
+    pending.append(to_string(sequence));
+    pending.push_back('\t');
+    pending.append(record);
+    pending.push_back('\n');
+    pending_last = sequence;
+}
+
+void ChangeFeed::finish_write() {
+    if (pending.empty() || file == nullptr) return;
+    if (fwrite(pending.data(), 1, pending.size(), file) != pending.size() || fflush(file) != 0) {
+        cout << "Error: Cannot write to " << path << ".\n";
+        // Cut off whatever part got out and keep the lines for the next write, so later changes
+        // never land after a torn line or ahead of the ones missing
+        fclose(file);
+        error_code ec;
+        filesystem::resize_file(path, complete_size.load(memory_order_relaxed), ec);
+        file = fopen(path.c_str(), "ab");
+        return;
+    }
+    // Readers take the size with acquire, so the numbers are in place before the lines show
+    if (last.load(memory_order_relaxed) == 0) first.store(pending_first, memory_order_release);
+    last.store(pending_last, memory_order_release);
+    complete_size.fetch_add(pending.size(), memory_order_release);
+    pending.clear();
+}
+
+void ChangeFeed::append_group(string_view records, uint64_t sequence) {
+    if (file == nullptr) return;
+    if (pending.empty()) pending_first = sequence;
+    while (!records.empty()) {
+        size_t end = records.find('\n');
+        string_view record = records.substr(0, end);
+        records.remove_prefix(min(end + 1, records.size()));
+        if (record.starts_with("T\t") || record.starts_with("S\t")) continue;
+        write_change(sequence++, record);
+    }
+    finish_write();
+}
+
+void ChangeFeed::recover(uint64_t sequence, string_view record) {
+    if (file == nullptr || sequence <= last.load(memory_order_relaxed)) return;
+    if (!pending.empty() && sequence <= pending_last) return;
+    if (pending.empty()) pending_first = sequence;
+    write_change(sequence, record);
+    finish_write();
+}
+
+bool ChangeFeed::sync() {
+    finish_write();
+    bool synced = file == nullptr || sync_file(file);
+    return synced && pending.empty();
+}
+
+void ChangeFeed::close() {
+    finish_write();
+    if (file != nullptr) {
+        sync_file(file);
+        fclose(file);
+    }
+    file = nullptr;
+}
+
+bool ChangeFeed::read(uint64_t from, size_t limit, vector<FeedChange>& changes) const {
+    ProbeTimer timer(FEED_READ_PROBE);
+    changes.clear();
+    uint64_t size = complete_size.load(memory_order_acquire);
+    if (limit == 0 || size == 0 || from > last.load(memory_order_acquire)) return true;
+    ifstream in(path, ios::binary);
+    if (!in.is_open()) return false;
+    string line;
+    uint64_t sequence;
+    string_view record;
+    // Returns the start of the first line at or after offset, filling sequence with its number
+    auto line_at = [&](uint64_t offset) {
+        in.clear();
+        in.seekg(static_cast<streamoff>(offset - 1));
+        getline(in, line);              // The rest of the line holding the byte before offset
+        uint64_t start = static_cast<uint64_t>(in.tellg());
+        sequence = 0;
+        if (in && start < size && getline(in, line)) parse_feed_line(line, sequence, record);
+        return in ? start : size;
+    };
+    // Lines are in sequence order: halve the byte range around the first line numbered from or
+    // later, keeping low at the start of a line numbered before it
+    uint64_t low = 0, high = size;
+    while (high - low > FEED_SCAN_BYTES) {
+        uint64_t middle = low + (high - low) / 2;
+        uint64_t start = line_at(middle);
+        if (start < high && sequence != 0 && sequence < from) low = start;
+        else high = middle;
+    }
+    in.clear();
+    in.seekg(static_cast<streamoff>(low));
+    uint64_t position = low;
+    while (changes.size() < limit && getline(in, line)) {
+        position += line.size() + 1;
+        if (position > size) break;     // Beyond the lines published when the read began
+        if (parse_feed_line(line, sequence, record) && sequence >= from) changes.push_back({sequence, string(record)});
+    }
+    timer.add_bytes(position - low);
+    return true;
+}
+
+bool WriteAheadLog::flush_locked() {
+    if (buffered_records == 0) return true;
+    if (file == nullptr) return false;
+    ProbeTimer timer(LOG_FLUSH_PROBE);
+    // The group's header numbers its changes, so replay can tell which ones the feed is missing
+    string header = "S\t" + to_string(next_sequence) + "\n";
+    timer.add_bytes(header.size() + buffer.size());
+    if (fwrite(header.data(), 1, header.size(), file) != header.size() ||
+        fwrite(buffer.data(), 1, buffer.size(), file) != buffer.size() || fflush(file) != 0 || !sync_file(file)) {
+        cout << "Error: Cannot write to " << path << ".\n";
+        // Cut off whatever part of the group got out and keep it buffered for the next flush, so
+        // neither the log nor the feed ever holds part of it. A failed sync counts the same: the
+        // group may not be on disk.
+        fclose(file);
+        error_code ec;
+        filesystem::resize_file(path, logged_size, ec);
+        file = fopen(path.c_str(), "ab");
+        return false;
+    }
+    logged_size += header.size() + buffer.size();
+    logged_records++;
+    if (feed != nullptr) feed->append_group(buffer, next_sequence);
+    next_sequence += buffered_changes;
+    buffer.clear();
+    buffered_records = 0;
+    buffered_changes = 0;
+    return true;
+}
+
+bool WriteAheadLog::rotate(const string& retired_path) {
+    lock_guard<mutex> lock(log_mutex);
+    if (file == nullptr || !flush_locked()) return false;
+    if (feed != nullptr && !feed->sync()) return false;
+    fclose(file);
+    file = nullptr;
+
+    error_code ec;
+    if (!filesystem::exists(retired_path, ec)) {
+        filesystem::rename(path, retired_path, ec);
+    } else {
+        // An earlier compaction did not finish; keep its records and add ours after them
+        ifstream current(path, ios::binary);
+        ofstream retired(retired_path, ios::binary | ios::app);
+        retired << current.rdbuf();
+        retired.flush();
+        bool copied = static_cast<bool>(retired);
+        current.close();
+        retired.close();
+        if (copied) filesystem::remove(path, ec);
+        else ec = make_error_code(errc::io_error);
+    }
+    file = fopen(path.c_str(), "ab");
+    if (!ec) logged_records = 0;
+    if (file != nullptr && fseek(file, 0, SEEK_END) == 0) logged_size = static_cast<uintmax_t>(ftell(file));
+    return !ec && file != nullptr;
+}
+
+// Counts the bits set in both a and b over count words
+size_t count_common_bits(const uint64_t* a, const uint64_t* b, size_t count) {
+    size_t total = 0;
+    size_t w = 0;
+    #ifdef __AVX2__
+        for (; w + 4 <= count; w += 4) {
+            __m256i both = _mm256_and_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + w)),
+                                            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + w)));
+            alignas(32) uint64_t lanes[4];
+            _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), both);
+            total += popcount(lanes[0]) + popcount(lanes[1]) + popcount(lanes[2]) + popcount(lanes[3]);
+        }
+    #endif
+    for (; w < count; w++) total += popcount(a[w] & b[w]);
+    return total;
+}
+
+// ORs count words of row into target
+void or_bits_into(uint64_t* target, const uint64_t* row, size_t count) {
+    size_t w = 0;
+    #ifdef __AVX2__
+        for (; w + 4 <= count; w += 4) {
+            __m256i* out = reinterpret_cast<__m256i*>(target + w);
+            _mm256_storeu_si256(out, _mm256_or_si256(_mm256_loadu_si256(out),
+                                                     _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + w))));
+        }
+    #endif
+    for (; w < count; w++) target[w] |= row[w];
+}
+
+// Summarizes count budgets in one pass. Unfunded roads hold 0, so they add nothing to the total;
+// four independent lanes keep the loop free of a serial dependency on one accumulator.
+BudgetSummary summarize_budgets(const double* budgets, size_t count) {
+    double total[4] = {0.0, 0.0, 0.0, 0.0};
+    double low[4] = {HUGE_VAL, HUGE_VAL, HUGE_VAL, HUGE_VAL};
+    double high[4] = {0.0, 0.0, 0.0, 0.0};
+    size_t funded = 0;
+    size_t r = 0;
+    #ifdef __AVX2__
+        const __m256d zero = _mm256_setzero_pd();
+        const __m256d none = _mm256_set1_pd(HUGE_VAL);
+        __m256d sum = zero, lo = none, hi = zero;
+        for (; r + 4 <= count; r += 4) {
+            __m256d value = _mm256_loadu_pd(budgets + r);
+            __m256d is_funded = _mm256_cmp_pd(value, zero, _CMP_GT_OQ);
+            sum = _mm256_add_pd(sum, value);
+            lo = _mm256_min_pd(lo, _mm256_blendv_pd(none, value, is_funded));
+            hi = _mm256_max_pd(hi, value);
+            funded += popcount(static_cast<unsigned>(_mm256_movemask_pd(is_funded)));
+        }
+        _mm256_storeu_pd(total, sum);
+        _mm256_storeu_pd(low, lo);
+        _mm256_storeu_pd(high, hi);
+    #endif
+    for (; r + 4 <= count; r += 4) {
+        for (int k = 0; k < 4; k++) {
+            double value = budgets[r + k];
+            total[k] += value;
+            funded += value > 0.0;
+            low[k] = value > 0.0 && value < low[k] ? value : low[k];
+            high[k] = value > high[k] ? value : high[k];
+        }
+    }
+    for (; r < count; r++) {
+        double value = budgets[r];
+        total[0] += value;
+        funded += value > 0.0;
+        if (value > 0.0 && value < low[0]) low[0] = value;
+        if (value > high[0]) high[0] = value;
+    }
+
+    BudgetSummary summary;
+    summary.total = (total[0] + total[1]) + (total[2] + total[3]);
+    summary.funded = funded;
+    if (funded > 0) {
+        summary.min = min(min(low[0], low[1]), min(low[2], low[3]));
+        summary.max = max(max(high[0], high[1]), max(high[2], high[3]));
+    }
+    return summary;
+}
+
+// Counts, for each of limit_count limits, the budgets strictly above it, all in one pass;
+// above[k] - above[k + 1] is then the number of budgets in (limits[k], limits[k + 1]]
+void count_budgets_above(const double* budgets, size_t count, const double* limits, size_t limit_count,
+                         size_t* above) {
+    fill(above, above + limit_count, size_t(0));
+    size_t r = 0;
+    #ifdef __AVX2__
+        for (; r + 4 <= count; r += 4) {
+            __m256d value = _mm256_loadu_pd(budgets + r);
+            for (size_t k = 0; k < limit_count; k++) {
+                __m256d is_above = _mm256_cmp_pd(value, _mm256_set1_pd(limits[k]), _CMP_GT_OQ);
+                above[k] += popcount(static_cast<unsigned>(_mm256_movemask_pd(is_above)));
+            }
+        }
+    #endif
+    for (; r < count; r++) {
+        for (size_t k = 0; k < limit_count; k++) above[k] += budgets[r] > limits[k];
+    }
+}
+
+// Describes a change status in words
+const char* describe(ChangeStatus status) {
+    switch (status) {
+        case ChangeStatus::Ok: return "OK";
+        case ChangeStatus::InvalidName:
+            return "City name must be 2+ characters, contain at least one letter, and only include alphanumeric, space, or hyphen.";
+        case ChangeStatus::DuplicateName: return "A city with that name already exists.";
+        case ChangeStatus::CityLimitReached: return "The city limit is reached.";
+        case ChangeStatus::UnknownCity: return "City does not exist.";
+        case ChangeStatus::SameCity: return "Cannot add a road from a city to itself.";
+        case ChangeStatus::RoadExists: return "Road already exists between the cities.";
+        case ChangeStatus::NoSuchRoad: return "No road exists between the cities.";
+        case ChangeStatus::InvalidBudget: return "Budget must be between 0 and 1000 billion RWF.";
+        case ChangeStatus::InvalidYear: return "Fiscal year must be between 1990 and 2100.";
+        case ChangeStatus::InvalidLocation: return "Latitude must be between -90 and 90 and longitude between -180 and 180.";
+        case ChangeStatus::WriteFailed: return "The change could not be saved to disk, so it was not made.";
+    }
+    return "Unknown status.";
+}
+
+// Strips leading and trailing spaces and tabs
+string_view trim(string_view text) {
+    size_t begin = text.find_first_not_of(" \t\r");
+    if (begin == string_view::npos) return {};
+    size_t end = text.find_last_not_of(" \t\r");
+    return text.substr(begin, end - begin + 1);
+}
+
+int InfrastructureManager::get_city_index(string_view name) const {
+    ProbeTimer timer(CITY_LOOKUP_PROBE);
+    return city_names.find(name);
+}
+
+bool InfrastructureManager::city_exists(string_view name) const {
+    return get_city_index(name) != -1;
+}
+
+int InfrastructureManager::road_slot(int i, int j) const {
+    // Scan whichever endpoint has fewer roads
+    if (adjacency[i].size() > adjacency[j].size()) swap(i, j);
+    for (const auto& link : adjacency[i]) {
+        if (link.neighbor == j) return link.road;
+    }
+    return -1;
+}
+
+bool InfrastructureManager::has_road(int i, int j) const {
+    if (dense_mode && !dense_roads_stale) return dense_roads.test(i, j);
+    return road_slot(i, j) != -1;
+}
+
+int InfrastructureManager::find_road(int i, int j) {
+    ensure_city_roads(i);
+    ensure_city_roads(j);
+    return road_slot(i, j);
+}
+
+bool InfrastructureManager::road_exists(int i, int j) {
+    ensure_city_roads(i);
+    ensure_city_roads(j);
+    return has_road(i, j);
+}
+
+void InfrastructureManager::page_in_roads(int city) {
+    if (!lazy_roads || city < 0 || static_cast<uint32_t>(city) >= lazy_roads->indexed_cities ||
+        lazy_roads->paged_in[city]) return;
+    ProbeTimer timer(ROAD_PAGE_IN_PROBE);
+    LazyRoadSnapshot& snapshot = *lazy_roads;
+    snapshot.paged_in[city] = 1;
+    bool changed = roads_changed;       // Loading is not a change to save or undo
+    bool recording = exchange(recording_changes, false);
+    for (uint32_t k = snapshot.offsets[city]; k < snapshot.offsets[city + 1]; k++) {
+        uint32_t position = snapshot.city_roads[k];
+        if (position >= snapshot.road_count) continue;
+        const SnapshotRoad& road = snapshot.roads[position];
+        if (!is_usable_snapshot_road(road, snapshot.indexed_cities) ||
+            (road.city1 != static_cast<uint32_t>(city) && road.city2 != static_cast<uint32_t>(city))) continue;
+        uint32_t other = road.city1 == static_cast<uint32_t>(city) ? road.city2 : road.city1;
+        if (snapshot.paged_in[other]) continue;  // Loaded along with the other city
+        if (!road_list.empty() && static_cast<int>(road.nbr) < road_list.back().nbr) snapshot.out_of_order = true;
+        insert_road(static_cast<int>(road.city1), static_cast<int>(road.city2), static_cast<int>(road.nbr), road.budget);
+        timer.add_bytes(sizeof(SnapshotRoad));
+    }
+    roads_changed = changed;
+    recording_changes = recording;
+}
+
+void InfrastructureManager::page_in_all_roads() {
+    if (!lazy_roads) return;
+    ProbeTimer timer(ROAD_FULL_LOAD_PROBE);
+    LazyRoadSnapshot& snapshot = *lazy_roads;
+    bool changed = roads_changed;
+    bool recording = exchange(recording_changes, false);
+    road_list.reserve(road_list.size() + snapshot.road_count);
+    road_budgets.reserve(road_list.size() + snapshot.road_count);
+    for (uint32_t r = 0; r < snapshot.road_count; r++) {
+        const SnapshotRoad& road = snapshot.roads[r];
+        if (!is_usable_snapshot_road(road, snapshot.indexed_cities) ||
+            snapshot.paged_in[road.city1] || snapshot.paged_in[road.city2]) continue;
+        if (!road_list.empty() && static_cast<int>(road.nbr) < road_list.back().nbr) snapshot.out_of_order = true;
+        insert_road(static_cast<int>(road.city1), static_cast<int>(road.city2), static_cast<int>(road.nbr), road.budget);
+        timer.add_bytes(sizeof(SnapshotRoad));
+    }
+    roads_changed = changed;
+    recording_changes = recording;
+    if (snapshot.out_of_order) restore_road_order();
+    lazy_roads.reset();
+    roads_complete.store(true, memory_order_release);
+    publish_view();
+}
+
+void InfrastructureManager::restore_road_order() {
+    vector<int> order(road_list.size());
+    iota(order.begin(), order.end(), 0);
+    sort(order.begin(), order.end(), [&](int a, int b) { return road_list[a].nbr < road_list[b].nbr; });
+    vector<int> new_slot(road_list.size());
+    vector<Road> roads;
+    vector<double> budgets;
+    roads.reserve(road_list.size());
+    budgets.reserve(road_list.size());
+    view_roads = NetworkView::Roads();
+    view_budgets = NetworkView::Budgets();
+    view_roads.reserve(road_list.size());
+    view_budgets.reserve(road_list.size());
+    for (size_t k = 0; k < order.size(); k++) {
+        new_slot[order[k]] = static_cast<int>(k);
+        roads.push_back(road_list[order[k]]);
+        budgets.push_back(road_budgets[order[k]]);
+        view_roads.push_back(roads.back());
+        view_budgets.push_back(budgets.back());
+    }
+    road_list.swap(roads);
+    road_budgets.swap(budgets);
+    for (size_t c = 0; c < adjacency.size(); c++) {
+        vector<RoadLink>& links = adjacency.mutable_at(c);
+        for (auto& link : links) link.road = new_slot[link.road];
+        sort(links.begin(), links.end(), [](const RoadLink& a, const RoadLink& b) { return a.road < b.road; });
+    }
+}
+
+void InfrastructureManager::ensure_city_roads(int city) {
+    if (roads_complete.load(memory_order_acquire)) return;
+    lock_guard<mutex> lock(state_mutex);
+    page_in_roads(city);
+}
+
+void InfrastructureManager::ensure_all_roads() {
+    if (roads_complete.load(memory_order_acquire)) return;
+    lock_guard<mutex> lock(state_mutex);
+    page_in_all_roads();
+}
+
+bool InfrastructureManager::dense_mode_worthwhile() {
+    size_t n = city_names.size();
+    return n > 0 && n <= DENSE_MODE_MAX_CITIES && 2 * (road_list.size() - removed_roads) / n >= (n + 63) / 64;
+}
+
+void InfrastructureManager::rebuild_dense_roads() {
+    dense_roads.reset(min(2 * city_names.size(), DENSE_MODE_MAX_CITIES));
+    for (const auto& road : road_list) {
+        if (!road.removed()) dense_roads.set(road.city1, road.city2);
+    }
+    dense_mode = true;
+    dense_roads_stale = false;
+}
+
+void InfrastructureManager::refresh_dense_roads() {
+    if (dense_mode && dense_roads_stale) rebuild_dense_roads();
+}
+
+CitySearchIndex& InfrastructureManager::search_index() {
+    if (city_search_stale) {
+        city_search = CitySearchIndex();
+        city_search.reserve(city_names.size());
+        for (size_t c = 0; c < city_names.size(); c++) city_search.add(city_names[c]);
+        city_search_stale = false;
+    }
+    return city_search;
+}
+
+void InfrastructureManager::append_city(string_view name) {
+    if (recording_changes) {
+        record_change({ChangeDelta::Kind::AddCity, static_cast<int>(city_names.size()), -1, 0, 0.0, 0.0, {}, string(name), 0,
+                       {}, {}});
+    }
+    city_names.add(name);
+    if (!city_search_stale) city_search.add(name);
+    cities_changed = true;
+    view_names.push_back(city_names[city_names.size() - 1]);
+    city_locations.push_back({});
+    view_locations.push_back({});
+    adjacency.push_back({});
+    connectivity.add();
+    if (dense_mode && city_names.size() > dense_roads.city_capacity()) {
+        if (city_names.size() > DENSE_MODE_MAX_CITIES) {
+            dense_mode = false;
+            dense_roads.release();
+        } else {
+            rebuild_dense_roads();
+        }
+    }
+}
+
+void InfrastructureManager::reserve_cities(size_t count) {
+    city_names.reserve(count);
+    city_search.reserve(count);
+    adjacency.reserve(count);
+    view_names.reserve(count);
+    city_locations.reserve(count);
+    view_locations.reserve(count);
+    connectivity.reserve(count);
+}
+
+void InfrastructureManager::apply_rename(int index, string_view new_name) {
+    if (recording_changes) {
+        record_change({ChangeDelta::Kind::Rename, index, -1, 0, 0.0, 0.0, string(city_names[index]), string(new_name), 0,
+                       {}, {}});
+    }
+    city_names.rename(static_cast<uint32_t>(index), new_name);
+    if (!city_search_stale) city_search.rename(static_cast<uint32_t>(index), new_name);
+    view_names.mutable_at(index) = city_names[index];
+    cities_changed = true;
+}
+
+void InfrastructureManager::apply_location(int city, GeoPoint location) {
+    if (recording_changes) {
+        record_change({ChangeDelta::Kind::SetLocation, city, -1, 0, 0.0, 0.0, {}, {}, 0, city_locations[city], location});
+    }
+    city_locations[city] = location;
+    view_locations.mutable_at(city) = location;
+    cities_changed = true;
+}
+
+int InfrastructureManager::insert_road(int i, int j, int nbr, double budget) {
+    if (i > j) swap(i, j);
+    if (recording_changes) record_change({ChangeDelta::Kind::AddRoad, i, j, nbr, 0.0, 0.0, {}, {}, 0, {}, {}});
+    int road = static_cast<int>(road_list.size());
+    road_list.push_back({i, j, nbr});
+    road_budgets.push_back(budget);
+    view_roads.push_back({i, j, nbr});
+    view_budgets.push_back(budget);
+    next_road_nbr = max(next_road_nbr, nbr + 1);
+    adjacency.mutable_at(i).push_back({j, road});
+    adjacency.mutable_at(j).push_back({i, road});
+    connectivity.unite(i, j);
+    roads_changed = true;
+    if (dense_mode) {
+        if (!dense_roads_stale) dense_roads.set(i, j);
+    } else if (dense_mode_worthwhile()) {
+        rebuild_dense_roads();
+    }
+    return road;
+}
+
+int InfrastructureManager::restore_road(int i, int j, int nbr, double budget) {
+    if (i > j) swap(i, j);
+    if (nbr >= next_road_nbr) return insert_road(i, j, nbr, budget);
+    page_in_all_roads();                // Binary search needs road_list in Nbr order
+    auto slot = lower_bound(road_list.begin(), road_list.end(), nbr,
+                            [](const Road& road, int value) { return road.nbr < value; });
+    if (slot != road_list.end() && slot->nbr == nbr && !slot->removed()) return insert_road(i, j, next_road_nbr, budget);
+    if (slot == road_list.end() || slot->nbr != nbr) {
+        // Swept out since it was removed
+        insert_road(i, j, nbr, budget);
+        restore_road_order();
+        return road_slot(i, j);
+    }
+    int road = static_cast<int>(slot - road_list.begin());
+    road_list[road] = {i, j, nbr};
+    road_budgets[road] = budget;
+    view_roads.mutable_at(road) = {i, j, nbr};
+    view_budgets.mutable_at(road) = budget;
+    removed_roads--;
+    for (auto [city, other] : {pair<int, int>(i, j), pair<int, int>(j, i)}) {
+        vector<RoadLink>& links = adjacency.mutable_at(city);
+        auto position = lower_bound(links.begin(), links.end(), road,
+                                    [](const RoadLink& link, int value) { return link.road < value; });
+        links.insert(position, {other, road});
+    }
+    connectivity.unite(i, j);
+    roads_changed = true;
+    if (dense_mode) {
+        if (!dense_roads_stale) dense_roads.set(i, j);
+    } else if (dense_mode_worthwhile()) {
+        rebuild_dense_roads();
+    }
+    return road;
+}
+
+void InfrastructureManager::discard_road(int road) {
+    auto [i, j, nbr] = road_list[road];
+    if (recording_changes) {
+        record_change({ChangeDelta::Kind::RemoveRoad, i, j, nbr, road_budgets[road], 0.0, {}, {}, 0, {}, {}});
+    }
+    for (int city : {i, j}) {
+        vector<RoadLink>& links = adjacency.mutable_at(city);
+        links.erase(find_if(links.begin(), links.end(), [road](const RoadLink& link) { return link.road == road; }));
+    }
+    if (dense_mode && !dense_roads_stale) dense_roads.clear(i, j);
+    road_list[road] = {-1, -1, nbr};
+    road_budgets[road] = 0.0;
+    view_roads.mutable_at(road) = road_list[road];
+    view_budgets.mutable_at(road) = 0.0;
+    removed_roads++;
+    connectivity_stale = true;
+    roads_changed = true;
+}
+
+void InfrastructureManager::sweep_removed_roads() {
+    if (removed_roads == 0) return;
+    vector<int> new_slot(road_list.size(), -1);
+    view_roads = NetworkView::Roads();
+    view_budgets = NetworkView::Budgets();
+    view_roads.reserve(road_list.size() - removed_roads);
+    view_budgets.reserve(road_list.size() - removed_roads);
+    size_t kept = 0;
+    for (size_t r = 0; r < road_list.size(); r++) {
+        if (road_list[r].removed()) continue;
+        new_slot[r] = static_cast<int>(kept);
+        road_list[kept] = road_list[r];
+        road_budgets[kept] = road_budgets[r];
+        view_roads.push_back(road_list[kept]);
+        view_budgets.push_back(road_budgets[kept]);
+        kept++;
+    }
+    road_list.resize(kept);
+    road_budgets.resize(kept);
+    road_list.shrink_to_fit();
+    road_budgets.shrink_to_fit();
+    for (size_t c = 0; c < adjacency.size(); c++) {
+        // Lists whose slots all stay put keep sharing their chunk with published views
+        const vector<RoadLink>& links = adjacency[c];
+        if (all_of(links.begin(), links.end(), [&](const RoadLink& link) { return new_slot[link.road] == link.road; })) continue;
+        for (auto& link : adjacency.mutable_at(c)) link.road = new_slot[link.road];
+    }
+    removed_roads = 0;
+    publish_view();
+}
+
+void InfrastructureManager::discard_city(int city) {
+    discard_cities(span<const int>(&city, 1));
+}
+
+void InfrastructureManager::discard_cities(span<const int> cities) {
+    if (cities.empty()) return;
+    if (recording_changes) {
+        for (auto city = cities.rbegin(); city != cities.rend(); ++city) {
+            record_change({ChangeDelta::Kind::RemoveCity, *city, -1, 0, 0.0, 0.0, string(city_names[*city]), {}, 0,
+                           city_locations[*city], {}});
+        }
+    }
+    vector<uint32_t> ids(cities.begin(), cities.end());
+    city_names.erase(ids);
+    size_t count = adjacency.size();
+    vector<int> new_id(count, -1);
+    vector<GeoPoint> locations;
+    NetworkView::Adjacency links;
+    locations.reserve(count - cities.size());
+    links.reserve(count - cities.size());
+    for (size_t c = 0, removed = 0; c < count; c++) {
+        if (removed < cities.size() && static_cast<size_t>(cities[removed]) == c) {
+            removed++;
+            continue;
+        }
+        new_id[c] = static_cast<int>(links.size());
+        locations.push_back(city_locations[c]);
+        links.push_back(adjacency[c]);
+    }
+    city_locations = move(locations);
+    adjacency = move(links);
+    renumber_cities(new_id);
+}
+
+void InfrastructureManager::restore_city(int city, string_view name) {
+    city_names.insert(static_cast<uint32_t>(city), name);
+    city_locations.insert(city_locations.begin() + city, GeoPoint());
+    NetworkView::Adjacency links;
+    links.reserve(adjacency.size() + 1);
+    for (size_t c = 0; c < adjacency.size(); c++) {
+        if (c == static_cast<size_t>(city)) links.push_back({});
+        links.push_back(adjacency[c]);
+    }
+    if (static_cast<size_t>(city) == adjacency.size()) links.push_back({});
+    vector<int> new_id(adjacency.size());
+    for (size_t c = 0; c < new_id.size(); c++) new_id[c] = static_cast<int>(c) + (c >= static_cast<size_t>(city));
+    adjacency = move(links);
+    renumber_cities(new_id);
+}
+
+void InfrastructureManager::renumber_cities(const vector<int>& new_id) {
+    auto moved = [&new_id](int city) { return city != new_id[city]; };
+    for (size_t r = 0; r < road_list.size(); r++) {
+        Road& road = road_list[r];
+        if (road.removed() || (!moved(road.city1) && !moved(road.city2))) continue;
+        road = {new_id[road.city1], new_id[road.city2], road.nbr};
+        view_roads.mutable_at(r) = road;
+        roads_changed = true;
+    }
+    for (size_t c = 0; c < adjacency.size(); c++) {
+        const vector<RoadLink>& links = adjacency[c];
+        if (none_of(links.begin(), links.end(), [&](const RoadLink& link) { return moved(link.neighbor); })) continue;
+        for (auto& link : adjacency.mutable_at(c)) link.neighbor = new_id[link.neighbor];
+    }
+
+    size_t n = city_names.size();
+    view_names = NetworkView::Names();
+    view_locations = NetworkView::Locations();
+    view_names.reserve(n);
+    view_locations.reserve(n);
+    for (size_t c = 0; c < n; c++) {
+        view_names.push_back(city_names[c]);
+        view_locations.push_back(city_locations[c]);
+    }
+    // The search index and the bit matrix are rebuilt by their next use, so a run of removals
+    // pays for one rebuild
+    city_search_stale = true;
+    connectivity_stale = true;
+    cities_changed = true;
+    if (dense_mode) {
+        if (n > DENSE_MODE_MAX_CITIES) {
+            dense_mode = false;
+            dense_roads.release();
+            dense_roads_stale = false;
+        } else {
+            dense_roads_stale = true;
+        }
+    }
+}
+
+void InfrastructureManager::rebuild_connectivity() {
+    connectivity.reset(city_names.size());
+    for (const auto& road : road_list) {
+        if (!road.removed()) connectivity.unite(road.city1, road.city2);
+    }
+    connectivity_stale = false;
+}
+
+void InfrastructureManager::publish_view() {
+    if (connectivity_stale) rebuild_connectivity();
+    shared_ptr<const NetworkView> previous = published_view.load(memory_order_relaxed);
+    published_view.store(make_shared<const NetworkView>(++published_version, view_names, view_roads, view_budgets,
+                                                         adjacency, view_locations, connectivity.count(),
+                                                         removed_roads, previous.get()),
+                         memory_order_release);
+}
+
+void InfrastructureManager::log_change(string_view record) {
+    if (transaction_open) {
+        transaction_records.append(record);
+        transaction_records.push_back('\n');
+        transaction_record_count++;
+        return;
+    }
+    wal.append(record);
+    close_undo_step();
+}
+
+void InfrastructureManager::log_changes(string_view records, size_t count) {
+    if (transaction_open) {
+        transaction_records.append(records);
+        transaction_record_count += count;
+        return;
+    }
+    wal.append_transaction(records, count);
+    close_undo_step();
+}
+
+void InfrastructureManager::record_change(ChangeDelta change) {
+    // A transaction keeps every change so it can roll back; other steps stop once they are too
+    // large to keep
+    if (!transaction_open && open_changes.size() >= UNDO_HISTORY_CHANGES) {
+        open_step_overflowed = true;
+        return;
+    }
+    open_changes.push_back(move(change));
+}
+
+void InfrastructureManager::close_undo_step() {
+    if (open_step_overflowed) {
+        // Earlier steps cannot be undone without undoing this one first
+        open_changes.clear();
+        undo_history.clear();
+        redo_history.clear();
+        undo_history_changes = 0;
+        open_step_overflowed = false;
+        return;
+    }
+    if (open_changes.empty()) return;
+    redo_history.clear();
+    undo_history_changes += open_changes.size();
+    undo_history.push_back(move(open_changes));
+    open_changes.clear();
+    while (undo_history_changes > UNDO_HISTORY_CHANGES) {
+        undo_history_changes -= undo_history.front().size();
+        undo_history.pop_front();
+    }
+}
+
+void InfrastructureManager::revert_step(const vector<ChangeDelta>& step, string& records, size_t& count) {
+    bool recording = exchange(recording_changes, false);
+    int year = current_fiscal_year();   // Budgets put back count towards this year's history
+    for (auto it = step.rbegin(); it != step.rend(); ++it) {
+        const ChangeDelta& change = *it;
+        switch (change.kind) {
+            case ChangeDelta::Kind::AddCity:
+                page_in_all_roads();
+                discard_city(change.city1);
+                records += city_removal_record(change.new_name);
+                break;
+            case ChangeDelta::Kind::AddRoad:
+                page_in_roads(change.city1);
+                page_in_roads(change.city2);
+                discard_road(road_slot(change.city1, change.city2));
+                records += road_removal_record(change.city1, change.city2);
+                break;
+            case ChangeDelta::Kind::SetBudget:
+                set_road_budget(road_slot(change.city1, change.city2), change.old_budget, year);
+                records += budget_record(change.city1, change.city2, change.old_budget, year);
+                break;
+            case ChangeDelta::Kind::Rename:
+                apply_rename(change.city1, change.old_name);
+                records += rename_record(change.city1, change.old_name);
+                break;
+            case ChangeDelta::Kind::RemoveRoad: {
+                int road = restore_road(change.city1, change.city2, change.nbr, change.old_budget);
+                records += road_record(road_list[road]);
+                if (change.old_budget > 0.0) {
+                    records += '\n';
+                    records += budget_record(change.city1, change.city2, change.old_budget, 0);
+                    count++;
+                }
+                break;
+            }
+            case ChangeDelta::Kind::RemoveCity:
+                page_in_all_roads();
+                restore_city(change.city1, change.old_name);
+                records += city_restore_record(change.city1, change.old_name);
+                if (change.old_location.known()) {
+                    apply_location(change.city1, change.old_location);
+                    records += '\n';
+                    records += location_record(change.city1, change.old_location);
+                    count++;
+                }
+                break;
+            case ChangeDelta::Kind::SetYearBudget:
+                set_history_budget(change.nbr, change.fiscal_year, change.old_budget);
+                records += year_budget_record(change.nbr, change.fiscal_year, change.old_budget);
+                break;
+            case ChangeDelta::Kind::SetLocation:
+                apply_location(change.city1, change.old_location);
+                records += location_record(change.city1, change.old_location);
+                break;
+        }
+        records += '\n';
+        count++;
+    }
+    recording_changes = recording;
+}
+
+void InfrastructureManager::reapply_step(const vector<ChangeDelta>& step, string& records, size_t& count) {
+    bool recording = exchange(recording_changes, false);
+    int year = current_fiscal_year();
+    for (const ChangeDelta& change : step) {
+        switch (change.kind) {
+            case ChangeDelta::Kind::AddCity:
+                append_city(change.new_name);
+                records += city_record(change.new_name);
+                break;
+            case ChangeDelta::Kind::AddRoad: {
+                int road = restore_road(change.city1, change.city2, change.nbr, 0.0);
+                records += road_record(road_list[road]);
+                break;
+            }
+            case ChangeDelta::Kind::SetBudget:
+                page_in_roads(change.city1);
+                page_in_roads(change.city2);
+                set_road_budget(road_slot(change.city1, change.city2), change.new_budget, year);
+                records += budget_record(change.city1, change.city2, change.new_budget, year);
+                break;
+            case ChangeDelta::Kind::Rename:
+                apply_rename(change.city1, change.new_name);
+                records += rename_record(change.city1, change.new_name);
+                break;
+            case ChangeDelta::Kind::RemoveRoad:
+                page_in_roads(change.city1);
+                page_in_roads(change.city2);
+                discard_road(road_slot(change.city1, change.city2));
+                records += road_removal_record(change.city1, change.city2);
+                break;
+            case ChangeDelta::Kind::RemoveCity:
+                page_in_all_roads();
+                discard_city(change.city1);
+                records += city_removal_record(change.old_name);
+                break;
+            case ChangeDelta::Kind::SetYearBudget:
+                set_history_budget(change.nbr, change.fiscal_year, change.new_budget);
+                records += year_budget_record(change.nbr, change.fiscal_year, change.new_budget);
+                break;
+            case ChangeDelta::Kind::SetLocation:
+                apply_location(change.city1, change.new_location);
+                records += location_record(change.city1, change.new_location);
+                break;
+        }
+        records += '\n';
+        count++;
+    }
+    recording_changes = recording;
+}
+
+// Returns the point on the unit sphere at a location
+array<double, 3> unit_vector(GeoPoint location) {
+    const double radians = numbers::pi / 180.0;
+    double latitude = location.latitude * radians;
+    double longitude = location.longitude * radians;
+    return {cos(latitude) * cos(longitude), cos(latitude) * sin(longitude), sin(latitude)};
+}
+
+// Squared straight-line distance between two points on the unit sphere
+double squared_chord(const array<double, 3>& a, const array<double, 3>& b) {
+    double dx = a[0] - b[0], dy = a[1] - b[1], dz = a[2] - b[2];
+    return dx * dx + dy * dy + dz * dz;
+}
+
+// Great-circle distance in km spanned by a chord of the unit sphere
+double chord_to_km(double chord) {
+    return 2.0 * EARTH_RADIUS_KM * asin(min(1.0, chord / 2.0));
+}
+
+// Great-circle distance in km between two known locations
+double great_circle_km(GeoPoint a, GeoPoint b) {
+    return chord_to_km(sqrt(squared_chord(unit_vector(a), unit_vector(b))));
+}
+
+void CityLocationIndex::add(int city, GeoPoint location) {
+    nodes.push_back({unit_vector(location), city, 0});
+}
+
+void CityLocationIndex::build() {
+    build_range(0, nodes.size());
+}
+
+void CityLocationIndex::build_range(size_t begin, size_t end) {
+    if (end - begin <= 1) return;
+    array<double, 3> low = nodes[begin].position, high = nodes[begin].position;
+    for (size_t k = begin + 1; k < end; k++) {
+        for (int d = 0; d < 3; d++) {
+            low[d] = min(low[d], nodes[k].position[d]);
+            high[d] = max(high[d], nodes[k].position[d]);
+        }
+    }
+    int axis = 0;
+    for (int d = 1; d < 3; d++) {
+        if (high[d] - low[d] > high[axis] - low[axis]) axis = d;
+    }
+    size_t middle = begin + (end - begin) / 2;
+    nth_element(nodes.begin() + begin, nodes.begin() + middle, nodes.begin() + end,
+                [axis](const Node& a, const Node& b) { return a.position[axis] < b.position[axis]; });
+    nodes[middle].axis = axis;
+    build_range(begin, middle);
+    build_range(middle + 1, end);
+}
+
+void CityLocationIndex::search_nearest(size_t begin, size_t end, const array<double, 3>& point, size_t count, int skip,
+                                       vector<pair<double, int>>& best) const {
+    if (begin >= end) return;
+    size_t middle = begin + (end - begin) / 2;
+    const Node& node = nodes[middle];
+    if (node.city != skip) {
+        double distance = squared_chord(point, node.position);
+        if (best.size() < count) {
+            best.emplace_back(distance, node.city);
+            push_heap(best.begin(), best.end());
+        } else if (distance < best.front().first) {
+            pop_heap(best.begin(), best.end());
+            best.back() = {distance, node.city};
+            push_heap(best.begin(), best.end());
+        }
+    }
+    if (end - begin == 1) return;
+    double offset = point[node.axis] - node.position[node.axis];
+    bool below = offset < 0.0;
+    search_nearest(below ? begin : middle + 1, below ? middle : end, point, count, skip, best);
+    if (best.size() < count || offset * offset < best.front().first) {
+        search_nearest(below ? middle + 1 : begin, below ? end : middle, point, count, skip, best);
+    }
+}
+
+void CityLocationIndex::search_within(size_t begin, size_t end, const array<double, 3>& point, double chord2, int skip,
+                                      vector<pair<double, int>>& found) const {
+    if (begin >= end) return;
+    size_t middle = begin + (end - begin) / 2;
+    const Node& node = nodes[middle];
+    double distance = squared_chord(point, node.position);
+    if (distance <= chord2 && node.city != skip) found.emplace_back(distance, node.city);
+    if (end - begin == 1) return;
+    double offset = point[node.axis] - node.position[node.axis];
+    if (offset <= 0.0 || offset * offset <= chord2) search_within(begin, middle, point, chord2, skip, found);
+    if (offset >= 0.0 || offset * offset <= chord2) search_within(middle + 1, end, point, chord2, skip, found);
+}
+
+void CityLocationIndex::nearest(GeoPoint from, size_t count, int skip, vector<CityDistance>& found) const {
+    vector<pair<double, int>> best;
+    best.reserve(count);
+    if (count > 0) search_nearest(0, nodes.size(), unit_vector(from), count, skip, best);
+    sort_heap(best.begin(), best.end());
+    found.clear();
+    for (const auto& [distance, city] : best) found.push_back({city, chord_to_km(sqrt(distance))});
+}
+
+void CityLocationIndex::within(GeoPoint from, double radius_km, int skip, vector<CityDistance>& found) const {
+    // The chord of an arc of angle a is 2 sin(a / 2); beyond half the globe every city is in range
+    double angle = radius_km / EARTH_RADIUS_KM;
+    double chord2 = angle >= numbers::pi ? 4.0 : 4.0 * sin(angle / 2.0) * sin(angle / 2.0);
+    vector<pair<double, int>> in_range;
+    search_within(0, nodes.size(), unit_vector(from), chord2, skip, in_range);
+    sort(in_range.begin(), in_range.end());
+    found.clear();
+    for (const auto& [distance, city] : in_range) found.push_back({city, chord_to_km(sqrt(distance))});
+}
+
+NetworkView::NetworkView(uint64_t version, const Names& names, const Roads& roads, const Budgets& budgets,
+                         const Adjacency& adjacency, const Locations& locations, int component_count,
+                         size_t removed_road_count, const NetworkView* previous)
+    : version_number(version), city_names(names), road_list(roads), road_budgets(budgets), adjacency(adjacency),
+      city_locations(locations), component_count(component_count), removed_road_count(removed_road_count) {
+    if (previous != nullptr && previous->city_names.shares_storage(city_names)) name_lookup = previous->name_lookup;
+    else name_lookup = make_shared<CityNameLookup>();
+}
+
+const CityNameLookup& NetworkView::names_lookup() const {
+    call_once(name_lookup->built, [this] {
+        CityNameLookup& lookup = *name_lookup;
+        size_t n = city_names.size();
+        lookup.by_name.resize(n);
+        iota(lookup.by_name.begin(), lookup.by_name.end(), 0u);
+        sort(lookup.by_name.begin(), lookup.by_name.end(),
+             [this](uint32_t a, uint32_t b) { return city_names[a] < city_names[b]; });
+        lookup.keys.resize(n);
+        for (size_t c = 0; c < n; c++) {
+            lookup.keys[c] = city_names[c];
+            for (char& ch : lookup.keys[c]) ch = static_cast<char>(tolower(static_cast<unsigned char>(ch)));
+        }
+        lookup.by_key.resize(n);
+        iota(lookup.by_key.begin(), lookup.by_key.end(), 0u);
+        sort(lookup.by_key.begin(), lookup.by_key.end(), [&lookup](uint32_t a, uint32_t b) {
+            return lookup.keys[a] < lookup.keys[b] || (lookup.keys[a] == lookup.keys[b] && a < b);
+        });
+    });
+    return *name_lookup;
+}
+
+int NetworkView::find_city(string_view name) const {
+    ProbeTimer timer(CITY_LOOKUP_PROBE);
+    const CityNameLookup& lookup = names_lookup();
+    auto found = lower_bound(lookup.by_name.begin(), lookup.by_name.end(), name,
+                             [this](uint32_t id, string_view value) { return city_names[id] < value; });
+    return found != lookup.by_name.end() && city_names[*found] == name ? static_cast<int>(*found) : -1;
+}
+
+void NetworkView::cities_starting_with(string_view prefix, size_t limit, vector<uint32_t>& found) const {
+    ProbeTimer timer(PREFIX_SEARCH_PROBE);
+    const CityNameLookup& lookup = names_lookup();
+    found.clear();
+    string key(prefix);
+    for (char& ch : key) ch = static_cast<char>(tolower(static_cast<unsigned char>(ch)));
+    auto first = lower_bound(lookup.by_key.begin(), lookup.by_key.end(), key,
+                             [&lookup](uint32_t id, const string& value) { return lookup.keys[id] < value; });
+    for (auto it = first; it != lookup.by_key.end() && found.size() < limit; ++it) {
+        if (lookup.keys[*it].compare(0, key.size(), key) != 0) break;
+        found.push_back(*it);
+    }
+}
+
+const RoadGraphCsr& NetworkView::route_graph() const {
+    call_once(csr_built, [this] {
+        size_t n = city_names.size();
+        csr.offsets.assign(n + 1, 0);
+        csr.arcs.resize(road_count() * 2);
+        for (size_t c = 0; c < n; c++) {
+            csr.offsets[c + 1] = csr.offsets[c] + static_cast<int>(adjacency[c].size());
+            RoadGraphCsr::Arc* arc = csr.arcs.data() + csr.offsets[c];
+            for (const auto& link : adjacency[c]) *arc++ = {link.neighbor, road_budgets[link.road]};
+        }
+
+        // The A* heuristic needs every city a route can pass through to have a location
+        for (size_t c = 0; c < n; c++) {
+            if (!adjacency[c].empty() && !city_locations[c].known()) return;
+        }
+        csr.positions.resize(n);
+        for (size_t c = 0; c < n; c++) {
+            if (city_locations[c].known()) csr.positions[c] = unit_vector(city_locations[c]);
+        }
+        double budget_scale = HUGE_VAL, longest_km = 0.0;
+        for (size_t r = 0; r < road_list.size(); r++) {
+            const Road& road = road_list[r];
+            if (road.removed()) continue;
+            double km = EARTH_RADIUS_KM * sqrt(squared_chord(csr.positions[road.city1], csr.positions[road.city2]));
+            longest_km = max(longest_km, km);
+            if (road_budgets[r] > 0.0 && km > 0.0) budget_scale = min(budget_scale, road_budgets[r] / km);
+        }
+        // Shaved so rounding can never make the estimate exceed the true cost
+        const double margin = 1.0 - 1e-9;
+        csr.budget_scale = budget_scale == HUGE_VAL ? 0.0 : budget_scale * margin;
+        csr.hops_scale = longest_km > 0.0 ? margin / longest_km : 0.0;
+    });
+    return csr;
+}
+
+const CityLocationIndex& NetworkView::locations_index() const {
+    call_once(location_index_built, [this] {
+        for (size_t c = 0; c < city_locations.size(); c++) {
+            if (city_locations[c].known()) location_index.add(static_cast<int>(c), city_locations[c]);
+        }
+        location_index.build();
+    });
+    return location_index;
+}
+
+int NetworkView::label_components(vector<int>& group) const {
+    ProbeTimer timer(COMPONENTS_PROBE);
+    size_t n = city_names.size();
+    group.assign(n, -1);
+    vector<int> queue;
+    int groups = 0;
+    for (size_t first = 0; first < n; first++) {
+        if (group[first] != -1) continue;
+        group[first] = groups;
+        queue.assign(1, static_cast<int>(first));
+        for (size_t k = 0; k < queue.size(); k++) {
+            for (const auto& link : adjacency[queue[k]]) {
+                if (group[link.neighbor] == -1) {
+                    group[link.neighbor] = groups;
+                    queue.push_back(link.neighbor);
+                }
+            }
+        }
+        groups++;
+    }
+    return groups;
+}
+
+bool NetworkView::find_route(int source, int target, RouteWeight weight, RouteSearch& search, vector<int>& path,
+                             double& cost) const {
+    ProbeTimer timer(ROUTE_PROBE);
+    const RoadGraphCsr& graph = route_graph();
+    size_t n = city_names.size();
+    if (search.stamp.size() < n) {
+        search.distance.resize(n);
+        search.previous.resize(n);
+        search.stamp.resize(n, 0);
+    }
+    if (++search.current_stamp == 0) {  // Stamp wrapped around: every old entry must be cleared
+        fill(search.stamp.begin(), search.stamp.end(), 0);
+        search.current_stamp = 1;
+    }
+    uint32_t stamp = search.current_stamp;
+    search.heap.reset(n);
+
+    // Cities are queued by their distance plus the straight-line estimate of what remains. The
+    // estimate never exceeds the cost of any road's stretch of it, so a settled city is final.
+    double scale = graph.positions.empty() ? 0.0 : weight == RouteWeight::Budget ? graph.budget_scale : graph.hops_scale;
+    scale *= EARTH_RADIUS_KM;
+    auto remaining = [&](int city) {
+        return scale == 0.0 ? 0.0 : scale * sqrt(squared_chord(graph.positions[city], graph.positions[target]));
+    };
+    search.distance[source] = 0.0;
+    search.previous[source] = -1;
+    search.stamp[source] = stamp;
+    search.heap.push_or_decrease(source, remaining(source));
+    while (!search.heap.empty()) {
+        int city = search.heap.pop().second;
+        if (city == target) break;
+        double distance = search.distance[city];
+        for (int a = graph.offsets[city]; a < graph.offsets[city + 1]; a++) {
+            const RoadGraphCsr::Arc& arc = graph.arcs[a];
+            double step;
+            if (weight == RouteWeight::Hops) {
+                step = 1.0;
+            } else if (arc.budget > 0.0) {
+                step = arc.budget;
+            } else {
+                continue;                      // Unfunded roads are not part of a funded corridor
+            }
+            double candidate = distance + step;
+            if (search.stamp[arc.target] != stamp || candidate < search.distance[arc.target]) {
+                search.stamp[arc.target] = stamp;
+                search.distance[arc.target] = candidate;
+                search.previous[arc.target] = city;
+                search.heap.push_or_decrease(arc.target, candidate + remaining(arc.target));
+            }
+        }
+    }
+
+    path.clear();
+    if (search.stamp[target] != stamp) return false;
+    cost = search.distance[target];
+    for (int city = target; city != -1; city = search.previous[city]) path.push_back(city);
+    reverse(path.begin(), path.end());
+    return true;
+}
+
+void NetworkView::nearest_cities(int city, size_t count, vector<CityDistance>& found) const {
+    ProbeTimer timer(NEAREST_PROBE);
+    found.clear();
+    if (city_locations[city].known()) locations_index().nearest(city_locations[city], count, city, found);
+}
+
+void NetworkView::cities_within(int city, double radius_km, vector<CityDistance>& found) const {
+    ProbeTimer timer(RADIUS_PROBE);
+    found.clear();
+    if (city_locations[city].known()) locations_index().within(city_locations[city], radius_km, city, found);
+}
+
+void NetworkView::propose_roads(double max_km, size_t limit, vector<RoadProposal>& proposals, bool joining_only) const {
+    ProbeTimer timer(PROPOSE_PROBE);
+    proposals.clear();
+    if (limit == 0) return;
+    const CityLocationIndex& index = locations_index();
+    vector<int> group;
+    label_components(group);
+    vector<int> neighbor_of(city_names.size(), -1); // City whose neighbours are marked, per city
+    auto farther = [](const RoadProposal& a, const RoadProposal& b) { return a.km < b.km; };
+    vector<CityDistance> near;
+    for (size_t c = 0; c < city_names.size(); c++) {
+        if (!city_locations[c].known()) continue;
+        int city = static_cast<int>(c);
+        // Once limit pairs are held, only a closer pair can still make the list
+        double radius = proposals.size() < limit ? max_km : proposals.front().km;
+        index.within(city_locations[c], radius, city, near);
+        if (near.empty()) continue;
+        for (const auto& link : adjacency[c]) neighbor_of[link.neighbor] = city;
+        for (const auto& [other, km] : near) {
+            // Each pair is found from both ends and kept from its lower city
+            if (other < city || neighbor_of[other] == city) continue;
+            if (joining_only && group[city] == group[other]) continue;
+            if (proposals.size() == limit) {
+                if (km >= proposals.front().km) break;
+                pop_heap(proposals.begin(), proposals.end(), farther);
+                proposals.pop_back();
+            }
+            proposals.push_back({city, other, km, group[city] != group[other]});
+            push_heap(proposals.begin(), proposals.end(), farther);
+        }
+    }
+    sort_heap(proposals.begin(), proposals.end(), farther);
+}
+
+void NetworkView::plan_minimum_network(NetworkPlan& plan) const {
+    ProbeTimer timer(PLAN_PROBE);
+    plan.candidates.clear();
+    for (size_t r = 0; r < road_list.size(); r++) {
+        if (road_budgets[r] > 0.0) plan.candidates.emplace_back(road_budgets[r], static_cast<int>(r));
+    }
+    sort(plan.candidates.begin(), plan.candidates.end());
+    plan.selected.assign(road_list.size(), 0);
+    plan.components.reset(city_names.size());
+    plan.total_budget = 0.0;
+    plan.selected_count = 0;
+    int needed = static_cast<int>(city_names.size()) - 1;
+    for (const auto& [budget, road] : plan.candidates) {
+        if (plan.components.unite(road_list[road].city1, road_list[road].city2)) {
+            plan.selected[road] = 1;
+            plan.total_budget += budget;
+            if (++plan.selected_count == needed) break;   // Every city is connected
+        }
+    }
+}
+
+void NetworkView::scan_bridges_and_articulations(ConnectivityScan& scan) const {
+    ProbeTimer timer(CONNECTIVITY_PROBE);
+    size_t n = city_names.size();
+    scan.discovery.assign(n, 0);
+    scan.low.assign(n, 0);
+    scan.articulation.assign(n, 0);
+    scan.bridges.clear();
+    int time = 0;
+    for (size_t root = 0; root < n; root++) {
+        if (scan.discovery[root] != 0) continue;
+        int root_children = 0;
+        scan.discovery[root] = scan.low[root] = ++time;
+        scan.stack.push_back({static_cast<int>(root), -1, 0});
+        while (!scan.stack.empty()) {
+            ConnectivityScan::Frame& frame = scan.stack.back();
+            int city = frame.city;
+            if (frame.next_link < adjacency[city].size()) {
+                const RoadLink& link = adjacency[city][frame.next_link++];
+                if (link.road == frame.parent_road) continue;
+                if (scan.discovery[link.neighbor] == 0) {
+                    scan.discovery[link.neighbor] = scan.low[link.neighbor] = ++time;
+                    if (city == static_cast<int>(root)) root_children++;
+                    scan.stack.push_back({link.neighbor, link.road, 0});   // frame is invalid from here
+                } else {
+                    scan.low[city] = min(scan.low[city], scan.discovery[link.neighbor]);
+                }
+                continue;
+            }
+            // city is finished: report what its subtree says about the road to its parent
+            int parent_road = frame.parent_road;
+            scan.stack.pop_back();
+            if (scan.stack.empty()) break;
+            int parent = scan.stack.back().city;
+            scan.low[parent] = min(scan.low[parent], scan.low[city]);
+            if (scan.low[city] > scan.discovery[parent]) scan.bridges.push_back(parent_road);
+            if (parent != static_cast<int>(root) && scan.low[city] >= scan.discovery[parent]) {
+                scan.articulation[parent] = 1;
+            }
+        }
+        if (root_children > 1) scan.articulation[root] = 1;
+    }
+    sort(scan.bridges.begin(), scan.bridges.end());
+}
+
+// Runs task(k, worker) for k = 0 to count - 1 on up to threads threads; worker numbers the thread,
+// so a task can keep scratch state per thread. Threads take the next task as they finish one.
+template <typename Task>
+void run_parallel(size_t count, int threads, const Task& task) {
+    size_t workers = min(static_cast<size_t>(max(threads, 1)), count);
+    atomic<size_t> next{0};
+    auto work = [&](size_t worker) {
+        for (size_t k = next.fetch_add(1, memory_order_relaxed); k < count; k = next.fetch_add(1, memory_order_relaxed)) {
+            task(k, worker);
+        }
+    };
+    vector<thread> pool;
+    for (size_t t = 1; t < workers; t++) pool.emplace_back(work, t);
+    work(0);
+    for (auto& worker : pool) worker.join();
+}
+
+// Relaxes tile c through tiles a and b in Floyd-Warshall order: c[i][j] = min(c[i][j], a[i][k] + b[k][j])
+// for k = 0 to TILE - 1 in turn. c may be a or b, as when the diagonal tile and its row and column
+// are closed over paths through the diagonal tile; the zero diagonal keeps that exact.
+void relax_tile_in_place(double* c, const double* a, const double* b, size_t stride) {
+    const size_t tile = RouteCostTable::TILE;
+    for (size_t k = 0; k < tile; k++) {
+        const double* through_row = b + k * stride;
+        for (size_t i = 0; i < tile; i++) {
+            double to_k = a[i * stride + k];
+            if (to_k == HUGE_VAL) continue;
+            double* row = c + i * stride;
+            for (size_t j = 0; j < tile; j++) row[j] = min(row[j], to_k + through_row[j]);
+        }
+    }
+}
+
+// Folds the min-plus product of tiles a and b into tile c, which must not overlap either:
+// c[i][j] = min(c[i][j], a[i][k] + b[k][j]) over every k. Two rows of 16 entries of c stay in
+// registers across the whole k loop, so each load from b feeds two additions.
+void min_plus_tile(double* c, const double* a, const double* b, size_t stride) {
+    const size_t tile = RouteCostTable::TILE;
+    for (size_t i = 0; i < tile; i += 2) {
+        const double* a0 = a + i * stride;
+        const double* a1 = a0 + stride;
+        for (size_t j = 0; j < tile; j += 16) {
+            double* c0 = c + i * stride + j;
+            double* c1 = c0 + stride;
+            #ifdef __AVX2__
+                __m256d x[4], y[4];
+                for (int q = 0; q < 4; q++) {
+                    x[q] = _mm256_loadu_pd(c0 + 4 * q);
+                    y[q] = _mm256_loadu_pd(c1 + 4 * q);
+                }
+                for (size_t k = 0; k < tile; k++) {
+                    const double* through_row = b + k * stride + j;
+                    __m256d to_k0 = _mm256_broadcast_sd(a0 + k);
+                    __m256d to_k1 = _mm256_broadcast_sd(a1 + k);
+                    for (int q = 0; q < 4; q++) {
+                        __m256d through = _mm256_loadu_pd(through_row + 4 * q);
+                        x[q] = _mm256_min_pd(x[q], _mm256_add_pd(to_k0, through));
+                        y[q] = _mm256_min_pd(y[q], _mm256_add_pd(to_k1, through));
+                    }
+                }
+                for (int q = 0; q < 4; q++) {
+                    _mm256_storeu_pd(c0 + 4 * q, x[q]);
+                    _mm256_storeu_pd(c1 + 4 * q, y[q]);
+                }
+            #else
+                double x[16], y[16];
+                for (int q = 0; q < 16; q++) {
+                    x[q] = c0[q];
+                    y[q] = c1[q];
+                }
+                for (size_t k = 0; k < tile; k++) {
+                    const double* through_row = b + k * stride + j;
+                    double to_k0 = a0[k], to_k1 = a1[k];
+                    for (int q = 0; q < 16; q++) {
+                        x[q] = min(x[q], to_k0 + through_row[q]);
+                        y[q] = min(y[q], to_k1 + through_row[q]);
+                    }
+                }
+                for (int q = 0; q < 16; q++) {
+                    c0[q] = x[q];
+                    c1[q] = y[q];
+                }
+            #endif
+        }
+    }
+}
+
+bool NetworkView::compute_route_costs(RouteCostTable& table, RouteTableMethod method, int threads) const {
+    ProbeTimer timer(ROUTE_TABLE_PROBE);
+    size_t n = city_names.size();
+    table.costs.clear();
+    table.city_count = table.stride = 0;
+    if (n > static_cast<size_t>(MAX_ROUTE_TABLE_CITIES)) return false;
+    const size_t tile = RouteCostTable::TILE;
+    size_t stride = (n + tile - 1) / tile * tile;
+    table.city_count = n;
+    table.stride = stride;
+    table.network_version = version_number;
+    table.threads = threads > 0 ? threads : max(1, static_cast<int>(thread::hardware_concurrency()));
+    const RoadGraphCsr& graph = route_graph();
+
+    if (method == RouteTableMethod::Automatic) {
+        // Dijkstra from every city takes about n * arcs * log2(n) steps against n^3 for Floyd-Warshall,
+        // whose steps are vectorized and stream through cache-resident tiles; measured on this
+        // code, Floyd-Warshall pulls ahead once the funded arcs exceed n^2 / (4 log2 n)
+        size_t funded_arcs = 0;
+        for (const auto& arc : graph.arcs) funded_arcs += arc.budget > 0.0;
+        double log_n = log2(static_cast<double>(max<size_t>(n, 2)));
+        method = static_cast<double>(funded_arcs) * 4.0 * log_n >= static_cast<double>(n) * static_cast<double>(n)
+                     ? RouteTableMethod::FloydWarshall : RouteTableMethod::Dijkstra;
+    }
+    table.method = method;
+    table.costs.assign(stride * stride, HUGE_VAL);
+    if (n == 0) return true;
+
+    if (method == RouteTableMethod::Dijkstra) {
+        vector<RouteHeap> heaps(static_cast<size_t>(table.threads));
+        run_parallel(n, table.threads, [&](size_t source, size_t worker) {
+            RouteHeap& heap = heaps[worker];
+            double* row = table.costs.data() + source * stride;
+            heap.reset(n);
+            row[source] = 0.0;
+            heap.push_or_decrease(static_cast<int>(source), 0.0);
+            while (!heap.empty()) {
+                auto [distance, city] = heap.pop();
+                for (int a = graph.offsets[city]; a < graph.offsets[city + 1]; a++) {
+                    const RoadGraphCsr::Arc& arc = graph.arcs[a];
+                    if (arc.budget <= 0.0) continue;
+                    double candidate = distance + arc.budget;
+                    if (candidate < row[arc.target]) {
+                        row[arc.target] = candidate;
+                        heap.push_or_decrease(arc.target, candidate);
+                    }
+                }
+            }
+        });
+        return true;
+    }
+
+    double* costs = table.costs.data();
+    for (size_t c = 0; c < stride; c++) costs[c * stride + c] = 0.0;
+    for (size_t c = 0; c < n; c++) {
+        for (int a = graph.offsets[c]; a < graph.offsets[c + 1]; a++) {
+            const RoadGraphCsr::Arc& arc = graph.arcs[a];
+            if (arc.budget > 0.0) costs[c * stride + arc.target] = arc.budget;
+        }
+    }
+    size_t tiles = stride / tile;
+    auto tile_at = [&](size_t row, size_t column) { return costs + row * tile * stride + column * tile; };
+    // One set of workers runs every round. Each round closes the diagonal tile k, then the tiles of
+    // row k and column k, which depend only on themselves and the diagonal tile, then every other
+    // tile through row k and column k; a barrier separates the stages, and its completion step,
+    // run by the last worker to arrive, closes the next diagonal tile
+    enum class Stage { Panels, Interior };
+    size_t panels = 2 * (tiles - 1), interior = (tiles - 1) * (tiles - 1);
+    size_t k = 0;
+    Stage stage = Stage::Interior;
+    bool started = false;
+    atomic<size_t> next{0};
+    auto advance = [&]() noexcept {
+        if (stage == Stage::Interior) {
+            if (started) k++;
+            started = true;
+            if (k < tiles) relax_tile_in_place(tile_at(k, k), tile_at(k, k), tile_at(k, k), stride);
+            stage = Stage::Panels;
+        } else {
+            stage = Stage::Interior;
+        }
+        next.store(0, memory_order_relaxed);
+    };
+    size_t workers = min(static_cast<size_t>(table.threads), max<size_t>({panels, interior, 1}));
+    barrier rounds(static_cast<ptrdiff_t>(workers), advance);
+    auto work = [&]() {
+        while (true) {
+            rounds.arrive_and_wait();
+            if (k == tiles) return;
+            double* diagonal = tile_at(k, k);
+            size_t count = stage == Stage::Panels ? panels : interior;
+            for (size_t p = next.fetch_add(1, memory_order_relaxed); p < count; p = next.fetch_add(1, memory_order_relaxed)) {
+                if (stage == Stage::Panels) {
+                    size_t other = p % (tiles - 1);
+                    other += other >= k;
+                    if (p < tiles - 1) {
+                        double* panel = tile_at(k, other);
+                        relax_tile_in_place(panel, diagonal, panel, stride);
+                    } else {
+                        double* panel = tile_at(other, k);
+                        relax_tile_in_place(panel, panel, diagonal, stride);
+                    }
+                } else {
+                    size_t i = p / (tiles - 1), j = p % (tiles - 1);
+                    i += i >= k;
+                    j += j >= k;
+                    min_plus_tile(tile_at(i, j), tile_at(i, k), tile_at(k, j), stride);
+                }
+            }
+        }
+    };
+    vector<thread> pool;
+    for (size_t t = 1; t < workers; t++) pool.emplace_back(work);
+    work();
+    for (auto& worker : pool) worker.join();
+    return true;
+}
+
+bool save_route_cost_table(const RouteCostTable& table, const string& path) {
+    ProbeTimer timer(ROUTE_TABLE_EXPORT_PROBE);
+    FILE* file = fopen(path.c_str(), "wb");
+    if (file == nullptr) return false;
+    RouteTableHeader header = {};
+    memcpy(header.magic, ROUTE_TABLE_MAGIC, sizeof(header.magic));
+    header.version = ROUTE_TABLE_VERSION;
+    header.city_count = static_cast<uint32_t>(table.city_count);
+    header.network_version = table.network_version;
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+    uint32_t hash = 2166136261u;
+    for (size_t row = 0; row < table.city_count && written; row++) {
+        const double* costs = table.costs.data() + row * table.stride;
+        written = fwrite(costs, sizeof(double), table.city_count, file) == table.city_count;
+        hash = checksum(costs, table.city_count * sizeof(double), hash);
+    }
+    header.payload_checksum = hash;
+    written = written && fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fflush(file) == 0;
+    written = written && sync_file(file);
+    fclose(file);
+    timer.add_bytes(sizeof(header) + table.city_count * table.city_count * sizeof(double));
+    return written;
+}
+
+bool InfrastructureManager::parse_batch_line(string_view line, BatchCommand& command, string& error) {
+    size_t space = line.find(' ');
+    string_view keyword = line.substr(0, space);
+    vector<string_view> fields;
+    if (space != string_view::npos) {
+        string_view rest = line.substr(space + 1);
+        size_t start = 0;
+        while (true) {
+            size_t comma = rest.find(',', start);
+            fields.push_back(trim(rest.substr(start, comma - start)));
+            if (comma == string_view::npos) break;
+            start = comma + 1;
+        }
+    }
+    size_t expected;
+    if (keyword == "city") {
+        command.kind = BatchCommand::Kind::City;
+        expected = 1;
+    } else if (keyword == "road") {
+        command.kind = BatchCommand::Kind::Road;
+        expected = 2;
+    } else if (keyword == "budget") {
+        command.kind = BatchCommand::Kind::Budget;
+        expected = 3;
+    } else if (keyword == "rename") {
+        command.kind = BatchCommand::Kind::Rename;
+        expected = 2;
+    } else if (keyword == "location") {
+        command.kind = BatchCommand::Kind::Location;
+        expected = 3;
+    } else {
+        error = "Unknown command '" + string(keyword) + "'.";
+        return false;
+    }
+    if (fields.size() != expected) {
+        error = "'" + string(keyword) + "' takes " + to_string(expected) + " comma-separated value(s).";
+        return false;
+    }
+    command.first = string(fields[0]);
+    if (command.kind == BatchCommand::Kind::Location) {
+        for (auto [text, value] : {pair{fields[1], &command.location.latitude}, pair{fields[2], &command.location.longitude}}) {
+            auto result = from_chars(text.data(), text.data() + text.size(), *value);
+            if (result.ec != errc() || result.ptr != text.data() + text.size()) {
+                error = "Coordinate '" + string(text) + "' is not a number.";
+                return false;
+            }
+        }
+        return true;
+    }
+    if (expected > 1) command.second = string(fields[1]);
+    if (command.kind == BatchCommand::Kind::Budget) {
+        string_view amount = fields[2];
+        auto result = from_chars(amount.data(), amount.data() + amount.size(), command.budget);
+        if (result.ec != errc() || result.ptr != amount.data() + amount.size()) {
+            error = "Budget '" + string(amount) + "' is not a number.";
+            return false;
+        }
+    }
+    return true;
+}
+
+void InfrastructureManager::split_csv_line(string_view line, vector<string_view>& fields) {
+    fields.clear();
+    size_t start = 0;
+    while (true) {
+        size_t comma = line.find(',', start);
+        string_view field = trim(line.substr(start, comma - start));
+        if (field.size() >= 2 && field.front() == '"' && field.back() == '"') {
+            field = field.substr(1, field.size() - 2);
+        }
+        fields.push_back(field);
+        if (comma == string_view::npos) break;
+        start = comma + 1;
+    }
+}
+
+bool InfrastructureManager::parse_csv_header(string_view header, CsvColumns& columns) {
+    vector<string_view> fields;
+    split_csv_line(header, fields);
+    for (size_t c = 0; c < fields.size(); c++) {
+        string name(fields[c]);
+        transform(name.begin(), name.end(), name.begin(), [](unsigned char ch) { return tolower(ch); });
+        int column = static_cast<int>(c);
+        if (name == "from" || name == "city1" || name == "origin") columns.from = column;
+        else if (name == "to" || name == "city2" || name == "destination") columns.to = column;
+        else if (name == "budget") columns.budget = column;
+    }
+    return columns.from != -1 && columns.to != -1;
+}
+
+void InfrastructureManager::resolve_imported_road(int line, string_view from, string_view to, string_view budget_text, ImportChunk& chunk) {
+    auto reject = [&](string reason) { chunk.rejections.push_back({line, move(reason)}); };
+    for (string_view name : {from, to}) {
+        if (!is_valid_city_name(name)) {
+            reject("City name '" + string(name) + "' is invalid.");
+            return;
+        }
+    }
+    int i = get_city_index(from);
+    int j = get_city_index(to);
+    if (i == -1 || j == -1) {
+        reject("City '" + string(i == -1 ? from : to) + "' does not exist.");
+        return;
+    }
+    if (i == j) {
+        reject("Cannot add a road from a city to itself.");
+        return;
+    }
+    double budget = 0.0;
+    if (!budget_text.empty() && budget_text != "null") {
+        auto result = from_chars(budget_text.data(), budget_text.data() + budget_text.size(), budget);
+        if (result.ec != errc() || result.ptr != budget_text.data() + budget_text.size()) {
+            reject("Budget '" + string(budget_text) + "' is not a number.");
+            return;
+        }
+        if (!is_valid_budget(budget)) {
+            reject("Budget must be between 0 and 1000 billion RWF.");
+            return;
+        }
+    }
+    chunk.roads.push_back({line, i, j, budget});
+}
+
+void InfrastructureManager::parse_csv_chunk(string_view data, size_t begin, size_t end, const CsvColumns& columns, ImportChunk& chunk) {
+    vector<string_view> fields;
+    size_t needed = static_cast<size_t>(max(columns.from, columns.to)) + 1; // A budget column may be left off
+    size_t pos = begin;
+    while (pos < end) {
+        size_t newline = data.find('\n', pos);
+        size_t line_end = newline == string_view::npos || newline > end ? end : newline;
+        string_view line = trim(data.substr(pos, line_end - pos));
+        int line_number = chunk.newlines;
+        if (line_end < end) chunk.newlines++;
+        pos = line_end + 1;
+        if (line.empty()) continue;
+        split_csv_line(line, fields);
+        if (fields.size() < needed) {
+            chunk.rejections.push_back({line_number, "Row has " + to_string(fields.size()) + " column(s)."});
+            continue;
+        }
+        string_view budget = columns.budget != -1 && columns.budget < static_cast<int>(fields.size())
+                                 ? fields[columns.budget] : string_view();
+        resolve_imported_road(line_number, fields[columns.from], fields[columns.to], budget, chunk);
+    }
+}
+
+size_t InfrastructureManager::read_json_value(string_view data, size_t pos, string_view& value) {
+    while (pos < data.size() && (isspace(static_cast<unsigned char>(data[pos])) || data[pos] == ':')) pos++;
+    if (pos < data.size() && data[pos] == '"') {
+        size_t close = pos + 1;
+        while (close < data.size() && data[close] != '"') close += data[close] == '\\' ? 2 : 1;
+        close = min(close, data.size());
+        value = data.substr(pos + 1, close - pos - 1);
+        return close + 1;
+    }
+    size_t stop = data.find_first_of(",}] \t\r\n", pos);
+    if (stop == string_view::npos) stop = data.size();
+    value = data.substr(pos, stop - pos);
+    return stop;
+}
+
+void InfrastructureManager::parse_geojson_chunk(string_view data, size_t begin, size_t end, ImportChunk& chunk) {
+    const string_view key = "\"properties\"";
+    size_t counted = begin;             // Newlines are counted up to here
+    size_t pos = begin;
+    while (true) {
+        size_t found = data.find(key, pos);
+        if (found == string_view::npos || found >= end) break;
+        chunk.newlines += static_cast<int>(count(data.begin() + counted, data.begin() + found, '\n'));
+        counted = found;
+        int line_number = chunk.newlines;
+        size_t open = data.find('{', found + key.size());
+        size_t close = open == string_view::npos ? string_view::npos : data.find('}', open);
+        if (close == string_view::npos) {
+            chunk.rejections.push_back({line_number, "Feature properties are not closed."});
+            break;
+        }
+        string_view from, to, budget;
+        size_t field = open + 1;
+        while (true) {
+            size_t quote = data.find('"', field);
+            if (quote == string_view::npos || quote > close) break;
+            size_t quote_end = data.find('"', quote + 1);
+            string_view name = data.substr(quote + 1, quote_end - quote - 1);
+            string_view value;
+            field = read_json_value(data, quote_end + 1, value);
+            if (name == "from" || name == "city1") from = value;
+            else if (name == "to" || name == "city2") to = value;
+            else if (name == "budget") budget = value;
+            // A string value may contain '}', so the object's end is found again past each value
+            if (field > close) close = data.find('}', field);
+            if (close == string_view::npos) close = data.size();
+        }
+        resolve_imported_road(line_number, from, to, budget, chunk);
+        pos = close;
+    }
+    chunk.newlines += static_cast<int>(count(data.begin() + counted, data.begin() + end, '\n'));
+}
+
+bool InfrastructureManager::import_roads(const string& path, ImportFormat format) {
+    ProbeTimer timer(IMPORT_PROBE);
+    MappedFile file;
+    if (!file.open(path)) {
+        cout << "Error: Cannot open '" << path << "'.\n";
+        return false;
+    }
+    timer.add_bytes(file.size());
+    string_view data(file.data(), file.size());
+
+    size_t body = 0;                    // Start of the rows, past the CSV header
+    int first_line = 1;                 // Line number at body
+    CsvColumns columns;
+    if (format == ImportFormat::Csv) {
+        size_t header_end = data.find('\n');
+        if (!parse_csv_header(data.substr(0, header_end), columns)) {
+            cout << "Error: The CSV header must name 'from' and 'to' columns (and optionally 'budget').\n";
+            return false;
+        }
+        body = header_end == string_view::npos ? data.size() : header_end + 1;
+        first_line = 2;
+    }
+
+    // Cut the body into chunks of at least 1 MB, one per core
+    const size_t min_chunk = size_t(1) << 20;
+    size_t threads = max<size_t>(1, thread::hardware_concurrency());
+    threads = max<size_t>(1, min(threads, (data.size() - body) / min_chunk));
+    vector<size_t> bounds = {body};
+    for (size_t t = 1; t < threads; t++) {
+        size_t cut = body + (data.size() - body) * t / threads;
+        if (format == ImportFormat::Csv) {
+            size_t newline = data.find('\n', cut);
+            cut = newline == string_view::npos ? data.size() : newline + 1;
+        }
+        bounds.push_back(max(cut, bounds.back()));
+    }
+    bounds.push_back(data.size());
+
+    vector<ImportChunk> chunks(bounds.size() - 1);
+    vector<thread> workers;
+    for (size_t c = 0; c < chunks.size(); c++) {
+        workers.emplace_back([&, c] {
+            if (format == ImportFormat::Csv) parse_csv_chunk(data, bounds[c], bounds[c + 1], columns, chunks[c]);
+            else parse_geojson_chunk(data, bounds[c], bounds[c + 1], chunks[c]);
+        });
+    }
+    for (auto& worker : workers) worker.join();
+
+    // Merge in file order as one transaction
+    int added = 0, updated = 0, unchanged = 0;
+    vector<ImportRejection> rejections;
+    {
+        lock_guard<mutex> lock(state_mutex);
+        string records;
+        size_t record_count = 0;
+        int year = current_fiscal_year();
+        int line_base = first_line;
+        for (const auto& chunk : chunks) {
+            for (const auto& row : chunk.roads) {
+                page_in_roads(row.city1);
+                page_in_roads(row.city2);
+                int road = road_slot(row.city1, row.city2);
+                if (road == -1) {
+                    road = insert_road(row.city1, row.city2, next_road_nbr, 0.0);
+                    records += road_record(road_list[road]) + "\n";
+                    record_count++;
+                    added++;
+                } else if (row.budget == 0.0 || row.budget == road_budgets[road]) {
+                    unchanged++;
+                    continue;
+                } else {
+                    updated++;
+                }
+                if (row.budget > 0.0) {
+                    set_road_budget(road, row.budget, year);
+                    records += budget_record(row.city1, row.city2, row.budget, year) + "\n";
+                    record_count++;
+                }
+            }
+            for (const auto& rejection : chunk.rejections) {
+                rejections.push_back({line_base + rejection.line, rejection.reason});
+            }
+            line_base += chunk.newlines;
+        }
+        log_changes(records, record_count);
+        publish_view();
+    }
+
+    const size_t max_listed = 100;
+    for (size_t r = 0; r < rejections.size() && r < max_listed; r++) {
+        cout << "Rejected line " << rejections[r].line << ": " << rejections[r].reason << "\n";
+    }
+    if (rejections.size() > max_listed) {
+        cout << "... and " << (rejections.size() - max_listed) << " more rejected line(s).\n";
+    }
+    cout << "Imported " << (added + updated + unchanged) << " road row(s): " << added << " new road(s), "
+         << updated << " budget update(s), " << unchanged << " unchanged; " << rejections.size()
+         << " row(s) rejected.\n";
+    return true;
+}
+
+bool InfrastructureManager::import_format_for(const string& path, ImportFormat& format) {
+    string extension = filesystem::path(path).extension().string();
+    transform(extension.begin(), extension.end(), extension.begin(),
+              [](unsigned char ch) { return tolower(ch); });
+    if (extension == ".csv") format = ImportFormat::Csv;
+    else if (extension == ".geojson" || extension == ".json") format = ImportFormat::GeoJson;
+    else return false;
+    return true;
+}
+
+void InfrastructureManager::neighbor_overlap(int a, int b, vector<int>& common, size_t& two_hop_count) {
+    if (!all_roads_loaded()) {
+        // Needs the roads of a, b and every city one road from a
+        lock_guard<mutex> lock(state_mutex);
+        page_in_roads(a);
+        page_in_roads(b);
+        vector<int> neighbors;
+        for (const auto& link : adjacency[a]) neighbors.push_back(link.neighbor);
+        for (int neighbor : neighbors) page_in_roads(neighbor);
+    }
+    common.clear();
+    size_t n = city_names.size();
+    refresh_dense_roads();
+    if (dense_mode) {
+        size_t words = dense_roads.row_words();
+        const uint64_t* row_a = dense_roads.row(a);
+        const uint64_t* row_b = dense_roads.row(b);
+        common.reserve(count_common_bits(row_a, row_b, words));
+        for (size_t w = 0; w < words; w++) {
+            for (uint64_t both = row_a[w] & row_b[w]; both != 0; both &= both - 1) {
+                common.push_back(static_cast<int>(w * 64 + countr_zero(both)));
+            }
+        }
+        vector<uint64_t> reach(row_a, row_a + words);
+        for (const auto& link : adjacency[a]) or_bits_into(reach.data(), dense_roads.row(link.neighbor), words);
+        reach[a / 64] &= ~(uint64_t(1) << (a % 64));
+        two_hop_count = 0;
+        for (uint64_t word : reach) two_hop_count += popcount(word);
+        return;
+    }
+    vector<char> mark(n, 0);
+    for (const auto& link : adjacency[a]) mark[link.neighbor] = 1;
+    for (const auto& link : adjacency[b]) {
+        if (mark[link.neighbor]) common.push_back(link.neighbor);
+    }
+    sort(common.begin(), common.end());
+    two_hop_count = adjacency[a].size();
+    for (const auto& link : adjacency[a]) {
+        for (const auto& next : adjacency[link.neighbor]) {
+            if (next.neighbor != a && !mark[next.neighbor]) {
+                mark[next.neighbor] = 1;
+                two_hop_count++;
+            }
+        }
+    }
+}
+
+bool InfrastructureManager::is_valid_city_name(string_view name) {
+    if (name.empty() || name.length() < 2) {
+        return false;
+    }
+    bool has_letter = false;
+    for (char c : name) {
+        if (isalpha(c)) has_letter = true;
+        if (!isalnum(c) && c != ' ' && c != '-') {
+            return false;
+        }
+    }
+    return has_letter;
+}
+
+bool InfrastructureManager::is_valid_budget(double budget) {
+    return budget > 0 && budget <= 1000.0; // Max 1000 billion RWF
+}
+
+void InfrastructureManager::ensure_data_directory() {
+    #ifdef _WIN32
+        _mkdir("data");
+    #else
+        mkdir("data", 0777);
+    #endif
+}
+
+string InfrastructureManager::format_cities_file() {
+    // The location columns appear once any city has a location, and stay empty for those without
+    bool located = any_of(city_locations.begin(), city_locations.end(), [](GeoPoint at) { return at.known(); });
+    string contents = located ? "Index\tCity Name\tLatitude\tLongitude\n" : "Index\tCity Name\n";
+    char digits[32];
+    for (size_t i = 0; i < city_names.size(); i++) {
+        contents += to_string(i + 1);
+        contents += '\t';
+        contents += city_names[i];
+        if (city_locations[i].known()) {
+            for (double degrees : {city_locations[i].latitude, city_locations[i].longitude}) {
+                contents += '\t';
+                contents.append(digits, to_chars(digits, digits + sizeof(digits), degrees).ptr);
+            }
+        }
+        contents += '\n';
+    }
+    return contents;
+}
+
+string InfrastructureManager::format_roads_file() {
+    // road_list is kept in Nbr order, so the file is a straight serialization of it. Cities
+    // are named by their index in cities.txt, so renaming one leaves this file as it is.
+    ostringstream out;
+    out << ROADS_FILE_HEADER << "\n" << fixed << setprecision(1);
+    for (size_t r = 0; r < road_list.size(); r++) {
+        const Road& road = road_list[r];
+        out << road.nbr << "\t" << (road.city1 + 1) << "\t" << (road.city2 + 1) << "\t" << road_budgets[r] << "\n";
+    }
+    return out.str();
+}
+
+string InfrastructureManager::format_cities_snapshot() {
+    size_t city_count = city_names.size();
+    size_t names_size = 0;
+    for (size_t i = 0; i < city_count; i++) names_size += city_names[i].size();
+    size_t offsets_size = align_to_8((city_count + 1) * sizeof(uint32_t));
+
+    string contents(sizeof(SnapshotHeader) + offsets_size + align_to_8(names_size) + city_count * 2 * sizeof(double), '\0');
+    char* offsets_section = contents.data() + sizeof(SnapshotHeader);
+    char* names_section = offsets_section + offsets_size;
+    char* locations_section = names_section + align_to_8(names_size);
+    for (size_t i = 0; i < city_count; i++) {
+        double degrees[2] = {city_locations[i].latitude, city_locations[i].longitude};
+        memcpy(locations_section + i * sizeof(degrees), degrees, sizeof(degrees));
+    }
+    uint32_t offset = 0;
+    for (size_t i = 0; i < city_count; i++) {
+        memcpy(offsets_section + i * sizeof(uint32_t), &offset, sizeof(offset));
+        memcpy(names_section + offset, city_names[i].data(), city_names[i].size());
+        offset += static_cast<uint32_t>(city_names[i].size());
+    }
+    memcpy(offsets_section + city_count * sizeof(uint32_t), &offset, sizeof(offset));
+    seal_snapshot(contents, CITIES_MAGIC, CITIES_SNAPSHOT_VERSION, city_count, 0);
+    return contents;
+}
+
+string InfrastructureManager::format_roads_snapshot() {
+    size_t city_count = city_names.size();
+    size_t roads_size = road_list.size() * sizeof(SnapshotRoad);
+    string contents(sizeof(SnapshotHeader) + roads_size + road_index_size(city_count, road_list.size()), '\0');
+    char* roads_section = contents.data() + sizeof(SnapshotHeader);
+    for (size_t r = 0; r < road_list.size(); r++) {
+        const Road& road = road_list[r];
+        SnapshotRoad entry = {static_cast<uint32_t>(road.city1), static_cast<uint32_t>(road.city2),
+                              static_cast<uint32_t>(road.nbr), 0, road_budgets[r]};
+        memcpy(roads_section + r * sizeof(SnapshotRoad), &entry, sizeof(entry));
+    }
+
+    // Adjacency lists hold road slots in increasing order, which is the order of roads[]
+    RoadIndexHeader index_header = {static_cast<uint32_t>(city_count), 0};
+    char* index_section = roads_section + roads_size;
+    memcpy(index_section, &index_header, sizeof(index_header));
+    char* offsets_section = index_section + sizeof(index_header);
+    char* city_roads_section = offsets_section + (city_count + 1) * sizeof(uint32_t);
+    uint32_t offset = 0;
+    for (size_t c = 0; c < city_count; c++) {
+        memcpy(offsets_section + c * sizeof(uint32_t), &offset, sizeof(offset));
+        for (const auto& link : adjacency[c]) {
+            uint32_t position = static_cast<uint32_t>(link.road);
+            memcpy(city_roads_section + offset * sizeof(uint32_t), &position, sizeof(position));
+            offset++;
+        }
+    }
+    memcpy(offsets_section + city_count * sizeof(uint32_t), &offset, sizeof(offset));
+    seal_snapshot(contents, ROADS_MAGIC, ROADS_SNAPSHOT_VERSION, road_list.size(), static_cast<uint32_t>(next_road_nbr));
+    return contents;
+}
+
+bool InfrastructureManager::load_snapshot() {
+    // Lazy loading skips the roads checksum, which would read the whole file, and checks each
+    // road as it is paged in instead
+    MappedFile cities_snapshot;
+    auto lazy = make_unique<LazyRoadSnapshot>();
+    MappedFile& roads_snapshot = lazy->file;
+    SnapshotHeader cities_header, roads_header;
+    if (!open_snapshot(cities_snapshot, CITIES_SNAPSHOT_PATH, CITIES_MAGIC, CITIES_SNAPSHOT_VERSION, true, cities_header) ||
+        !open_snapshot(roads_snapshot, ROADS_SNAPSHOT_PATH, ROADS_MAGIC, ROADS_SNAPSHOT_VERSION,
+                       !persistence.lazy_roads, roads_header)) {
+        return false;
+    }
+    bool lazy_load = persistence.lazy_roads && roads_header.version >= 2;
+    if (persistence.lazy_roads && !lazy_load &&
+        roads_header.payload_checksum != checksum(roads_snapshot.data() + sizeof(SnapshotHeader), roads_header.payload_size)) {
+        cout << "Error: " << ROADS_SNAPSHOT_PATH << " failed its checksum; loading the text files instead.\n";
+        return false;
+    }
+    size_t city_count = cities_header.count;
+    size_t offsets_size = align_to_8((city_count + 1) * sizeof(uint32_t));
+    size_t roads_size = size_t(roads_header.count) * sizeof(SnapshotRoad);
+    RoadIndexHeader index_header = {0, 0};
+    if (roads_header.version >= 2 && roads_header.payload_size >= roads_size + sizeof(index_header)) {
+        memcpy(&index_header, roads_snapshot.data() + sizeof(SnapshotHeader) + roads_size, sizeof(index_header));
+    }
+    size_t roads_payload = roads_header.version >= 2 ? roads_size + road_index_size(index_header.city_count, roads_header.count)
+                                                     : roads_size;
+    size_t locations_size = cities_header.version >= 2 ? city_count * 2 * sizeof(double) : 0;
+    if (cities_header.payload_size < offsets_size + locations_size || roads_header.payload_size != roads_payload ||
+        index_header.city_count > city_count) {
+        cout << "Error: The snapshots are inconsistent; loading the text files instead.\n";
+        return false;
+    }
+
+    // Sections are 8-byte aligned within a page-aligned mapping, so they are read in place
+    const char* offsets_section = cities_snapshot.data() + sizeof(SnapshotHeader);
+    const uint32_t* offsets = reinterpret_cast<const uint32_t*>(offsets_section);
+    const char* names_section = offsets_section + offsets_size;
+    const SnapshotRoad* roads = reinterpret_cast<const SnapshotRoad*>(roads_snapshot.data() + sizeof(SnapshotHeader));
+    const uint32_t* road_offsets = reinterpret_cast<const uint32_t*>(roads_snapshot.data() + sizeof(SnapshotHeader) +
+                                                                     roads_size + sizeof(index_header));
+    bool consistent = offsets[city_count] <= cities_header.payload_size - offsets_size - locations_size;
+    if (cities_header.version >= 2) {
+        consistent = consistent && cities_header.payload_size == offsets_size + align_to_8(offsets[city_count]) + locations_size;
+    }
+    const char* locations_section = names_section + align_to_8(consistent ? offsets[city_count] : 0);
+    // Each name must lie inside the names section and be one add_city would have accepted, since
+    // the name index takes them as they are
+    consistent = consistent && offsets[0] == 0;
+    unordered_set<string_view> names;
+    names.reserve(consistent ? city_count : 0);
+    for (size_t i = 0; consistent && i < city_count; i++) {
+        consistent = offsets[i] <= offsets[i + 1];
+        string_view name(names_section + offsets[i], consistent ? offsets[i + 1] - offsets[i] : 0);
+        consistent = consistent && is_valid_city_name(name) && names.insert(name).second;
+    }
+    if (lazy_load) {
+        // The index is checked here, in O(cities); the roads it points at when they are paged in
+        consistent = consistent && road_offsets[0] == 0 &&
+                     road_offsets[index_header.city_count] == 2 * size_t(roads_header.count);
+        for (uint32_t c = 0; consistent && c < index_header.city_count; c++) {
+            consistent = road_offsets[c] <= road_offsets[c + 1];
+        }
+    } else {
+        for (uint32_t r = 0; consistent && r < roads_header.count; r++) {
+            consistent = is_usable_snapshot_road(roads[r], city_count);
+        }
+    }
+    if (!consistent) {
+        cout << "Error: The snapshots are inconsistent; loading the text files instead.\n";
+        return false;
+    }
+
+    reserve_cities(city_count);
+    for (size_t i = 0; i < city_count; i++) {
+        append_city(string_view(names_section + offsets[i], offsets[i + 1] - offsets[i]));
+        if (locations_size == 0) continue;
+        double degrees[2];
+        memcpy(degrees, locations_section + i * sizeof(degrees), sizeof(degrees));
+        // An out-of-range location could only come from a damaged file; the city keeps none
+        if (is_valid_location(degrees[0], degrees[1])) {
+            city_locations[i] = {degrees[0], degrees[1]};
+            view_locations.mutable_at(i) = city_locations[i];
+        }
+    }
+    next_road_nbr = max(next_road_nbr, static_cast<int>(roads_header.next_road_nbr));
+    cities_changed = false;
+    if (lazy_load) {
+        lazy->roads = roads;
+        lazy->road_count = roads_header.count;
+        lazy->indexed_cities = index_header.city_count;
+        lazy->offsets = road_offsets;
+        lazy->city_roads = road_offsets + index_header.city_count + 1;
+        lazy->paged_in.assign(index_header.city_count, 0);
+        lazy_roads = move(lazy);
+        roads_complete.store(false, memory_order_release);
+        roads_changed = false;
+        return true;
+    }
+    road_list.reserve(roads_header.count);
+    road_budgets.reserve(roads_header.count);
+    view_roads.reserve(roads_header.count);
+    view_budgets.reserve(roads_header.count);
+    for (uint32_t r = 0; r < roads_header.count; r++) {
+        insert_road(static_cast<int>(roads[r].city1), static_cast<int>(roads[r].city2),
+                    static_cast<int>(roads[r].nbr), roads[r].budget);
+    }
+    next_road_nbr = max(next_road_nbr, static_cast<int>(roads_header.next_road_nbr));
+    // A roads file without the index is rewritten with one at the next compaction
+    roads_changed = persistence.lazy_roads && roads_header.version < 2;
+    return true;
+}
+
+bool InfrastructureManager::save_data_files(const vector<DataFile>& files) {
+    ensure_data_directory();
+    for (const auto& file : files) {
+        if (!write_file_synced(string(file.path) + ".new", file.contents)) {
+            cout << "Error: Cannot save to " << file.path << ". Check permissions.\n";
+            return false;
+        }
+    }
+    if (!write_file_synced(COMPACTION_MARKER_PATH, "")) {
+        cout << "Error: Cannot write " << COMPACTION_MARKER_PATH << ".\n";
+        return false;
+    }
+    return finish_data_file_swap();
+}
+
+// Lists the new data files written beside the ones they replace
+vector<filesystem::path> find_new_data_files() {
+    vector<filesystem::path> found;
+    error_code ec;
+    for (const auto& entry : filesystem::directory_iterator("data", ec)) {
+        if (entry.path().extension() == ".new") found.push_back(entry.path());
+    }
+    return found;
+}
+
+bool InfrastructureManager::finish_data_file_swap() {
+    error_code ec;
+    for (const auto& new_path : find_new_data_files()) {
+        filesystem::path path = new_path;
+        path.replace_extension();
+        filesystem::rename(new_path, path, ec);
+        if (ec) {
+            cout << "Error: Cannot replace " << path.string() << ".\n";
+            return false;
+        }
+    }
+    // The new files hold everything the retired log did, and replaying its records over them could
+    // misapply those that refer to cities by an index a later removal has changed
+    filesystem::remove(RETIRED_LOG_PATH, ec);
+    filesystem::remove(COMPACTION_MARKER_PATH, ec);
+    return true;
+}
+
+void InfrastructureManager::recover_data_files() {
+    error_code ec;
+    if (filesystem::exists(COMPACTION_MARKER_PATH, ec)) {
+        finish_data_file_swap();
+    } else {
+        for (const auto& new_path : find_new_data_files()) filesystem::remove(new_path, ec);
+    }
+}
+
+void InfrastructureManager::compact() {
+    lock_guard<mutex> compaction_lock(compaction_mutex);
+    error_code ec;
+    vector<DataFile> files;
+    bool saved_cities, saved_roads;
+    vector<int> saved_years;
+    uint64_t exported;
+    optional<ProbeTimer> timer;         // Started once there is something to save
+    {
+        lock_guard<mutex> lock(state_mutex);
+        if (transaction_open) return;   // The files must not reflect uncommitted changes
+        bool retired_pending = filesystem::exists(RETIRED_LOG_PATH, ec);
+        saved_years = budget_history.changed_years();
+        if (wal.record_count() == 0 && !retired_pending && !cities_changed && !roads_changed && saved_years.empty()) {
+            return;
+        }
+        timer.emplace(SAVE_PROBE);
+        if (!wal.rotate(RETIRED_LOG_PATH)) {
+            cout << "Error: Cannot rotate " << LOG_PATH << ".\n";
+            return;
+        }
+        // Swapped in with the other files, so a consumer bootstrapping from them knows where they end
+        exported = wal.last_sequence();
+        files.push_back({FEED_POSITION_PATH, to_string(exported) + "\n"});
+        // Only the files describing what changed are rewritten; a rename leaves the roads alone
+        saved_cities = cities_changed;
+        saved_roads = roads_changed;
+        if (saved_cities) {
+            files.push_back({CITIES_SNAPSHOT_PATH, format_cities_snapshot()});
+            files.push_back({CITIES_PATH, format_cities_file()});
+        }
+        if (saved_roads) {
+            page_in_all_roads();        // The files are written whole
+            sweep_removed_roads();
+            files.push_back({ROADS_SNAPSHOT_PATH, format_roads_snapshot()});
+            files.push_back({ROADS_PATH, format_roads_file()});
+        }
+        for (int year : saved_years) {
+            files.push_back({BudgetHistory::segment_path(year), budget_history.format_segment(year)});
+        }
+        cities_changed = false;
+        roads_changed = false;
+    }
+    for (const auto& file : files) timer->add_bytes(file.contents.size());
+    if (save_data_files(files)) {
+        filesystem::remove(LEGACY_SNAPSHOT_PATH, ec);
+        exported_change_sequence.store(exported, memory_order_release);
+    } else {
+        lock_guard<mutex> lock(state_mutex);
+        cities_changed = cities_changed || saved_cities;
+        roads_changed = roads_changed || saved_roads;
+        for (int year : saved_years) budget_history.segment(year).changed = true;
+    }
+    last_compaction = chrono::steady_clock::now();
+}
+
+bool InfrastructureManager::compaction_due() {
+    size_t records = wal.record_count();
+    if (records >= persistence.compact_after_records) return true;
+    return records > 0 && chrono::steady_clock::now() - last_compaction >=
+                          chrono::milliseconds(persistence.compact_interval_ms);
+}
+
+void InfrastructureManager::run_background_worker() {
+    unique_lock<mutex> lock(worker_mutex);
+    while (!stopping) {
+        worker_wakeup.wait_for(lock, chrono::milliseconds(max(persistence.group_commit_ms, 1)));
+        if (stopping) break;
+        lock.unlock();
+        wal.flush_if_due();
+        if (compaction_due()) compact();
+        lock.lock();
+    }
+}
+
+string InfrastructureManager::city_record(string_view name) {
+    return string("C\t").append(name);
+}
+
+string InfrastructureManager::road_record(const Road& road) {
+    return "R\t" + to_string(road.city1) + "\t" + to_string(road.city2) + "\t" + to_string(road.nbr);
+}
+
+string InfrastructureManager::budget_record(int i, int j, double budget, int fiscal_year) {
+    char digits[32];
+    auto result = to_chars(digits, digits + sizeof(digits), budget); // Shortest exact form
+    string record = "B\t" + to_string(i) + "\t" + to_string(j) + "\t" + string(digits, result.ptr);
+    if (fiscal_year != 0) record += "\t" + to_string(fiscal_year);
+    return record;
+}
+
+string InfrastructureManager::year_budget_record(int nbr, int fiscal_year, double budget) {
+    char digits[32];
+    auto result = to_chars(digits, digits + sizeof(digits), budget);
+    return "Y\t" + to_string(nbr) + "\t" + to_string(fiscal_year) + "\t" + string(digits, result.ptr);
+}
+
+string InfrastructureManager::rename_record(int index, string_view name) {
+    return "E\t" + to_string(index) + "\t" + string(name);
+}
+
+string InfrastructureManager::road_removal_record(int i, int j) {
+    return "D\t" + to_string(i) + "\t" + to_string(j);
+}
+
+string InfrastructureManager::city_removal_record(string_view name) {
+    return "X\t" + string(name);
+}
+
+string InfrastructureManager::city_restore_record(int index, string_view name) {
+    return "A\t" + to_string(index) + "\t" + string(name);
+}
+
+string InfrastructureManager::location_record(int index, GeoPoint location) {
+    char digits[64];
+    char* end = to_chars(digits, digits + sizeof(digits), location.latitude).ptr;
+    *end++ = '\t';
+    end = to_chars(end, digits + sizeof(digits), location.longitude).ptr;
+    return "L\t" + to_string(index) + "\t" + string(digits, end);
+}
+
+bool InfrastructureManager::is_city(int id) const {
+    return id >= 0 && id < static_cast<int>(city_names.size());
+}
+
+ChangeStatus InfrastructureManager::check_new_name(string_view name) const {
+    if (city_exists(name)) return ChangeStatus::DuplicateName;
+    if (!is_valid_city_name(name)) return ChangeStatus::InvalidName;
+    return ChangeStatus::Ok;
+}
+
+ChangeStatus InfrastructureManager::check_new_city(string_view name, size_t city_count) const {
+    if (city_count >= static_cast<size_t>(max_cities)) return ChangeStatus::CityLimitReached;
+    return check_new_name(name);
+}
+
+ChangeStatus InfrastructureManager::check_city_pair(int city1, int city2) const {
+    if (!is_city(city1) || !is_city(city2)) return ChangeStatus::UnknownCity;
+    if (city1 == city2) return ChangeStatus::SameCity;
+    return ChangeStatus::Ok;
+}
+
+ChangeStatus InfrastructureManager::check_budget_change(int city1, int city2, double budget) {
+    ChangeStatus status = check_city_pair(city1, city2);
+    if (status != ChangeStatus::Ok) return status;
+    page_in_roads(city1);
+    page_in_roads(city2);
+    if (!has_road(city1, city2)) return ChangeStatus::NoSuchRoad;
+    if (!is_valid_budget(budget)) return ChangeStatus::InvalidBudget;
+    return ChangeStatus::Ok;
+}
+
+ChangeStatus InfrastructureManager::reject_bulk(ChangeStatus status, size_t position, size_t* failed) {
+    if (failed != nullptr) *failed = position;
+    return status;
+}
+
+void InfrastructureManager::set_road_budget(int road, double budget, int fiscal_year) {
+    if (recording_changes) {
+        record_change({ChangeDelta::Kind::SetBudget, road_list[road].city1, road_list[road].city2, road_list[road].nbr,
+                       road_budgets[road], budget, {}, {}, fiscal_year, {}, {}});
+    }
+    road_budgets[road] = budget;
+    view_budgets.mutable_at(road) = budget;
+    roads_changed = true;
+    // A transaction's history is appended when it commits, so rolling back leaves none behind
+    if (fiscal_year != 0 && !transaction_open) budget_history.append(fiscal_year, road_list[road].nbr, budget);
+}
+
+void InfrastructureManager::set_history_budget(int nbr, int fiscal_year, double budget) {
+    if (recording_changes) {
+        double old_budget = 0.0;
+        budget_history.latest(fiscal_year, nbr, old_budget);
+        record_change({ChangeDelta::Kind::SetYearBudget, -1, -1, nbr, old_budget, budget, {}, {}, fiscal_year, {}, {}});
+    }
+    if (!transaction_open) budget_history.append(fiscal_year, nbr, budget);
+}
+
+bool InfrastructureManager::parse_log_int(string_view field, int& value) {
+    auto result = from_chars(field.data(), field.data() + field.size(), value);
+    return result.ec == errc() && result.ptr == field.data() + field.size() && value >= 0;
+}
+
+bool InfrastructureManager::apply_log_record(string_view record) {
+    vector<string_view> fields;
+    size_t start = 0;
+    while (true) {
+        size_t tab = record.find('\t', start);
+        fields.push_back(record.substr(start, tab - start));
+        if (tab == string_view::npos) break;
+        start = tab + 1;
+    }
+    int n = static_cast<int>(city_names.size());
+    int i, j, nbr;
+    if (fields[0] == "C" && fields.size() == 2) {
+        string_view name = fields[1];
+        if (!is_valid_city_name(name)) return false;
+        if (!city_exists(name)) append_city(name);
+    } else if (fields[0] == "R" && fields.size() == 4) {
+        if (!parse_log_int(fields[1], i) || !parse_log_int(fields[2], j) || !parse_log_int(fields[3], nbr) ||
+            i >= n || j >= n || i == j) return false;
+        page_in_roads(i);
+        page_in_roads(j);
+        if (!has_road(i, j)) restore_road(i, j, nbr, 0.0);
+    } else if (fields[0] == "B" && (fields.size() == 4 || fields.size() == 5)) {
+        double budget;
+        int year = 0;
+        auto result = from_chars(fields[3].data(), fields[3].data() + fields[3].size(), budget);
+        if (!parse_log_int(fields[1], i) || !parse_log_int(fields[2], j) || result.ec != errc() ||
+            i >= n || j >= n || (budget != 0.0 && !is_valid_budget(budget)) ||
+            (fields.size() == 5 && (!parse_log_int(fields[4], year) || !is_valid_fiscal_year(year)))) return false;
+        page_in_roads(i);
+        page_in_roads(j);
+        int road = road_slot(i, j);
+        if (road == -1) return false;
+        set_road_budget(road, budget, year);
+    } else if (fields[0] == "Y" && fields.size() == 4) {
+        double budget;
+        int year;
+        auto result = from_chars(fields[3].data(), fields[3].data() + fields[3].size(), budget);
+        if (!parse_log_int(fields[1], nbr) || !parse_log_int(fields[2], year) || !is_valid_fiscal_year(year) ||
+            result.ec != errc() || (budget != 0.0 && !is_valid_budget(budget))) return false;
+        set_history_budget(nbr, year, budget);
+    } else if (fields[0] == "D" && fields.size() == 3) {
+        if (!parse_log_int(fields[1], i) || !parse_log_int(fields[2], j) || i >= n || j >= n) return false;
+        page_in_roads(i);
+        page_in_roads(j);
+        int road = road_slot(i, j);
+        if (road != -1) discard_road(road);
+    } else if (fields[0] == "X" && fields.size() == 2) {
+        int city = city_names.find(fields[1]);
+        if (city != -1) {
+            page_in_all_roads();
+            while (!adjacency[city].empty()) discard_road(adjacency[city].back().road);
+            discard_city(city);
+        }
+    } else if (fields[0] == "A" && fields.size() == 3) {
+        string_view name = fields[2];
+        if (!parse_log_int(fields[1], i) || i > n || !is_valid_city_name(name)) return false;
+        if (!city_exists(name)) {
+            page_in_all_roads();
+            restore_city(i, name);
+        }
+    } else if (fields[0] == "L" && fields.size() == 4) {
+        GeoPoint location;
+        auto latitude = from_chars(fields[2].data(), fields[2].data() + fields[2].size(), location.latitude);
+        auto longitude = from_chars(fields[3].data(), fields[3].data() + fields[3].size(), location.longitude);
+        if (!parse_log_int(fields[1], i) || i >= n || latitude.ec != errc() || longitude.ec != errc()) return false;
+        // A location taken back to none is written as NaN
+        if (!location.known()) location = GeoPoint();
+        else if (!is_valid_location(location.latitude, location.longitude)) return false;
+        apply_location(i, location);
+    } else if (fields[0] == "E" && fields.size() == 3) {
+        string_view name = fields[2];
+        if (!parse_log_int(fields[1], i) || i >= n || !is_valid_city_name(name)) return false;
+        if (city_names[i] != name && !city_exists(name)) apply_rename(i, name);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+size_t InfrastructureManager::replay_log(const string& path) {
+    ifstream log_file(path, ios::binary);
+    if (!log_file.is_open()) return 0;
+    size_t records = 0;
+    streamoff intact_size = 0;          // Bytes up to the end of the last applied record
+    string record;
+    vector<string> transaction;
+    uint64_t sequence = 0;              // Number of the next change, once a group header has given it
+    auto feed_change = [&](string_view change) {
+        if (sequence == 0) return;      // Logs written before the feed existed number nothing
+        change_feed.recover(sequence++, change);
+    };
+    // A record is complete only if its newline made it to disk
+    auto read_record = [&](string& out) { return getline(log_file, out) && !log_file.eof(); };
+    while (read_record(record)) {
+        int count;
+        if (record.compare(0, 2, "S\t") == 0 && parse_sequence(string_view(record).substr(2), sequence)) {
+            records++;
+            intact_size = log_file.tellg();
+            continue;
+        }
+        if (record.compare(0, 2, "T\t") == 0 && parse_log_int(string_view(record).substr(2), count)) {
+            transaction.resize(count);
+            int read = 0;
+            while (read < count && read_record(transaction[read])) read++;
+            if (read < count) break;
+            // Applied as an open transaction, so a record that fails takes the ones before it back
+            // out and the budget history only sees groups that apply whole
+            transaction_open = true;
+            recording_changes = true;
+            bool applied = true;
+            for (const auto& entry : transaction) applied = applied && apply_log_record(entry);
+            recording_changes = false;
+            string reverted;
+            size_t reverted_count = 0;
+            if (!applied) revert_step(open_changes, reverted, reverted_count);
+            transaction_open = false;
+            if (applied) append_deferred_history();
+            open_changes.clear();
+            if (!applied) break;
+            for (const auto& entry : transaction) feed_change(entry);
+            records += count + 1;
+            intact_size = log_file.tellg();
+            continue;
+        }
+        if (!apply_log_record(record)) break;
+        feed_change(record);
+        records++;
+        intact_size = log_file.tellg();
+    }
+    log_file.close();
+    error_code ec;
+    if (static_cast<uintmax_t>(intact_size) < filesystem::file_size(path, ec) && !ec) {
+        filesystem::resize_file(path, static_cast<uintmax_t>(intact_size), ec);
+    }
+    return records;
+}
+
+vector<int> InfrastructureManager::load_cities_from_file() {
+    vector<int> city_ids;
+    ifstream cities_file("data/cities.txt");
+    if (!cities_file.is_open()) return city_ids;
+
+    string line;
+    getline(cities_file, line); // Skip header
+    while (getline(cities_file, line)) {
+        size_t tab_pos = line.find('\t');
+        if (tab_pos == string::npos) continue;
+        // Names hold no tabs, so a third and fourth field are the latitude and longitude
+        string_view city_name = string_view(line).substr(tab_pos + 1);
+        size_t location_tab = city_name.find('\t');
+        string_view location_text = location_tab == string_view::npos ? string_view() : city_name.substr(location_tab + 1);
+        city_name = city_name.substr(0, location_tab);
+        int file_index;
+        if (!parse_log_int(string_view(line).substr(0, tab_pos), file_index) || file_index < 1) continue;
+        int id = -1;
+        if (is_valid_city_name(city_name)) {
+            if (!city_exists(city_name)) append_city(city_name);
+            id = get_city_index(city_name);
+        }
+        size_t degrees_tab = location_text.find('\t');
+        if (id != -1 && degrees_tab != string_view::npos) {
+            string_view latitude_text = trim(location_text.substr(0, degrees_tab));
+            string_view longitude_text = trim(location_text.substr(degrees_tab + 1));
+            GeoPoint location;
+            auto latitude = from_chars(latitude_text.data(), latitude_text.data() + latitude_text.size(), location.latitude);
+            auto longitude = from_chars(longitude_text.data(), longitude_text.data() + longitude_text.size(), location.longitude);
+            if (latitude.ec == errc() && longitude.ec == errc() && is_valid_location(location.latitude, location.longitude)) {
+                apply_location(id, location);
+            }
+        }
+        if (city_ids.size() < size_t(file_index)) city_ids.resize(file_index, -1);
+        city_ids[file_index - 1] = id;
+    }
+    cities_file.close();
+    return city_ids;
+}
+
+void InfrastructureManager::load_roads_from_file(const vector<int>& city_ids) {
+    ifstream roads_file("data/roads.txt");
+    if (!roads_file.is_open()) return;
+
+    string line;
+    getline(roads_file, line);
+    bool by_index = trim(line) == ROADS_FILE_HEADER;
+    while (getline(roads_file, line)) {
+        string_view fields(line);
+        size_t first_tab = fields.find('\t');
+        size_t second_tab = fields.find('\t', first_tab + 1);
+        if (first_tab == string::npos || second_tab == string::npos) continue;
+
+        int nbr;
+        if (!parse_log_int(fields.substr(0, first_tab), nbr)) continue;
+
+        int i = -1, j = -1;
+        size_t budget_tab = second_tab;
+        if (by_index) {
+            budget_tab = fields.find('\t', second_tab + 1);
+            if (budget_tab == string::npos) continue;
+            int index1, index2;
+            if (!parse_log_int(fields.substr(first_tab + 1, second_tab - first_tab - 1), index1) ||
+                !parse_log_int(fields.substr(second_tab + 1, budget_tab - second_tab - 1), index2)) {
+                continue;
+            }
+            if (index1 >= 1 && size_t(index1) <= city_ids.size()) i = city_ids[index1 - 1];
+            if (index2 >= 1 && size_t(index2) <= city_ids.size()) j = city_ids[index2 - 1];
+        } else {
+            string_view road = fields.substr(first_tab + 1, second_tab - first_tab - 1);
+            size_t dash_pos = road.find(" - ");
+            if (dash_pos == string_view::npos) continue;
+            i = get_city_index(road.substr(0, dash_pos));
+            j = get_city_index(road.substr(dash_pos + 3));
+        }
+
+        string_view budget_text = trim(fields.substr(budget_tab + 1));
+        double budget;
+        auto parsed = from_chars(budget_text.data(), budget_text.data() + budget_text.size(), budget);
+        if (parsed.ec != errc()) continue;
+
+        // A budget of 0.0 is a road that has not been given a budget yet
+        if (i != -1 && j != -1 && i != j && (budget == 0.0 || is_valid_budget(budget))) {
+            int road = road_slot(i, j);
+            if (road == -1) {
+                // Out-of-order or duplicate Nbrs from hand-edited files are renumbered
+                insert_road(i, j, nbr >= next_road_nbr ? nbr : next_road_nbr, budget);
+            } else {
+                set_road_budget(road, budget, 0);
+            }
+        }
+    }
+    roads_file.close();
+}
+
+InfrastructureManager::InfrastructureManager(const PersistenceOptions& options)
+    : persistence(options) {
+    ProbeTimer timer(LOAD_PROBE);
+    recover_data_files();
+    budget_history.find_saved_years();
+    bool from_snapshot = !persistence.import_text && load_snapshot();
+    if (!from_snapshot) {
+        load_roads_from_file(load_cities_from_file());
+    }
+    ensure_data_directory();
+    if (!change_feed.open(FEED_PATH)) cout << "Error: Cannot open " << FEED_PATH << ". Changes will not be fed.\n";
+    ifstream position_file(FEED_POSITION_PATH);
+    uint64_t exported = 0;
+    if (position_file >> exported) exported_change_sequence.store(exported, memory_order_release);
+    replay_log(RETIRED_LOG_PATH);
+    size_t pending_records = replay_log(LOG_PATH);
+    for (const char* path : {from_snapshot ? CITIES_SNAPSHOT_PATH : CITIES_PATH, from_snapshot ? ROADS_SNAPSHOT_PATH : ROADS_PATH,
+                             RETIRED_LOG_PATH, LOG_PATH}) {
+        error_code ec;
+        uintmax_t size = filesystem::file_size(path, ec);
+        if (!ec) timer.add_bytes(size);
+    }
+    // Numbering carries on after the newest change anywhere, even if the feed file was removed
+    uint64_t next_sequence = max(change_feed.last_sequence(), exported) + 1;
+    if (!wal.open(LOG_PATH, persistence, pending_records, &change_feed, next_sequence)) {
+        cout << "Error: Cannot open " << LOG_PATH << ". Changes will not be saved.\n";
+    }
+    publish_view();
+    recording_changes = true;
+    background_worker = thread(&InfrastructureManager::run_background_worker, this);
+}
+
+InfrastructureManager::~InfrastructureManager() {
+    {
+        lock_guard<mutex> lock(worker_mutex);
+        stopping = true;
+    }
+    worker_wakeup.notify_all();
+    background_worker.join();
+    rollback_transaction();             // Changes never committed are not kept
+    wal.flush();
+    compact();
+}
+
+void InfrastructureManager::set_max_cities(int limit) {
+    max_cities = limit;
+}
+
+void InfrastructureManager::checkpoint() {
+    wal.flush();
+    compact();
+}
+
+ChangeStatus InfrastructureManager::add_city(string_view name) {
+    lock_guard<mutex> lock(state_mutex);
+    ChangeStatus status = check_new_city(name, city_names.size());
+    if (status != ChangeStatus::Ok) return status;
+    append_city(name);
+    log_change(city_record(name));
+    publish_view();
+    return ChangeStatus::Ok;
+}
+
+ChangeStatus InfrastructureManager::add_road(int city1, int city2) {
+    lock_guard<mutex> lock(state_mutex);
+    ChangeStatus status = check_city_pair(city1, city2);
+    if (status != ChangeStatus::Ok) return status;
+    page_in_roads(city1);
+    page_in_roads(city2);
+    if (has_road(city1, city2)) return ChangeStatus::RoadExists;
+    int road = insert_road(city1, city2, next_road_nbr, 0.0);
+    log_change(road_record(road_list[road]));
+    publish_view();
+    return ChangeStatus::Ok;
+}
+
+ChangeStatus InfrastructureManager::set_budget(int city1, int city2, double budget) {
+    lock_guard<mutex> lock(state_mutex);
+    ChangeStatus status = check_budget_change(city1, city2, budget);
+    if (status != ChangeStatus::Ok) return status;
+    int year = current_fiscal_year();
+    set_road_budget(road_slot(city1, city2), budget, year);
+    log_change(budget_record(city1, city2, budget, year));
+    publish_view();
+    return ChangeStatus::Ok;
+}
+
+ChangeStatus InfrastructureManager::set_budget_for_year(int city1, int city2, int fiscal_year, double budget) {
+    lock_guard<mutex> lock(state_mutex);
+    ChangeStatus status = check_budget_change(city1, city2, budget);
+    if (status != ChangeStatus::Ok) return status;
+    if (!is_valid_fiscal_year(fiscal_year)) return ChangeStatus::InvalidYear;
+    int road = road_slot(city1, city2);
+    if (fiscal_year == current_fiscal_year()) {
+        set_road_budget(road, budget, fiscal_year);
+        log_change(budget_record(city1, city2, budget, fiscal_year));
+        publish_view();
+    } else {
+        set_history_budget(road_list[road].nbr, fiscal_year, budget);
+        log_change(year_budget_record(road_list[road].nbr, fiscal_year, budget));
+    }
+    return ChangeStatus::Ok;
+}
+
+bool InfrastructureManager::budget_in_year(int city1, int city2, int fiscal_year, double& budget) {
+    lock_guard<mutex> lock(state_mutex);
+    if (check_city_pair(city1, city2) != ChangeStatus::Ok || !is_valid_fiscal_year(fiscal_year)) return false;
+    page_in_roads(city1);
+    page_in_roads(city2);
+    int road = road_slot(city1, city2);
+    return road != -1 && budget_history.latest(fiscal_year, road_list[road].nbr, budget);
+}
+
+BudgetSummary InfrastructureManager::city_budgets_in_year(int city, int fiscal_year) {
+    lock_guard<mutex> lock(state_mutex);
+    if (!is_city(city) || !is_valid_fiscal_year(fiscal_year)) return {};
+    page_in_roads(city);
+    vector<int> nbrs;
+    nbrs.reserve(adjacency[city].size());
+    for (const auto& link : adjacency[city]) nbrs.push_back(road_list[link.road].nbr);
+    vector<double> amounts;
+    budget_history.latest_of(fiscal_year, nbrs, amounts);
+    return summarize_budgets(amounts.data(), amounts.size());
+}
+
+vector<int> InfrastructureManager::budget_history_years() {
+    lock_guard<mutex> lock(state_mutex);
+    return budget_history.years();
+}
+
+ChangeStatus InfrastructureManager::rename_city(int city, string_view new_name) {
+    lock_guard<mutex> lock(state_mutex);
+    if (!is_city(city)) return ChangeStatus::UnknownCity;
+    ChangeStatus status = check_new_name(new_name);
+    if (status != ChangeStatus::Ok) return status;
+    apply_rename(city, new_name);
+    log_change(rename_record(city, new_name));
+    publish_view();
+    return ChangeStatus::Ok;
+}
+
+ChangeStatus InfrastructureManager::add_cities(span<const string_view> names, size_t* failed) {
+    lock_guard<mutex> lock(state_mutex);
+    unordered_set<string_view> staged;
+    for (size_t k = 0; k < names.size(); k++) {
+        ChangeStatus status = check_new_city(names[k], city_names.size() + k);
+        if (status == ChangeStatus::Ok && !staged.insert(names[k]).second) status = ChangeStatus::DuplicateName;
+        if (status != ChangeStatus::Ok) return reject_bulk(status, k, failed);
+    }
+    reserve_cities(city_names.size() + names.size());
+    string records;
+    for (string_view name : names) {
+        append_city(name);
+        records += city_record(name);
+        records += '\n';
+    }
+    log_changes(records, names.size());
+    publish_view();
+    return ChangeStatus::Ok;
+}
+
+ChangeStatus InfrastructureManager::add_roads(span<const pair<int, int>> roads, size_t* failed) {
+    lock_guard<mutex> lock(state_mutex);
+    unordered_set<uint64_t> staged;
+    for (size_t k = 0; k < roads.size(); k++) {
+        auto [i, j] = roads[k];
+        ChangeStatus status = check_city_pair(i, j);
+        if (status == ChangeStatus::Ok) {
+            page_in_roads(i);
+            page_in_roads(j);
+        }
+        if (status == ChangeStatus::Ok &&
+            (has_road(i, j) ||
+             !staged.insert((static_cast<uint64_t>(min(i, j)) << 32) | static_cast<uint32_t>(max(i, j))).second)) {
+            status = ChangeStatus::RoadExists;
+        }
+        if (status != ChangeStatus::Ok) return reject_bulk(status, k, failed);
+    }
+    string records;
+    for (auto [i, j] : roads) {
+        records += road_record(road_list[insert_road(i, j, next_road_nbr, 0.0)]);
+        records += '\n';
+    }
+    log_changes(records, roads.size());
+    publish_view();
+    return ChangeStatus::Ok;
+}
+
+ChangeStatus InfrastructureManager::set_budgets(span<const BudgetChange> changes, size_t* failed) {
+    lock_guard<mutex> lock(state_mutex);
+    for (size_t k = 0; k < changes.size(); k++) {
+        ChangeStatus status = check_budget_change(changes[k].city1, changes[k].city2, changes[k].budget);
+        if (status != ChangeStatus::Ok) return reject_bulk(status, k, failed);
+    }
+    string records;
+    int year = current_fiscal_year();
+    for (const auto& change : changes) {
+        set_road_budget(road_slot(change.city1, change.city2), change.budget, year);
+        records += budget_record(change.city1, change.city2, change.budget, year);
+        records += '\n';
+    }
+    log_changes(records, changes.size());
+    publish_view();
+    return ChangeStatus::Ok;
+}
+
+ChangeStatus InfrastructureManager::set_location(int city, double latitude, double longitude) {
+    lock_guard<mutex> lock(state_mutex);
+    if (!is_city(city)) return ChangeStatus::UnknownCity;
+    if (!is_valid_location(latitude, longitude)) return ChangeStatus::InvalidLocation;
+    apply_location(city, {latitude, longitude});
+    log_change(location_record(city, {latitude, longitude}));
+    publish_view();
+    return ChangeStatus::Ok;
+}
+
+ChangeStatus InfrastructureManager::set_locations(span<const LocationChange> changes, size_t* failed) {
+    lock_guard<mutex> lock(state_mutex);
+    for (size_t k = 0; k < changes.size(); k++) {
+        const LocationChange& change = changes[k];
+        if (!is_city(change.city)) return reject_bulk(ChangeStatus::UnknownCity, k, failed);
+        if (!is_valid_location(change.location.latitude, change.location.longitude)) {
+            return reject_bulk(ChangeStatus::InvalidLocation, k, failed);
+        }
+    }
+    string records;
+    for (const auto& change : changes) {
+        apply_location(change.city, change.location);
+        records += location_record(change.city, change.location);
+        records += '\n';
+    }
+    log_changes(records, changes.size());
+    publish_view();
+    return ChangeStatus::Ok;
+}
+
+ChangeStatus InfrastructureManager::remove_road(int city1, int city2) {
+    lock_guard<mutex> lock(state_mutex);
+    ChangeStatus status = check_city_pair(city1, city2);
+    if (status != ChangeStatus::Ok) return status;
+    page_in_roads(city1);
+    page_in_roads(city2);
+    int road = road_slot(city1, city2);
+    if (road == -1) return ChangeStatus::NoSuchRoad;
+    const Road& removed = road_list[road];
+    string record = road_removal_record(removed.city1, removed.city2);
+    discard_road(road);
+    log_change(record);
+    publish_view();
+    return ChangeStatus::Ok;
+}
+
+ChangeStatus InfrastructureManager::remove_city(int city) {
+    lock_guard<mutex> lock(state_mutex);
+    if (!is_city(city)) return ChangeStatus::UnknownCity;
+    page_in_all_roads();
+    // One record covers the roads too: replay removes them in the same order
+    string record = city_removal_record(city_names[city]);
+    while (!adjacency[city].empty()) discard_road(adjacency[city].back().road);
+    discard_city(city);
+    log_change(record);
+    publish_view();
+    return ChangeStatus::Ok;
+}
+
+ChangeStatus InfrastructureManager::remove_cities(span<const int> cities, size_t* failed) {
+    lock_guard<mutex> lock(state_mutex);
+    vector<int> sorted(cities.begin(), cities.end());
+    for (size_t k = 0; k < cities.size(); k++) {
+        if (!is_city(cities[k])) return reject_bulk(ChangeStatus::UnknownCity, k, failed);
+    }
+    sort(sorted.begin(), sorted.end());
+    auto repeated = adjacent_find(sorted.begin(), sorted.end());
+    if (repeated != sorted.end()) {
+        size_t second = find(find(cities.begin(), cities.end(), *repeated) + 1, cities.end(), *repeated) - cities.begin();
+        return reject_bulk(ChangeStatus::UnknownCity, second, failed);
+    }
+    if (sorted.empty()) return ChangeStatus::Ok;
+    page_in_all_roads();
+    string records;
+    for (auto city = sorted.rbegin(); city != sorted.rend(); ++city) {
+        records += city_removal_record(city_names[*city]);
+        records += '\n';
+        while (!adjacency[*city].empty()) discard_road(adjacency[*city].back().road);
+    }
+    discard_cities(sorted);
+    log_changes(records, sorted.size());
+    publish_view();
+    return ChangeStatus::Ok;
+}
+
+bool InfrastructureManager::begin_transaction() {
+    lock_guard<mutex> lock(state_mutex);
+    if (transaction_open) return false;
+    transaction_open = true;
+    return true;
+}
+
+bool InfrastructureManager::commit_transaction() {
+    lock_guard<mutex> lock(state_mutex);
+    if (!transaction_open) return false;
+    transaction_open = false;
+    append_deferred_history();
+    wal.append_transaction(transaction_records, transaction_record_count);
+    transaction_records.clear();
+    transaction_record_count = 0;
+    close_undo_step();
+    return true;
+}
+
+void InfrastructureManager::append_deferred_history() {
+    for (const ChangeDelta& change : open_changes) {
+        if ((change.kind == ChangeDelta::Kind::SetBudget || change.kind == ChangeDelta::Kind::SetYearBudget) &&
+            change.fiscal_year != 0) {
+            budget_history.append(change.fiscal_year, change.nbr, change.new_budget);
+        }
+    }
+}
+
+bool InfrastructureManager::rollback_transaction() {
+    lock_guard<mutex> lock(state_mutex);
+    if (!transaction_open) return false;
+    string records;                     // Never logged: the changes themselves were not
+    size_t count = 0;
+    revert_step(open_changes, records, count);
+    open_changes.clear();
+    transaction_open = false;
+    transaction_records.clear();
+    transaction_record_count = 0;
+    publish_view();
+    return true;
+}
+
+size_t InfrastructureManager::undo() {
+    lock_guard<mutex> lock(state_mutex);
+    if (transaction_open || undo_history.empty()) return 0;
+    vector<ChangeDelta> step = move(undo_history.back());
+    undo_history.pop_back();
+    undo_history_changes -= step.size();
+    string records;
+    size_t count = 0;
+    revert_step(step, records, count);
+    wal.append_transaction(records, count);
+    redo_history.push_back(move(step));
+    publish_view();
+    return count;
+}
+
+size_t InfrastructureManager::redo() {
+    lock_guard<mutex> lock(state_mutex);
+    if (transaction_open || redo_history.empty()) return 0;
+    vector<ChangeDelta> step = move(redo_history.back());
+    redo_history.pop_back();
+    string records;
+    size_t count = 0;
+    reapply_step(step, records, count);
+    wal.append_transaction(records, count);
+    undo_history_changes += step.size();
+    undo_history.push_back(move(step));
+    publish_view();
+    return count;
+}
+
+bool InfrastructureManager::in_transaction() {
+    lock_guard<mutex> lock(state_mutex);
+    return transaction_open;
+}
+
+size_t InfrastructureManager::transaction_size() {
+    lock_guard<mutex> lock(state_mutex);
+    return transaction_open ? open_changes.size() : 0;
+}
+
+size_t InfrastructureManager::undo_steps_available() {
+    lock_guard<mutex> lock(state_mutex);
+    return undo_history.size();
+}
+
+size_t InfrastructureManager::redo_steps_available() {
+    lock_guard<mutex> lock(state_mutex);
+    return redo_history.size();
+}
+
+void InfrastructureManager::cities_starting_with(string_view prefix, size_t limit, vector<uint32_t>& found) {
+    ProbeTimer timer(PREFIX_SEARCH_PROBE);
+    search_index().starting_with(prefix, limit, found);
+}
+
+void InfrastructureManager::cities_similar_to(string_view name, int max_distance, size_t limit, vector<CitySearchIndex::Match>& found) {
+    ProbeTimer timer(SIMILAR_SEARCH_PROBE);
+    search_index().similar_to(name, max_distance, limit, found);
+}
+
+int InfrastructureManager::lookup_city(string_view name) {
+    lock_guard<mutex> lock(state_mutex);
+    return get_city_index(name);
+}
+
+void InfrastructureManager::lookup_prefix(string_view prefix, size_t limit, vector<uint32_t>& found) {
+    ProbeTimer timer(PREFIX_SEARCH_PROBE);
+    lock_guard<mutex> lock(state_mutex);
+    search_index().starting_with(prefix, limit, found);
+}
+
+void InfrastructureManager::apply_commands(span<const BatchCommand> commands, vector<ChangeStatus>& statuses) {
+    ProbeTimer timer(COMMIT_PROBE);
+    statuses.assign(commands.size(), ChangeStatus::Ok);
+    lock_guard<mutex> lock(state_mutex);
+    string records;
+    size_t record_count = 0;
+    int year = current_fiscal_year();
+    // Outside a transaction the group is applied as one, so every change is kept and the budget
+    // history waits, and a group the log cannot take is taken back before any reader sees it
+    bool own_transaction = !transaction_open;
+    transaction_open = true;
+    for (size_t k = 0; k < commands.size(); k++) {
+        const BatchCommand& command = commands[k];
+        ChangeStatus& status = statuses[k];
+        if (command.kind == BatchCommand::Kind::City) {
+            status = check_new_city(command.first, city_names.size());
+            if (status != ChangeStatus::Ok) continue;
+            append_city(command.first);
+            records += city_record(command.first);
+        } else {
+            bool one_city = command.kind == BatchCommand::Kind::Rename || command.kind == BatchCommand::Kind::Location;
+            int i = get_city_index(command.first);
+            int j = one_city ? -1 : get_city_index(command.second);
+            if (i == -1 || (!one_city && j == -1)) {
+                status = ChangeStatus::UnknownCity;
+                continue;
+            }
+            if (command.kind == BatchCommand::Kind::Location) {
+                if (!is_valid_location(command.location.latitude, command.location.longitude)) {
+                    status = ChangeStatus::InvalidLocation;
+                    continue;
+                }
+                apply_location(i, command.location);
+                records += location_record(i, command.location);
+            } else if (command.kind == BatchCommand::Kind::Rename) {
+                status = check_new_name(command.second);
+                if (status != ChangeStatus::Ok) continue;
+                apply_rename(i, command.second);
+                records += rename_record(i, command.second);
+            } else if (command.kind == BatchCommand::Kind::Road) {
+                status = check_city_pair(i, j);
+                if (status == ChangeStatus::Ok) {
+                    page_in_roads(i);
+                    page_in_roads(j);
+                    if (has_road(i, j)) status = ChangeStatus::RoadExists;
+                }
+                if (status != ChangeStatus::Ok) continue;
+                records += road_record(road_list[insert_road(i, j, next_road_nbr, 0.0)]);
+            } else {
+                status = check_budget_change(i, j, command.budget);
+                if (status != ChangeStatus::Ok) continue;
+                set_road_budget(road_slot(i, j), command.budget, year);
+                records += budget_record(i, j, command.budget, year);
+            }
+        }
+        records += '\n';
+        record_count++;
+    }
+    if (!own_transaction) {
+        log_changes(records, record_count);
+        if (record_count > 0) publish_view();
+        return;
+    }
+    if (!wal.append_transaction(records, record_count, true)) {
+        string reverted;
+        size_t reverted_count = 0;
+        revert_step(open_changes, reverted, reverted_count);
+        open_changes.clear();
+        transaction_open = false;
+        statuses.assign(commands.size(), ChangeStatus::WriteFailed);
+        return;
+    }
+    transaction_open = false;
+    append_deferred_history();
+    close_undo_step();
+    if (record_count > 0) publish_view();
+}
+
+bool InfrastructureManager::run_batch(istream& in) {
+    ProbeTimer timer(BATCH_PROBE);
+    vector<BatchCommand> commands;
+    vector<pair<int, string>> errors; // (line, message)
+    string line;
+    for (int line_number = 1; getline(in, line); line_number++) {
+        string_view text = trim(line);
+        if (text.empty() || text[0] == '#') continue;
+        BatchCommand command;
+        command.line = line_number;
+        string error;
+        if (parse_batch_line(text, command, error)) {
+            commands.push_back(move(command));
+        } else {
+            errors.emplace_back(line_number, error);
+        }
+    }
+
+    // Validate against an overlay holding only the names and roads the batch adds or changes, so
+    // checking costs O(batch size) whatever the size of the network. Views into commands stay
+    // valid because the vector is not modified from here on.
+    int existing_cities = static_cast<int>(city_names.size());
+    vector<string_view> added_names;    // Names of the cities the batch adds, by ID - existing_cities
+    unordered_map<string_view, int> staged_names; // Names the batch gives to cities
+    unordered_map<int, string_view> renamed; // Staged name of each city the batch renames
+    unordered_set<uint64_t> added_roads;
+    auto road_key = [](int i, int j) {
+        return (static_cast<uint64_t>(min(i, j)) << 32) | static_cast<uint32_t>(max(i, j));
+    };
+    auto staged_road_exists = [&](int i, int j) {
+        if (max(i, j) < existing_cities && road_exists(i, j)) return true;
+        return added_roads.count(road_key(i, j)) > 0;
+    };
+    auto staged_name = [&](int id) {
+        auto it = renamed.find(id);
+        if (it != renamed.end()) return it->second;
+        return id < existing_cities ? city_names[id] : added_names[id - existing_cities];
+    };
+    // Entries in either index are ignored once the city they point at has been renamed away
+    auto find_staged_city = [&](string_view name) {
+        auto it = staged_names.find(name);
+        if (it != staged_names.end() && staged_name(it->second) == name) return it->second;
+        int id = city_names.find(name);
+        return id != -1 && staged_name(id) == name ? id : -1;
+    };
+    for (const auto& command : commands) {
+        auto reject = [&](const string& error) { errors.emplace_back(command.line, error); };
+        if (command.kind == BatchCommand::Kind::City) {
+            if (find_staged_city(command.first) != -1) {
+                reject("City '" + command.first + "' already exists.");
+            } else if (!is_valid_city_name(command.first)) {
+                reject("City name '" + command.first + "' is invalid.");
+            } else if (existing_cities + static_cast<int>(added_names.size()) >= max_cities) {
+                reject("The limit of " + to_string(max_cities) + " cities is reached.");
+            } else {
+                staged_names.insert_or_assign(command.first, existing_cities + static_cast<int>(added_names.size()));
+                added_names.push_back(command.first);
+            }
+            continue;
+        }
+        bool one_city = command.kind == BatchCommand::Kind::Rename || command.kind == BatchCommand::Kind::Location;
+        int i = find_staged_city(command.first);
+        int j = one_city ? -1 : find_staged_city(command.second);
+        if (i == -1) {
+            reject("City '" + command.first + "' does not exist.");
+        } else if (command.kind == BatchCommand::Kind::Location) {
+            if (!is_valid_location(command.location.latitude, command.location.longitude)) {
+                reject("Latitude must be between -90 and 90 and longitude between -180 and 180.");
+            }
+        } else if (command.kind == BatchCommand::Kind::Rename) {
+            if (find_staged_city(command.second) != -1) {
+                reject("City '" + command.second + "' already exists.");
+            } else if (!is_valid_city_name(command.second)) {
+                reject("City name '" + command.second + "' is invalid.");
+            } else {
+                staged_names.insert_or_assign(command.second, i);
+                renamed.insert_or_assign(i, command.second);
+            }
+        } else if (j == -1) {
+            reject("City '" + command.second + "' does not exist.");
+        } else if (command.kind == BatchCommand::Kind::Road) {
+            if (i == j) {
+                reject("Cannot add a road from a city to itself.");
+            } else if (staged_road_exists(i, j)) {
+                reject("Road already exists between " + command.first + " and " + command.second + ".");
+            } else {
+                added_roads.insert(road_key(i, j));
+            }
+        } else if (i == j || !staged_road_exists(i, j)) {
+            reject("No road exists between " + command.first + " and " + command.second + ".");
+        } else if (!is_valid_budget(command.budget)) {
+            reject("Budget must be between 0 and 1000 billion RWF.");
+        }
+    }
+    if (!errors.empty()) {
+        stable_sort(errors.begin(), errors.end(),
+                    [](const auto& a, const auto& b) { return a.first < b.first; });
+        for (const auto& [line_number, error] : errors) {
+            cout << "Error: Line " << line_number << ": " << error << "\n";
+        }
+        cout << "Batch rejected with " << errors.size() << " error(s); no changes were made.\n";
+        return false;
+    }
+
+    // Apply everything and log it as one transaction
+    int counts[5] = {0, 0, 0, 0, 0};
+    {
+        lock_guard<mutex> lock(state_mutex);
+        reserve_cities(city_names.size() + added_names.size());
+        string records;
+        int year = current_fiscal_year();
+        for (const auto& command : commands) {
+            switch (command.kind) {
+                case BatchCommand::Kind::City:
+                    append_city(command.first);
+                    records += city_record(command.first);
+                    break;
+                case BatchCommand::Kind::Road: {
+                    int road = insert_road(get_city_index(command.first), get_city_index(command.second),
+                                           next_road_nbr, 0.0);
+                    records += road_record(road_list[road]);
+                    break;
+                }
+                case BatchCommand::Kind::Budget: {
+                    int i = get_city_index(command.first);
+                    int j = get_city_index(command.second);
+                    set_road_budget(road_slot(i, j), command.budget, year);
+                    records += budget_record(i, j, command.budget, year);
+                    break;
+                }
+                case BatchCommand::Kind::Rename: {
+                    int index = get_city_index(command.first);
+                    apply_rename(index, command.second);
+                    records += rename_record(index, command.second);
+                    break;
+                }
+                case BatchCommand::Kind::Location: {
+                    int index = get_city_index(command.first);
+                    apply_location(index, command.location);
+                    records += location_record(index, command.location);
+                    break;
+                }
+            }
+            records += '\n';
+            counts[static_cast<int>(command.kind)]++;
+        }
+        log_changes(records, commands.size());
+        publish_view();
+    }
+    cout << "Batch applied: " << counts[0] << " city(ies), " << counts[1] << " road(s), "
+         << counts[2] << " budget(s), " << counts[3] << " rename(s), " << counts[4] << " location(s).\n";
+    return true;
+}
+
+bool InfrastructureManager::import_road_file(const string& path) {
+    ImportFormat format;
+    if (!import_format_for(path, format)) {
+        cout << "Error: Import files must end in .csv, .geojson or .json.\n";
+        return false;
+    }
+    return import_roads(path, format);
+}
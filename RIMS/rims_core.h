@@ -0,0 +1,1710 @@
+/*
+ * Core of the Rwanda Infrastructure Management System: the city and road network, its
+ * persistence (snapshots, text files and write-ahead log) and the queries over it, behind a
+ * non-interactive API. The console in main.cpp, and any other client, is built on this.
+ */
+#pragma once
+
+#include <vector>     // For vectors and matrices
+#include <string>     // For string operations
+#include <string_view> // For non-owning views of city names
+#include <unordered_map> // For the city name index
+#include <algorithm>  // For ordering and sorting
+#include <istream>    // For batch command streams
+#include <chrono>     // For group commit and compaction timing
+#include <cstdio>     // For the write-ahead log file
+#include <mutex>      // For guarding state shared with the background writer
+#include <thread>     // For the background log writer
+#include <condition_variable> // For waking the background writer
+#include <cstdint>    // For fixed-width fields in the binary snapshot
+#include <span>       // For the bulk API
+#include <cstring>    // For copying names into the arena
+#include <memory>     // For the city name arena blocks and shared network versions
+#include <atomic>     // For publishing network versions to readers
+#include <bit>        // For popcount over the dense road matrix
+#include <deque>      // For the undo history
+#include <map>        // For the budget history's fiscal year segments
+#include <array>      // For city positions as unit vectors
+#include <cmath>      // For NAN and distances on the sphere
+#include "rims_stats.h" // For instrumenting the hot paths
+
+
+// City limit used unless --max-cities overrides it. Storage grows with the number of roads, so
+// the limit only guards against runaway input.
+const int DEFAULT_MAX_CITIES = 100000;
+
+// Changes the undo history keeps; the oldest steps are forgotten beyond it
+const size_t UNDO_HISTORY_CHANGES = 100000;
+
+// Group commit and compaction settings for the write-ahead log
+struct PersistenceOptions {
+    size_t group_commit_ops = 32;       // Flush the log once this many records are buffered...
+    int group_commit_ms = 50;           // ...or once the oldest buffered record is this old
+    size_t compact_after_records = 1000; // Fold the log into the data files after this many records...
+    int compact_interval_ms = 30000;    // ...or once records have been pending this long
+    bool import_text = false;           // Load cities.txt/roads.txt even when a snapshot exists
+    bool lazy_roads = false;            // Page each city's roads in from roads.snap when first needed
+};
+
+// Forces a file's written contents to stable storage; returns false if they may not be there
+bool sync_file(FILE* file);
+
+// Writes contents to a file and syncs it; returns false if the file cannot be written
+bool write_file_synced(const std::string& path, const std::string& contents);
+
+// One change read back from the change feed
+struct FeedChange {
+    uint64_t sequence;
+    std::string record;                 // The change as the log wrote it (see the log record formats)
+};
+
+// Sequence-numbered changes for downstream systems (data/changes.feed), one line per change: its
+// sequence number, a tab and the log record the change was written as. The log hands each group
+// over once the group is on disk, so the feed never holds a change that could still be lost, and
+// numbering continues across restarts and compactions. Readers on any thread fetch changes by
+// sequence number with a binary search over the file, never seeing a line still being written.
+class ChangeFeed {
+private:
+    FILE* file = nullptr;
+    std::string path;
+    std::atomic<uint64_t> first{0};     // Sequence numbers of the first and last changes in the file, 0 if none
+    std::atomic<uint64_t> last{0};
+    std::atomic<uint64_t> complete_size{0}; // Bytes of the file holding whole lines
+    std::string pending;                // Lines formatted but not yet written, kept after a failed write
+    uint64_t pending_first = 0, pending_last = 0;
+
+    // Formats one change into pending; finish_write() writes it
+    void write_change(uint64_t sequence, std::string_view record);
+
+    // Writes the pending lines and makes them visible to readers; after a failed write the file is
+    // cut back to its whole lines and the pending lines wait for the next write
+    void finish_write();
+
+public:
+    ~ChangeFeed() {
+        close();
+    }
+
+    // Opens (or creates) the feed for appending, cutting off a last line torn by a crash
+    bool open(const std::string& feed_path);
+
+    // Appends the records of a log group, numbered from sequence on; headers of transactions and
+    // of log groups are not changes and get no number
+    void append_group(std::string_view records, uint64_t sequence);
+
+    // Appends a change found in the log that a crash kept out of the feed, if it is newer than the
+    // feed's last change
+    void recover(uint64_t sequence, std::string_view record);
+
+    // Writes any pending lines and forces the feed's contents to disk, so the log records behind
+    // them may be discarded; returns false if lines are still waiting or the sync failed
+    bool sync();
+
+    void close();
+
+    uint64_t first_sequence() const { return first.load(std::memory_order_acquire); }
+    uint64_t last_sequence() const { return last.load(std::memory_order_acquire); }
+
+    // Fills changes with up to limit changes numbered from from onwards; returns false if the feed
+    // file cannot be read
+    bool read(uint64_t from, size_t limit, std::vector<FeedChange>& changes) const;
+};
+
+// Append-only log of mutations. Records are buffered and written with one flush and fsync per
+// group, so bulk data entry pays for durability once per group rather than once per record. Each
+// group opens with an "S <sequence>" header numbering its changes for the change feed.
+class WriteAheadLog {
+private:
+    std::mutex log_mutex;
+    FILE* file = nullptr;
+    std::string path;
+    std::string buffer;                 // Records appended since the last flush
+    size_t buffered_records = 0;
+    size_t buffered_changes = 0;        // Records in buffer other than transaction headers
+    size_t logged_records = 0;          // Records in the current log file, flushed or not
+    uintmax_t logged_size = 0;          // Bytes of the current log file holding whole groups
+    ChangeFeed* feed = nullptr;         // Given each group once it is on disk
+    uint64_t next_sequence = 1;         // Sequence number of the next change
+    std::chrono::steady_clock::time_point oldest_buffered;
+    size_t group_commit_ops = 1;
+    std::chrono::milliseconds group_commit_interval{0};
+
+    // Writes the buffered group to disk; caller holds log_mutex. Returns false, keeping the group
+    // buffered, if it could not be written.
+    bool flush_locked();
+
+public:
+    ~WriteAheadLog() {
+        close();
+    }
+
+    // Opens (or creates) the log for appending; existing_records is how many it already holds.
+    // Flushed groups go to change_feed, numbered from first_sequence on.
+    bool open(const std::string& log_path, const PersistenceOptions& options, size_t existing_records,
+              ChangeFeed* change_feed, uint64_t first_sequence) {
+        std::lock_guard<std::mutex> lock(log_mutex);
+        path = log_path;
+        logged_records = existing_records;
+        feed = change_feed;
+        next_sequence = first_sequence;
+        group_commit_ops = std::max<size_t>(options.group_commit_ops, 1);
+        group_commit_interval = std::chrono::milliseconds(options.group_commit_ms);
+        file = fopen(path.c_str(), "ab");
+        if (file != nullptr && fseek(file, 0, SEEK_END) == 0) logged_size = static_cast<uintmax_t>(ftell(file));
+        return file != nullptr;
+    }
+
+    // Buffers one record, flushing the group once it is full
+    void append(std::string_view record) {
+        std::lock_guard<std::mutex> lock(log_mutex);
+        if (buffered_records == 0) oldest_buffered = std::chrono::steady_clock::now();
+        buffer.append(record);
+        buffer.push_back('\n');
+        buffered_records++;
+        buffered_changes++;
+        logged_records++;
+        if (buffered_records >= group_commit_ops) flush_locked();
+    }
+
+    // Appends records as one transaction and flushes them at once. The records are framed by a
+    // "T <count>" header so replay applies them all or, if the write was torn, none of them.
+    // Returns false if they could not be written; they then stay buffered for the next flush, or
+    // with discard_unwritten are dropped for the caller to take the changes back.
+    bool append_transaction(std::string_view records, size_t count, bool discard_unwritten = false) {
+        std::lock_guard<std::mutex> lock(log_mutex);
+        if (count == 0) return true;
+        size_t buffered_before = buffer.size();
+        buffer.append("T\t" + std::to_string(count) + "\n");
+        buffer.append(records);
+        buffered_records += count + 1;
+        buffered_changes += count;
+        logged_records += count + 1;
+        if (flush_locked()) return true;
+        if (discard_unwritten) {
+            buffer.resize(buffered_before);
+            buffered_records -= count + 1;
+            buffered_changes -= count;
+            logged_records -= count + 1;
+        }
+        return false;
+    }
+
+    // Flushes the buffered group if its oldest record has waited long enough
+    void flush_if_due() {
+        std::lock_guard<std::mutex> lock(log_mutex);
+        if (buffered_records > 0 && std::chrono::steady_clock::now() - oldest_buffered >= group_commit_interval) {
+            flush_locked();
+        }
+    }
+
+    // Flushes any buffered records
+    void flush() {
+        std::lock_guard<std::mutex> lock(log_mutex);
+        flush_locked();
+    }
+
+    // Number of records in the current log file
+    size_t record_count() {
+        std::lock_guard<std::mutex> lock(log_mutex);
+        return logged_records;
+    }
+
+    // Sequence number of the latest change written, 0 if there is none
+    uint64_t last_sequence() {
+        std::lock_guard<std::mutex> lock(log_mutex);
+        return next_sequence - 1;
+    }
+
+    // Moves the current log's records to the end of retired_path and starts an empty log, first
+    // syncing the change feed so it keeps every change the retired records describe. Returns
+    // false, leaving the log as it is, if the buffered records or the feed cannot be written first.
+    bool rotate(const std::string& retired_path);
+
+    // Flushes and closes the log
+    void close() {
+        std::lock_guard<std::mutex> lock(log_mutex);
+        flush_locked();
+        if (file != nullptr) fclose(file);
+        file = nullptr;
+    }
+};
+
+// Interned city names. Every name is copied once into large arena blocks and addressed by a
+// 32-bit city ID; callers read names as string_views into the arena. Blocks never move, so the
+// views (and the name index keyed by them) stay valid as cities are added. A rename stores the
+// new name and leaves the old bytes unused until the table is next rebuilt from disk.
+class CityNameTable {
+private:
+    static constexpr size_t BLOCK_SIZE = 64 * 1024;
+    std::vector<std::unique_ptr<char[]>> blocks;
+    size_t block_used = BLOCK_SIZE;     // Bytes used in the newest block; full before the first name
+    std::vector<std::string_view> names; // Name of each city ID
+    std::unordered_map<std::string_view, uint32_t> index; // City ID of each name
+
+    // Copies a name into the arena and returns a view of the copy
+    std::string_view store(std::string_view name) {
+        if (BLOCK_SIZE - block_used < name.size()) {
+            blocks.push_back(std::make_unique<char[]>(std::max(BLOCK_SIZE, name.size())));
+            block_used = 0;
+        }
+        char* copy = blocks.back().get() + block_used;
+        std::memcpy(copy, name.data(), name.size());
+        block_used = std::min(BLOCK_SIZE, block_used + name.size()); // An oversized name fills its block
+        return std::string_view(copy, name.size());
+    }
+
+public:
+    // Returns the ID of a name, or -1 if no city has it
+    int find(std::string_view name) const {
+        auto it = index.find(name);
+        return it == index.end() ? -1 : static_cast<int>(it->second);
+    }
+
+    // Adds a name that is not in the table yet and returns its ID
+    uint32_t add(std::string_view name) {
+        uint32_t id = static_cast<uint32_t>(names.size());
+        std::string_view stored = store(name);
+        names.push_back(stored);
+        index.emplace(stored, id);
+        return id;
+    }
+
+    // Gives city id a name that is not in the table yet
+    void rename(uint32_t id, std::string_view name) {
+        index.erase(names[id]);
+        std::string_view stored = store(name);
+        names[id] = stored;
+        index.emplace(stored, id);
+    }
+
+    // Removes the cities with the given IDs, in increasing order, moving the later cities down to
+    // close the gaps in one pass; their bytes stay in the arena
+    void erase(std::span<const uint32_t> ids) {
+        if (ids.empty()) return;
+        for (uint32_t id : ids) index.erase(names[id]);
+        size_t kept = ids[0];
+        for (size_t k = ids[0], next = 0; k < names.size(); k++) {
+            if (next < ids.size() && ids[next] == k) {
+                next++;
+                continue;
+            }
+            names[kept] = names[k];
+            index[names[kept]] = static_cast<uint32_t>(kept);
+            kept++;
+        }
+        names.resize(kept);
+    }
+
+    // Inserts a name that is not in the table yet as city id, moving every later city up one ID
+    void insert(uint32_t id, std::string_view name) {
+        names.insert(names.begin() + id, store(name));
+        for (size_t k = id; k < names.size(); k++) index[names[k]] = static_cast<uint32_t>(k);
+    }
+
+    // Makes room for count names
+    void reserve(size_t count) {
+        names.reserve(count);
+        index.reserve(count);
+    }
+
+    std::string_view operator[](size_t id) const { return names[id]; }
+    size_t size() const { return names.size(); }
+    bool empty() const { return names.empty(); }
+};
+
+// Case-insensitive name search for autocomplete and typo-tolerant lookup. Prefix queries binary
+// search a sorted array of lowercased names; approximate queries walk a BK-tree over the same
+// keys. Added and renamed names are queued and folded in by the next query that needs them, so
+// loading thousands of cities costs nothing until someone searches.
+class CitySearchIndex {
+public:
+    struct Match {
+        uint32_t id;
+        int distance;                   // Edit distance from the query, ignoring case
+    };
+
+private:
+    struct BkNode {
+        std::string key;                // Lowercased name the node was inserted with
+        uint32_t id;
+        bool live;                      // Cleared when the city is renamed away from key
+        std::vector<std::pair<int, int>> children; // (edit distance to key, node)
+    };
+
+    std::vector<std::string> keys;      // Lowercased current name of each city ID
+    std::vector<uint32_t> sorted;       // City IDs ordered by key, then ID
+    std::vector<uint32_t> unsorted;     // IDs added or renamed since sorted was last merged
+    std::vector<BkNode> tree;           // tree[0] is the root
+    std::vector<int> tree_node;         // Live node of each city ID, -1 while queued
+    std::vector<uint32_t> untreed;      // IDs waiting to be inserted into the tree
+    size_t dead_nodes = 0;
+    std::vector<int> row_above, row;    // Edit distance rows reused across comparisons
+
+    static std::string lowercase(std::string_view name) {
+        std::string key(name);
+        for (char& ch : key) ch = static_cast<char>(std::tolower(static_cast<unsigned char>(ch)));
+        return key;
+    }
+
+    bool key_before(uint32_t a, uint32_t b) const {
+        return keys[a] < keys[b] || (keys[a] == keys[b] && a < b);
+    }
+
+    // Levenshtein distance between a and b
+    int distance(std::string_view a, std::string_view b) {
+        row_above.resize(b.size() + 1);
+        row.resize(b.size() + 1);
+        for (size_t j = 0; j <= b.size(); j++) row_above[j] = static_cast<int>(j);
+        for (size_t i = 1; i <= a.size(); i++) {
+            row[0] = static_cast<int>(i);
+            for (size_t j = 1; j <= b.size(); j++) {
+                int replace = row_above[j - 1] + (a[i - 1] != b[j - 1]);
+                row[j] = std::min(replace, std::min(row_above[j], row[j - 1]) + 1);
+            }
+            std::swap(row, row_above);
+        }
+        return row_above[b.size()];
+    }
+
+    // Merges the queued IDs into the sorted array
+    void merge_unsorted() {
+        if (unsorted.empty()) return;
+        auto before = [this](uint32_t a, uint32_t b) { return key_before(a, b); };
+        std::sort(unsorted.begin(), unsorted.end(), before);
+        size_t middle = sorted.size();
+        sorted.insert(sorted.end(), unsorted.begin(), unsorted.end());
+        std::inplace_merge(sorted.begin(), sorted.begin() + middle, sorted.end(), before);
+        unsorted.clear();
+    }
+
+    // Inserts the queued IDs into the BK-tree
+    void grow_tree() {
+        for (uint32_t id : untreed) {
+            int added = static_cast<int>(tree.size());
+            tree.push_back({keys[id], id, true, {}});
+            tree_node[id] = added;
+            if (added == 0) continue;
+            int node = 0;
+            while (true) {
+                int d = distance(keys[id], tree[node].key);
+                auto child = std::find_if(tree[node].children.begin(), tree[node].children.end(),
+                                          [d](const std::pair<int, int>& edge) { return edge.first == d; });
+                if (child == tree[node].children.end()) {
+                    tree[node].children.emplace_back(d, added);
+                    break;
+                }
+                node = child->second;
+            }
+        }
+        untreed.clear();
+    }
+
+    // Rebuilds the tree from scratch once most of its nodes belong to old names
+    void rebuild_tree() {
+        tree.clear();
+        dead_nodes = 0;
+        untreed.clear();
+        for (uint32_t id = 0; id < keys.size(); id++) {
+            tree_node[id] = -1;
+            untreed.push_back(id);
+        }
+    }
+
+public:
+    // Indexes the name of the next city ID
+    void add(std::string_view name) {
+        uint32_t id = static_cast<uint32_t>(keys.size());
+        keys.push_back(lowercase(name));
+        unsorted.push_back(id);
+        tree_node.push_back(-1);
+        untreed.push_back(id);
+    }
+
+    // Re-indexes city id under a new name
+    void rename(uint32_t id, std::string_view name) {
+        auto before = [this](uint32_t a, uint32_t b) { return key_before(a, b); };
+        auto slot = std::lower_bound(sorted.begin(), sorted.end(), id, before);
+        bool was_sorted = slot != sorted.end() && *slot == id;
+        if (was_sorted) sorted.erase(slot);
+        keys[id] = lowercase(name);
+        if (was_sorted) unsorted.push_back(id);
+
+        if (tree_node[id] != -1) {
+            tree[tree_node[id]].live = false;
+            tree_node[id] = -1;
+            untreed.push_back(id);
+            if (++dead_nodes > tree.size() / 2) rebuild_tree();
+        }
+    }
+
+    void reserve(size_t count) {
+        keys.reserve(count);
+        tree_node.reserve(count);
+    }
+
+    // Collects up to limit city IDs whose names start with prefix, in name order
+    void starting_with(std::string_view prefix, size_t limit, std::vector<uint32_t>& found) {
+        merge_unsorted();
+        found.clear();
+        std::string key = lowercase(prefix);
+        auto first = std::lower_bound(sorted.begin(), sorted.end(), key,
+                                      [this](uint32_t id, const std::string& value) { return keys[id] < value; });
+        for (auto it = first; it != sorted.end() && found.size() < limit; ++it) {
+            if (keys[*it].compare(0, key.size(), key) != 0) break;
+            found.push_back(*it);
+        }
+    }
+
+    // Collects up to limit cities whose names are within max_distance edits of name, closest
+    // first. The triangle inequality lets the walk skip every subtree whose edge distance is
+    // more than max_distance away from the query's distance to the parent.
+    void similar_to(std::string_view name, int max_distance, size_t limit, std::vector<Match>& found) {
+        grow_tree();
+        found.clear();
+        if (tree.empty()) return;
+        std::string key = lowercase(name);
+        std::vector<int> pending = {0};
+        while (!pending.empty()) {
+            int node = pending.back();
+            pending.pop_back();
+            int d = distance(key, tree[node].key);
+            if (d <= max_distance && tree[node].live) found.push_back({tree[node].id, d});
+            for (const auto& [edge, child] : tree[node].children) {
+                if (edge >= d - max_distance && edge <= d + max_distance) pending.push_back(child);
+            }
+        }
+        std::sort(found.begin(), found.end(), [this](const Match& a, const Match& b) {
+            return a.distance != b.distance ? a.distance < b.distance : key_before(a.id, b.id);
+        });
+        if (found.size() > limit) found.resize(limit);
+    }
+};
+
+// Largest network kept in dense mode: the bit matrix then takes at most 8 MB
+const size_t DENSE_MODE_MAX_CITIES = 8192;
+
+// Bit-packed square road matrix for dense networks: one bit per city pair, 64 pairs per word, in
+// a single allocation. Rows are padded to whole words and sized for a city capacity that grows by
+// rebuilding, so adding a city below the capacity costs nothing.
+class RoadBitMatrix {
+private:
+    std::vector<uint64_t> bits;
+    size_t words_per_row = 0;
+    size_t capacity = 0;
+
+public:
+    // Clears the matrix and sizes it for at least city_count cities
+    void reset(size_t city_count) {
+        capacity = std::max<size_t>(64, (city_count + 63) / 64 * 64);
+        words_per_row = capacity / 64;
+        bits.assign(capacity * words_per_row, 0);
+    }
+
+    // Frees the matrix
+    void release() {
+        std::vector<uint64_t>().swap(bits);
+        words_per_row = capacity = 0;
+    }
+
+    size_t city_capacity() const { return capacity; }
+    size_t row_words() const { return words_per_row; }
+    const uint64_t* row(int city) const { return bits.data() + size_t(city) * words_per_row; }
+
+    // Marks the road between cities i and j in both rows
+    void set(int i, int j) {
+        bits[size_t(i) * words_per_row + size_t(j) / 64] |= uint64_t(1) << (j % 64);
+        bits[size_t(j) * words_per_row + size_t(i) / 64] |= uint64_t(1) << (i % 64);
+    }
+
+    // Clears the road between cities i and j from both rows
+    void clear(int i, int j) {
+        bits[size_t(i) * words_per_row + size_t(j) / 64] &= ~(uint64_t(1) << (j % 64));
+        bits[size_t(j) * words_per_row + size_t(i) / 64] &= ~(uint64_t(1) << (i % 64));
+    }
+
+    bool test(int i, int j) const {
+        return (bits[size_t(i) * words_per_row + size_t(j) / 64] >> (j % 64)) & 1;
+    }
+
+    // Number of roads at a city
+    int degree(int city) const {
+        const uint64_t* words = row(city);
+        int total = 0;
+        for (size_t w = 0; w < words_per_row; w++) total += std::popcount(words[w]);
+        return total;
+    }
+};
+
+// Aggregates over a run of road budgets; only funded roads count towards min and max
+struct BudgetSummary {
+    double total = 0.0;
+    size_t funded = 0;                  // Roads with a budget above 0
+    double min = 0.0;                   // Smallest and largest funded budget, 0 if none is funded
+    double max = 0.0;
+};
+
+// Summarizes count budgets in one pass. Unfunded roads hold 0, so they add nothing to the total;
+// four independent lanes keep the loop free of a serial dependency on one accumulator.
+BudgetSummary summarize_budgets(const double* budgets, size_t count);
+
+// Counts, for each of limit_count limits, the budgets strictly above it, all in one pass;
+// above[k] - above[k + 1] is then the number of budgets in (limits[k], limits[k + 1]]
+void count_budgets_above(const double* budgets, size_t count, const double* limits, size_t limit_count,
+                         size_t* above);
+
+// Fiscal years the budget history accepts
+const int MIN_FISCAL_YEAR = 1990;
+const int MAX_FISCAL_YEAR = 2100;
+
+// Returns the fiscal year a moment falls in. Rwanda's fiscal year runs from 1 July to 30 June and
+// is named here by the calendar year it ends in, so FY2025 runs from July 2024 to June 2025.
+int fiscal_year_of(std::chrono::system_clock::time_point when);
+
+// Returns the fiscal year of the present moment
+inline int current_fiscal_year() { return fiscal_year_of(std::chrono::system_clock::now()); }
+
+// Budget history of the roads, kept append-only in one segment per fiscal year. A segment holds
+// its entries as parallel columns of road Nbrs and amounts in the order they were recorded, and
+// the segment's year stands for the year column, so an aggregate over one year scans two
+// contiguous arrays and never reads another year. A road's budget for a year is its latest entry
+// in that year's segment. Each segment is read from its file the first time it is needed.
+class BudgetHistory {
+public:
+    struct Segment {
+        std::vector<uint32_t> nbrs;
+        std::vector<double> amounts;    // 0 once a road's budget for the year was taken back
+        bool changed = false;           // Entries were added since the segment's file was written
+    };
+
+    // Returns the path of the file holding a fiscal year's segment
+    static std::string segment_path(int fiscal_year);
+
+    // Lists the fiscal years that have a segment file in the data directory; call once at startup
+    void find_saved_years();
+
+    // Returns a fiscal year's segment, reading it from its file first if need be
+    Segment& segment(int fiscal_year);
+
+    // Appends an entry for a road to a fiscal year's segment
+    void append(int fiscal_year, int nbr, double amount) {
+        Segment& entries = segment(fiscal_year);
+        entries.nbrs.push_back(static_cast<uint32_t>(nbr));
+        entries.amounts.push_back(amount);
+        entries.changed = true;
+    }
+
+    // Finds a road's latest amount in a fiscal year; returns false if the year has no entry for it
+    bool latest(int fiscal_year, int nbr, double& amount);
+
+    // Fills amounts[k] with the latest amount of road nbrs[k] in a fiscal year, 0 where it has
+    // none, in one pass over the year's columns
+    void latest_of(int fiscal_year, const std::vector<int>& nbrs, std::vector<double>& amounts);
+
+    // Fiscal years with any entry, saved or not, in increasing order
+    std::vector<int> years() const;
+
+    // Fiscal years whose segment changed since it was last written
+    std::vector<int> changed_years() const;
+
+    // Formats a segment's file: a SnapshotHeader whose Nbr field holds the fiscal year, then the
+    // uint32_t Nbr column padded to 8 bytes, then the double amount column
+    std::string format_segment(int fiscal_year);
+
+private:
+    std::map<int, Segment> segments;    // Segments read or written so far, by fiscal year
+    std::vector<int> saved_years;       // Fiscal years with a segment file, read or not
+};
+
+
+const double EARTH_RADIUS_KM = 6371.0088;  // Mean radius of the Earth
+
+// A city's location in degrees, north and east positive; NaN in both until one is given
+struct GeoPoint {
+    double latitude = NAN;
+    double longitude = NAN;
+
+    bool known() const { return !std::isnan(latitude); }
+};
+
+// Returns the point on the unit sphere at a location
+std::array<double, 3> unit_vector(GeoPoint location);
+
+// Great-circle distance in km between two known locations
+double great_circle_km(GeoPoint a, GeoPoint b);
+
+// A city found by a spatial query and its great-circle distance in km from the query point
+struct CityDistance {
+    int city;
+    double km;
+};
+
+// Static k-d tree over the cities of one network version that have a location. Each city is kept
+// as its unit vector on the sphere, where the straight-line distance between two points orders
+// cities exactly as the great-circle distance does, with no special case at the poles or across
+// 180 degrees of longitude. The tree is implicit: each range of the node array is split at its
+// middle node, on the axis along which the range is widest, so it needs no child pointers.
+class CityLocationIndex {
+public:
+    // Adds a city to be indexed by the next build()
+    void add(int city, GeoPoint location);
+
+    // Builds the tree over the cities added so far, in O(N log N)
+    void build();
+
+    size_t size() const { return nodes.size(); }
+
+    // Finds the count cities nearest to a location, closest first, leaving out the city skip
+    void nearest(GeoPoint from, size_t count, int skip, std::vector<CityDistance>& found) const;
+
+    // Finds every city within radius_km of a location, closest first, leaving out the city skip
+    void within(GeoPoint from, double radius_km, int skip, std::vector<CityDistance>& found) const;
+
+private:
+    struct Node {
+        std::array<double, 3> position; // Unit vector of the city's location
+        int city;
+        int axis;                       // Axis this node splits its range on
+    };
+    std::vector<Node> nodes;
+
+    // Arranges nodes[begin, end) into a subtree
+    void build_range(size_t begin, size_t end);
+
+    // Keeps the count nodes of nodes[begin, end) closest to point in best, a max-heap of
+    // (squared chord, city)
+    void search_nearest(size_t begin, size_t end, const std::array<double, 3>& point, size_t count, int skip,
+                        std::vector<std::pair<double, int>>& best) const;
+
+    // Collects the nodes of nodes[begin, end) within a squared chord of point
+    void search_within(size_t begin, size_t end, const std::array<double, 3>& point, double chord2, int skip,
+                       std::vector<std::pair<double, int>>& found) const;
+};
+
+// A new road proposed between two nearby cities that have no road between them
+struct RoadProposal {
+    int city1, city2;
+    double km;                          // Great-circle distance between the cities
+    bool joins_groups;                  // The cities cannot reach each other by road today
+};
+
+// A road between two cities; city1 always holds the lower city index. A removed road leaves a
+// tombstone with both cities -1 and its Nbr kept, until compaction sweeps it out of road_list.
+struct Road {
+    int city1, city2;
+    int nbr;                            // Stable road number written to the Nbr column of roads.txt
+
+    bool removed() const { return city1 < 0; }
+};
+
+// An entry in a city's adjacency list: the city on the other end and the road's slot in road_list
+struct RoadLink {
+    int neighbor;
+    int road;
+};
+
+// Edge weight used by route queries
+enum class RouteWeight {
+    Budget,                             // Sum of road budgets; roads without a budget are not usable
+    Hops                                // Number of roads
+};
+
+// Compressed sparse row copy of the road graph: city c's arcs are arcs[offsets[c]] up to
+// arcs[offsets[c + 1]], stored contiguously with their budgets so a search never chases pointers
+struct RoadGraphCsr {
+    struct Arc {
+        int target;
+        double budget;
+    };
+    std::vector<int> offsets;
+    std::vector<Arc> arcs;
+
+    // A* heuristic: when every city with a road has a location, positions holds each city's unit
+    // vector and a route from c to t costs at least scale * EARTH_RADIUS_KM * |positions[c] -
+    // positions[t]|, with scale the smallest cost per straight-line km of any usable road.
+    // positions is empty, and routes are found with plain Dijkstra, otherwise.
+    std::vector<std::array<double, 3>> positions;
+    double budget_scale = 0.0;          // Per km, for RouteWeight::Budget
+    double hops_scale = 0.0;            // Per km, for RouteWeight::Hops
+};
+
+// Binary min-heap of cities keyed by tentative distance, with decrease-key. Its buffers are kept
+// between queries, so once it has grown to the graph's size a search allocates nothing.
+class RouteHeap {
+private:
+    std::vector<std::pair<double, int>> entries; // (distance, city)
+    std::vector<int> position;          // Slot of each city in entries, or -1 if it is not queued
+
+    void place(size_t slot, std::pair<double, int> entry) {
+        entries[slot] = entry;
+        position[entry.second] = static_cast<int>(slot);
+    }
+
+    void sift_up(size_t slot) {
+        std::pair<double, int> entry = entries[slot];
+        while (slot > 0) {
+            size_t parent = (slot - 1) / 2;
+            if (entries[parent].first <= entry.first) break;
+            place(slot, entries[parent]);
+            slot = parent;
+        }
+        place(slot, entry);
+    }
+
+    void sift_down(size_t slot) {
+        std::pair<double, int> entry = entries[slot];
+        size_t count = entries.size();
+        while (true) {
+            size_t child = 2 * slot + 1;
+            if (child >= count) break;
+            if (child + 1 < count && entries[child + 1].first < entries[child].first) child++;
+            if (entry.first <= entries[child].first) break;
+            place(slot, entries[child]);
+            slot = child;
+        }
+        place(slot, entry);
+    }
+
+public:
+    // Empties the heap for a graph of city_count cities, touching only what the last query left
+    void reset(size_t city_count) {
+        for (const auto& entry : entries) position[entry.second] = -1;
+        entries.clear();
+        if (position.size() < city_count) position.resize(city_count, -1);
+    }
+
+    bool empty() const { return entries.empty(); }
+
+    // Queues a city, or lowers its distance if it is already queued with a larger one
+    void push_or_decrease(int city, double distance) {
+        int slot = position[city];
+        if (slot == -1) {
+            entries.emplace_back(distance, city);
+            sift_up(entries.size() - 1);
+        } else if (distance < entries[slot].first) {
+            entries[slot].first = distance;
+            sift_up(static_cast<size_t>(slot));
+        }
+    }
+
+    // Removes and returns the queued city with the smallest distance
+    std::pair<double, int> pop() {
+        std::pair<double, int> top = entries.front();
+        position[top.second] = -1;
+        std::pair<double, int> last = entries.back();
+        entries.pop_back();
+        if (!entries.empty()) {
+            entries[0] = last;
+            sift_down(0);
+        }
+        return top;
+    }
+};
+
+// Scratch state reused by route queries. Entries are valid only where stamp matches the current
+// query's stamp, so starting a query costs O(1) instead of clearing arrays of size N.
+struct RouteSearch {
+    RouteHeap heap;
+    std::vector<double> distance;
+    std::vector<int> previous;
+    std::vector<uint32_t> stamp;
+    uint32_t current_stamp = 0;
+};
+
+// Union-find over city indices with union by size and path halving. reset() reuses the
+// existing buffers, so repeated runs over the same network allocate nothing.
+class DisjointSet {
+private:
+    std::vector<int> parent;
+    std::vector<int> set_size;
+    int sets = 0;
+
+public:
+    // Puts each of count cities in its own set
+    void reset(size_t count) {
+        parent.resize(count);
+        set_size.resize(count);
+        for (size_t i = 0; i < count; i++) {
+            parent[i] = static_cast<int>(i);
+            set_size[i] = 1;
+        }
+        sets = static_cast<int>(count);
+    }
+
+    // Makes room for count cities so add() does not reallocate
+    void reserve(size_t count) {
+        parent.reserve(count);
+        set_size.reserve(count);
+    }
+
+    // Adds one more city in a set of its own
+    void add() {
+        parent.push_back(static_cast<int>(parent.size()));
+        set_size.push_back(1);
+        sets++;
+    }
+
+    // Returns the representative of the set containing city
+    int find(int city) {
+        while (parent[city] != city) {
+            parent[city] = parent[parent[city]];
+            city = parent[city];
+        }
+        return city;
+    }
+
+    // Joins the sets of a and b; returns false if they were already joined
+    bool unite(int a, int b) {
+        a = find(a);
+        b = find(b);
+        if (a == b) return false;
+        if (set_size[a] < set_size[b]) std::swap(a, b);
+        parent[b] = a;
+        set_size[a] += set_size[b];
+        sets--;
+        return true;
+    }
+
+    // Number of disjoint sets
+    int count() const { return sets; }
+};
+
+// Scratch state reused by the minimum-budget network planner
+struct NetworkPlan {
+    std::vector<std::pair<double, int>> candidates; // (budget, road) for every funded road, sorted by budget
+    std::vector<char> selected;         // Per road: 1 if it is part of the plan
+    DisjointSet components;
+    double total_budget = 0.0;
+    int selected_count = 0;
+};
+
+// Results and scratch state of a bridge and articulation point scan
+struct ConnectivityScan {
+    std::vector<int> discovery;         // DFS discovery time of each city, 0 if not yet visited
+    std::vector<int> low;               // Lowest discovery time reachable through the city's subtree
+    std::vector<char> articulation;     // Per city: 1 if removing it splits its component
+    std::vector<int> bridges;           // Roads whose removal splits their component
+    struct Frame {
+        int city;
+        int parent_road;                // Road used to reach city, -1 for a DFS root
+        size_t next_link;               // Next entry of adjacency[city] to explore
+    };
+    std::vector<Frame> stack;
+};
+
+// Largest network whose all-pairs route cost table is computed: the table takes 8 bytes per pair
+const int MAX_ROUTE_TABLE_CITIES = 20000;
+
+// How the all-pairs route cost table is computed
+enum class RouteTableMethod {
+    Automatic,                          // Floyd-Warshall for dense networks, Dijkstra from every city for sparse ones
+    FloydWarshall,
+    Dijkstra
+};
+
+// Cheapest funded-route cost between every pair of cities, HUGE_VAL where no funded route exists.
+// Rows are padded to a whole number of tiles so the blocked Floyd-Warshall kernels never see a
+// partial tile; the padding cities have no roads.
+struct RouteCostTable {
+    static constexpr size_t TILE = 64;  // Cities per tile side; a 64 x 64 tile of doubles is 32 KB
+    size_t city_count = 0;
+    size_t stride = 0;                  // Doubles per row, city_count rounded up to TILE
+    std::vector<double> costs;          // costs[from * stride + to]
+    uint64_t network_version = 0;       // Version of the network the table describes
+    RouteTableMethod method = RouteTableMethod::Automatic; // Method actually used
+    int threads = 0;                    // Threads actually used
+
+    double cost(int from, int to) const { return costs[size_t(from) * stride + size_t(to)]; }
+};
+
+// Writes a route cost table as a binary matrix: a 32-byte header ("RIMSRCT1", format version,
+// city count, network version and a checksum of the payload), then city_count rows of city_count
+// little-endian IEEE doubles, row i holding the costs from city ID i (line i + 1 of cities.txt)
+// and +infinity where no funded route exists. Returns false if the file cannot be written.
+bool save_route_cost_table(const RouteCostTable& table, const std::string& path);
+
+// Vector stored in fixed-size chunks that copies share until one of them changes: copying costs
+// one pointer per chunk, and writing an element first clones its chunk if another copy still
+// refers to it. One thread may write a copy while others read copies that nobody writes.
+template <typename T, size_t CHUNK_SIZE>
+class CowVector {
+private:
+    std::vector<std::shared_ptr<std::vector<T>>> chunks; // Every chunk but the last holds CHUNK_SIZE elements
+    size_t count = 0;
+
+    // Returns chunk c, cloned first unless this copy is its only owner
+    std::vector<T>& own_chunk(size_t c) {
+        if (chunks[c].use_count() > 1) {
+            auto copy = std::make_shared<std::vector<T>>();
+            copy->reserve(CHUNK_SIZE);
+            copy->assign(chunks[c]->begin(), chunks[c]->end());
+            chunks[c] = std::move(copy);
+        } else {
+            // Orders the reads of the copy that just released the chunk before our writes to it
+            std::atomic_thread_fence(std::memory_order_acquire);
+        }
+        return *chunks[c];
+    }
+
+public:
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const T& operator[](size_t i) const { return (*chunks[i / CHUNK_SIZE])[i % CHUNK_SIZE]; }
+
+    // Returns element i for writing
+    T& mutable_at(size_t i) { return own_chunk(i / CHUNK_SIZE)[i % CHUNK_SIZE]; }
+
+    void push_back(T value) {
+        if (count % CHUNK_SIZE == 0) {
+            chunks.push_back(std::make_shared<std::vector<T>>());
+            chunks.back()->reserve(CHUNK_SIZE);
+        }
+        own_chunk(count / CHUNK_SIZE).push_back(std::move(value));
+        count++;
+    }
+
+    void reserve(size_t capacity) { chunks.reserve((capacity + CHUNK_SIZE - 1) / CHUNK_SIZE); }
+
+    // Checks whether other holds exactly this copy's chunks, so neither was written since one was
+    // copied from the other
+    bool shares_storage(const CowVector& other) const { return count == other.count && chunks == other.chunks; }
+};
+
+// Name lookups over one version's city names, built by the first lookup that needs them. Versions
+// whose names did not change share one.
+struct CityNameLookup {
+    std::once_flag built;
+    std::vector<uint32_t> by_name;      // City IDs ordered by name
+    std::vector<std::string> keys;      // Lowercased name of each city ID
+    std::vector<uint32_t> by_key;       // City IDs ordered by key, then ID
+};
+
+// Immutable version of the network. The manager publishes a new version after every change and
+// readers query the version they hold without locking, so long analyses never wait for data
+// entry and data entry never waits for them. Consecutive versions share every storage chunk that
+// did not change between them, and the name lookups while the names stay the same. City names
+// point into the manager's name arena, so a version must not outlive the manager that published it.
+class NetworkView {
+public:
+    using Names = CowVector<std::string_view, 1024>;
+    using Roads = CowVector<Road, 1024>;
+    using Budgets = CowVector<double, 1024>;
+    using Locations = CowVector<GeoPoint, 1024>;
+    using Adjacency = CowVector<std::vector<RoadLink>, 16>; // Small chunks: a road touches two of them
+
+    // previous, if given, is the version this one replaces
+    NetworkView(uint64_t version, const Names& names, const Roads& roads, const Budgets& budgets,
+                const Adjacency& adjacency, const Locations& locations, int component_count,
+                size_t removed_road_count, const NetworkView* previous = nullptr);
+
+    // Number of changes published before this version
+    uint64_t version() const { return version_number; }
+
+    size_t city_count() const { return city_names.size(); }
+    std::string_view city_name(int city) const { return city_names[city]; }
+    size_t road_count() const { return road_list.size() - removed_road_count; }
+    // Road slots run from 0 to road_slots(), including the tombstones of removed roads
+    size_t road_slots() const { return road_list.size(); }
+    const Road& road(int r) const { return road_list[r]; }
+    double budget(int r) const { return road_budgets[r]; }
+    const std::vector<RoadLink>& roads_of(int city) const { return adjacency[city]; }
+    GeoPoint city_location(int city) const { return city_locations[city]; }
+
+    // Returns the ID of the city with exactly this name in this version, -1 if there is none
+    int find_city(std::string_view name) const;
+
+    // Collects up to limit city IDs whose names start with prefix, ignoring case, in name order
+    void cities_starting_with(std::string_view prefix, size_t limit, std::vector<uint32_t>& found) const;
+
+    // Checks whether every city can reach every other by road
+    bool is_connected() const { return component_count <= 1; }
+
+    // Numbers the groups of connected cities in order of their lowest city and fills group with
+    // each city's group number; returns the number of groups
+    int label_components(std::vector<int>& group) const;
+
+    // Finds the lowest-cost route from source to target, stopping as soon as the target is settled:
+    // with A* when every city with a road has a location (see RoadGraphCsr), which settles only the
+    // cities that lie roughly towards the target, and with Dijkstra's algorithm otherwise. Fills
+    // path with the cities on the route (source first) and cost with its total weight; returns
+    // false if no route exists. search holds the caller's scratch buffers.
+    bool find_route(int source, int target, RouteWeight weight, RouteSearch& search, std::vector<int>& path,
+                    double& cost) const;
+
+    // Computes a minimum spanning forest of the funded roads with Kruskal's algorithm: roads are
+    // taken cheapest first whenever they join two cities that are not yet connected
+    void plan_minimum_network(NetworkPlan& plan) const;
+
+    // Finds bridges and articulation points with an iterative version of Tarjan's algorithm, so
+    // long chains of cities cannot overflow the call stack
+    void scan_bridges_and_articulations(ConnectivityScan& scan) const;
+
+    // Computes the cheapest funded-route cost between every pair of cities on up to threads
+    // threads (0 for one per core). Floyd-Warshall runs over 64 x 64 tiles: each round closes the
+    // diagonal tile, then its row and column of tiles, then updates every other tile with a
+    // min-plus product, the tiles of a phase spread over the threads. Dijkstra runs from every
+    // city in parallel, which wins once the network is sparse enough. Returns false, leaving the
+    // table empty, if the network has more than MAX_ROUTE_TABLE_CITIES cities.
+    bool compute_route_costs(RouteCostTable& table, RouteTableMethod method = RouteTableMethod::Automatic,
+                             int threads = 0) const;
+
+    // Spatial queries over the cities with a location, answered from a k-d tree built by the first
+    // query on this version. The query city itself is never among the results.
+
+    // Finds the count cities nearest to a located city, closest first
+    void nearest_cities(int city, size_t count, std::vector<CityDistance>& found) const;
+
+    // Finds every city within radius_km of a located city, closest first
+    void cities_within(int city, double radius_km, std::vector<CityDistance>& found) const;
+
+    // Proposes up to limit new roads between cities at most max_km apart that have no road between
+    // them, closest first. Each city asks the tree only for cities closer than the limit-th best
+    // pair found so far, so the search shrinks as it goes instead of comparing every pair. With
+    // joining_only, only pairs of cities that cannot reach each other today are proposed.
+    void propose_roads(double max_km, size_t limit, std::vector<RoadProposal>& proposals, bool joining_only = false) const;
+
+private:
+    uint64_t version_number;
+    Names city_names;
+    Roads road_list;
+    Budgets road_budgets;
+    Adjacency adjacency;
+    Locations city_locations;
+    int component_count;                // Groups of connected cities, from the manager's union-find
+    size_t removed_road_count;          // Tombstones in road_list
+    mutable std::once_flag csr_built;
+    mutable RoadGraphCsr csr;           // Built by the first route query on this version
+    mutable std::once_flag location_index_built;
+    mutable CityLocationIndex location_index; // Built by the first spatial query on this version
+    std::shared_ptr<CityNameLookup> name_lookup;
+
+    // Returns the name lookups, building them on first use
+    const CityNameLookup& names_lookup() const;
+
+    // Returns the CSR copy of the road graph, building it on first use
+    const RoadGraphCsr& route_graph() const;
+
+    // Returns the k-d tree of the located cities, building it on first use
+    const CityLocationIndex& locations_index() const;
+};
+
+// A road row read by the bulk importer, with its cities already resolved to indices
+struct ImportedRoad {
+    int line;
+    int city1, city2;
+    double budget;                      // 0.0 when the row carries no budget
+};
+
+// A row the bulk importer could not use
+struct ImportRejection {
+    int line;
+    std::string reason;
+};
+
+// What one importer thread produced from its share of the input
+struct ImportChunk {
+    std::vector<ImportedRoad> roads;    // Line numbers are relative to the start of the chunk
+    std::vector<ImportRejection> rejections;
+    int newlines = 0;                   // Newlines in the chunk, to place the next chunk's lines
+};
+
+// Input formats understood by the bulk importer
+enum class ImportFormat {
+    Csv,                                // Header row naming from/to/budget columns, one road per row
+    GeoJson                             // Features whose properties hold from, to and budget
+};
+
+// Outcome of a change made through the InfrastructureManager API
+enum class ChangeStatus {
+    Ok,
+    InvalidName,                        // Not a valid city name (see is_valid_city_name)
+    DuplicateName,                      // Another city already has the name
+    CityLimitReached,
+    UnknownCity,                        // No city has the given ID
+    SameCity,                           // A road from a city to itself
+    RoadExists,
+    NoSuchRoad,
+    InvalidBudget,                      // Outside (0, 1000] billion RWF
+    InvalidYear,                        // Fiscal year outside MIN_FISCAL_YEAR to MAX_FISCAL_YEAR
+    InvalidLocation,                    // Latitude outside [-90, 90] or longitude outside [-180, 180]
+    WriteFailed                         // The log could not be written, so the change was taken back
+};
+
+// Describes a change status in words
+const char* describe(ChangeStatus status);
+
+// A budget to give the road between two cities, for InfrastructureManager::set_budgets
+struct BudgetChange {
+    int city1, city2;
+    double budget;
+};
+
+// A location to give a city, for InfrastructureManager::set_locations
+struct LocationChange {
+    int city;
+    GeoPoint location;
+};
+
+// Strips leading and trailing spaces and tabs
+std::string_view trim(std::string_view text);
+
+// One change as the undo history keeps it: what it touched and the values on either side, never
+// a copy of the network. Roads are named by their cities and Nbr rather than their slot, so the
+// history survives compaction sweeping tombstones out of road_list.
+struct ChangeDelta {
+    enum class Kind : uint8_t { AddCity, AddRoad, SetBudget, Rename, RemoveRoad, RemoveCity, SetYearBudget, SetLocation } kind;
+    int city1 = -1, city2 = -1;         // The city, or the two cities of the road
+    int nbr = 0;                        // AddRoad, RemoveRoad and SetYearBudget: the road's Nbr
+    double old_budget = 0.0, new_budget = 0.0; // SetBudget and SetYearBudget, and RemoveRoad's old budget; 0 is no budget
+    std::string old_name, new_name;     // Rename; AddCity uses new_name and RemoveCity old_name
+    int fiscal_year = 0;                // SetBudget and SetYearBudget: the history year, 0 for none
+    GeoPoint old_location, new_location; // SetLocation; RemoveCity uses old_location
+};
+
+// Mapped roads.snap whose roads are paged in city by city (defined in rims_core.cpp)
+struct LazyRoadSnapshot;
+
+class InfrastructureManager {
+public:
+    // Constructor loads the snapshots (or the text files), replays any log records not yet folded
+    // into them, and starts the background log writer
+    explicit InfrastructureManager(const PersistenceOptions& options = PersistenceOptions());
+
+    // Destructor stops the background writer and folds everything logged into the data files
+    ~InfrastructureManager();
+
+    InfrastructureManager(const InfrastructureManager&) = delete;
+    InfrastructureManager& operator=(const InfrastructureManager&) = delete;
+
+    // Sets the maximum number of cities
+    void set_max_cities(int limit);
+
+    // Folds everything logged so far into the data files now, instead of when the background
+    // worker next finds compaction due
+    void checkpoint();
+
+    // Non-interactive API. Cities are identified by their 0-based ID, the index the log and the
+    // snapshots use. Each call validates and applies its change under state_mutex and logs it
+    // before returning; the bulk variants apply all of their changes as one logged transaction,
+    // or none of them along with the position of the first bad entry in failed.
+
+    // Adds a city
+    ChangeStatus add_city(std::string_view name);
+
+    // Adds a road with no budget between two cities
+    ChangeStatus add_road(int city1, int city2);
+
+    // Sets the budget of the road between two cities
+    ChangeStatus set_budget(int city1, int city2, double budget);
+
+    // Renames a city
+    ChangeStatus rename_city(int city, std::string_view new_name);
+
+    // Adds several cities
+    ChangeStatus add_cities(std::span<const std::string_view> names, size_t* failed = nullptr);
+
+    // Adds several roads with no budget
+    ChangeStatus add_roads(std::span<const std::pair<int, int>> roads, size_t* failed = nullptr);
+
+    // Sets several budgets; a road listed twice ends up with its last budget
+    ChangeStatus set_budgets(std::span<const BudgetChange> changes, size_t* failed = nullptr);
+
+    // Gives a city a location in degrees, replacing any it had
+    ChangeStatus set_location(int city, double latitude, double longitude);
+
+    // Gives several cities a location; a city listed twice ends up with its last location
+    ChangeStatus set_locations(std::span<const LocationChange> changes, size_t* failed = nullptr);
+
+    // Budget history. Every budget set through the calls above is also appended to the history of
+    // the current fiscal year (see fiscal_year_of); budgets read from the data files or taken back
+    // along with a removed road are not.
+
+    // Records a road's budget for a fiscal year. For the current fiscal year this is set_budget;
+    // for any other year only the history changes, which is how earlier years are filled in.
+    ChangeStatus set_budget_for_year(int city1, int city2, int fiscal_year, double budget);
+
+    // Finds the budget recorded for the road between two cities in a fiscal year; returns false if
+    // there is none
+    bool budget_in_year(int city1, int city2, int fiscal_year, double& budget);
+
+    // Summarizes the budgets recorded in a fiscal year for the roads that touch a city now,
+    // reading that year's history and no other
+    BudgetSummary city_budgets_in_year(int city, int fiscal_year);
+
+    // Fiscal years with any budget history, in increasing order
+    std::vector<int> budget_history_years();
+
+    // Removes the road between two cities. Its slot in road_list stays behind as a tombstone until
+    // the next compaction sweeps it out; the data files never hold it.
+    ChangeStatus remove_road(int city1, int city2);
+
+    // Removes a city and every road at it. Every later city moves down one ID at once, in one pass
+    // over the names, roads and adjacency lists, so IDs stay dense; with lazy_roads, every road is
+    // paged in first.
+    ChangeStatus remove_city(int city);
+
+    // Removes several cities and every road at them as one step, renumbering the cities left in a
+    // single pass. Fails with UnknownCity, changing nothing, if an ID is not a city or is listed
+    // twice; failed then holds its position in cities.
+    ChangeStatus remove_cities(std::span<const int> cities, size_t* failed = nullptr);
+
+    // Transactions and undo. Every change made through the calls above and below is recorded as a
+    // step of deltas: one call is one step, and so is a whole transaction. While a transaction is
+    // open its changes are visible at once but held back from the log (and from compaction) until
+    // commit_transaction() writes them as one logged transaction; rollback_transaction() takes
+    // them back. undo() and redo() log their changes the same way. Steps apply to the whole
+    // manager, so with several clients undo takes back the latest step whoever made it.
+
+    // Opens a transaction; returns false if one is already open
+    bool begin_transaction();
+
+    // Logs and closes the open transaction as one undo step; returns false if none is open
+    bool commit_transaction();
+
+    // Takes back every change of the open transaction and closes it; returns false if none is open
+    bool rollback_transaction();
+
+    // Takes back the latest step and returns how many changes it held; 0 if there is none or a
+    // transaction is open
+    size_t undo();
+
+    // Applies the step undo() took back most recently again and returns how many changes it
+    // held; 0 if there is none or a transaction is open. Any new change forgets the undone steps.
+    size_t redo();
+
+    bool in_transaction();
+    size_t transaction_size();          // Changes made in the open transaction
+    size_t undo_steps_available();
+    size_t redo_steps_available();
+
+    // Read access for clients; views and references stay valid until the next change
+    size_t city_count() const { return city_names.size(); }
+    std::string_view city_name(int city) const { return city_names[city]; }
+    int find_city(std::string_view name) const { return get_city_index(name); }
+    GeoPoint city_location(int city) const { return city_locations[city]; }
+    int city_limit() const { return max_cities; }
+    // With lazy_roads, roads() and budgets() first page in every road, roads_of only the city's own
+    const std::vector<Road>& roads() { ensure_all_roads(); return road_list; }
+    const std::vector<double>& budgets() { ensure_all_roads(); return road_budgets; }
+    const std::vector<RoadLink>& roads_of(int city) { ensure_city_roads(city); return adjacency[city]; }
+    // roads() also holds the tombstones of removed roads (see Road::removed), which road_count() leaves out
+    size_t road_count() { ensure_all_roads(); return road_list.size() - removed_roads; }
+
+    // Versions of find_city and cities_starting_with for threads other than the one making changes;
+    // each waits for a change in progress, if any, including its log write. Readers that must not
+    // wait use the same lookups on view().
+    int lookup_city(std::string_view name);
+    void lookup_prefix(std::string_view prefix, size_t limit, std::vector<uint32_t>& found);
+
+    // Returns the latest published version of the network. Readers on any thread query it without
+    // blocking writers; it reflects every change that returned before the call.
+    // With lazy_roads, the first call pages in every road.
+    std::shared_ptr<const NetworkView> view() {
+        ensure_all_roads();
+        return published_view.load(std::memory_order_acquire);
+    }
+
+    // Reads the change feed for downstream systems from any thread: up to limit changes numbered
+    // from onwards, as durable on disk. A consumer bootstraps from the data files, which include
+    // every change up to exported_sequence(), then applies the changes after it in order.
+    bool read_changes(uint64_t from, size_t limit, std::vector<FeedChange>& changes) const {
+        return change_feed.read(from, limit, changes);
+    }
+
+    // Sequence numbers of the oldest and newest changes held by the change feed, 0 if it is empty
+    uint64_t first_change_sequence() const { return change_feed.first_sequence(); }
+    uint64_t last_change_sequence() const { return change_feed.last_sequence(); }
+
+    // Sequence number of the last change included in the data files (data/changes.position),
+    // 0 until a compaction has recorded one
+    uint64_t exported_sequence() const { return exported_change_sequence.load(std::memory_order_acquire); }
+
+    // Returns the slot in road_list of the road between cities i and j, or -1 if there is none
+    int find_road(int i, int j);
+
+    // Checks if a road exists between cities i and j
+    bool road_exists(int i, int j);
+
+    // Checks whether every road is in memory, as it is unless lazy_roads left some in roads.snap
+    bool all_roads_loaded() const { return roads_complete.load(std::memory_order_acquire); }
+
+    // Collects up to limit cities whose names start with prefix, in name order
+    void cities_starting_with(std::string_view prefix, size_t limit, std::vector<uint32_t>& found);
+
+    // Collects up to limit cities whose names are within max_distance edits of name, closest first
+    void cities_similar_to(std::string_view name, int max_distance, size_t limit,
+                           std::vector<CitySearchIndex::Match>& found);
+
+    // Lists the cities joined by road to both a and b, and counts the cities within two roads of a.
+    // Dense mode intersects and merges bit rows a word at a time; otherwise adjacency lists are
+    // marked in a per-city array.
+    void neighbor_overlap(int a, int b, std::vector<int>& common, size_t& two_hop_count);
+
+    // A command from a batch stream
+    struct BatchCommand {
+        enum class Kind { City, Road, Budget, Rename, Location } kind;
+        int line;
+        std::string first, second;      // City names; for Rename, the current and the new name
+        double budget = 0.0;
+        GeoPoint location;              // Location only
+    };
+
+    // Parses one batch line into a command; returns false with a message if it is malformed
+    static bool parse_batch_line(std::string_view line, BatchCommand& command, std::string& error);
+
+    // Applies commands one after another, each on its own: one that is invalid given the changes
+    // before it is skipped and reported in statuses, and the rest still apply. Everything applied
+    // is logged as one transaction with one flush and published as one version, which is how a
+    // server commits the mutations its clients sent while the previous group was being written.
+    // If the group cannot be written to the log, it is taken back and every command gets
+    // WriteFailed.
+    void apply_commands(std::span<const BatchCommand> commands, std::vector<ChangeStatus>& statuses);
+
+    // Applies a stream of batch commands as one transaction. Each line is one of
+    //     city <name>
+    //     road <city>, <city>
+    //     budget <city>, <city>, <amount>
+    //     rename <current name>, <new name>
+    //     location <city>, <latitude>, <longitude>
+    // Blank lines and lines starting with '#' are ignored. Every command is validated against the
+    // state the earlier commands leave behind; if any is invalid, nothing is applied. Otherwise
+    // all changes are logged as a single transaction with one flush. Returns false if rejected.
+    bool run_batch(std::istream& in);
+
+    // Import roads and budgets from a CSV or GeoJSON road inventory; returns false if the file
+    // could not be read
+    bool import_road_file(const std::string& path);
+
+    // Validates city name
+    static bool is_valid_city_name(std::string_view name);
+
+    // Validates budget amount
+    static bool is_valid_budget(double budget);
+
+    // Validates a fiscal year for the budget history
+    static bool is_valid_fiscal_year(int fiscal_year) {
+        return fiscal_year >= MIN_FISCAL_YEAR && fiscal_year <= MAX_FISCAL_YEAR;
+    }
+
+    // Validates a location in degrees
+    static bool is_valid_location(double latitude, double longitude) {
+        return latitude >= -90.0 && latitude <= 90.0 && longitude >= -180.0 && longitude <= 180.0;
+    }
+
+private:
+    CityNameTable city_names;           // Interned city names, indexed by 0-based city ID
+    CitySearchIndex city_search;        // Prefix and approximate name search over city_names
+    bool city_search_stale = false;     // Cities were renumbered; city_search is rebuilt when next used
+    std::vector<Road> road_list;        // Every road exactly once, in Nbr order, with tombstones of removed roads
+    std::vector<double> road_budgets;   // Budget of road_list[r] in billion RWF (0 until one is added), kept contiguous for aggregate scans
+    NetworkView::Adjacency adjacency;   // Per-city lists of incident roads, sized by degree rather than city count
+    std::vector<GeoPoint> city_locations; // Location of each city, unknown until one is given
+    int next_road_nbr = 1;              // Nbr assigned to the next new road
+    size_t removed_roads = 0;           // Tombstones in road_list, swept out by the next compaction
+    bool cities_changed = true;         // City names changed since the city files were last saved
+    bool roads_changed = true;          // Roads or budgets changed since the road files were last saved
+    int max_cities = DEFAULT_MAX_CITIES; // Maximum number of cities, set with --max-cities
+
+    PersistenceOptions persistence;     // Group commit and compaction settings
+    ChangeFeed change_feed;             // Changes for downstream systems, fed by the log; outlives wal
+    WriteAheadLog wal;                  // Log of mutations not yet folded into the data files
+    std::atomic<uint64_t> exported_change_sequence{0}; // Last change the data files include
+    std::mutex state_mutex;             // Serializes mutations against the compactor reading the state
+    std::mutex compaction_mutex;        // Keeps the background and shutdown compactions apart
+    std::chrono::steady_clock::time_point last_compaction = std::chrono::steady_clock::now();
+    std::thread background_worker;      // Flushes due log groups and runs compaction
+    std::mutex worker_mutex;
+    std::condition_variable worker_wakeup;
+    bool stopping = false;              // Set under worker_mutex to stop the background worker
+
+    DisjointSet connectivity;           // Cities joined by roads, maintained as roads are inserted
+    RoadBitMatrix dense_roads;          // Bit matrix of roads, kept up to date while dense_mode is on
+    bool dense_mode = false;            // On for small networks whose average degree exceeds a bit row
+    bool dense_roads_stale = false;     // Cities were renumbered; dense_roads is rebuilt when next used
+
+    NetworkView::Names view_names;      // Names, roads and budgets as published views share them
+    NetworkView::Roads view_roads;
+    NetworkView::Budgets view_budgets;
+    NetworkView::Locations view_locations;
+    std::atomic<std::shared_ptr<const NetworkView>> published_view;
+    uint64_t published_version = 0;
+
+    std::unique_ptr<LazyRoadSnapshot> lazy_roads; // Roads still in roads.snap, null once all are loaded
+    std::atomic<bool> roads_complete{true}; // Cleared while lazy_roads holds roads not yet paged in
+    bool connectivity_stale = false;    // A road or city was removed since connectivity was built
+
+    bool recording_changes = false;     // Off while loading, replaying and applying undo steps
+    std::vector<ChangeDelta> open_changes; // Changes of the step in progress
+    bool open_step_overflowed = false;  // The step in progress outgrew the history and is not kept
+    std::deque<std::vector<ChangeDelta>> undo_history; // Steps that can be undone, oldest first
+    std::vector<std::vector<ChangeDelta>> redo_history; // Undone steps, most recently undone last
+    size_t undo_history_changes = 0;    // Deltas held in undo_history
+    bool transaction_open = false;
+    std::string transaction_records;    // Log records of the open transaction
+    size_t transaction_record_count = 0;
+
+    BudgetHistory budget_history;       // Budgets by fiscal year, besides the current one in road_budgets
+
+    // Returns 0-based index of city by name, or -1 if not found
+    int get_city_index(std::string_view name) const;
+
+    // Checks if a city exists
+    bool city_exists(std::string_view name) const;
+
+    // Versions of find_road and road_exists for callers holding state_mutex; roads of both cities
+    // must already be paged in
+    int road_slot(int i, int j) const;
+    bool has_road(int i, int j) const;
+
+    // Loads the roads of a city from the mapped roads.snap, unless they already are; caller holds
+    // state_mutex. A road is inserted with whichever of its cities is paged in first.
+    void page_in_roads(int city);
+
+    // Loads every road still in the mapped roads.snap and releases the mapping, putting road_list
+    // back in Nbr order if cities were paged in out of it; caller holds state_mutex
+    void page_in_all_roads();
+
+    // Sorts road_list by Nbr and renumbers the road slots in the adjacency lists to match
+    void restore_road_order();
+
+    // Locking versions of page_in_roads and page_in_all_roads for the public accessors; free once
+    // every road is loaded
+    void ensure_city_roads(int city);
+    void ensure_all_roads();
+
+    // Dense mode pays off once a bit row (N/64 words) is no longer than an average adjacency list
+    bool dense_mode_worthwhile();
+
+    // Rebuilds the bit matrix from the road list, with room for the network to double
+    void rebuild_dense_roads();
+
+    // Rebuilds the bit matrix if a renumbering left it stale; every use of the bits goes through it
+    void refresh_dense_roads();
+
+    // Returns city_search, rebuilding it first if a renumbering left it stale
+    CitySearchIndex& search_index();
+
+    // Appends a city with no roads
+    void append_city(std::string_view name);
+
+    // Makes room for count cities in every per-city structure, so adding them never reallocates
+    void reserve_cities(size_t count);
+
+    // Renames the city at index, keeping the name indexes in sync
+    void apply_rename(int index, std::string_view new_name);
+
+    // Sets the location of a city
+    void apply_location(int city, GeoPoint location);
+
+    // Records a new road between cities i and j and returns its slot in road_list.
+    // Nbrs must be handed out in increasing order so road_list stays sorted by Nbr.
+    int insert_road(int i, int j, int nbr, double budget);
+
+    // Puts back a road that was removed, with its old Nbr, and returns its slot: its tombstone is
+    // revived if still there, otherwise the road is sorted back into Nbr order. A road whose Nbr
+    // another road has taken gets a new one. Never recorded as a change.
+    int restore_road(int i, int j, int nbr, double budget);
+
+    // Removes a road, leaving a tombstone in its slot. Removals leave connectivity out of date
+    // until publish_view rebuilds it.
+    void discard_road(int road);
+
+    // Drops every tombstone from road_list in one pass, renumbers the slots in the adjacency lists
+    // to match and publishes the result
+    void sweep_removed_roads();
+
+    // Removes a city that has no roads left, moving every later city down one ID; every road must
+    // be paged in
+    void discard_city(int city);
+
+    // Removes cities that have no roads left, given in increasing order, moving the later cities
+    // down to close the gaps in one pass; every road must be paged in. The removals are recorded
+    // from the highest ID down, as one at a time, so undo puts each back under its old ID.
+    void discard_cities(std::span<const int> cities);
+
+    // Inserts a city with no roads as ID city, moving every later city up one ID; every road must
+    // be paged in
+    void restore_city(int city, std::string_view name);
+
+    // Moves every city c to new_id[c] in the roads and adjacency lists after cities were removed
+    // or inserted, rebuilds the view's per-city chunks and marks the search index and the bit
+    // matrix stale
+    void renumber_cities(const std::vector<int>& new_id);
+
+    // Rebuilds connectivity from the road list after removals
+    void rebuild_connectivity();
+
+    // Publishes the current state as a new NetworkView; caller holds state_mutex
+    void publish_view();
+
+    // Logs one record, or several forming one transaction, for a change just applied and closes
+    // its undo step; while a transaction is open the records wait for commit_transaction instead
+    void log_change(std::string_view record);
+    void log_changes(std::string_view records, size_t count);
+
+    // Adds a change to the step in progress
+    void record_change(ChangeDelta change);
+
+    // Moves open_changes into the undo history as one step, forgetting the oldest steps beyond
+    // UNDO_HISTORY_CHANGES and every undone step
+    void close_undo_step();
+
+    // Takes back a step's changes in reverse order, appending the log records that do so
+    void revert_step(const std::vector<ChangeDelta>& step, std::string& records, size_t& count);
+
+    // Applies a step's changes again in order, appending their log records
+    void reapply_step(const std::vector<ChangeDelta>& step, std::string& records, size_t& count);
+
+    // Appends the fiscal year budgets of open_changes to the budget history, which an open
+    // transaction defers until it commits
+    void append_deferred_history();
+
+    // Column positions of a CSV road inventory, found from its header row
+    struct CsvColumns {
+        int from = -1, to = -1, budget = -1;
+    };
+
+    // Splits a CSV line into fields, dropping surrounding spaces and double quotes
+    static void split_csv_line(std::string_view line, std::vector<std::string_view>& fields);
+
+    // Finds the from/to/budget columns in a CSV header row
+    static bool parse_csv_header(std::string_view header, CsvColumns& columns);
+
+    // Validates one imported row and resolves its cities. An empty budget means the road has none.
+    // Only reads the name index, so chunks can be checked concurrently.
+    void resolve_imported_road(int line, std::string_view from, std::string_view to, std::string_view budget_text,
+                               ImportChunk& chunk);
+
+    // Parses the CSV rows in data[begin, end), which starts and ends on line boundaries
+    void parse_csv_chunk(std::string_view data, size_t begin, size_t end, const CsvColumns& columns, ImportChunk& chunk);
+
+    // Reads the JSON value that follows a key: the contents of a string, or the raw text of a number
+    // or literal. Returns the position after the value.
+    static size_t read_json_value(std::string_view data, size_t pos, std::string_view& value);
+
+    // Parses the GeoJSON features whose "properties" key starts in data[begin, end). Each properties
+    // object is flat, with from/to (or city1/city2) names and an optional budget.
+    void parse_geojson_chunk(std::string_view data, size_t begin, size_t end, ImportChunk& chunk);
+
+    // Reads a road inventory in parallel: the mapped file is cut into one chunk per core (on line
+    // boundaries for CSV), each chunk is parsed and resolved on its own thread, and the results are
+    // merged into the network in file order as one logged transaction. Returns false if the file
+    // could not be read at all.
+    bool import_roads(const std::string& path, ImportFormat format);
+
+    // Picks the import format from a file name: .csv is CSV, .geojson and .json are GeoJSON
+    static bool import_format_for(const std::string& path, ImportFormat& format);
+
+    // Creates data directory if it doesn't exist
+    void ensure_data_directory();
+
+    // Formats the contents of data/cities.txt
+    std::string format_cities_file();
+
+    // Formats the contents of data/roads.txt
+    std::string format_roads_file();
+
+    // Formats data/cities.snap (see SnapshotHeader for the layout)
+    std::string format_cities_snapshot();
+
+    // Formats data/roads.snap (see SnapshotHeader for the layout)
+    std::string format_roads_snapshot();
+
+    // Loads cities and roads from the binary snapshots; returns false, having loaded nothing, if
+    // either is missing or unusable. With lazy_roads and an indexed roads.snap, only the cities are
+    // loaded and the roads file is kept mapped for page_in_roads.
+    bool load_snapshot();
+
+    // A data file and the contents it should be replaced with
+    struct DataFile {
+        std::string path;
+        std::string contents;
+    };
+
+    // Replaces the data files with new contents. The new files are written beside the old ones and
+    // a marker is committed before they are renamed into place, so startup can finish an
+    // interrupted swap and the files always describe the same state.
+    bool save_data_files(const std::vector<DataFile>& files);
+
+    // Renames every committed .new data file into place and clears the marker
+    bool finish_data_file_swap();
+
+    // Completes or discards a data file swap that was interrupted by a crash
+    void recover_data_files();
+
+    // Folds the log into the snapshots and text files. The current log is retired first, the data
+    // files are rewritten from memory, and the retired log is deleted as part of committing the
+    // swap, so a crash at any point still leaves files and logs that reproduce the latest state.
+    // Tombstones are swept out of road_list on the way.
+    void compact();
+
+    // Checks whether enough has been logged, or enough time has passed, to compact
+    bool compaction_due();
+
+    // Background worker: flushes log groups that have waited long enough and compacts when due
+    void run_background_worker();
+
+    // Log record formats: C (city added), R (road added), B (budget set, 0 for none, with the
+    // fiscal year it is recorded for when it goes into the history), E (city renamed), D (road
+    // removed), X (city removed, with its roads), A (removed city put back at its index), Y
+    // (history entry for a road Nbr and fiscal year) and L (city location, latitude then
+    // longitude), with tab-separated fields that refer to cities by 0-based index, except C and X
+    // which name the city. Replay applies them in order, so an index always means the ID the city
+    // had when the record was written. T (transaction of the next count records) and S (sequence
+    // number of the group's first change) frame the records and are not changes themselves.
+
+    static std::string city_record(std::string_view name);
+    static std::string road_record(const Road& road);
+    static std::string budget_record(int i, int j, double budget, int fiscal_year);
+    static std::string year_budget_record(int nbr, int fiscal_year, double budget);
+    static std::string rename_record(int index, std::string_view name);
+    static std::string road_removal_record(int i, int j);
+    static std::string city_removal_record(std::string_view name);
+    static std::string city_restore_record(int index, std::string_view name);
+    static std::string location_record(int index, GeoPoint location);
+
+    // Checks whether id names a city
+    bool is_city(int id) const;
+
+    // Checks that no city has name yet and that it is a valid city name
+    ChangeStatus check_new_name(std::string_view name) const;
+
+    // Checks that a city called name can be added to a network of city_count cities
+    ChangeStatus check_new_city(std::string_view name, size_t city_count) const;
+
+    // Checks that two different cities are named
+    ChangeStatus check_city_pair(int city1, int city2) const;
+
+    // Checks that the road between two cities exists and budget is valid for it, paging in the
+    // roads of both cities
+    ChangeStatus check_budget_change(int city1, int city2, double budget);
+
+    // Reports the first bad entry of a rejected bulk change
+    static ChangeStatus reject_bulk(ChangeStatus status, size_t position, size_t* failed);
+
+    // Sets the budget of a road and, unless fiscal_year is 0, appends it to that year's history
+    void set_road_budget(int road, double budget, int fiscal_year);
+
+    // Appends a road's budget to a fiscal year's history without touching its current budget
+    void set_history_budget(int nbr, int fiscal_year, double budget);
+
+    // Parses a non-negative integer log field
+    static bool parse_log_int(std::string_view field, int& value);
+
+    // Applies one log record. Records that are already reflected in the loaded data, such as a road
+    // that exists or a city name that is taken, are skipped.
+    bool apply_log_record(std::string_view record);
+
+    // Replays a log file and returns how many records it held; stops at the first damaged record,
+    // such as one torn by a crash mid-write, and cuts the file there so new records are not appended
+    // after the damage. A transaction is applied only if all of it was written. Numbered changes
+    // newer than the change feed's last go to the feed, which a crash may have kept them out of.
+    size_t replay_log(const std::string& path);
+
+    // Loads cities from data/cities.txt and returns the city ID loaded for each index in the file,
+    // -1 for lines that were skipped
+    std::vector<int> load_cities_from_file();
+
+    // Loads roads and budgets from data/roads.txt, translating the city indexes it holds through
+    // city_ids. Files written before roads referred to cities by index name them instead.
+    void load_roads_from_file(const std::vector<int>& city_ids);
+};
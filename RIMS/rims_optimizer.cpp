@@ -0,0 +1,439 @@
+#include "rims_optimizer.h"
+
+#include <deque>      // For each worker's branches
+#include <mutex>      // For guarding the deques and the best plan
+#include <thread>     // For the worker pool
+#include <algorithm>  // For ordering candidates and group sizes
+#include <cmath>      // For isfinite
+
+using namespace std;
+
+const Probe OPTIMIZE_PROBE("optimize_investment");
+
+const size_t SPAWN_MIN_REMAINING = 8;       // Branches with fewer candidates left are not worth handing out
+const uint64_t CLOCK_CHECK_INTERVAL = 256;  // Branches explored between checks of the deadline
+
+// The optimizer's problem on the graph of groups: the usable candidates cheapest first, each
+// joining two groups numbered from 0
+struct InvestmentProblem {
+    vector<int> original;               // Index of each candidate in the caller's list
+    vector<int> end1, end2;             // Groups joined by each candidate
+    vector<double> cost;
+    vector<uint64_t> group_size;        // Cities per group
+    InvestmentGoal goal = InvestmentGoal::ConnectedPairs;
+    int hub_group = -1;                 // Group of the hub city, with CitiesReached
+    double budget_cap = 0.0;
+};
+
+// Union-find over the groups whose joins can be undone latest first, so a branch leaves the sets
+// as it found them. Union by size without path compression keeps find within O(log n) steps.
+class UndoableSets {
+private:
+    vector<int> parent;
+    vector<uint64_t> set_size;
+    vector<pair<int, uint64_t>> joins;  // (root attached under another, value gained) per join
+    InvestmentGoal goal = InvestmentGoal::ConnectedPairs;
+    int hub = -1;
+
+public:
+    uint64_t value = 0;                 // Goal value gained by the joins so far
+
+    // Puts each group of the problem in a set of its own
+    void reset(const InvestmentProblem& problem) {
+        size_t n = problem.group_size.size();
+        parent.resize(n);
+        for (size_t g = 0; g < n; g++) parent[g] = static_cast<int>(g);
+        set_size = problem.group_size;
+        joins.clear();
+        goal = problem.goal;
+        hub = problem.hub_group;
+        value = 0;
+    }
+
+    int find(int group) const {
+        while (parent[group] != group) group = parent[group];
+        return group;
+    }
+
+    // Returns the goal value gained by joining the sets with roots a and b
+    uint64_t gain(int a, int b) const {
+        if (goal == InvestmentGoal::ConnectedPairs) return set_size[a] * set_size[b];
+        int hub_root = find(hub);
+        return a == hub_root ? set_size[b] : b == hub_root ? set_size[a] : 0;
+    }
+
+    // Joins the sets of groups a and b; returns false if they were already joined
+    bool unite(int a, int b) {
+        a = find(a);
+        b = find(b);
+        if (a == b) return false;
+        uint64_t gained = gain(a, b);
+        if (set_size[a] < set_size[b]) swap(a, b);
+        parent[b] = a;
+        set_size[a] += set_size[b];
+        joins.emplace_back(b, gained);
+        value += gained;
+        return true;
+    }
+
+    // Reverts the latest join
+    void undo() {
+        auto [child, gained] = joins.back();
+        joins.pop_back();
+        set_size[parent[child]] -= set_size[child];
+        parent[child] = child;
+        value -= gained;
+    }
+
+    size_t join_count() const { return joins.size(); }
+
+    // Returns an upper bound on the value that joins_left more joins could gain: the most they can do is
+    // gather the largest sets into one (ConnectedPairs) or into the hub's (CitiesReached)
+    uint64_t best_gain_of(size_t joins_left, vector<uint64_t>& sizes) const {
+        if (joins_left == 0) return 0;
+        int hub_root = goal == InvestmentGoal::CitiesReached ? find(hub) : -1;
+        sizes.clear();
+        for (size_t g = 0; g < parent.size(); g++) {
+            if (parent[g] == static_cast<int>(g) && static_cast<int>(g) != hub_root) sizes.push_back(set_size[g]);
+        }
+        size_t taken = min(sizes.size(), goal == InvestmentGoal::ConnectedPairs ? joins_left + 1 : joins_left);
+        partial_sort(sizes.begin(), sizes.begin() + static_cast<ptrdiff_t>(taken), sizes.end(), greater<uint64_t>());
+        uint64_t total = 0, pairs_within = 0;
+        for (size_t k = 0; k < taken; k++) {
+            pairs_within += sizes[k] * total;   // Pairs between this set and the larger ones
+            total += sizes[k];
+        }
+        return goal == InvestmentGoal::ConnectedPairs ? pairs_within : total;
+    }
+};
+
+// A branch of the search waiting for a worker: the candidates before next are decided
+struct BranchTask {
+    size_t next = 0;
+    double spent = 0.0;
+    vector<int> chosen;                 // Candidates built so far
+};
+
+// One thread of the search and the branches it has handed out
+struct SearchWorker {
+    mutex deque_mutex;
+    deque<BranchTask> branches;         // The owner takes the newest, thieves the oldest
+    atomic<size_t> queued{0};           // branches.size(), readable without the lock
+    UndoableSets sets;
+    vector<int> chosen;                 // Candidates built on the current branch
+    vector<int> forest;                 // Scratch for the spanning forest bound
+    vector<uint64_t> sizes;             // Scratch for the join bound
+    uint64_t nodes = 0;
+};
+
+// A branch and bound search shared by a pool of workers
+class InvestmentSearch {
+private:
+    const InvestmentProblem& problem;
+    chrono::steady_clock::time_point deadline;
+    const atomic<bool>* cancel;
+    vector<unique_ptr<SearchWorker>> workers;
+    atomic<int64_t> outstanding{0};     // Branches queued or being explored
+    atomic<bool> stopped{false};        // Set when the time ran out or the search was cancelled
+    mutex best_mutex;
+    atomic<uint64_t> best_gain{0};      // Written under best_mutex, read without it
+    atomic<double> best_cost{0.0};
+    vector<int> best_chosen;
+
+    bool out_of_time() const {
+        return chrono::steady_clock::now() >= deadline || (cancel != nullptr && cancel->load(memory_order_relaxed));
+    }
+
+    // Checks whether a plan gaining gain for cost beats the best so far. The two fields are read
+    // separately, which at worst lets a useless branch through.
+    bool improves(uint64_t gain, double cost) const {
+        uint64_t best = best_gain.load(memory_order_relaxed);
+        return gain > best || (gain == best && cost < best_cost.load(memory_order_relaxed));
+    }
+
+    // Keeps a plan if it beats the best so far
+    void offer(uint64_t gain, double cost, const vector<int>& chosen) {
+        if (!improves(gain, cost)) return;
+        lock_guard<mutex> lock(best_mutex);
+        if (!improves(gain, cost)) return;
+        best_chosen = chosen;
+        best_cost.store(cost, memory_order_relaxed);
+        best_gain.store(gain, memory_order_relaxed);
+    }
+
+    // Queues a branch on a worker's own deque
+    void hand_out(SearchWorker& worker, BranchTask task) {
+        outstanding.fetch_add(1, memory_order_relaxed);
+        lock_guard<mutex> lock(worker.deque_mutex);
+        worker.branches.push_back(move(task));
+        worker.queued.store(worker.branches.size(), memory_order_relaxed);
+    }
+
+    // Takes the newest branch of worker self or else the oldest of another; returns false if none is queued
+    bool take(size_t self, BranchTask& task) {
+        for (size_t k = 0; k < workers.size(); k++) {
+            SearchWorker& victim = *workers[(self + k) % workers.size()];
+            if (victim.queued.load(memory_order_relaxed) == 0) continue;
+            lock_guard<mutex> lock(victim.deque_mutex);
+            if (victim.branches.empty()) continue;
+            if (k == 0) {
+                task = move(victim.branches.back());
+                victim.branches.pop_back();
+            } else {
+                task = move(victim.branches.front());
+                victim.branches.pop_front();
+            }
+            victim.queued.store(victim.branches.size(), memory_order_relaxed);
+            return true;
+        }
+        return false;
+    }
+
+    // Explores the branch in which the candidates before next are decided, as recorded in the
+    // worker's sets and chosen list, and spent has gone on them
+    void explore(SearchWorker& worker, size_t next, double spent) {
+        if (stopped.load(memory_order_relaxed)) return;
+        if (++worker.nodes % CLOCK_CHECK_INTERVAL == 0 && out_of_time()) {
+            stopped.store(true, memory_order_relaxed);
+            return;
+        }
+        const InvestmentProblem& p = problem;
+        UndoableSets& sets = worker.sets;
+        size_t count = p.cost.size();
+        double left = p.budget_cap - spent;
+        // Candidates that join nothing new stay unbuilt in every completion, and once one no longer
+        // fits, neither does any after it
+        while (next < count && p.cost[next] <= left && sets.find(p.end1[next]) == sets.find(p.end2[next])) next++;
+        offer(sets.value, spent, worker.chosen);
+        if (next == count || p.cost[next] > left) return;
+
+        // No completion can build more roads than the cheapest useful ones that fit together
+        size_t joins_left = 0;
+        double cheapest = 0.0;
+        for (size_t c = next; c < count; c++) {
+            if (sets.find(p.end1[c]) == sets.find(p.end2[c])) continue;
+            if (cheapest + p.cost[c] > left) break;
+            cheapest += p.cost[c];
+            joins_left++;
+        }
+        uint64_t join_bound = sets.value + sets.best_gain_of(joins_left, worker.sizes);
+
+        // Nor can it join more than every affordable candidate does; Kruskal's algorithm finds the
+        // cheapest forest that joins as much, which is the best completion if it fits
+        size_t mark = sets.join_count();
+        worker.forest.clear();
+        for (size_t c = next; c < count && p.cost[c] <= left; c++) {
+            if (sets.unite(p.end1[c], p.end2[c])) worker.forest.push_back(static_cast<int>(c));
+        }
+        uint64_t forest_bound = sets.value;
+        // Toward the hub, only the forest's tree around the hub gains anything; the rest is dropped
+        if (p.goal == InvestmentGoal::CitiesReached) {
+            int hub_root = sets.find(p.hub_group);
+            erase_if(worker.forest, [&](int c) { return sets.find(p.end1[c]) != hub_root; });
+        }
+        double forest_cost = 0.0;
+        for (int c : worker.forest) forest_cost += p.cost[c];
+        while (sets.join_count() > mark) sets.undo();
+        if (forest_cost <= left) {
+            size_t built = worker.chosen.size();
+            worker.chosen.insert(worker.chosen.end(), worker.forest.begin(), worker.forest.end());
+            offer(forest_bound, spent + forest_cost, worker.chosen);
+            worker.chosen.resize(built);
+            return;
+        }
+        if (!improves(min(join_bound, forest_bound), spent)) return;
+
+        // Build next, leaving the branch without it to a thief if this worker has nothing queued
+        bool handed_out = false;
+        if (workers.size() > 1 && count - next > SPAWN_MIN_REMAINING && worker.queued.load(memory_order_relaxed) == 0) {
+            hand_out(worker, {next + 1, spent, worker.chosen});
+            handed_out = true;
+        }
+        sets.unite(p.end1[next], p.end2[next]);
+        worker.chosen.push_back(static_cast<int>(next));
+        explore(worker, next + 1, spent + p.cost[next]);
+        worker.chosen.pop_back();
+        sets.undo();
+        if (!handed_out) explore(worker, next + 1, spent);
+    }
+
+    // Explores branches until none is left anywhere or the search is stopped
+    void work(size_t self) {
+        SearchWorker& worker = *workers[self];
+        BranchTask task;
+        while (!stopped.load(memory_order_relaxed)) {
+            if (!take(self, task)) {
+                if (outstanding.load(memory_order_acquire) == 0) return;
+                if (out_of_time()) stopped.store(true, memory_order_relaxed);
+                this_thread::yield();
+                continue;
+            }
+            worker.sets.reset(problem);
+            for (int c : task.chosen) worker.sets.unite(problem.end1[c], problem.end2[c]);
+            worker.chosen = move(task.chosen);
+            explore(worker, task.next, task.spent);
+            outstanding.fetch_sub(1, memory_order_acq_rel);
+        }
+    }
+
+public:
+    InvestmentSearch(const InvestmentProblem& problem, chrono::steady_clock::time_point deadline,
+                     const atomic<bool>* cancel)
+        : problem(problem), deadline(deadline), cancel(cancel) {}
+
+    // Starts from a plan already known, such as a greedy one
+    void start_from(uint64_t gain, double cost, const vector<int>& chosen) { offer(gain, cost, chosen); }
+
+    // Searches on threads threads; returns true if the search finished before being stopped
+    bool run(int threads) {
+        workers.clear();
+        for (int t = 0; t < threads; t++) workers.push_back(make_unique<SearchWorker>());
+        hand_out(*workers[0], {});
+        if (out_of_time()) stopped.store(true, memory_order_relaxed);
+        vector<thread> pool;
+        for (size_t t = 1; t < workers.size(); t++) pool.emplace_back([this, t] { work(t); });
+        work(0);
+        for (auto& worker : pool) worker.join();
+        return !stopped.load(memory_order_relaxed);
+    }
+
+    uint64_t gain() const { return best_gain.load(memory_order_relaxed); }
+    double cost() const { return best_cost.load(memory_order_relaxed); }
+    const vector<int>& chosen() const { return best_chosen; }
+
+    uint64_t nodes() const {
+        uint64_t total = 0;
+        for (const auto& worker : workers) total += worker->nodes;
+        return total;
+    }
+};
+
+// Builds a plan by taking, while any fits, the candidate that gains the most per unit of cost;
+// returns the value it gains and fills chosen and cost
+static uint64_t greedy_plan(const InvestmentProblem& problem, vector<int>& chosen, double& cost) {
+    UndoableSets sets;
+    sets.reset(problem);
+    vector<char> built(problem.cost.size(), 0);
+    chosen.clear();
+    cost = 0.0;
+    while (true) {
+        int best = -1;
+        double best_ratio = 0.0;
+        for (size_t c = 0; c < problem.cost.size(); c++) {
+            if (built[c] || problem.cost[c] > problem.budget_cap - cost) continue;
+            int a = sets.find(problem.end1[c]), b = sets.find(problem.end2[c]);
+            if (a == b) continue;
+            double gained = static_cast<double>(sets.gain(a, b));
+            double ratio = problem.cost[c] > 0.0 ? gained / problem.cost[c] : HUGE_VAL;
+            if (gained > 0.0 && ratio > best_ratio) {
+                best = static_cast<int>(c);
+                best_ratio = ratio;
+            }
+        }
+        if (best == -1) break;
+        built[best] = 1;
+        sets.unite(problem.end1[best], problem.end2[best]);
+        chosen.push_back(best);
+        cost += problem.cost[best];
+    }
+    return sets.value;
+}
+
+void optimize_investment(const NetworkView& network, const vector<RoadCandidate>& candidates,
+                         const InvestmentOptions& options, InvestmentPlan& plan) {
+    ProbeTimer timer(OPTIMIZE_PROBE);
+    chrono::steady_clock::time_point deadline = chrono::steady_clock::now() + options.time_limit;
+    plan.chosen.clear();
+    plan.cost = 0.0;
+    plan.nodes = 0;
+    plan.threads = options.threads > 0 ? options.threads : max(1, static_cast<int>(thread::hardware_concurrency()));
+    plan.optimal = false;
+    int n = static_cast<int>(network.city_count());
+    if (options.goal == InvestmentGoal::CitiesReached && (options.hub < 0 || options.hub >= n)) {
+        plan.value_before = 0;
+        plan.value = 0;
+        return;
+    }
+
+    vector<int> group;
+    int groups = network.label_components(group);
+    vector<uint64_t> sizes(static_cast<size_t>(groups), 0);
+    for (int g : group) sizes[g]++;
+    if (options.goal == InvestmentGoal::ConnectedPairs) {
+        plan.value_before = 0;
+        for (uint64_t size : sizes) plan.value_before += size * (size - 1) / 2;
+    } else {
+        plan.value_before = sizes[group[options.hub]];
+    }
+    plan.value = plan.value_before;
+
+    // Number the groups the usable candidates touch, and keep those candidates cheapest first
+    InvestmentProblem problem;
+    problem.goal = options.goal;
+    problem.budget_cap = options.budget_cap;
+    vector<int> compact_group(static_cast<size_t>(groups), -1);
+    auto compact = [&](int g) {
+        if (compact_group[g] == -1) {
+            compact_group[g] = static_cast<int>(problem.group_size.size());
+            problem.group_size.push_back(sizes[g]);
+        }
+        return compact_group[g];
+    };
+    if (options.goal == InvestmentGoal::CitiesReached) problem.hub_group = compact(group[options.hub]);
+    vector<int> usable;
+    for (size_t k = 0; k < candidates.size() && k < MAX_INVESTMENT_CANDIDATES; k++) {
+        const RoadCandidate& candidate = candidates[k];
+        if (candidate.city1 < 0 || candidate.city1 >= n || candidate.city2 < 0 || candidate.city2 >= n) continue;
+        if (!isfinite(candidate.cost) || candidate.cost < 0.0 || candidate.cost > options.budget_cap) continue;
+        if (group[candidate.city1] == group[candidate.city2]) continue;
+        usable.push_back(static_cast<int>(k));
+    }
+    stable_sort(usable.begin(), usable.end(), [&](int a, int b) { return candidates[a].cost < candidates[b].cost; });
+    for (int k : usable) {
+        problem.original.push_back(k);
+        problem.end1.push_back(compact(group[candidates[k].city1]));
+        problem.end2.push_back(compact(group[candidates[k].city2]));
+        problem.cost.push_back(candidates[k].cost);
+    }
+    if (problem.cost.empty()) {
+        plan.optimal = true;
+        return;
+    }
+
+    InvestmentSearch search(problem, deadline, options.cancel);
+    vector<int> chosen;
+    double cost = 0.0;
+    uint64_t gained = greedy_plan(problem, chosen, cost);
+    search.start_from(gained, cost, chosen);
+    plan.optimal = search.run(plan.threads);
+    plan.nodes = search.nodes();
+    plan.cost = search.cost();
+    plan.value = plan.value_before + search.gain();
+    for (int c : search.chosen()) plan.chosen.push_back(problem.original[c]);
+    sort(plan.chosen.begin(), plan.chosen.end());
+}
+
+double typical_cost_per_km(const NetworkView& network) {
+    vector<double> per_km;
+    for (size_t r = 0; r < network.road_slots(); r++) {
+        const Road& road = network.road(static_cast<int>(r));
+        double budget = network.budget(static_cast<int>(r));
+        if (road.removed() || budget <= 0.0) continue;
+        GeoPoint from = network.city_location(road.city1), to = network.city_location(road.city2);
+        if (!from.known() || !to.known()) continue;
+        double km = great_circle_km(from, to);
+        if (km > 0.0) per_km.push_back(budget / km);
+    }
+    if (per_km.empty()) return 0.0;
+    auto middle = per_km.begin() + static_cast<ptrdiff_t>(per_km.size() / 2);
+    nth_element(per_km.begin(), middle, per_km.end());
+    return *middle;
+}
+
+void propose_investments(const NetworkView& network, double max_km, size_t limit, double cost_per_km,
+                         vector<RoadCandidate>& candidates) {
+    vector<RoadProposal> proposals;
+    network.propose_roads(max_km, limit, proposals, true);
+    candidates.clear();
+    for (const auto& proposal : proposals) candidates.push_back({proposal.city1, proposal.city2, proposal.km * cost_per_km});
+}
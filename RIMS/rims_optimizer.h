@@ -0,0 +1,70 @@
+/*
+ * Road investment optimizer of the Rwanda Infrastructure Management System: given roads that
+ * could be built and what each would cost, chooses the ones to build within a budget cap so the
+ * network ends up as connected as possible.
+ *
+ * Only the groups of connected cities that candidate roads touch can change, so the search runs
+ * on a small graph whose nodes are those groups. It is a branch and bound over the candidates,
+ * cheapest first, deciding at each step whether to build one of them, and it starts from a greedy
+ * plan. The bounds come from union-find: building every affordable remaining candidate is as
+ * connected as a completion can get, and when the minimum spanning forest of those candidates
+ * fits the remaining budget, that forest is the best completion and the branch ends there.
+ * Branches are shared out by a work-stealing pool: each worker keeps a deque of branches, works
+ * on its newest and, when idle, steals the oldest of another's. A deadline or a cancel flag stops
+ * the search, which then returns the best plan found so far.
+ */
+#pragma once
+
+#include "rims_core.h"
+
+// Most candidate roads one optimizer run considers
+const size_t MAX_INVESTMENT_CANDIDATES = 1000;
+
+// A road the optimizer may choose to build
+struct RoadCandidate {
+    int city1, city2;
+    double cost;                        // Estimated budget in billion RWF
+};
+
+// What the optimizer maximizes
+enum class InvestmentGoal {
+    ConnectedPairs,                     // Pairs of cities that can reach each other by road
+    CitiesReached                       // Cities that can reach the hub city by road, the hub included
+};
+
+// Settings of one optimizer run
+struct InvestmentOptions {
+    double budget_cap = 0.0;            // Most the chosen roads may cost together
+    InvestmentGoal goal = InvestmentGoal::ConnectedPairs;
+    int hub = 0;                        // City to reach when the goal is CitiesReached
+    std::chrono::milliseconds time_limit{1000}; // Search time after which the best plan so far is returned
+    int threads = 0;                    // 0 for one per core
+    const std::atomic<bool>* cancel = nullptr; // Stops the search early once set, if given
+};
+
+// Outcome of an optimizer run
+struct InvestmentPlan {
+    std::vector<int> chosen;            // Indices of the candidates to build, ascending
+    double cost = 0.0;                  // Their total cost
+    uint64_t value_before = 0;          // The goal's value for the network as it is
+    uint64_t value = 0;                 // The goal's value once the chosen roads are built
+    bool optimal = false;               // The search finished: no plan within the cap does better
+    uint64_t nodes = 0;                 // Branches explored
+    int threads = 0;                    // Threads actually used
+};
+
+// Chooses the candidates to build within options.budget_cap that maximize options.goal, the
+// cheapest of the equally good plans found. Candidates beyond the first MAX_INVESTMENT_CANDIDATES,
+// those costing more than the cap or a negative amount, and those between cities that can
+// already reach each other are never chosen. With CitiesReached and a hub that is not a city of
+// the network, the plan is left empty and not optimal.
+void optimize_investment(const NetworkView& network, const std::vector<RoadCandidate>& candidates,
+                         const InvestmentOptions& options, InvestmentPlan& plan);
+
+// Returns the median budget per km of the funded roads between located cities, 0 if there are none
+double typical_cost_per_km(const NetworkView& network);
+
+// Fills candidates with up to limit proposed roads of at most max_km, closest first, that each join
+// two groups of cities unable to reach each other today, costed at cost_per_km
+void propose_investments(const NetworkView& network, double max_km, size_t limit, double cost_per_km,
+                         std::vector<RoadCandidate>& candidates);
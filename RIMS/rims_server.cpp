@@ -0,0 +1,805 @@
+#include "rims_server.h"
+#include "rims_optimizer.h"
+
+#include <iostream>   // For startup and error messages
+#include <deque>      // For the request queues
+#include <map>        // For replies that finish out of order
+#include <charconv>   // For exact number formatting in replies and parsing arguments
+#include <csignal>    // For stopping on SIGINT and SIGTERM
+#ifdef __linux__
+#include <sys/epoll.h> // For the event loop
+#include <sys/eventfd.h> // For waking the event loop from other threads
+#include <sys/socket.h> // For the listening and client sockets
+#include <netinet/in.h> // For socket addresses
+#include <netinet/tcp.h> // For TCP_NODELAY
+#include <netdb.h>    // For resolving the listen address
+#include <unistd.h>   // For close, read and write
+#include <fcntl.h>    // For the spare descriptor
+#include <cerrno>     // For EAGAIN and EINTR
+#endif
+
+using namespace std;
+
+#ifndef __linux__
+
+int run_server(InfrastructureManager&, const ServerOptions&) {
+    cout << "Error: Server mode is only available on Linux.\n";
+    return 1;
+}
+
+#else
+
+const size_t MAX_REQUEST_LINE = 64 * 1024;  // Longest request line accepted
+const uint64_t MAX_PENDING_REQUESTS = 256;  // Unanswered requests per client before reading pauses
+const size_t READ_CHUNK = 64 * 1024;
+const size_t ROUTE_PATH_LIMIT = 100000;     // Longest path listed in a route reply
+const size_t SEARCH_LIMIT = 20;             // Most cities listed in a search reply
+const size_t NEARBY_LIMIT = 1000;           // Most cities or proposed roads listed in a spatial reply
+const size_t INVEST_CANDIDATES = 64;        // Proposed roads the investment optimizer chooses from
+const chrono::milliseconds INVEST_TIME_LIMIT{1000}; // Search time of one 'invest' query
+const size_t CHANGES_LIMIT = 10000;         // Most changes listed in a changes reply
+
+// Thread-safe FIFO of jobs. pop_batch takes everything queued at once so a consumer can handle a
+// whole burst together; after close() consumers drain what is left and then stop.
+template <typename T>
+class WorkQueue {
+private:
+    mutex queue_mutex;
+    condition_variable ready;
+    deque<T> items;
+    bool closed = false;
+
+public:
+    void push(T item) {
+        {
+            lock_guard<mutex> lock(queue_mutex);
+            items.push_back(move(item));
+        }
+        ready.notify_one();
+    }
+
+    // Waits for work and moves up to limit items into batch; returns false once closed and empty
+    bool pop_batch(vector<T>& batch, size_t limit) {
+        batch.clear();
+        unique_lock<mutex> lock(queue_mutex);
+        ready.wait(lock, [this] { return closed || !items.empty(); });
+        while (!items.empty() && batch.size() < limit) {
+            batch.push_back(move(items.front()));
+            items.pop_front();
+        }
+        return !batch.empty();
+    }
+
+    void close() {
+        {
+            lock_guard<mutex> lock(queue_mutex);
+            closed = true;
+        }
+        ready.notify_all();
+    }
+};
+
+// A request line on its way to a worker or the committer
+struct ServerRequest {
+    uint64_t connection;
+    uint64_t sequence;                  // Position of the request among its connection's requests
+    string line;
+    bool mutation;
+};
+
+// A finished reply on its way back to the event loop
+struct ServerReply {
+    uint64_t connection;
+    uint64_t sequence;
+    string text;
+    bool mutation;
+};
+
+// Per-client state owned by the event loop
+struct ServerConnection {
+    int fd = -1;
+    string input;                       // Bytes received but not yet split into lines
+    string output;                      // Replies not yet written to the socket
+    uint64_t next_sequence = 0;         // Sequence number of the next request read
+    uint64_t next_reply = 0;            // Sequence number of the next reply to send
+    map<uint64_t, string> finished;     // Replies that arrived ahead of an earlier one
+    // A client's requests take effect in the order it sent them: queries in a row run in parallel,
+    // as do mutations in a row, but neither kind starts while the other kind is in flight
+    deque<ServerRequest> waiting;
+    size_t queries_in_flight = 0;
+    size_t mutations_in_flight = 0;
+    uint32_t events = 0;                // Events currently registered with epoll
+    bool closing = false;               // Quit, disconnect or bad input: close once replies are sent
+};
+
+// Scratch buffers of one worker thread
+struct QueryScratch {
+    RouteSearch route_search;
+    NetworkPlan network_plan;
+    ConnectivityScan connectivity_scan;
+    vector<int> path;
+    vector<int> groups;
+    vector<uint32_t> found;
+    vector<CityDistance> nearby;
+    vector<RoadProposal> proposals;
+    vector<RoadCandidate> candidates;
+    InvestmentPlan investment;
+    vector<FeedChange> changes;
+};
+
+int stop_event_fd = -1;                 // Written by the signal handler to stop the event loop
+
+// Wakes the event loop on SIGINT or SIGTERM; only async-signal-safe calls are allowed here
+void request_server_stop(int) {
+    uint64_t one = 1;
+    ssize_t ignored = write(stop_event_fd, &one, sizeof(one));
+    (void)ignored;
+}
+
+// Appends text as a JSON string literal
+void append_json_string(string& out, string_view text) {
+    out.push_back('"');
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            out.push_back('\\');
+            out.push_back(c);
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            static const char hex[] = "0123456789abcdef";
+            out.append("\\u00");
+            out.push_back(hex[(c >> 4) & 0xf]);
+            out.push_back(hex[c & 0xf]);
+        } else {
+            out.push_back(c);
+        }
+    }
+    out.push_back('"');
+}
+
+// Appends a number in its shortest exact form
+void append_json_number(string& out, double value) {
+    char digits[32];
+    auto result = to_chars(digits, digits + sizeof(digits), value);
+    out.append(digits, result.ptr);
+}
+
+// Returns a failure reply
+string error_reply(string_view message) {
+    string reply = "{\"ok\":false,\"error\":";
+    append_json_string(reply, message);
+    reply += "}";
+    return reply;
+}
+
+// Parses a whole request argument as a number; returns false if it is not one
+template <typename T>
+bool parse_argument(string_view text, T& value) {
+    auto result = from_chars(text.data(), text.data() + text.size(), value);
+    return result.ec == errc() && result.ptr == text.data() + text.size();
+}
+
+// Splits the comma-separated arguments of a request
+vector<string_view> split_arguments(string_view text) {
+    vector<string_view> fields;
+    if (trim(text).empty()) return fields;
+    size_t start = 0;
+    while (true) {
+        size_t comma = text.find(',', start);
+        fields.push_back(trim(text.substr(start, comma - start)));
+        if (comma == string_view::npos) break;
+        start = comma + 1;
+    }
+    return fields;
+}
+
+// Checks whether a request line changes the network rather than querying it
+bool is_mutation(string_view keyword) {
+    return keyword == "city" || keyword == "road" || keyword == "budget" || keyword == "rename" || keyword == "location";
+}
+
+class QueryServer {
+private:
+    static constexpr uint64_t LISTEN_ID = 0;    // epoll tags of the fixed descriptors
+    static constexpr uint64_t WAKEUP_ID = 1;
+    static constexpr uint64_t STOP_ID = 2;
+
+    InfrastructureManager& manager;
+    ServerOptions options;
+    int epoll_fd = -1;
+    int listen_fd = -1;
+    int wakeup_fd = -1;                 // Counts replies posted by workers and the committer
+    int spare_fd = -1;                  // Held back to refuse a client once descriptors run out
+    bool listening = true;              // False while the listener is unwatched for want of descriptors
+    unordered_map<uint64_t, ServerConnection> connections; // By connection ID, which unlike fds is never reused
+    uint64_t next_connection = STOP_ID + 1;
+
+    WorkQueue<ServerRequest> queries;
+    WorkQueue<ServerRequest> mutations;
+    vector<thread> workers;
+    thread committer;
+    mutex reply_mutex;
+    vector<ServerReply> replies;        // Posted under reply_mutex, collected by the event loop
+
+    // Hands a reply to the event loop
+    void post_reply(uint64_t connection, uint64_t sequence, string text, bool mutation) {
+        bool first;
+        {
+            lock_guard<mutex> lock(reply_mutex);
+            first = replies.empty();
+            replies.push_back({connection, sequence, move(text), mutation});
+        }
+        if (first) {                        // Later replies ride on the same wakeup
+            uint64_t one = 1;
+            ssize_t ignored = write(wakeup_fd, &one, sizeof(one));
+            (void)ignored;
+        }
+    }
+
+    // Answers one query against the latest published version of the network
+    string answer_query(string_view line, QueryScratch& scratch) {
+        size_t space = line.find(' ');
+        string_view keyword = line.substr(0, space);
+        string_view rest = space == string_view::npos ? string_view() : trim(line.substr(space + 1));
+        string reply = "{\"ok\":true";
+
+        if (keyword == "find") {
+            shared_ptr<const NetworkView> network = manager.view();
+            int city = network->find_city(rest);
+            if (city == -1) return error_reply("City '" + string(rest) + "' does not exist.");
+            reply += ",\"city\":" + to_string(city) + ",\"name\":";
+            append_json_string(reply, network->city_name(city));
+            reply += ",\"roads\":" + to_string(network->roads_of(city).size()) + "}";
+            return reply;
+        }
+        if (keyword == "search") {
+            if (rest.empty()) return error_reply("'search' takes the start of a city name.");
+            shared_ptr<const NetworkView> network = manager.view();
+            network->cities_starting_with(rest, SEARCH_LIMIT, scratch.found);
+            reply += ",\"cities\":[";
+            for (size_t k = 0; k < scratch.found.size(); k++) {
+                if (k > 0) reply += ",";
+                append_json_string(reply, network->city_name(static_cast<int>(scratch.found[k])));
+            }
+            reply += "]}";
+            return reply;
+        }
+        if (keyword == "route") {
+            vector<string_view> fields = split_arguments(rest);
+            if (fields.size() != 2 && !(fields.size() == 3 && fields[2] == "hops")) {
+                return error_reply("'route' takes two city names and optionally 'hops'.");
+            }
+            shared_ptr<const NetworkView> network = manager.view();
+            int source = network->find_city(fields[0]);
+            if (source == -1) return error_reply("City '" + string(fields[0]) + "' does not exist.");
+            int target = network->find_city(fields[1]);
+            if (target == -1) return error_reply("City '" + string(fields[1]) + "' does not exist.");
+            RouteWeight weight = fields.size() == 3 ? RouteWeight::Hops : RouteWeight::Budget;
+            double cost = 0.0;
+            if (!network->find_route(source, target, weight, scratch.route_search, scratch.path, cost)) {
+                return error_reply(string("No ") + (weight == RouteWeight::Budget ? "funded " : "") +
+                                   "route exists between " + string(fields[0]) + " and " + string(fields[1]) + ".");
+            }
+            reply += ",\"path\":[";
+            for (size_t k = 0; k < scratch.path.size() && k < ROUTE_PATH_LIMIT; k++) {
+                if (k > 0) reply += ",";
+                append_json_string(reply, network->city_name(scratch.path[k]));
+            }
+            reply += "],\"roads\":" + to_string(scratch.path.size() - 1) + ",\"cost\":";
+            append_json_number(reply, cost);
+            reply += "}";
+            return reply;
+        }
+        if (keyword == "nearest" || keyword == "within") {
+            vector<string_view> fields = split_arguments(rest);
+            bool nearest = keyword == "nearest";
+            size_t count = 5;
+            double radius_km = 0.0;
+            bool valid = nearest ? fields.size() == 1 || (fields.size() == 2 && parse_argument(fields[1], count))
+                                 : fields.size() == 2 && parse_argument(fields[1], radius_km) && radius_km >= 0.0;
+            if (!valid) {
+                return error_reply(nearest ? "'nearest' takes a city name and optionally a count."
+                                           : "'within' takes a city name and a distance in km.");
+            }
+            shared_ptr<const NetworkView> network = manager.view();
+            int city = network->find_city(fields[0]);
+            if (city == -1) return error_reply("City '" + string(fields[0]) + "' does not exist.");
+            if (!network->city_location(city).known()) return error_reply("City '" + string(fields[0]) + "' has no location.");
+            if (nearest) network->nearest_cities(city, min(count, NEARBY_LIMIT), scratch.nearby);
+            else network->cities_within(city, radius_km, scratch.nearby);
+            reply += ",\"count\":" + to_string(scratch.nearby.size()) + ",\"cities\":[";
+            for (size_t k = 0; k < scratch.nearby.size() && k < NEARBY_LIMIT; k++) {
+                reply += k > 0 ? ",{\"name\":" : "{\"name\":";
+                append_json_string(reply, network->city_name(scratch.nearby[k].city));
+                reply += ",\"km\":";
+                append_json_number(reply, scratch.nearby[k].km);
+                reply += "}";
+            }
+            reply += "]}";
+            return reply;
+        }
+        if (keyword == "propose") {
+            vector<string_view> fields = split_arguments(rest);
+            double max_km = 0.0;
+            size_t limit = 20;
+            if (fields.empty() || fields.size() > 2 || !parse_argument(fields[0], max_km) || max_km < 0.0 ||
+                (fields.size() == 2 && !parse_argument(fields[1], limit))) {
+                return error_reply("'propose' takes a distance in km and optionally a count.");
+            }
+            shared_ptr<const NetworkView> network = manager.view();
+            network->propose_roads(max_km, min(limit, NEARBY_LIMIT), scratch.proposals);
+            reply += ",\"roads\":[";
+            for (size_t k = 0; k < scratch.proposals.size(); k++) {
+                const RoadProposal& proposal = scratch.proposals[k];
+                reply += k > 0 ? ",{\"from\":" : "{\"from\":";
+                append_json_string(reply, network->city_name(proposal.city1));
+                reply += ",\"to\":";
+                append_json_string(reply, network->city_name(proposal.city2));
+                reply += ",\"km\":";
+                append_json_number(reply, proposal.km);
+                reply += string(",\"joins_groups\":") + (proposal.joins_groups ? "true" : "false") + "}";
+            }
+            reply += "]}";
+            return reply;
+        }
+        if (keyword == "invest") {
+            vector<string_view> fields = split_arguments(rest);
+            InvestmentOptions options;
+            double max_km = 0.0;
+            if (fields.size() < 2 || fields.size() > 3 || !parse_argument(fields[0], options.budget_cap) ||
+                options.budget_cap < 0.0 || !parse_argument(fields[1], max_km) || max_km < 0.0) {
+                return error_reply("'invest' takes a budget, a distance in km and optionally a city to reach.");
+            }
+            shared_ptr<const NetworkView> network = manager.view();
+            if (fields.size() == 3) {
+                options.goal = InvestmentGoal::CitiesReached;
+                options.hub = network->find_city(fields[2]);
+                if (options.hub == -1) return error_reply("City '" + string(fields[2]) + "' does not exist.");
+            }
+            double per_km = typical_cost_per_km(*network);
+            if (per_km == 0.0) return error_reply("No funded road between located cities gives a cost per km.");
+            // The worker pool already answers clients in parallel, so each search keeps to its worker
+            options.threads = 1;
+            options.time_limit = INVEST_TIME_LIMIT;
+            propose_investments(*network, max_km, INVEST_CANDIDATES, per_km, scratch.candidates);
+            InvestmentPlan& plan = scratch.investment;
+            optimize_investment(*network, scratch.candidates, options, plan);
+            reply += ",\"roads\":[";
+            for (size_t k = 0; k < plan.chosen.size(); k++) {
+                const RoadCandidate& road = scratch.candidates[plan.chosen[k]];
+                reply += k > 0 ? ",{\"from\":" : "{\"from\":";
+                append_json_string(reply, network->city_name(road.city1));
+                reply += ",\"to\":";
+                append_json_string(reply, network->city_name(road.city2));
+                reply += ",\"cost\":";
+                append_json_number(reply, road.cost);
+                reply += "}";
+            }
+            reply += "],\"cost\":";
+            append_json_number(reply, plan.cost);
+            reply += ",\"before\":" + to_string(plan.value_before) + ",\"after\":" + to_string(plan.value) +
+                     ",\"optimal\":" + (plan.optimal ? "true" : "false") + "}";
+            return reply;
+        }
+        if (keyword == "plan") {
+            shared_ptr<const NetworkView> network = manager.view();
+            NetworkPlan& plan = scratch.network_plan;
+            network->plan_minimum_network(plan);
+            reply += ",\"roads\":" + to_string(plan.selected_count) + ",\"total_budget\":";
+            append_json_number(reply, plan.total_budget);
+            reply += ",\"groups\":" + to_string(plan.components.count()) +
+                     ",\"unfunded\":" + to_string(network->road_count() - plan.candidates.size()) + "}";
+            return reply;
+        }
+        if (keyword == "connectivity") {
+            shared_ptr<const NetworkView> network = manager.view();
+            ConnectivityScan& scan = scratch.connectivity_scan;
+            network->scan_bridges_and_articulations(scan);
+            size_t critical = 0;
+            for (char flag : scan.articulation) critical += flag;
+            reply += string(",\"connected\":") + (network->is_connected() ? "true" : "false") +
+                     ",\"groups\":" + to_string(network->label_components(scratch.groups)) +
+                     ",\"bridges\":" + to_string(scan.bridges.size()) +
+                     ",\"critical_cities\":" + to_string(critical) + "}";
+            return reply;
+        }
+        if (keyword == "changes") {
+            vector<string_view> fields = split_arguments(rest);
+            uint64_t from = 0;
+            size_t limit = 1000;
+            if (fields.empty() || fields.size() > 2 || !parse_argument(fields[0], from) ||
+                (fields.size() == 2 && !parse_argument(fields[1], limit))) {
+                return error_reply("'changes' takes a sequence number and optionally a count.");
+            }
+            // Read the bounds first: every change they cover is already in the file
+            uint64_t first = manager.first_change_sequence();
+            uint64_t last = manager.last_change_sequence();
+            if (!manager.read_changes(from, min(limit, CHANGES_LIMIT), scratch.changes)) {
+                return error_reply("The change feed cannot be read.");
+            }
+            reply += ",\"first\":" + to_string(first) + ",\"last\":" + to_string(last) +
+                     ",\"exported\":" + to_string(manager.exported_sequence()) + ",\"changes\":[";
+            for (size_t k = 0; k < scratch.changes.size(); k++) {
+                reply += k > 0 ? ",{\"seq\":" : "{\"seq\":";
+                reply += to_string(scratch.changes[k].sequence) + ",\"record\":";
+                append_json_string(reply, scratch.changes[k].record);
+                reply += "}";
+            }
+            reply += "]}";
+            return reply;
+        }
+        if (keyword == "info") {
+            shared_ptr<const NetworkView> network = manager.view();
+            reply += ",\"version\":" + to_string(network->version()) + ",\"cities\":" + to_string(network->city_count()) +
+                     ",\"roads\":" + to_string(network->road_count()) +
+                     ",\"changes\":" + to_string(manager.last_change_sequence()) +
+                     ",\"exported\":" + to_string(manager.exported_sequence()) + "}";
+            return reply;
+        }
+        return error_reply("Unknown request '" + string(keyword) + "'.");
+    }
+
+    // Worker thread: answers queries until the queue is closed
+    void run_worker() {
+        QueryScratch scratch;
+        vector<ServerRequest> batch;
+        while (queries.pop_batch(batch, 1)) {
+            for (auto& request : batch) post_reply(request.connection, request.sequence, answer_query(request.line, scratch), false);
+        }
+    }
+
+    // Committer thread: applies each burst of queued mutations as one group commit
+    void run_committer() {
+        vector<ServerRequest> batch;
+        vector<InfrastructureManager::BatchCommand> commands;
+        vector<size_t> command_request;     // Index in batch of each command
+        vector<ChangeStatus> statuses;
+        vector<string> answers;
+        while (mutations.pop_batch(batch, options.max_group)) {
+            commands.clear();
+            command_request.clear();
+            answers.assign(batch.size(), string());
+            for (size_t k = 0; k < batch.size(); k++) {
+                InfrastructureManager::BatchCommand command;
+                command.line = static_cast<int>(k + 1);
+                string error;
+                if (InfrastructureManager::parse_batch_line(batch[k].line, command, error)) {
+                    commands.push_back(move(command));
+                    command_request.push_back(k);
+                } else {
+                    answers[k] = error_reply(error);
+                }
+            }
+            manager.apply_commands(commands, statuses);
+            for (size_t c = 0; c < commands.size(); c++) {
+                answers[command_request[c]] = statuses[c] == ChangeStatus::Ok ? "{\"ok\":true}"
+                                                                             : error_reply(describe(statuses[c]));
+            }
+            for (size_t k = 0; k < batch.size(); k++) post_reply(batch[k].connection, batch[k].sequence, move(answers[k]), true);
+        }
+    }
+
+    // Registers or removes interest in reading and writing as the connection's state requires
+    void update_events(uint64_t id, ServerConnection& connection) {
+        uint32_t wanted = 0;
+        bool backlogged = connection.next_sequence - connection.next_reply >= MAX_PENDING_REQUESTS;
+        if (!connection.closing && !backlogged) wanted |= EPOLLIN;
+        if (!connection.output.empty()) wanted |= EPOLLOUT;
+        if (wanted == connection.events) return;
+        epoll_event event{};
+        event.events = wanted;
+        event.data.u64 = id;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, connection.fd, &event);
+        connection.events = wanted;
+    }
+
+    void close_connection(uint64_t id) {
+        auto it = connections.find(id);
+        if (it == connections.end()) return;
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, it->second.fd, nullptr);
+        close(it->second.fd);
+        connections.erase(it);
+        if (spare_fd < 0) spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        if (!listening) {
+            watch(listen_fd, LISTEN_ID);
+            listening = true;
+        }
+    }
+
+    // Writes as much pending output as the socket takes; returns false if the client is gone
+    bool write_output(ServerConnection& connection) {
+        size_t written = 0;
+        while (written < connection.output.size()) {
+            ssize_t n = send(connection.fd, connection.output.data() + written, connection.output.size() - written,
+                             MSG_NOSIGNAL);
+            if (n > 0) {
+                written += static_cast<size_t>(n);
+            } else if (n < 0 && errno == EINTR) {
+                continue;
+            } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            } else {
+                return false;
+            }
+        }
+        connection.output.erase(0, written);
+        return true;
+    }
+
+    // Sends what can be sent, then closes the connection or adjusts its events
+    void settle(uint64_t id, ServerConnection& connection) {
+        if (!write_output(connection)) {
+            close_connection(id);
+            return;
+        }
+        if (connection.closing && connection.output.empty() && connection.next_reply == connection.next_sequence) {
+            close_connection(id);
+            return;
+        }
+        update_events(id, connection);
+    }
+
+    // Numbers a request and hands it to the committer or the worker pool
+    void dispatch(uint64_t id, ServerConnection& connection, string_view line) {
+        if (line == "quit") {
+            connection.closing = true;
+            return;
+        }
+        string_view keyword = line.substr(0, line.find(' '));
+        connection.waiting.push_back({id, connection.next_sequence++, string(line), is_mutation(keyword)});
+        release_waiting(connection);
+    }
+
+    // Passes on the waiting requests that no request of the other kind is holding up
+    void release_waiting(ServerConnection& connection) {
+        while (!connection.waiting.empty()) {
+            ServerRequest& request = connection.waiting.front();
+            if (request.mutation) {
+                if (connection.queries_in_flight > 0) break;
+                connection.mutations_in_flight++;
+                mutations.push(move(request));
+            } else {
+                if (connection.mutations_in_flight > 0) break;
+                connection.queries_in_flight++;
+                queries.push(move(request));
+            }
+            connection.waiting.pop_front();
+        }
+    }
+
+    // Reads what the client sent and dispatches every complete line
+    void read_requests(uint64_t id, ServerConnection& connection) {
+        char chunk[READ_CHUNK];
+        while (!connection.closing) {
+            ssize_t n = recv(connection.fd, chunk, sizeof(chunk), 0);
+            if (n > 0) {
+                connection.input.append(chunk, static_cast<size_t>(n));
+            } else if (n < 0 && errno == EINTR) {
+                continue;
+            } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            } else {
+                connection.closing = true;  // Peer closed its end; still answer what it sent
+                break;
+            }
+            if (connection.next_sequence - connection.next_reply >= MAX_PENDING_REQUESTS) break;
+        }
+
+        size_t start = 0;
+        while (!connection.closing) {
+            size_t newline = connection.input.find('\n', start);
+            if (newline == string::npos) break;
+            string_view line = trim(string_view(connection.input).substr(start, newline - start));
+            if (!line.empty() && line.back() == '\r') line = trim(line.substr(0, line.size() - 1));
+            if (!line.empty()) dispatch(id, connection, line);
+            start = newline + 1;
+        }
+        connection.input.erase(0, start);
+        if (!connection.closing && connection.input.size() > MAX_REQUEST_LINE) {
+            connection.finished.emplace(connection.next_sequence++, error_reply("Request line is too long."));
+            connection.closing = true;
+            deliver_finished(connection);
+        }
+    }
+
+    // Moves replies that are next in their connection's order into its output
+    void deliver_finished(ServerConnection& connection) {
+        auto it = connection.finished.begin();
+        while (it != connection.finished.end() && it->first == connection.next_reply) {
+            connection.output += it->second;
+            connection.output += '\n';
+            connection.next_reply++;
+            it = connection.finished.erase(it);
+        }
+    }
+
+    // Collects the replies posted since the last wakeup
+    void collect_replies() {
+        uint64_t count;
+        ssize_t ignored = read(wakeup_fd, &count, sizeof(count));
+        (void)ignored;
+        vector<ServerReply> ready;
+        {
+            lock_guard<mutex> lock(reply_mutex);
+            ready.swap(replies);
+        }
+        vector<uint64_t> touched;
+        for (auto& reply : ready) {
+            auto it = connections.find(reply.connection);
+            if (it == connections.end()) continue;   // The client went away before its answer
+            it->second.finished.emplace(reply.sequence, move(reply.text));
+            if (reply.mutation) it->second.mutations_in_flight--;
+            else it->second.queries_in_flight--;
+            release_waiting(it->second);
+            touched.push_back(reply.connection);
+        }
+        sort(touched.begin(), touched.end());
+        touched.erase(unique(touched.begin(), touched.end()), touched.end());
+        for (uint64_t id : touched) {
+            auto it = connections.find(id);
+            deliver_finished(it->second);
+            settle(id, it->second);
+        }
+    }
+
+    void accept_clients() {
+        while (true) {
+            int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                if (errno == EINTR) continue;
+                if (errno != EMFILE && errno != ENFILE) return; // EAGAIN, or a client that gave up waiting
+                // Out of descriptors, the waiting client would keep the listener ready forever:
+                // give up the spare descriptor to take the client off the queue and hang up on it
+                if (spare_fd >= 0) {
+                    close(spare_fd);
+                    fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+                    if (fd >= 0) close(fd);
+                    spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+                    if (fd >= 0) continue;
+                }
+                // Not even the spare was free: stop watching the listener until a client leaves
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, listen_fd, nullptr);
+                listening = false;
+                return;
+            }
+            int on = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            uint64_t id = next_connection++;
+            ServerConnection& connection = connections[id];
+            connection.fd = fd;
+            connection.events = EPOLLIN;
+            epoll_event event{};
+            event.events = EPOLLIN;
+            event.data.u64 = id;
+            epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+        }
+    }
+
+    // Opens the listening socket; returns false after saying why if it cannot
+    bool open_listener() {
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+        addrinfo* addresses = nullptr;
+        string port = to_string(options.port);
+        int status = getaddrinfo(options.host.empty() ? nullptr : options.host.c_str(), port.c_str(), &hints, &addresses);
+        if (status != 0) {
+            cout << "Error: Cannot resolve '" << options.host << "': " << gai_strerror(status) << ".\n";
+            return false;
+        }
+        // Prefer IPv6, which also accepts IPv4 clients, when listening on every interface
+        for (int pass = 0; pass < 2 && listen_fd < 0; pass++) {
+            for (addrinfo* a = addresses; a != nullptr && listen_fd < 0; a = a->ai_next) {
+                if ((a->ai_family == AF_INET6) != (pass == 0)) continue;
+                int fd = socket(a->ai_family, a->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, a->ai_protocol);
+                if (fd < 0) continue;
+                int on = 1;
+                setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+                if (a->ai_family == AF_INET6) {
+                    int off = 0;
+                    setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+                }
+                if (bind(fd, a->ai_addr, a->ai_addrlen) == 0 && listen(fd, SOMAXCONN) == 0) listen_fd = fd;
+                else close(fd);
+            }
+        }
+        freeaddrinfo(addresses);
+        if (listen_fd < 0) {
+            cout << "Error: Cannot listen on port " << options.port << ".\n";
+            return false;
+        }
+        return true;
+    }
+
+    // Adds a fixed descriptor to the event loop
+    void watch(int fd, uint64_t id) {
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.u64 = id;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+    }
+
+public:
+    QueryServer(InfrastructureManager& manager, const ServerOptions& options) : manager(manager), options(options) {}
+
+    ~QueryServer() {
+        for (auto& [id, connection] : connections) close(connection.fd);
+        if (listen_fd >= 0) close(listen_fd);
+        if (wakeup_fd >= 0) close(wakeup_fd);
+        if (spare_fd >= 0) close(spare_fd);
+        if (stop_event_fd >= 0) close(stop_event_fd);
+        if (epoll_fd >= 0) close(epoll_fd);
+        stop_event_fd = -1;
+    }
+
+    int run() {
+        if (!open_listener()) return 1;
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        stop_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        if (epoll_fd < 0 || wakeup_fd < 0 || stop_event_fd < 0 || spare_fd < 0) {
+            cout << "Error: Cannot set up the event loop.\n";
+            return 1;
+        }
+        watch(listen_fd, LISTEN_ID);
+        watch(wakeup_fd, WAKEUP_ID);
+        watch(stop_event_fd, STOP_ID);
+        signal(SIGINT, request_server_stop);
+        signal(SIGTERM, request_server_stop);
+
+        int worker_count = options.worker_threads > 0 ? options.worker_threads
+                                                      : max(1, static_cast<int>(thread::hardware_concurrency()));
+        for (int w = 0; w < worker_count; w++) workers.emplace_back(&QueryServer::run_worker, this);
+        committer = thread(&QueryServer::run_committer, this);
+        cout << "Serving on port " << options.port << " with " << worker_count << " query thread(s).\n" << flush;
+
+        const int max_events = 256;
+        epoll_event events[max_events];
+        bool running = true;
+        while (running) {
+            int ready = epoll_wait(epoll_fd, events, max_events, -1);
+            if (ready < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            for (int e = 0; e < ready; e++) {
+                uint64_t id = events[e].data.u64;
+                if (id == LISTEN_ID) {
+                    accept_clients();
+                } else if (id == WAKEUP_ID) {
+                    collect_replies();
+                } else if (id == STOP_ID) {
+                    running = false;
+                } else {
+                    auto it = connections.find(id);
+                    if (it == connections.end()) continue;
+                    ServerConnection& connection = it->second;
+                    if (events[e].events & (EPOLLERR | EPOLLHUP) && !(events[e].events & EPOLLIN)) {
+                        close_connection(id);
+                        continue;
+                    }
+                    if (events[e].events & EPOLLIN) read_requests(id, connection);
+                    settle(id, connection);
+                }
+            }
+        }
+
+        // Finish the requests already taken, send their replies if the clients still read, and stop
+        cout << "Stopping the server...\n";
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+        queries.close();
+        mutations.close();
+        for (auto& worker : workers) worker.join();
+        committer.join();
+        collect_replies();
+        return 0;
+    }
+};
+
+int run_server(InfrastructureManager& manager, const ServerOptions& options) {
+    QueryServer server(manager, options);
+    return server.run();
+}
+
+#endif
@@ -0,0 +1,60 @@
+/*
+ * Network server for the Rwanda Infrastructure Management System (RwandaInfraSystem --serve).
+ *
+ * One shared instance answers many clients over TCP. A client sends one request per line and
+ * gets one JSON object per line back, in the order of its requests; it may send further
+ * requests before the replies arrive. Cities are named as in the console and batch files.
+ *
+ *     find <name>                          {"ok":true,"city":0,"name":"Kigali","roads":3}
+ *     search <prefix>                      {"ok":true,"cities":["Kibuye","Kigali"]}
+ *     route <city>, <city>[, hops]         {"ok":true,"path":["Kigali","Muhanga"],"roads":1,"cost":2.5}
+ *     nearest <city>[, count]              {"ok":true,"count":1,"cities":[{"name":"Muhanga","km":38.2}]}
+ *     within <city>, <km>                  (as nearest, every city within km)
+ *     propose <km>[, count]                {"ok":true,"roads":[{"from":"Huye","to":"Nyanza","km":31.5,"joins_groups":false}]}
+ *     invest <budget>, <km>[, <city>]     {"ok":true,"roads":[{"from":"Huye","to":"Nyanza","cost":9.5}],"cost":9.5,
+ *                                          "before":21,"after":28,"optimal":true}
+ *     plan                                 {"ok":true,"roads":12,"total_budget":340.5,"groups":1,"unfunded":3}
+ *     connectivity                         {"ok":true,"connected":true,"groups":1,"bridges":2,"critical_cities":1}
+ *     info                                 {"ok":true,"version":42,"cities":120,"roads":310,"changes":905,"exported":880}
+ *     changes <sequence>[, count]          {"ok":true,"first":1,"last":905,"exported":880,
+ *                                          "changes":[{"seq":881,"record":"B\u00090\u00094\u000912.5"}]}
+ *     city <name>                          {"ok":true}
+ *     road <city>, <city>
+ *     budget <city>, <city>, <amount>
+ *     rename <current name>, <new name>
+ *     location <city>, <latitude>, <longitude>
+ *     quit                                 closes the connection once earlier replies are sent
+ *
+ * invest chooses, among the proposed roads of up to km that join groups of cities unable to reach
+ * each other, the ones to build within the budget that connect the most pairs of cities, or the
+ * most cities to the given one. New roads are costed at the median cost per km of the funded
+ * roads, and the search stops after a second with the best plan found.
+ *
+ * changes reads the change feed: every city, road, budget and location change as logged, numbered
+ * in the order it took effect, from the given sequence number on (at most 10000 per reply). A
+ * downstream system bootstraps from the data files, which hold every change up to exported, then
+ * follows the feed from exported + 1, asking again from one past the last change it got. If the
+ * next change it needs is older than first, the feed no longer has it and it must bootstrap again.
+ *
+ * A failed request is answered with {"ok":false,"error":"..."}.
+ *
+ * One thread runs an epoll event loop over every connection. Queries go to a pool of worker
+ * threads that read the latest NetworkView without locking. Mutations go to a single committer
+ * that applies all the mutations queued while it was writing the previous group as one logged
+ * transaction, so the cost of a log flush is shared by every client in the group. A mutation is
+ * answered only once its group is on disk.
+ */
+#pragma once
+
+#include "rims_core.h"
+
+// Settings of the network server
+struct ServerOptions {
+    std::string host;                   // Address to listen on; empty for every interface
+    int port = 0;
+    int worker_threads = 0;             // Query threads; 0 for one per core
+    size_t max_group = 4096;            // Most mutations committed as one group
+};
+
+// Serves clients until SIGINT or SIGTERM; returns the process exit status
+int run_server(InfrastructureManager& manager, const ServerOptions& options);
@@ -0,0 +1,176 @@
+#include "rims_stats.h"
+
+#include <mutex>      // For guarding registration
+#include <memory>     // For the per-thread blocks
+#include <iomanip>    // For formatting durations
+#include <cmath>      // For ceil
+
+using namespace std;
+
+// Every probe and the counters of every running thread. A thread's block is folded into retired
+// when the thread exits, so its calls still count, and is kept for the next thread to register.
+struct StatisticsRegistry {
+    mutex registry_mutex;
+    vector<const char*> names;          // Probe names by ID
+    vector<unique_ptr<ThreadStatistics>> threads;
+    vector<unique_ptr<ThreadStatistics>> spare; // Blocks of exited threads, zeroed
+    ThreadStatistics retired;           // What exited threads recorded
+};
+
+// Returns the registry, created on first use so probes in any file may register during startup
+static StatisticsRegistry& registry() {
+    static StatisticsRegistry instance;
+    return instance;
+}
+
+Probe::Probe(const char* name, int sample_shift) : sample_mask((uint64_t(1) << sample_shift) - 1) {
+    StatisticsRegistry& stats = registry();
+    lock_guard<mutex> lock(stats.registry_mutex);
+    // A program with more probes than MAX_PROBES records the extra ones under the last
+    id = min(static_cast<int>(stats.names.size()), MAX_PROBES - 1);
+    if (stats.names.size() < MAX_PROBES) stats.names.push_back(name);
+}
+
+// Adds what one block recorded to another; the caller holds the registry lock
+static void fold_counters(const ThreadStatistics& from, ThreadStatistics& into) {
+    for (int id = 0; id < MAX_PROBES; id++) {
+        const ProbeCounters& source = from.probes[id];
+        ProbeCounters& target = into.probes[id];
+        ProbeCounters::bump(target.calls, source.calls.load(memory_order_relaxed));
+        ProbeCounters::bump(target.timed_calls, source.timed_calls.load(memory_order_relaxed));
+        ProbeCounters::bump(target.total_ns, source.total_ns.load(memory_order_relaxed));
+        ProbeCounters::bump(target.total_bytes, source.total_bytes.load(memory_order_relaxed));
+        target.max_ns.store(max(target.max_ns.load(memory_order_relaxed), source.max_ns.load(memory_order_relaxed)),
+                            memory_order_relaxed);
+        for (int b = 0; b < LATENCY_BUCKETS; b++) {
+            ProbeCounters::bump(target.latency[b], source.latency[b].load(memory_order_relaxed));
+        }
+        uint64_t finished = source.last_finished.load(memory_order_relaxed);
+        if (finished > target.last_finished.load(memory_order_relaxed)) {
+            target.last_finished.store(finished, memory_order_relaxed);
+            target.last_ns.store(source.last_ns.load(memory_order_relaxed), memory_order_relaxed);
+            target.last_bytes.store(source.last_bytes.load(memory_order_relaxed), memory_order_relaxed);
+        }
+    }
+}
+
+// Zeroes every counter of a block
+static void clear_counters(ThreadStatistics& block) {
+    for (ProbeCounters& counters : block.probes) {
+        for (atomic<uint64_t>* field : {&counters.calls, &counters.timed_calls, &counters.total_ns, &counters.max_ns,
+                                        &counters.last_ns, &counters.last_finished, &counters.total_bytes,
+                                        &counters.last_bytes}) {
+            field->store(0, memory_order_relaxed);
+        }
+        for (atomic<uint64_t>& bucket : counters.latency) bucket.store(0, memory_order_relaxed);
+    }
+}
+
+// Retires the calling thread's block when the thread exits
+struct ThreadStatisticsOwner {
+    ThreadStatistics* block = nullptr;
+
+    ~ThreadStatisticsOwner() {
+        if (block == nullptr) return;
+        StatisticsRegistry& stats = registry();
+        lock_guard<mutex> lock(stats.registry_mutex);
+        fold_counters(*block, stats.retired);
+        auto owned = find_if(stats.threads.begin(), stats.threads.end(),
+                             [&](const unique_ptr<ThreadStatistics>& thread) { return thread.get() == block; });
+        if (owned != stats.threads.end()) {
+            clear_counters(**owned);
+            stats.spare.push_back(move(*owned));
+            *owned = move(stats.threads.back());
+            stats.threads.pop_back();
+        }
+        thread_statistics = nullptr;
+        block = nullptr;
+    }
+};
+
+static thread_local ThreadStatisticsOwner thread_owner;
+
+ThreadStatistics* register_thread_statistics() {
+    StatisticsRegistry& stats = registry();
+    lock_guard<mutex> lock(stats.registry_mutex);
+    if (stats.spare.empty()) {
+        stats.threads.push_back(make_unique<ThreadStatistics>());
+    } else {
+        stats.threads.push_back(move(stats.spare.back()));
+        stats.spare.pop_back();
+    }
+    thread_owner.block = stats.threads.back().get();
+    return thread_owner.block;
+}
+
+uint64_t ProbeSummary::percentile_ns(double share) const {
+    if (timed_calls == 0) return 0;
+    uint64_t wanted = max<uint64_t>(1, static_cast<uint64_t>(ceil(share * static_cast<double>(timed_calls))));
+    uint64_t seen = 0;
+    for (int b = 0; b < LATENCY_BUCKETS; b++) {
+        seen += latency[b];
+        if (seen >= wanted) return min(latency_bucket_limit(b), max_ns);
+    }
+    return 0;
+}
+
+vector<ProbeSummary> collect_statistics() {
+    StatisticsRegistry& stats = registry();
+    lock_guard<mutex> lock(stats.registry_mutex);
+    vector<ProbeSummary> summaries;
+    for (size_t id = 0; id < stats.names.size(); id++) {
+        ProbeSummary summary;
+        summary.name = stats.names[id];
+        summary.latency.assign(LATENCY_BUCKETS, 0);
+        uint64_t latest = 0;
+        auto add = [&](const ThreadStatistics& thread) {
+            const ProbeCounters& counters = thread.probes[id];
+            summary.calls += counters.calls.load(memory_order_relaxed);
+            summary.timed_calls += counters.timed_calls.load(memory_order_relaxed);
+            summary.total_ns += counters.total_ns.load(memory_order_relaxed);
+            summary.total_bytes += counters.total_bytes.load(memory_order_relaxed);
+            summary.max_ns = max(summary.max_ns, counters.max_ns.load(memory_order_relaxed));
+            for (int b = 0; b < LATENCY_BUCKETS; b++) summary.latency[b] += counters.latency[b].load(memory_order_relaxed);
+            uint64_t finished = counters.last_finished.load(memory_order_relaxed);
+            if (finished > latest) {
+                latest = finished;
+                summary.last_ns = counters.last_ns.load(memory_order_relaxed);
+                summary.last_bytes = counters.last_bytes.load(memory_order_relaxed);
+            }
+        };
+        add(stats.retired);
+        for (const auto& thread : stats.threads) add(*thread);
+        if (summary.calls > 0) summaries.push_back(move(summary));
+    }
+    return summaries;
+}
+
+void write_statistics_json(ostream& out) {
+    vector<ProbeSummary> summaries = collect_statistics();
+    auto ms = [](double ns) { return ns / 1e6; };
+    out << "{\"operations\":[";
+    ios::fmtflags flags = out.flags();
+    streamsize precision = out.precision();
+    out << fixed << setprecision(6);
+    for (size_t k = 0; k < summaries.size(); k++) {
+        const ProbeSummary& s = summaries[k];
+        if (k > 0) out << ",";
+        out << "\n{\"name\":\"" << s.name << "\",\"calls\":" << s.calls << ",\"timed_calls\":" << s.timed_calls
+            << ",\"total_ms\":" << ms(static_cast<double>(s.total_ns)) << ",\"mean_ms\":" << ms(s.mean_ns())
+            << ",\"p50_ms\":" << ms(static_cast<double>(s.percentile_ns(0.5)))
+            << ",\"p99_ms\":" << ms(static_cast<double>(s.percentile_ns(0.99)))
+            << ",\"max_ms\":" << ms(static_cast<double>(s.max_ns)) << ",\"last_ms\":" << ms(static_cast<double>(s.last_ns))
+            << ",\"total_bytes\":" << s.total_bytes << ",\"last_bytes\":" << s.last_bytes << ",\"histogram\":[";
+        // Non-empty buckets as [upper bound in ns, calls]
+        bool first = true;
+        for (int b = 0; b < LATENCY_BUCKETS; b++) {
+            if (s.latency[b] == 0) continue;
+            out << (first ? "" : ",") << "[" << latency_bucket_limit(b) << "," << s.latency[b] << "]";
+            first = false;
+        }
+        out << "]}";
+    }
+    out << "\n]}\n";
+    out.flags(flags);
+    out.precision(precision);
+}
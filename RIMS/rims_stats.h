@@ -0,0 +1,150 @@
+/*
+ * Built-in instrumentation of the Rwanda Infrastructure Management System: call counts,
+ * latency histograms and byte counts of the hot paths, readable while the program runs.
+ *
+ * Each operation worth watching is a Probe, and a ProbeTimer placed at the top of the operation
+ * records one call. Every thread records into its own block of counters, so recording takes no
+ * lock and no atomic read-modify-write; collect_statistics() merges the blocks of every thread
+ * that ever recorded, including threads that have since finished.
+ */
+#pragma once
+
+#include <atomic>     // For counters read by other threads
+#include <chrono>     // For timing calls
+#include <cstdint>    // For fixed-width counters
+#include <string>     // For probe names
+#include <vector>     // For merged statistics
+#include <ostream>    // For the JSON dump
+#include <bit>        // For histogram bucket indices
+#include <algorithm>  // For min
+
+
+const int MAX_PROBES = 64;              // Probes a program may register
+
+// Latency histogram buckets: four per power of two of nanoseconds, up to about 36 minutes
+const int LATENCY_BUCKETS = 164;
+
+// Returns the histogram bucket of a duration in nanoseconds
+inline int latency_bucket(uint64_t ns) {
+    if (ns < 4) return static_cast<int>(ns);
+    int power = std::bit_width(ns) - 1;
+    int bucket = 4 * (power - 1) + static_cast<int>((ns >> (power - 2)) & 3);
+    return std::min(bucket, LATENCY_BUCKETS - 1);
+}
+
+// Returns the smallest duration in nanoseconds above every duration in a bucket
+inline uint64_t latency_bucket_limit(int bucket) {
+    if (bucket < 4) return static_cast<uint64_t>(bucket) + 1;
+    int power = bucket / 4 + 1;
+    return (static_cast<uint64_t>(5 + bucket % 4)) << (power - 2);
+}
+
+// A named operation whose calls are counted and timed. Probes register themselves when they are
+// constructed, normally as constants at namespace scope. Two clock reads per call are cheap next
+// to a file write but not next to a hash lookup, so a probe on a sub-microsecond path counts
+// every call and times one in 2^sample_shift.
+class Probe {
+public:
+    int id;
+    uint64_t sample_mask;
+
+    explicit Probe(const char* name, int sample_shift = 0);
+};
+
+// What one thread has recorded for one probe. Only the owning thread writes, with relaxed loads
+// and stores, so readers on other threads see every field whole without slowing the writer.
+struct ProbeCounters {
+    std::atomic<uint64_t> calls{0};
+    std::atomic<uint64_t> timed_calls{0};
+    std::atomic<uint64_t> total_ns{0};  // Over the timed calls
+    std::atomic<uint64_t> max_ns{0};
+    std::atomic<uint64_t> last_ns{0};
+    std::atomic<uint64_t> last_finished{0}; // Steady clock at the end of the last timed call, to find the latest across threads
+    std::atomic<uint64_t> total_bytes{0};
+    std::atomic<uint64_t> last_bytes{0};
+    std::atomic<uint64_t> latency[LATENCY_BUCKETS] = {};
+
+    // Adds amount to a counter only this thread writes
+    static void bump(std::atomic<uint64_t>& counter, uint64_t amount) {
+        counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+};
+
+// Counters of every probe for one thread
+struct ThreadStatistics {
+    ProbeCounters probes[MAX_PROBES];
+};
+
+// Creates and registers the calling thread's counters, reusing the block of a thread that exited
+ThreadStatistics* register_thread_statistics();
+
+inline thread_local ThreadStatistics* thread_statistics = nullptr;
+
+// Returns the calling thread's counters for a probe
+inline ProbeCounters& local_counters(const Probe& probe) {
+    if (thread_statistics == nullptr) thread_statistics = register_thread_statistics();
+    return thread_statistics->probes[probe.id];
+}
+
+// Records one call of a probe, timed from construction to destruction
+class ProbeTimer {
+private:
+    ProbeCounters& counters;
+    std::chrono::steady_clock::time_point start;
+    uint64_t bytes = 0;
+    bool timed;
+
+public:
+    explicit ProbeTimer(const Probe& probe) : counters(local_counters(probe)) {
+        uint64_t call = counters.calls.load(std::memory_order_relaxed);
+        counters.calls.store(call + 1, std::memory_order_relaxed);
+        timed = (call & probe.sample_mask) == 0;
+        if (timed) start = std::chrono::steady_clock::now();
+    }
+
+    ~ProbeTimer() {
+        if (bytes > 0) ProbeCounters::bump(counters.total_bytes, bytes);
+        counters.last_bytes.store(bytes, std::memory_order_relaxed);
+        if (!timed) return;
+        auto finished = std::chrono::steady_clock::now();
+        uint64_t ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(finished - start).count());
+        ProbeCounters::bump(counters.timed_calls, 1);
+        ProbeCounters::bump(counters.total_ns, ns);
+        ProbeCounters::bump(counters.latency[latency_bucket(ns)], 1);
+        if (ns > counters.max_ns.load(std::memory_order_relaxed)) counters.max_ns.store(ns, std::memory_order_relaxed);
+        counters.last_ns.store(ns, std::memory_order_relaxed);
+        counters.last_finished.store(static_cast<uint64_t>(finished.time_since_epoch().count()), std::memory_order_relaxed);
+    }
+
+    ProbeTimer(const ProbeTimer&) = delete;
+    ProbeTimer& operator=(const ProbeTimer&) = delete;
+
+    // Counts bytes read or written by this call
+    void add_bytes(uint64_t count) { bytes += count; }
+};
+
+// One probe's statistics merged across threads
+struct ProbeSummary {
+    std::string name;
+    uint64_t calls = 0;
+    uint64_t timed_calls = 0;
+    uint64_t total_ns = 0;
+    uint64_t max_ns = 0;
+    uint64_t last_ns = 0;               // Duration of the most recent timed call on any thread
+    uint64_t total_bytes = 0;
+    uint64_t last_bytes = 0;            // Bytes of the last call on the thread that made the most recent timed call
+    std::vector<uint64_t> latency;      // Timed calls per histogram bucket
+
+    // Mean duration of the timed calls in nanoseconds
+    double mean_ns() const { return timed_calls == 0 ? 0.0 : static_cast<double>(total_ns) / static_cast<double>(timed_calls); }
+
+    // Duration in nanoseconds that a share of the timed calls (0.5 for the median) stayed within,
+    // to the resolution of the histogram
+    uint64_t percentile_ns(double share) const;
+};
+
+// Returns the statistics of every probe that has been called, in registration order
+std::vector<ProbeSummary> collect_statistics();
+
+// Writes the statistics of every probe that has been called as a JSON object
+void write_statistics_json(std::ostream& out);
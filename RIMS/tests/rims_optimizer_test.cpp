@@ -0,0 +1,88 @@
+/*
+ * rims_optimizer_test: checks the road investment optimizer's plans on small networks whose best
+ * plans are known. Runs in a scratch directory so the network starts empty; exits non-zero if any
+ * check fails.
+ */
+#include <iostream>   // For failure messages
+#include <filesystem> // For the scratch directory
+#include "rims_optimizer.h"
+
+using namespace std;
+
+int failures = 0;
+
+// Reports a failed check
+void check(bool passed, const string& what) {
+    if (passed) return;
+    cout << "FAILED: " << what << "\n";
+    failures++;
+}
+
+// Checks that a plan built exactly the expected candidates
+void check_plan(const InvestmentPlan& plan, const vector<int>& chosen, double cost, const string& what) {
+    check(plan.chosen == chosen, what + ": chosen candidates");
+    check(plan.cost == cost, what + ": cost");
+    check(plan.optimal, what + ": search finished");
+}
+
+// Roads that would connect Alpha to the ten cities of the Bee group directly or through Cee, and
+// one more road between Eee and Eff, which cannot reach Alpha either way
+void check_unreachable_join(InfrastructureManager& manager) {
+    for (string_view name : {"Alpha", "Cee", "Eee", "Eff"}) manager.add_city(name);
+    for (char letter = 'a'; letter < 'k'; letter++) {
+        manager.add_city(string("Bee") + letter);
+        if (letter > 'a') manager.add_road(manager.lookup_city("Beea"), manager.lookup_city(string("Bee") + letter));
+    }
+    int alpha = manager.lookup_city("Alpha"), bee = manager.lookup_city("Beea"), cee = manager.lookup_city("Cee");
+    vector<RoadCandidate> candidates = {{alpha, bee, 5.0}, {alpha, cee, 1.0}, {cee, bee, 1.0},
+                                        {manager.lookup_city("Eee"), manager.lookup_city("Eff"), 1.0}};
+    shared_ptr<const NetworkView> network = manager.view();
+    for (int threads : {1, 3}) {
+        InvestmentOptions options;
+        options.budget_cap = 100.0;
+        options.threads = threads;
+        InvestmentPlan plan;
+
+        options.goal = InvestmentGoal::CitiesReached;
+        options.hub = alpha;
+        optimize_investment(*network, candidates, options, plan);
+        check_plan(plan, {1, 2}, 2.0, "cities reached from Alpha, " + to_string(threads) + " thread(s)");
+        check(plan.value_before == 1 && plan.value == 12, "cities reached from Alpha: value");
+
+        // A hub outside the network gets an empty plan rather than a read past the city groups
+        for (int hub : {-1, static_cast<int>(network->city_count())}) {
+            options.hub = hub;
+            optimize_investment(*network, candidates, options, plan);
+            check(plan.chosen.empty() && !plan.optimal && plan.value_before == 0 && plan.value == 0,
+                  "hub " + to_string(hub) + " is refused");
+        }
+
+        options.goal = InvestmentGoal::ConnectedPairs;
+        optimize_investment(*network, candidates, options, plan);
+        check_plan(plan, {1, 2, 3}, 3.0, "connected pairs, " + to_string(threads) + " thread(s)");
+
+        options.budget_cap = 1.5;
+        optimize_investment(*network, candidates, options, plan);
+        check_plan(plan, {2}, 1.0, "connected pairs within 1.5, " + to_string(threads) + " thread(s)");
+    }
+}
+
+int main() {
+    error_code ec;
+    filesystem::path scratch = filesystem::temp_directory_path() / "rims_optimizer_test";
+    filesystem::remove_all(scratch, ec);
+    filesystem::create_directories(scratch, ec);
+    filesystem::current_path(scratch, ec);
+    if (ec) {
+        cout << "Error: Cannot use " << scratch.string() << ": " << ec.message() << ".\n";
+        return 1;
+    }
+    {
+        InfrastructureManager manager;
+        check_unreachable_join(manager);
+    }
+    filesystem::current_path(scratch.parent_path(), ec);
+    filesystem::remove_all(scratch, ec);
+    if (failures == 0) cout << "All optimizer checks passed.\n";
+    return failures == 0 ? 0 : 1;
+}
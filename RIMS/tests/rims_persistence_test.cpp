@@ -0,0 +1,300 @@
+/*
+ * rims_persistence_test: checks what InfrastructureManager loads back from data files that were
+ * damaged or left behind by a crash. Each case runs in a fresh scratch directory; the program
+ * exits non-zero if any check fails.
+ */
+#include <iostream>   // For failure messages
+#include <fstream>    // For reading and damaging the data files
+#include <sstream>    // For reading whole files
+#include <filesystem> // For the scratch directories
+#include <cstring>    // For patching the snapshot header
+#include "rims_core.h"
+
+#ifndef _WIN32
+#include <csignal>    // For ignoring SIGXFSZ
+#include <sys/resource.h> // For making log writes fail
+#endif
+
+using namespace std;
+
+int failures = 0;
+filesystem::path scratch_root;
+
+// Reports a failed check
+void check(bool passed, const string& what) {
+    if (passed) return;
+    cout << "FAILED: " << what << "\n";
+    failures++;
+}
+
+// Makes a fresh scratch directory for a case and moves into it
+void enter_scratch(const string& name) {
+    error_code ec;
+    filesystem::current_path(scratch_root, ec);
+    filesystem::remove_all(scratch_root / name, ec);
+    filesystem::create_directories(scratch_root / name, ec);
+    filesystem::current_path(scratch_root / name, ec);
+    if (ec) check(false, "cannot use the scratch directory " + (scratch_root / name).string());
+}
+
+string read_file(const string& path) {
+    ifstream in(path, ios::binary);
+    stringstream contents;
+    contents << in.rdbuf();
+    return contents.str();
+}
+
+void write_file(const string& path, const string& contents) {
+    ofstream out(path, ios::binary | ios::trunc);
+    out << contents;
+}
+
+// Returns the names of the cities the manager has, in ID order, joined by spaces
+string city_names(InfrastructureManager& manager) {
+    shared_ptr<const NetworkView> network = manager.view();
+    string names;
+    for (size_t i = 0; i < network->city_count(); i++) {
+        if (i > 0) names += " ";
+        names += network->city_name(static_cast<int>(i));
+    }
+    return names;
+}
+
+// Returns the cities of every road the manager has, as "<ID>-<ID>" in slot order, joined by spaces
+string road_ends(InfrastructureManager& manager) {
+    shared_ptr<const NetworkView> network = manager.view();
+    string ends;
+    for (size_t r = 0; r < network->road_slots(); r++) {
+        const Road& road = network->road(static_cast<int>(r));
+        if (road.removed()) continue;
+        if (!ends.empty()) ends += " ";
+        ends += to_string(road.city1) + "-" + to_string(road.city2);
+    }
+    return ends;
+}
+
+// The snapshot checksum (FNV-1a), so a damaged file can be sealed as if it were sound
+uint32_t snapshot_checksum(const char* data, size_t size) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; i++) hash = (hash ^ static_cast<unsigned char>(data[i])) * 16777619u;
+    return hash;
+}
+
+// Offsets of the snapshot header fields (see the layout in rims_core.cpp)
+const size_t HEADER_SIZE = 40;
+const size_t HEADER_COUNT = 12;
+const size_t HEADER_PAYLOAD_CHECKSUM = 28;
+const size_t HEADER_CHECKSUM = 32;
+
+// Recomputes both checksums of a snapshot after its payload was changed
+void seal(string& snapshot) {
+    uint32_t payload = snapshot_checksum(snapshot.data() + HEADER_SIZE, snapshot.size() - HEADER_SIZE);
+    memcpy(snapshot.data() + HEADER_PAYLOAD_CHECKSUM, &payload, sizeof(payload));
+    uint32_t header = snapshot_checksum(snapshot.data(), HEADER_CHECKSUM);
+    memcpy(snapshot.data() + HEADER_CHECKSUM, &header, sizeof(header));
+}
+
+// cities.snap sealed over a name table that is out of bounds or names a city twice must be
+// refused in favour of the text files
+void check_damaged_city_snapshot() {
+    enum class Damage { None, FirstOffset, DecreasingOffset, DuplicateName };
+    for (Damage damage : {Damage::None, Damage::FirstOffset, Damage::DecreasingOffset, Damage::DuplicateName}) {
+        string what = "city snapshot damage " + to_string(static_cast<int>(damage));
+        enter_scratch("damaged_city_snapshot");
+        {
+            InfrastructureManager manager;
+            for (string_view name : {"Kigali", "Huye", "Nyanza"}) manager.add_city(name);
+        }
+        // The text files get a name of their own, so the loaded names tell which file was read
+        string text = read_file("data/cities.txt");
+        size_t huye = text.find("Huye");
+        check(huye != string::npos, what + ": cities.txt names Huye");
+        if (huye == string::npos) continue;
+        write_file("data/cities.txt", text.replace(huye, 4, "Butare"));
+
+        string snapshot = read_file("data/cities.snap");
+        uint32_t count;
+        memcpy(&count, snapshot.data() + HEADER_COUNT, sizeof(count));
+        check(count == 3, what + ": the snapshot holds three cities");
+        if (count != 3) continue;
+        char* offsets = snapshot.data() + HEADER_SIZE;
+        char* names = offsets + (4 * (count + 1) + 7) / 8 * 8; // After the offsets, padded to 8 bytes
+        uint32_t offset[4];
+        memcpy(offset, offsets, sizeof(offset));
+        if (damage == Damage::FirstOffset) offset[0] = 1;
+        if (damage == Damage::DecreasingOffset) swap(offset[1], offset[2]);
+        if (damage == Damage::DuplicateName) memcpy(names + offset[2], "Kigali", 6); // Nyanza has six letters too
+        memcpy(offsets, offset, sizeof(offset));
+        seal(snapshot);
+        write_file("data/cities.snap", snapshot);
+
+        InfrastructureManager manager;
+        check(city_names(manager) == (damage == Damage::None ? "Kigali Huye Nyanza" : "Kigali Butare Nyanza"),
+              what + ": loaded " + city_names(manager));
+    }
+}
+
+// A logged transaction whose last record cannot apply must leave none of its records behind,
+// neither after the replay nor once the replay has been compacted into the data files
+void check_failed_transaction_replay() {
+    enter_scratch("failed_transaction_replay");
+    {
+        InfrastructureManager manager;
+        for (string_view name : {"Kigali", "Huye"}) manager.add_city(name);
+    }
+    // Adds Gisenyi and a road from Kigali to it, then funds a road between Kigali and Huye,
+    // which does not exist
+    write_file("data/rims.wal", "T\t3\nC\tGisenyi\nR\t0\t2\t1\nB\t0\t1\t5\n");
+    for (int start = 0; start < 2; start++) {
+        string what = start == 0 ? "after the replay" : "after compacting the replay";
+        InfrastructureManager manager;
+        check(city_names(manager) == "Kigali Huye", what + ": loaded " + city_names(manager));
+        check(manager.view()->road_count() == 0, what + ": no road was added");
+    }
+    check(read_file("data/cities.txt").find("Gisenyi") == string::npos, "cities.txt leaves Gisenyi out");
+
+    // The same group without the failing record applies whole
+    write_file("data/rims.wal", "T\t2\nC\tGisenyi\nR\t0\t2\t1\n");
+    InfrastructureManager manager;
+    check(city_names(manager) == "Kigali Huye Gisenyi", "an intact group is replayed");
+    check(manager.view()->road_count() == 1, "an intact group's road is replayed");
+}
+
+// Settings that write every change to the log at once and never compact during a case
+PersistenceOptions immediate_log() {
+    PersistenceOptions options;
+    options.group_commit_ops = 1;
+    options.compact_after_records = 1000000;
+    options.compact_interval_ms = 3600000;
+    return options;
+}
+
+// Returns the feed's changes from sequence number from on, one "<sequence> <record>" per line
+string feed_changes(InfrastructureManager& manager, uint64_t from) {
+    vector<FeedChange> changes;
+    if (!manager.read_changes(from, 100, changes)) return "unreadable";
+    string text;
+    for (const FeedChange& change : changes) text += to_string(change.sequence) + " " + change.record + "\n";
+    return text;
+}
+
+#ifndef _WIN32
+// A command group the log cannot take is answered WriteFailed and taken back; it never reaches
+// changes.feed, and the next group written gets the sequence numbers it would have had
+void check_unwritten_group() {
+    enter_scratch("unwritten_group");
+    InfrastructureManager manager(immediate_log());
+    for (string_view name : {"Kigali", "Huye"}) manager.add_city(name);
+    vector<InfrastructureManager::BatchCommand> commands(2);
+    string error;
+    InfrastructureManager::parse_batch_line("city Gisenyi", commands[0], error);
+    InfrastructureManager::parse_batch_line("road Kigali, Gisenyi", commands[1], error);
+    vector<ChangeStatus> statuses;
+
+    // Writes past the log's current size fail (with EFBIG once SIGXFSZ is ignored)
+    signal(SIGXFSZ, SIG_IGN);
+    rlimit limit;
+    getrlimit(RLIMIT_FSIZE, &limit);
+    rlimit lowered = limit;
+    error_code ec;
+    lowered.rlim_cur = static_cast<rlim_t>(filesystem::file_size("data/rims.wal", ec));
+    check(!ec && setrlimit(RLIMIT_FSIZE, &lowered) == 0, "the log size can be capped");
+    manager.apply_commands(commands, statuses);
+    setrlimit(RLIMIT_FSIZE, &limit);
+    check(statuses == vector<ChangeStatus>(2, ChangeStatus::WriteFailed), "an unwritten group is answered WriteFailed");
+    check(city_names(manager) == "Kigali Huye" && manager.view()->road_count() == 0,
+          "an unwritten group is taken back: loaded " + city_names(manager));
+    check(manager.last_change_sequence() == 2, "an unwritten group takes no sequence numbers");
+    check(feed_changes(manager, 1) == "1 C\tKigali\n2 C\tHuye\n", "an unwritten group stays out of the feed");
+
+    manager.apply_commands(commands, statuses);
+    check(statuses == vector<ChangeStatus>(2, ChangeStatus::Ok), "the group applies once the log takes it");
+    check(feed_changes(manager, 3).starts_with("3 C\tGisenyi\n4 R\t"), "the group is numbered on from 3");
+    check(manager.last_change_sequence() == 4, "the written group takes two sequence numbers");
+}
+#endif
+
+// A feed line torn by a crash is cut off on restart and the changes from it on are filled in
+// again from the log
+void check_torn_feed_tail() {
+    enter_scratch("torn_feed_tail");
+    filesystem::create_directories("data");
+    write_file("data/rims.wal", "S\t1\nC\tKigali\nS\t2\nC\tHuye\nS\t3\nC\tNyanza\n");
+    write_file("data/changes.feed", "1\tC\tKigali\n2\tC\tHu");
+    InfrastructureManager manager(immediate_log());
+    check(city_names(manager) == "Kigali Huye Nyanza", "the log is replayed under a torn feed: loaded " + city_names(manager));
+    check(read_file("data/changes.feed") == "1\tC\tKigali\n2\tC\tHuye\n3\tC\tNyanza\n",
+          "the torn feed line is cut off and refilled from the log");
+    check(manager.first_change_sequence() == 1 && manager.last_change_sequence() == 3, "the refilled feed runs from 1 to 3");
+}
+
+// Removed cities take their roads with them and the later cities move down to close the gaps,
+// through a replay of the removal and the compaction after it; undoing the removal logs A records
+// that put each city back under its old ID when they are replayed in turn
+void check_city_removal() {
+    enter_scratch("city_removal");
+    {
+        InfrastructureManager manager(immediate_log());
+        for (string_view name : {"Kigali", "Huye", "Nyanza", "Musanze", "Rubavu"}) manager.add_city(name);
+        for (auto [i, j] : {pair{0, 2}, pair{2, 4}, pair{1, 3}, pair{3, 4}}) manager.add_road(i, j);
+    }
+    error_code ec;
+    filesystem::copy("data", "base", filesystem::copy_options::recursive, ec);
+    check(!ec, "the data files can be copied");
+
+    write_file("data/rims.wal", "T\t2\nX\tMusanze\nX\tHuye\n");
+    for (int start = 0; start < 2; start++) {
+        string what = start == 0 ? "after replaying the removal" : "after compacting the removal";
+        InfrastructureManager manager(immediate_log());
+        check(city_names(manager) == "Kigali Nyanza Rubavu", what + ": loaded " + city_names(manager));
+        check(road_ends(manager) == "0-1 1-2", what + ": roads " + road_ends(manager));
+    }
+
+    filesystem::remove_all("data", ec);
+    filesystem::copy("base", "data", filesystem::copy_options::recursive, ec);
+    string log;
+    {
+        InfrastructureManager manager(immediate_log());
+        int cities[] = {1, 3};
+        check(manager.remove_cities(cities) == ChangeStatus::Ok, "two cities are removed");
+        check(city_names(manager) == "Kigali Nyanza Rubavu" && road_ends(manager) == "0-1 1-2",
+              "the removal renumbers at once: " + city_names(manager) + ", roads " + road_ends(manager));
+        check(manager.undo() > 0, "the removal can be undone");
+        check(city_names(manager) == "Kigali Huye Nyanza Musanze Rubavu", "undo restores: " + city_names(manager));
+        log = read_file("data/rims.wal");
+    }
+    check(log.find("A\t1\tHuye\n") != string::npos && log.find("A\t3\tMusanze\n") != string::npos,
+          "undo logs an A record per city");
+    // Replays the removal and its undo over the data files from before them
+    filesystem::remove_all("data", ec);
+    filesystem::copy("base", "data", filesystem::copy_options::recursive, ec);
+    write_file("data/rims.wal", log);
+    for (int start = 0; start < 2; start++) {
+        string what = start == 0 ? "after replaying the undo" : "after compacting the undo";
+        InfrastructureManager manager(immediate_log());
+        check(city_names(manager) == "Kigali Huye Nyanza Musanze Rubavu", what + ": loaded " + city_names(manager));
+        check(road_ends(manager) == "0-2 2-4 1-3 3-4", what + ": roads " + road_ends(manager));
+    }
+}
+
+int main() {
+    error_code ec;
+    scratch_root = filesystem::temp_directory_path(ec) / "rims_persistence_test";
+    filesystem::remove_all(scratch_root, ec);
+    filesystem::create_directories(scratch_root, ec);
+    if (ec) {
+        cout << "Error: Cannot use " << scratch_root.string() << ": " << ec.message() << ".\n";
+        return 1;
+    }
+    check_damaged_city_snapshot();
+    check_failed_transaction_replay();
+#ifndef _WIN32
+    check_unwritten_group();
+#endif
+    check_torn_feed_tail();
+    check_city_removal();
+    filesystem::current_path(scratch_root.parent_path(), ec);
+    filesystem::remove_all(scratch_root, ec);
+    if (failures == 0) cout << "All persistence checks passed.\n";
+    return failures == 0 ? 0 : 1;
+}